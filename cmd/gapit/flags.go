@@ -311,6 +311,8 @@ type (
 		Clear struct {
 			Cache bool `help:"clear package data before running it"`
 		}
+		FineGrainedLocking bool `help:"_allow commands on different objects to be traced concurrently. Only valid for Vulkan."`
+		DeltaObservations  bool `help:"_encode repeated observations of large memory ranges as deltas"`
 		Start struct {
 			Defer bool `help:"defers the start of the trace until <enter> is pressed. Only valid for Vulkan."`
 			At    struct {
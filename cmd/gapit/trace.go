@@ -247,6 +247,8 @@ func (verb *traceVerb) Run(ctx context.Context, flags flag.FlagSet) error {
 		ServerLocalSavePath:          out,
 		PipeName:                     verb.PipeName,
 		DisableCoherentMemoryTracker: verb.Disable.CoherentMemoryTracker,
+		FineGrainedLocking:           verb.FineGrainedLocking,
+		DeltaObservations:            verb.DeltaObservations,
 	}
 	target(options)
 
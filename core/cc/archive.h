@@ -46,6 +46,9 @@ class Archive {
   // Checks if the archive contains a record for the given id.
   bool contains(const std::string& id) const;
 
+  // Returns the size of the resource keyed by id, or 0 if it does not exist.
+  uint32_t size(const std::string& id) const;
+
   // Reads the resource keyed by id into buffer if it exists and if its size
   // matches.
   bool read(const std::string& id, void* buffer, uint32_t size);
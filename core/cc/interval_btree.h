@@ -0,0 +1,571 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CORE_INTERVAL_BTREE_H
+#define CORE_INTERVAL_BTREE_H
+
+#include "interval_list.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace core {
+
+// FixedVector is a vector of up to N elements stored inline, used for the
+// nodes of BTreeIntervalStorage. T does not need to be default constructible.
+template <typename T, size_t N>
+class FixedVector {
+ public:
+  inline FixedVector() : mSize(0) {}
+  inline ~FixedVector() { clear(); }
+
+  inline size_t size() const { return mSize; }
+  inline T* begin() { return reinterpret_cast<T*>(mData); }
+  inline const T* begin() const { return reinterpret_cast<const T*>(mData); }
+  inline T* end() { return begin() + mSize; }
+  inline const T* end() const { return begin() + mSize; }
+  inline T& operator[](size_t i) { return begin()[i]; }
+  inline const T& operator[](size_t i) const { return begin()[i]; }
+  inline const T& back() const { return begin()[mSize - 1]; }
+
+  // insert inserts v at index pos.
+  inline void insert(size_t pos, const T& v);
+  // append adds the elements of [first, last) to the end.
+  inline void append(const T* first, const T* last);
+  // erase removes the elements with indices in [first, last).
+  inline void erase(size_t first, size_t last);
+  inline void clear() { erase(0, mSize); }
+
+ private:
+  FixedVector(const FixedVector&) = delete;
+  FixedVector& operator=(const FixedVector&) = delete;
+
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type mData[N];
+  size_t mSize;
+};
+
+template <typename T, size_t N>
+inline void FixedVector<T, N>::insert(size_t pos, const T& v) {
+  T* data = begin();
+  if (pos == mSize) {
+    new (&data[mSize]) T(v);
+  } else {
+    new (&data[mSize]) T(std::move(data[mSize - 1]));
+    std::move_backward(data + pos, data + mSize - 1, data + mSize);
+    data[pos] = v;
+  }
+  mSize++;
+}
+
+template <typename T, size_t N>
+inline void FixedVector<T, N>::append(const T* first, const T* last) {
+  for (; first != last; ++first) {
+    new (&begin()[mSize++]) T(*first);
+  }
+}
+
+template <typename T, size_t N>
+inline void FixedVector<T, N>::erase(size_t first, size_t last) {
+  T* data = begin();
+  std::move(data + last, data + mSize, data + first);
+  for (size_t i = mSize - (last - first); i < mSize; i++) {
+    data[i].~T();
+  }
+  mSize -= last - first;
+}
+
+// BTreeIntervalStorage holds the intervals of a CustomIntervalList in a B+
+// tree, so that lookups, insertions and removals are O(log n) however many
+// intervals the list holds. Each inner node holds the number of intervals
+// and the last interval of each of its children, which are used to find
+// intervals by index and by position. The leaves are linked for iteration.
+template <typename T>
+class BTreeIntervalStorage {
+  struct Node;
+  struct Leaf;
+  struct Inner;
+
+ public:
+  class const_iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef T value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const T* pointer;
+    typedef const T& reference;
+
+    inline const_iterator() : mLeaf(nullptr), mIndex(0) {}
+
+    inline const T& operator*() const { return mLeaf->items[mIndex]; }
+    inline const T* operator->() const { return &mLeaf->items[mIndex]; }
+    inline const_iterator& operator++();
+    inline const_iterator operator++(int);
+    inline bool operator==(const const_iterator& other) const {
+      return mLeaf == other.mLeaf && mIndex == other.mIndex;
+    }
+    inline bool operator!=(const const_iterator& other) const {
+      return !(*this == other);
+    }
+
+   private:
+    friend class BTreeIntervalStorage<T>;
+
+    inline const_iterator(const Leaf* leaf, size_t index)
+        : mLeaf(leaf), mIndex(index) {}
+
+    const Leaf* mLeaf;  // nullptr for the end iterator.
+    size_t mIndex;
+  };
+
+  // range is an iterable span of intervals of the storage.
+  class range {
+   public:
+    typedef T value_type;
+    typedef BTreeIntervalStorage<T>::const_iterator const_iterator;
+
+    inline range(const_iterator start, const_iterator end, size_t size)
+        : mStart(start), mEnd(end), mSize(size) {}
+
+    inline const_iterator begin() const { return mStart; }
+    inline const_iterator end() const { return mEnd; }
+    inline size_t size() const { return mSize; }
+
+   private:
+    const_iterator mStart;
+    const_iterator mEnd;
+    size_t mSize;
+  };
+
+  inline BTreeIntervalStorage() : mRoot(nullptr), mFirst(nullptr), mSize(0) {}
+  inline BTreeIntervalStorage(const BTreeIntervalStorage& other);
+  inline BTreeIntervalStorage(BTreeIntervalStorage&& other);
+  inline BTreeIntervalStorage& operator=(BTreeIntervalStorage other);
+  inline ~BTreeIntervalStorage() { clear(); }
+
+  inline size_t size() const { return mSize; }
+  inline const T& operator[](size_t pos) const;
+  inline void set(size_t pos, const T& v);
+  inline void insert(size_t pos, const T& v);
+  inline void erase(size_t first, size_t last);
+  inline void clear();
+
+  // partition_point returns the index of the first interval for which pred
+  // returns false. pred must return true for all the intervals before it.
+  template <typename F>
+  inline size_t partition_point(F pred) const;
+
+  inline const_iterator begin() const { return const_iterator(mFirst, 0); }
+  inline const_iterator end() const { return const_iterator(); }
+  // slice returns the intervals with indices in [first, last).
+  inline range slice(size_t first, size_t last) const {
+    return range(at(first), at(last), last - first);
+  }
+
+ private:
+  // The maximum number of intervals of a leaf, and of children of an inner
+  // node. Nodes with less than a quarter of this are merged with a sibling.
+  static const size_t kCapacity = 64;
+
+  struct Node {
+    inline explicit Node(bool l) : leaf(l) {}
+    const bool leaf;
+  };
+
+  // The nodes have room for one element more than their capacity, which is
+  // held until they are split.
+  struct Leaf : Node {
+    inline Leaf() : Node(true), prev(nullptr), next(nullptr) {}
+    FixedVector<T, kCapacity + 1> items;
+    Leaf* prev;
+    Leaf* next;
+  };
+
+  struct Inner : Node {
+    inline Inner() : Node(false) {}
+    // Returns the index of the child holding the interval at pos, and
+    // updates pos to the index of the interval in that child. If append is
+    // true, a pos one-past the last interval of a child is in that child.
+    inline size_t find(size_t* pos, bool append) const;
+
+    FixedVector<Node*, kCapacity + 1> children;
+    // The number of intervals of each child.
+    FixedVector<size_t, kCapacity + 1> counts;
+    // The last interval of each child.
+    FixedVector<T, kCapacity + 1> lasts;
+  };
+
+  static inline size_t countOf(const Node* node);
+  static inline size_t sizeOf(const Node* node);
+  static inline const T& lastOf(const Node* node);
+
+  // Returns an iterator to the interval at pos, or end() if pos is size().
+  inline const_iterator at(size_t pos) const;
+  // Inserts v at pos in node, and returns the new right sibling of node if
+  // it was split.
+  inline Node* insert(Node* node, size_t pos, const T& v);
+  // Removes the interval at pos in node.
+  inline void erase(Node* node, size_t pos);
+  inline void set(Node* node, size_t pos, const T& v);
+  // Merges the child at idx of node with a sibling if it is small enough.
+  inline void rebalance(Inner* node, size_t idx);
+  inline void unlink(Leaf* leaf);
+  inline void destroy(Node* node);
+
+  Node* mRoot;   // nullptr if empty.
+  Leaf* mFirst;  // the leftmost leaf.
+  size_t mSize;
+};
+
+template <typename T>
+inline typename BTreeIntervalStorage<T>::const_iterator&
+BTreeIntervalStorage<T>::const_iterator::operator++() {
+  if (++mIndex == mLeaf->items.size()) {
+    mLeaf = mLeaf->next;
+    mIndex = 0;
+  }
+  return *this;
+}
+
+template <typename T>
+inline typename BTreeIntervalStorage<T>::const_iterator
+BTreeIntervalStorage<T>::const_iterator::operator++(int) {
+  const_iterator ret = *this;
+  ++(*this);
+  return ret;
+}
+
+template <typename T>
+inline BTreeIntervalStorage<T>::BTreeIntervalStorage(
+    const BTreeIntervalStorage& other)
+    : BTreeIntervalStorage() {
+  for (const T& v : other) {
+    insert(mSize, v);
+  }
+}
+
+template <typename T>
+inline BTreeIntervalStorage<T>::BTreeIntervalStorage(
+    BTreeIntervalStorage&& other)
+    : mRoot(other.mRoot), mFirst(other.mFirst), mSize(other.mSize) {
+  other.mRoot = nullptr;
+  other.mFirst = nullptr;
+  other.mSize = 0;
+}
+
+template <typename T>
+inline BTreeIntervalStorage<T>& BTreeIntervalStorage<T>::operator=(
+    BTreeIntervalStorage other) {
+  std::swap(mRoot, other.mRoot);
+  std::swap(mFirst, other.mFirst);
+  std::swap(mSize, other.mSize);
+  return *this;
+}
+
+template <typename T>
+inline size_t BTreeIntervalStorage<T>::Inner::find(size_t* pos,
+                                                   bool append) const {
+  size_t i = 0;
+  const size_t last = children.size() - 1;
+  while (i < last && (append ? *pos > counts[i] : *pos >= counts[i])) {
+    *pos -= counts[i];
+    i++;
+  }
+  return i;
+}
+
+template <typename T>
+inline size_t BTreeIntervalStorage<T>::countOf(const Node* node) {
+  if (node->leaf) {
+    return static_cast<const Leaf*>(node)->items.size();
+  }
+  size_t count = 0;
+  for (size_t c : static_cast<const Inner*>(node)->counts) {
+    count += c;
+  }
+  return count;
+}
+
+template <typename T>
+inline size_t BTreeIntervalStorage<T>::sizeOf(const Node* node) {
+  return node->leaf ? static_cast<const Leaf*>(node)->items.size()
+                    : static_cast<const Inner*>(node)->children.size();
+}
+
+template <typename T>
+inline const T& BTreeIntervalStorage<T>::lastOf(const Node* node) {
+  return node->leaf ? static_cast<const Leaf*>(node)->items.back()
+                    : static_cast<const Inner*>(node)->lasts.back();
+}
+
+template <typename T>
+inline const T& BTreeIntervalStorage<T>::operator[](size_t pos) const {
+  const_iterator it = at(pos);
+  return *it;
+}
+
+template <typename T>
+inline typename BTreeIntervalStorage<T>::const_iterator
+BTreeIntervalStorage<T>::at(size_t pos) const {
+  if (pos >= mSize) {
+    return end();
+  }
+  const Node* node = mRoot;
+  while (!node->leaf) {
+    auto inner = static_cast<const Inner*>(node);
+    node = inner->children[inner->find(&pos, false)];
+  }
+  return const_iterator(static_cast<const Leaf*>(node), pos);
+}
+
+template <typename T>
+template <typename F>
+inline size_t BTreeIntervalStorage<T>::partition_point(F pred) const {
+  if (mRoot == nullptr) {
+    return 0;
+  }
+  size_t base = 0;
+  const Node* node = mRoot;
+  while (!node->leaf) {
+    auto inner = static_cast<const Inner*>(node);
+    // The first child whose last interval does not satisfy pred holds the
+    // partition point.
+    size_t c = std::partition_point(inner->lasts.begin(), inner->lasts.end(),
+                                    pred) -
+               inner->lasts.begin();
+    if (c == inner->lasts.size()) {
+      return base + countOf(node);
+    }
+    for (size_t i = 0; i < c; i++) {
+      base += inner->counts[i];
+    }
+    node = inner->children[c];
+  }
+  auto& items = static_cast<const Leaf*>(node)->items;
+  return base +
+         (std::partition_point(items.begin(), items.end(), pred) -
+          items.begin());
+}
+
+template <typename T>
+inline void BTreeIntervalStorage<T>::set(size_t pos, const T& v) {
+  set(mRoot, pos, v);
+}
+
+template <typename T>
+inline void BTreeIntervalStorage<T>::set(Node* node, size_t pos, const T& v) {
+  if (node->leaf) {
+    static_cast<Leaf*>(node)->items[pos] = v;
+    return;
+  }
+  auto inner = static_cast<Inner*>(node);
+  size_t c = inner->find(&pos, false);
+  set(inner->children[c], pos, v);
+  inner->lasts[c] = lastOf(inner->children[c]);
+}
+
+template <typename T>
+inline void BTreeIntervalStorage<T>::insert(size_t pos, const T& v) {
+  if (mRoot == nullptr) {
+    mFirst = new Leaf();
+    mRoot = mFirst;
+  }
+  if (Node* split = insert(mRoot, pos, v)) {
+    auto root = new Inner();
+    for (Node* child : {mRoot, split}) {
+      root->children.insert(root->children.size(), child);
+      root->counts.insert(root->counts.size(), countOf(child));
+      root->lasts.insert(root->lasts.size(), lastOf(child));
+    }
+    mRoot = root;
+  }
+  mSize++;
+}
+
+template <typename T>
+inline typename BTreeIntervalStorage<T>::Node* BTreeIntervalStorage<T>::insert(
+    Node* node, size_t pos, const T& v) {
+  const size_t half = (kCapacity + 1) / 2;
+  if (node->leaf) {
+    auto leaf = static_cast<Leaf*>(node);
+    leaf->items.insert(pos, v);
+    if (leaf->items.size() <= kCapacity) {
+      return nullptr;
+    }
+    auto right = new Leaf();
+    right->items.append(leaf->items.begin() + half, leaf->items.end());
+    leaf->items.erase(half, leaf->items.size());
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (right->next != nullptr) {
+      right->next->prev = right;
+    }
+    leaf->next = right;
+    return right;
+  }
+
+  auto inner = static_cast<Inner*>(node);
+  size_t c = inner->find(&pos, true);
+  Node* child = inner->children[c];
+  Node* split = insert(child, pos, v);
+  if (split == nullptr) {
+    inner->counts[c]++;
+    inner->lasts[c] = lastOf(child);
+    return nullptr;
+  }
+  inner->counts[c] = countOf(child);
+  inner->lasts[c] = lastOf(child);
+  inner->children.insert(c + 1, split);
+  inner->counts.insert(c + 1, countOf(split));
+  inner->lasts.insert(c + 1, lastOf(split));
+  if (inner->children.size() <= kCapacity) {
+    return nullptr;
+  }
+  auto right = new Inner();
+  right->children.append(inner->children.begin() + half,
+                         inner->children.end());
+  right->counts.append(inner->counts.begin() + half, inner->counts.end());
+  right->lasts.append(inner->lasts.begin() + half, inner->lasts.end());
+  const size_t size = inner->children.size();
+  inner->children.erase(half, size);
+  inner->counts.erase(half, size);
+  inner->lasts.erase(half, size);
+  return right;
+}
+
+template <typename T>
+inline void BTreeIntervalStorage<T>::erase(size_t first, size_t last) {
+  for (size_t i = first; i < last; i++) {
+    erase(mRoot, first);
+    mSize--;
+    if (mSize == 0) {
+      clear();
+    } else if (!mRoot->leaf &&
+               static_cast<Inner*>(mRoot)->children.size() == 1) {
+      auto root = static_cast<Inner*>(mRoot);
+      mRoot = root->children[0];
+      delete root;
+    }
+  }
+}
+
+template <typename T>
+inline void BTreeIntervalStorage<T>::erase(Node* node, size_t pos) {
+  if (node->leaf) {
+    auto& items = static_cast<Leaf*>(node)->items;
+    items.erase(pos, pos + 1);
+    return;
+  }
+  auto inner = static_cast<Inner*>(node);
+  size_t c = inner->find(&pos, false);
+  Node* child = inner->children[c];
+  erase(child, pos);
+  if (--inner->counts[c] == 0) {
+    if (child->leaf) {
+      unlink(static_cast<Leaf*>(child));
+    }
+    destroy(child);
+    inner->children.erase(c, c + 1);
+    inner->counts.erase(c, c + 1);
+    inner->lasts.erase(c, c + 1);
+    return;
+  }
+  inner->lasts[c] = lastOf(child);
+  rebalance(inner, c);
+}
+
+template <typename T>
+inline void BTreeIntervalStorage<T>::rebalance(Inner* node, size_t idx) {
+  if (sizeOf(node->children[idx]) >= kCapacity / 4 ||
+      node->children.size() < 2) {
+    return;
+  }
+  // Merge the right one of the child and of a sibling into the left one.
+  size_t l = idx + 1 < node->children.size() ? idx : idx - 1;
+  Node* left = node->children[l];
+  Node* right = node->children[l + 1];
+  if (sizeOf(left) + sizeOf(right) > kCapacity) {
+    return;
+  }
+  if (left->leaf) {
+    auto& to = static_cast<Leaf*>(left)->items;
+    auto& from = static_cast<Leaf*>(right)->items;
+    to.append(from.begin(), from.end());
+    unlink(static_cast<Leaf*>(right));
+    delete static_cast<Leaf*>(right);
+  } else {
+    auto to = static_cast<Inner*>(left);
+    auto from = static_cast<Inner*>(right);
+    to->children.append(from->children.begin(), from->children.end());
+    to->counts.append(from->counts.begin(), from->counts.end());
+    to->lasts.append(from->lasts.begin(), from->lasts.end());
+    delete from;
+  }
+  node->counts[l] += node->counts[l + 1];
+  node->lasts[l] = node->lasts[l + 1];
+  node->children.erase(l + 1, l + 2);
+  node->counts.erase(l + 1, l + 2);
+  node->lasts.erase(l + 1, l + 2);
+}
+
+template <typename T>
+inline void BTreeIntervalStorage<T>::unlink(Leaf* leaf) {
+  if (leaf->prev != nullptr) {
+    leaf->prev->next = leaf->next;
+  } else {
+    mFirst = leaf->next;
+  }
+  if (leaf->next != nullptr) {
+    leaf->next->prev = leaf->prev;
+  }
+}
+
+template <typename T>
+inline void BTreeIntervalStorage<T>::clear() {
+  if (mRoot != nullptr) {
+    destroy(mRoot);
+  }
+  mRoot = nullptr;
+  mFirst = nullptr;
+  mSize = 0;
+}
+
+template <typename T>
+inline void BTreeIntervalStorage<T>::destroy(Node* node) {
+  if (node->leaf) {
+    delete static_cast<Leaf*>(node);
+    return;
+  }
+  auto inner = static_cast<Inner*>(node);
+  for (Node* child : inner->children) {
+    destroy(child);
+  }
+  delete inner;
+}
+
+// BTreeIntervalList is an IntervalList of Interval<T>s held in a B+ tree.
+template <typename T>
+class BTreeIntervalList
+    : public CustomIntervalList<Interval<T>,
+                                BTreeIntervalStorage<Interval<T> > > {};
+
+}  // namespace core
+
+#endif  // CORE_INTERVAL_BTREE_H
@@ -50,6 +50,62 @@ inline bool operator==(const Interval<T>& lhs, const Interval<T>& rhs) {
   return lhs.start() == rhs.start() && lhs.end() == rhs.end();
 }
 
+// VectorIntervalStorage holds the intervals of a CustomIntervalList in a
+// sorted vector. Lookups are binary searches, and inserting or removing an
+// interval shifts the intervals that follow it.
+template <typename T>
+class VectorIntervalStorage {
+ public:
+  typedef const T* const_iterator;
+  typedef Range<T> range;
+
+  inline size_t size() const { return mItems.size(); }
+  inline const T& operator[](size_t pos) const { return mItems[pos]; }
+  inline void set(size_t pos, const T& v) { mItems[pos] = v; }
+  inline void insert(size_t pos, const T& v) {
+    mItems.insert(mItems.begin() + pos, v);
+  }
+  inline void erase(size_t first, size_t last) {
+    mItems.erase(mItems.begin() + first, mItems.begin() + last);
+  }
+  inline void clear() { mItems.clear(); }
+
+  // partition_point returns the index of the first interval for which pred
+  // returns false. pred must return true for all the intervals before it.
+  template <typename F>
+  inline size_t partition_point(F pred) const;
+
+  // begin() returns the pointer to the first interval, or nullptr if empty.
+  inline const T* begin() const {
+    return mItems.empty() ? nullptr : &mItems[0];
+  }
+  // end() returns the pointer to one-past the last interval.
+  inline const T* end() const { return begin() + mItems.size(); }
+  // slice returns the intervals with indices in [first, last).
+  inline range slice(size_t first, size_t last) const {
+    return range(begin() + first, begin() + last);
+  }
+
+ private:
+  std::vector<T> mItems;
+};
+
+template <typename T>
+template <typename F>
+inline size_t VectorIntervalStorage<T>::partition_point(F pred) const {
+  size_t l = 0;
+  size_t h = mItems.size();
+  while (l != h) {
+    size_t m = (l + h) / 2;
+    if (pred(mItems[m])) {
+      l = m + 1;
+    } else {
+      h = m;
+    }
+  }
+  return l;
+}
+
 // CustomIntervalList holds a ascendingly-sorted list of custom interval types.
 // Intervals can be added to the list using merge(), where they may be merged
 // with existing intervals if the spans are within the specified
@@ -57,11 +113,15 @@ inline bool operator==(const Interval<T>& lhs, const Interval<T>& rhs) {
 // where any completely overlapping intervals are removed and partially
 // overlapping intervals are trimmed, before inserting the new interval.
 // CustomIntervalList supports for-range looping.
-template <typename T>
+// The intervals are held by Storage: VectorIntervalStorage is best for short
+// lists, and BTreeIntervalStorage (interval_btree.h) keeps insertions
+// logarithmic for lists of many disjoint intervals.
+template <typename T, typename Storage = VectorIntervalStorage<T> >
 class CustomIntervalList {
  public:
   typedef T value_type;
-  typedef const T* const_iterator;
+  typedef typename Storage::const_iterator const_iterator;
+  typedef typename Storage::range range;
   typedef typename T::interval_unit_type interval_unit_type;
 
   // Constructs an CustomIntervalList with a default merge threshold of 1.
@@ -69,8 +129,8 @@ class CustomIntervalList {
 
   // intersect returns a iterable range covering all the intervals that
   // intersect the span between start and end.
-  inline Range<T> intersect(interval_unit_type start,
-                            interval_unit_type end) const;
+  inline range intersect(interval_unit_type start,
+                         interval_unit_type end) const;
 
   // index_of returns the index of the interval that contains v, or -1 if
   // there is no interval containing v.
@@ -102,11 +162,11 @@ class CustomIntervalList {
   // count returns the number of intervals in the list.
   inline uint32_t count() const;
 
-  // begin() returns the pointer to the first interval in the list.
-  inline const T* begin() const;
+  // begin() returns an iterator to the first interval in the list.
+  inline const_iterator begin() const;
 
-  // end() returns the pointer to one-past the last interval in the list.
-  inline const T* end() const;
+  // end() returns an iterator to one-past the last interval in the list.
+  inline const_iterator end() const;
 
   // operator[] returns the const reference to the element at the specified
   // location pos.
@@ -123,35 +183,38 @@ class CustomIntervalList {
   inline ssize_t rangeLast(interval_unit_type end,
                            interval_unit_type bias) const;
 
-  std::vector<T> mIntervals;
+  Storage mIntervals;
   interval_unit_type mMergeBias;
 };
 
-template <typename T>
-CustomIntervalList<T>::CustomIntervalList() : mMergeBias(0) {}
+template <typename T, typename Storage>
+CustomIntervalList<T, Storage>::CustomIntervalList() : mMergeBias(0) {}
 
-template <typename T>
-inline Range<T> CustomIntervalList<T>::intersect(interval_unit_type start,
-                                                 interval_unit_type end) const {
-  auto first = begin() + rangeFirst(start, -1);
-  auto last = begin() + rangeLast(end, -1);
-  return Range<T>(first, last + 1);
+template <typename T, typename Storage>
+inline typename CustomIntervalList<T, Storage>::range
+CustomIntervalList<T, Storage>::intersect(interval_unit_type start,
+                                          interval_unit_type end) const {
+  auto first = rangeFirst(start, -1);
+  auto last = rangeLast(end, -1);
+  return mIntervals.slice(first, last + 1);
 }
 
-template <typename T>
-inline ssize_t CustomIntervalList<T>::index_of(interval_unit_type v) const {
+template <typename T, typename Storage>
+inline ssize_t CustomIntervalList<T, Storage>::index_of(
+    interval_unit_type v) const {
   auto i = rangeFirst(v, -1);
   if (i >= count()) {
     return -1;
   }
-  if (mIntervals[i].mStart > v || mIntervals[i].mEnd < v) {
+  const T& interval = mIntervals[i];
+  if (interval.mStart > v || interval.mEnd < v) {
     return -1;
   }
   return i;
 }
 
-template <typename T>
-inline void CustomIntervalList<T>::replace(const T& i) {
+template <typename T, typename Storage>
+inline void CustomIntervalList<T, Storage>::replace(const T& i) {
   auto first = rangeFirst(i.start(), mMergeBias);
   auto last = rangeLast(i.end(), mMergeBias);
 
@@ -165,8 +228,8 @@ inline void CustomIntervalList<T>::replace(const T& i) {
       //           ┗━━━━━━━━━━━━━━┛
       //━━━━━━━━━━━┳═─═─═─═─═─═─═─┳━━━━━━━━━━━
       //━━━━━━━━━━━┻─═─═─═─═─═─═─═┻━━━━━━━━━━━
-      auto interval = mIntervals.begin() + first;
-      mIntervals.insert(interval, *interval);
+      T interval = mIntervals[first];
+      mIntervals.insert(first, interval);
       last++;
     }
     if (trimTail) {
@@ -175,8 +238,9 @@ inline void CustomIntervalList<T>::replace(const T& i) {
       //           ┗━━━━━━━━━━━━━━━━
       //━━━━━━━━━━━┳═─═─╗
       //━━━━━━━━━━━┻─═─═┘
-      auto interval = mIntervals.begin() + first;
-      interval->adjust(interval->start(), i.start());
+      T interval = mIntervals[first];
+      interval.adjust(interval.start(), i.start());
+      mIntervals.set(first, interval);
       first++;  // Don't erase the first interval.
     }
     if (trimHead) {
@@ -185,112 +249,88 @@ inline void CustomIntervalList<T>::replace(const T& i) {
       //━━━━━━━━━━━━━━━━┛
       //           ┌═─═─┳━━━━━━━━━━━
       //           ╚─═─═┻━━━━━━━━━━━
-      auto interval = mIntervals.begin() + last;
-      interval->adjust(i.end(), interval->end());
+      T interval = mIntervals[last];
+      interval.adjust(i.end(), interval.end());
+      mIntervals.set(last, interval);
       last--;  // Don't erase the last interval.
     }
     if (first <= last) {
-      auto from = mIntervals.begin() + first;
-      auto to = mIntervals.begin() + last + 1;
-      mIntervals.erase(from, to);
+      mIntervals.erase(first, last + 1);
     }
   }
-  mIntervals.insert(mIntervals.begin() + first, i);
+  mIntervals.insert(first, i);
 }
 
-template <typename T>
-inline void CustomIntervalList<T>::merge(const T& i) {
+template <typename T, typename Storage>
+inline void CustomIntervalList<T, Storage>::merge(const T& i) {
   auto first = rangeFirst(i.start(), mMergeBias);
   auto last = rangeLast(i.end(), mMergeBias);
-  auto from = mIntervals.begin() + first;
   if (first <= last) {
-    auto to = mIntervals.begin() + last;
-    auto low = std::min(from->start(), i.start());
-    auto high = std::max(to->end(), i.end());
-    T* f = &(*from);
-    mIntervals.erase(from, to);
-    f->adjust(low, high);
+    // The last overlapping interval is kept, and covers all the others.
+    T interval = mIntervals[last];
+    auto low = std::min(mIntervals[first].start(), i.start());
+    auto high = std::max(interval.end(), i.end());
+    mIntervals.erase(first, last);
+    interval.adjust(low, high);
+    mIntervals.set(first, interval);
   } else {
-    mIntervals.insert(from, i);
+    mIntervals.insert(first, i);
   }
 }
 
-template <typename T>
-inline void CustomIntervalList<T>::setMergeThreshold(
+template <typename T, typename Storage>
+inline void CustomIntervalList<T, Storage>::setMergeThreshold(
     interval_unit_type threshold) {
   mMergeBias = threshold - 1;
 }
 
-template <typename T>
-inline void CustomIntervalList<T>::clear() {
+template <typename T, typename Storage>
+inline void CustomIntervalList<T, Storage>::clear() {
   mIntervals.clear();
 }
 
-template <typename T>
-inline uint32_t CustomIntervalList<T>::count() const {
+template <typename T, typename Storage>
+inline uint32_t CustomIntervalList<T, Storage>::count() const {
   return mIntervals.size();
 }
 
-template <typename T>
-inline const T* CustomIntervalList<T>::begin() const {
-  if (count() > 0) {
-    return &mIntervals[0];
-  } else {
-    return nullptr;
-  }
+template <typename T, typename Storage>
+inline typename CustomIntervalList<T, Storage>::const_iterator
+CustomIntervalList<T, Storage>::begin() const {
+  return mIntervals.begin();
 }
 
-template <typename T>
-inline const T* CustomIntervalList<T>::end() const {
-  size_t c = mIntervals.size();
-  if (c > 0) {
-    return &mIntervals[0] + c;
-  } else {
-    return nullptr;
-  }
+template <typename T, typename Storage>
+inline typename CustomIntervalList<T, Storage>::const_iterator
+CustomIntervalList<T, Storage>::end() const {
+  return mIntervals.end();
 }
 
-template <typename T>
-inline const T& CustomIntervalList<T>::operator[](size_t pos) const {
+template <typename T, typename Storage>
+inline const T& CustomIntervalList<T, Storage>::operator[](size_t pos) const {
   return mIntervals[pos];
 }
 
-template <typename T>
-inline ssize_t CustomIntervalList<T>::rangeFirst(
+template <typename T, typename Storage>
+inline ssize_t CustomIntervalList<T, Storage>::rangeFirst(
     interval_unit_type start, interval_unit_type bias) const {
-  ssize_t l = 0;
-  ssize_t h = mIntervals.size();
-  while (l != h) {
-    ssize_t m = (l + h) / 2;
-    if (mIntervals[m].end() + bias >= start) {
-      h = m;
-    } else {
-      l = m + 1;
-    }
-  }
-  return l;
+  return mIntervals.partition_point(
+      [start, bias](const T& i) { return !(i.end() + bias >= start); });
 }
 
-template <typename T>
-inline ssize_t CustomIntervalList<T>::rangeLast(interval_unit_type end,
-                                                interval_unit_type bias) const {
-  ssize_t l = -1;
-  ssize_t h = mIntervals.size() - 1;
-  while (l != h) {
-    ssize_t m = (l + h + 1) / 2;
-    if (mIntervals[m].start() <= end + bias) {
-      l = m;
-    } else {
-      h = m - 1;
-    }
-  }
-  return l;
+template <typename T, typename Storage>
+inline ssize_t CustomIntervalList<T, Storage>::rangeLast(
+    interval_unit_type end, interval_unit_type bias) const {
+  return ssize_t(mIntervals.partition_point([end, bias](const T& i) {
+           return i.start() <= end + bias;
+         })) -
+         1;
 }
 
 // IntervalList holds a ascendingly-sorted list of Interval<T>s.
 // See CustomIntervalList for more information.
-template <typename T>
-class IntervalList : public CustomIntervalList<Interval<T> > {};
+template <typename T, typename Storage = VectorIntervalStorage<Interval<T> > >
+class IntervalList : public CustomIntervalList<Interval<T>, Storage> {};
 
 }  // namespace core
 
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Synthetic benchmark of the interval list storages. Disjoint intervals are
+// merged in random and in ascending order, as the observations of a command
+// and the reserved memory of a replay are, then intersected and looked up.
+// The small lists are cleared and refilled, as the pending observations of
+// each command are.
+
+#include "core/cc/interval_btree.h"
+#include "core/cc/interval_list.h"
+#include "core/cc/timer.h"
+
+#include <stdio.h>
+
+#include <random>
+#include <vector>
+
+namespace {
+
+struct Result {
+  double merge;      // ns per merge.
+  double intersect;  // ns per intersect.
+  double index;      // ns per index_of.
+  uint64_t check;
+};
+
+double nsPer(uint64_t start, size_t n) {
+  return double(core::GetNanoseconds() - start) / n;
+}
+
+template <typename L>
+Result run(const std::vector<uint64_t>& starts, size_t lists) {
+  Result r = {};
+  L l;
+  uint64_t start = core::GetNanoseconds();
+  for (size_t i = 0; i < lists; i++) {
+    l.clear();
+    for (uint64_t s : starts) {
+      l.merge(core::Interval<uint64_t>{s, s + 16});
+    }
+  }
+  r.merge = nsPer(start, starts.size() * lists);
+  r.check = l.count();
+
+  start = core::GetNanoseconds();
+  for (uint64_t s : starts) {
+    for (auto& i : l.intersect(s + 8, s + 200)) {
+      r.check += i.start();
+    }
+  }
+  r.intersect = nsPer(start, starts.size());
+
+  start = core::GetNanoseconds();
+  for (uint64_t s : starts) {
+    r.check += l.index_of(s + 4);
+  }
+  r.index = nsPer(start, starts.size());
+  return r;
+}
+
+void compare(const char* name, const std::vector<uint64_t>& starts,
+             size_t lists) {
+  typedef core::IntervalList<uint64_t> Vector;
+  typedef core::BTreeIntervalList<uint64_t> BTree;
+  Result vector = run<Vector>(starts, lists);
+  Result btree = run<BTree>(starts, lists);
+  if (vector.check != btree.check) {
+    printf("%s: results differ\n", name);
+  }
+  printf("%-10s %8zu %-7s %10.1f %10.1f %10.1f\n", name, starts.size(),
+         "vector", vector.merge, vector.intersect, vector.index);
+  printf("%-10s %8zu %-7s %10.1f %10.1f %10.1f\n", name, starts.size(),
+         "btree", btree.merge, btree.intersect, btree.index);
+}
+
+}  // anonymous namespace
+
+int main() {
+  printf("%-10s %8s %-7s %10s %10s %10s   (ns per op)\n", "order", "count",
+         "storage", "merge", "intersect", "index_of");
+  std::mt19937_64 rng(1234);
+  for (size_t n : {8, 64, 1000, 100000, 400000}) {
+    // Enough lists to merge about a million intervals.
+    size_t lists = std::max<size_t>(1, 1000000 / n);
+    if (n > 100000) {
+      lists = 1;
+    }
+    std::vector<uint64_t> ascending(n);
+    std::vector<uint64_t> random(n);
+    for (size_t i = 0; i < n; i++) {
+      ascending[i] = 0x10000 + i * 64;
+      random[i] = 0x10000 + (rng() % (n * 8)) * 64;
+    }
+    compare("ascending", ascending, lists);
+    compare("random", random, lists);
+  }
+  return 0;
+}
@@ -15,10 +15,13 @@
  */
 
 #include "interval_list.h"
+#include "interval_btree.h"
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <random>
+
 using ::testing::ElementsAre;
 using ::testing::ElementsAreArray;
 using ::testing::Eq;
@@ -30,8 +33,9 @@ template <typename T>
   return os << "[" << interval.start() << " - " << interval.end() - 1 << "]";
 }
 
-template <typename T>
-::std::ostream& operator<<(::std::ostream& os, const IntervalList<T>& l) {
+template <typename T, typename Storage>
+::std::ostream& operator<<(::std::ostream& os,
+                           const CustomIntervalList<T, Storage>& l) {
   os << "IntervalList{";
   for (auto i : l) {
     os << i;
@@ -43,21 +47,26 @@ namespace test {
 
 Interval<int> I(int first, int last) { return Interval<int>{first, last + 1}; }
 
-class IntervalListTest : public ::testing::Test, public IntervalList<int> {
+// The tests of IntervalListTest run against each storage of the intervals.
+template <typename List>
+class IntervalListTest : public ::testing::Test, public List {
  public:
-  inline IntervalList<int>& L() {
-    return *static_cast<IntervalList<int>*>(this);
-  }
+  inline List& L() { return *static_cast<List*>(this); }
 };
 
-TEST_F(IntervalListTest, IntersectEmpty) {
-  EXPECT_THAT(L().intersect(0, 5), testing::ElementsAre());
+using IntervalListTestTypes =
+    ::testing::Types<IntervalList<int>, BTreeIntervalList<int>>;
+
+TYPED_TEST_CASE(IntervalListTest, IntervalListTestTypes);
+
+TYPED_TEST(IntervalListTest, IntersectEmpty) {
+  EXPECT_THAT(this->L().intersect(0, 5), testing::ElementsAre());
 }
 
-TEST_F(IntervalListTest, Intersect) {
-  merge(I(0x2, 0x4));  // 0
-  merge(I(0x8, 0x9));  // 1
-  merge(I(0xb, 0xc));  // 2
+TYPED_TEST(IntervalListTest, Intersect) {
+  this->merge(I(0x2, 0x4));  // 0
+  this->merge(I(0x8, 0x9));  // 1
+  this->merge(I(0xb, 0xc));  // 2
 
   struct test {
     Interval<int> interval;
@@ -81,15 +90,16 @@ TEST_F(IntervalListTest, Intersect) {
 
            test{I(0x0, 0xe), {I(0x2, 0x4), I(0x8, 0x9), I(0xb, 0xc)}},
        }) {
-    auto intersection = L().intersect(t.interval.start(), t.interval.end());
+    auto intersection =
+        this->L().intersect(t.interval.start(), t.interval.end());
     EXPECT_THAT(intersection, ElementsAreArray(t.expected));
   }
 }
 
-TEST_F(IntervalListTest, IndexOf) {
-  merge(I(0x2, 0x4));  // 0
-  merge(I(0x8, 0x9));  // 1
-  merge(I(0xb, 0xc));  // 2
+TYPED_TEST(IntervalListTest, IndexOf) {
+  this->merge(I(0x2, 0x4));  // 0
+  this->merge(I(0x8, 0x9));  // 1
+  this->merge(I(0xb, 0xc));  // 2
 
   struct test {
     int val;
@@ -111,17 +121,17 @@ TEST_F(IntervalListTest, IndexOf) {
            test{0xc, 2},
            test{0xd, -1},
        }) {
-    auto index = L().index_of(t.val);
+    auto index = this->L().index_of(t.val);
     EXPECT_THAT(index, Eq(t.expected));
   }
 }
 
-TEST_F(IntervalListTest, ReplaceEmpty) {
-  replace(I(0x2, 0x4));
-  EXPECT_THAT(L(), ElementsAre(I(0x2, 0x4)));
+TYPED_TEST(IntervalListTest, ReplaceEmpty) {
+  this->replace(I(0x2, 0x4));
+  EXPECT_THAT(this->L(), ElementsAre(I(0x2, 0x4)));
 }
 
-TEST_F(IntervalListTest, Replace) {
+TYPED_TEST(IntervalListTest, Replace) {
   struct test {
     Interval<int> interval;
     std::vector<Interval<int>> expected;
@@ -143,38 +153,38 @@ TEST_F(IntervalListTest, Replace) {
                 {I(0x2, 0x2), I(0x3, 0x3), I(0x4, 0x4), I(0x8, 0x9),
                  I(0xb, 0xc)}},
        }) {
-    clear();
-    merge(I(0x2, 0x4));  // 0
-    merge(I(0x8, 0x9));  // 1
-    merge(I(0xb, 0xc));  // 2
+    this->clear();
+    this->merge(I(0x2, 0x4));  // 0
+    this->merge(I(0x8, 0x9));  // 1
+    this->merge(I(0xb, 0xc));  // 2
 
-    replace(t.interval);
-    EXPECT_THAT(L(), ElementsAreArray(t.expected));
+    this->replace(t.interval);
+    EXPECT_THAT(this->L(), ElementsAreArray(t.expected));
   }
 }
 
-TEST_F(IntervalListTest, Empty) {
-  EXPECT_EQ(count(), 0);
-  EXPECT_EQ(begin(), end());
+TYPED_TEST(IntervalListTest, Empty) {
+  EXPECT_EQ(this->count(), 0);
+  EXPECT_EQ(this->begin(), this->end());
 }
 
-TEST_F(IntervalListTest, SingleMerge) {
-  merge(I(1, 2));
-  EXPECT_THAT(L(), ElementsAreArray({I(1, 2)}));
+TYPED_TEST(IntervalListTest, SingleMerge) {
+  this->merge(I(1, 2));
+  EXPECT_THAT(this->L(), ElementsAreArray({I(1, 2)}));
 }
 
-TEST_F(IntervalListTest, MergeSparseForward) {
-  merge(I(1, 2));
-  merge(I(4, 5));
-  merge(I(7, 8));
-  EXPECT_THAT(L(), ElementsAre(I(1, 2), I(4, 5), I(7, 8)));
+TYPED_TEST(IntervalListTest, MergeSparseForward) {
+  this->merge(I(1, 2));
+  this->merge(I(4, 5));
+  this->merge(I(7, 8));
+  EXPECT_THAT(this->L(), ElementsAre(I(1, 2), I(4, 5), I(7, 8)));
 }
 
-TEST_F(IntervalListTest, MergeSparseReverse) {
-  merge(I(7, 8));
-  merge(I(4, 5));
-  merge(I(1, 2));
-  EXPECT_THAT(L(), ElementsAre(I(1, 2), I(4, 5), I(7, 8)));
+TYPED_TEST(IntervalListTest, MergeSparseReverse) {
+  this->merge(I(7, 8));
+  this->merge(I(4, 5));
+  this->merge(I(1, 2));
+  EXPECT_THAT(this->L(), ElementsAre(I(1, 2), I(4, 5), I(7, 8)));
 }
 
 //   0   1   2   3   4   5   6   7   8   9   A   B   C   D   E
@@ -204,7 +214,7 @@ auto i = I(0x1, 0x5);
 auto j = I(0x8, 0xc);
 auto k = I(0x0, 0xe);
 
-TEST_F(IntervalListTest, Merge) {
+TYPED_TEST(IntervalListTest, Merge) {
   struct test {
     const char* name;
     Interval<int> interval;
@@ -223,19 +233,19 @@ TEST_F(IntervalListTest, Merge) {
            test{"j", j, {I(0x2, 0x4), I(0x8, 0xc)}},
            test{"k", k, {I(0x0, 0xe)}},
        }) {
-    clear();
-    merge(I(0x2, 0x4));  // 0
-    merge(I(0x8, 0x9));  // 1
-    merge(I(0xb, 0xc));  // 2
+    this->clear();
+    this->merge(I(0x2, 0x4));  // 0
+    this->merge(I(0x8, 0x9));  // 1
+    this->merge(I(0xb, 0xc));  // 2
 
-    merge(t.interval);
+    this->merge(t.interval);
 
-    EXPECT_THAT(L(), ElementsAreArray(t.expected));
+    EXPECT_THAT(this->L(), ElementsAreArray(t.expected));
   }
 }
 
-TEST_F(IntervalListTest, MergeThreshold0) {
-  setMergeThreshold(0);
+TYPED_TEST(IntervalListTest, MergeThreshold0) {
+  this->setMergeThreshold(0);
 
   struct test {
     const char* name;
@@ -255,19 +265,19 @@ TEST_F(IntervalListTest, MergeThreshold0) {
            test{"j", j, {I(0x2, 0x4), I(0x8, 0xc)}},
            test{"k", k, {I(0x0, 0xe)}},
        }) {
-    clear();
-    merge(I(0x2, 0x4));  // 0
-    merge(I(0x8, 0x9));  // 1
-    merge(I(0xb, 0xc));  // 2
+    this->clear();
+    this->merge(I(0x2, 0x4));  // 0
+    this->merge(I(0x8, 0x9));  // 1
+    this->merge(I(0xb, 0xc));  // 2
 
-    merge(t.interval);
+    this->merge(t.interval);
 
-    EXPECT_THAT(L(), ElementsAreArray(t.expected));
+    EXPECT_THAT(this->L(), ElementsAreArray(t.expected));
   }
 }
 
-TEST_F(IntervalListTest, MergeThreshold2) {
-  setMergeThreshold(2);
+TYPED_TEST(IntervalListTest, MergeThreshold2) {
+  this->setMergeThreshold(2);
 
   struct test {
     const char* name;
@@ -287,19 +297,19 @@ TEST_F(IntervalListTest, MergeThreshold2) {
            test{"j", j, {I(0x2, 0x4), I(0x8, 0xc)}},
            test{"k", k, {I(0x0, 0xe)}},
        }) {
-    clear();
-    merge(I(0x2, 0x4));  // 0
-    merge(I(0x8, 0x9));  // 1
-    merge(I(0xb, 0xc));  // 2
+    this->clear();
+    this->merge(I(0x2, 0x4));  // 0
+    this->merge(I(0x8, 0x9));  // 1
+    this->merge(I(0xb, 0xc));  // 2
 
-    merge(t.interval);
+    this->merge(t.interval);
 
-    EXPECT_THAT(L(), ElementsAreArray(t.expected));
+    EXPECT_THAT(this->L(), ElementsAreArray(t.expected));
   }
 }
 
-TEST_F(IntervalListTest, MergeThreshold3) {
-  setMergeThreshold(3);
+TYPED_TEST(IntervalListTest, MergeThreshold3) {
+  this->setMergeThreshold(3);
 
   struct test {
     const char* name;
@@ -319,19 +329,19 @@ TEST_F(IntervalListTest, MergeThreshold3) {
            test{"j", j, {I(0x2, 0x4), I(0x8, 0xc)}},
            test{"k", k, {I(0x0, 0xe)}},
        }) {
-    clear();
-    merge(I(0x2, 0x4));  // 0
-    merge(I(0x8, 0x9));  // 1
-    merge(I(0xb, 0xc));  // 2
+    this->clear();
+    this->merge(I(0x2, 0x4));  // 0
+    this->merge(I(0x8, 0x9));  // 1
+    this->merge(I(0xb, 0xc));  // 2
 
-    merge(t.interval);
+    this->merge(t.interval);
 
-    EXPECT_THAT(L(), ElementsAreArray(t.expected));
+    EXPECT_THAT(this->L(), ElementsAreArray(t.expected));
   }
 }
 
-TEST_F(IntervalListTest, MergeThreshold4) {
-  setMergeThreshold(4);
+TYPED_TEST(IntervalListTest, MergeThreshold4) {
+  this->setMergeThreshold(4);
 
   struct test {
     const char* name;
@@ -351,21 +361,21 @@ TEST_F(IntervalListTest, MergeThreshold4) {
            test{"j", j, {I(0x2, 0xc)}},
            test{"k", k, {I(0x0, 0xe)}},
        }) {
-    clear();
-    merge(I(0x2, 0x4));  // 0
-    merge(I(0x8, 0x9));  // 1
-    merge(I(0xb, 0xc));  // 2
+    this->clear();
+    this->merge(I(0x2, 0x4));  // 0
+    this->merge(I(0x8, 0x9));  // 1
+    this->merge(I(0xb, 0xc));  // 2
 
-    merge(t.interval);
+    this->merge(t.interval);
 
-    EXPECT_THAT(L(), ElementsAreArray(t.expected));
+    EXPECT_THAT(this->L(), ElementsAreArray(t.expected));
   }
 }
 
-TEST_F(IntervalListTest, rangeFirstLast) {
-  merge(I(0x2, 0x4));  // 0
-  merge(I(0x8, 0x9));  // 1
-  merge(I(0xb, 0xc));  // 2
+TYPED_TEST(IntervalListTest, rangeFirstLast) {
+  this->merge(I(0x2, 0x4));  // 0
+  this->merge(I(0x8, 0x9));  // 1
+  this->merge(I(0xb, 0xc));  // 2
 
   struct test {
     const char* name;
@@ -386,8 +396,8 @@ TEST_F(IntervalListTest, rangeFirstLast) {
            test{"j", j, 1, 2},
            test{"k", k, 0, 2},
        }) {
-    int s = rangeFirst(t.interval.start(), 0);
-    int e = rangeLast(t.interval.end(), 0);
+    int s = this->rangeFirst(t.interval.start(), 0);
+    int e = this->rangeLast(t.interval.end(), 0);
     if (t.start != s) {
       ADD_FAILURE() << t.name << ": l.rangeFirst(" << t.interval
                     << ") returned " << s << ", expected " << t.start;
@@ -399,5 +409,52 @@ TEST_F(IntervalListTest, rangeFirstLast) {
   }
 }
 
+// The B-tree storage must hold the same intervals as the vector storage, for
+// lists large enough to have a few levels of nodes.
+TEST(BTreeIntervalListTest, MatchesVector) {
+  std::default_random_engine generator;
+  for (int threshold : {0, 1, 3}) {
+    IntervalList<int> expected;
+    BTreeIntervalList<int> got;
+    expected.setMergeThreshold(threshold);
+    got.setMergeThreshold(threshold);
+    std::uniform_int_distribution<int> start(0, 200000);
+    std::uniform_int_distribution<int> length(1, 8);
+    for (int i = 0; i < 40000; i++) {
+      int s = start(generator);
+      auto interval = I(s, s + length(generator));
+      if (i % 3 == 0) {
+        expected.replace(interval);
+        got.replace(interval);
+      } else {
+        expected.merge(interval);
+        got.merge(interval);
+      }
+      if (i % 1000 == 0) {
+        // Remove a large span, to merge nodes.
+        auto span = I(s, s + 40000);
+        expected.replace(span);
+        got.replace(span);
+      }
+    }
+    ASSERT_EQ(expected.count(), got.count());
+    EXPECT_THAT(std::vector<Interval<int>>(got.begin(), got.end()),
+                ElementsAreArray(expected.begin(), expected.end()));
+    for (int i = 0; i < 1000; i++) {
+      int s = start(generator);
+      auto e = expected.intersect(s, s + 100);
+      auto g = got.intersect(s, s + 100);
+      EXPECT_EQ(e.size(), g.size());
+      EXPECT_THAT(std::vector<Interval<int>>(g.begin(), g.end()),
+                  ElementsAreArray(e.begin(), e.end()));
+      ssize_t index = expected.index_of(s);
+      EXPECT_EQ(index, got.index_of(s));
+      if (index >= 0) {
+        EXPECT_EQ(expected[index], got[index]);
+      }
+    }
+  }
+}
+
 }  // namespace test
 }  // namespace core
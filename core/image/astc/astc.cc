@@ -14,6 +14,14 @@
 
 #include "astc.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "third_party/astc-encoder/Source/astc_codec_internals.h"
 
 // astc-encoder global variables... *sigh*
@@ -40,8 +48,178 @@ uint8_t float2byte(float f) {
     return (uint8_t)(f * 255.0f + 0.5f);
 }
 
+namespace {
+
+// The minimum number of blocks decoded by each thread, so that small
+// textures and mip levels are not split across threads.
+const uint32_t kMinBlocksPerThread = 1024;
+
+// The RGBA8 value of each UNORM16 texel value, as converted by the float
+// decoder: the value is converted to FP16, then to float, then to a byte.
+uint8_t unorm16_to_byte[65536];
+
+// Guards the block size descriptors and partition tables, which
+// astc-encoder builds lazily on first use.
+std::mutex tables_mutex;
+
+// Builds the astc-encoder tables for the block size, so that the blocks can
+// then be decoded concurrently.
+void build_tables(uint32_t block_width, uint32_t block_height) {
+    std::lock_guard<std::mutex> lock(tables_mutex);
+    get_block_size_descriptor(block_width, block_height, 1);
+    for (int partitions = 1; partitions <= 4; partitions++) {
+        get_partition_table(block_width, block_height, 1, partitions);
+    }
+}
+
+// Decodes the block with the astc-encoder float decoder, to block_width by
+// block_height RGBA8 texels.
+void decode_block_float(uint32_t block_width, uint32_t block_height,
+                        const symbolic_compressed_block& scb, uint8_t* texels) {
+    imageblock pb;
+    decompress_symbolic_block(DECODE_LDR, block_width, block_height, 1, 0, 0, 0, &scb, &pb);
+    const float* data = pb.orig_data;
+    for (uint32_t i = 0; i < block_width * block_height * 4; i++) {
+        texels[i] = float2byte(data[i]);
+    }
+}
+
+// Returns the infilled weight of the texel, from the unquantized weights
+// of the block, as decompress_symbolic_block does.
+inline int texel_weight(const decimation_table* it, int texel, const int* weights) {
+    int sum = 8;
+    for (int i = 0; i < it->texel_num_weights[texel]; i++) {
+        sum += weights[it->texel_weights[texel][i]] * it->texel_weights_int[texel][i];
+    }
+    return sum >> 4;
+}
+
+// Decodes the block in the integer domain, to block_width by block_height
+// RGBA8 texels. The result is the same as that of decode_block_float, which
+// interpolates the same UNORM16 colors before converting them to float.
+// Returns false for the blocks left to the float decoder: error blocks, HDR
+// void-extent blocks and blocks with HDR endpoints.
+bool decode_block_ldr(uint32_t block_width, uint32_t block_height,
+                      const symbolic_compressed_block& scb, uint8_t* texels) {
+    const int texel_count = block_width * block_height;
+    if (scb.error_block || scb.block_mode == -1) {
+        return false;
+    }
+    if (scb.block_mode == -2) {  // A UNORM16 void-extent block.
+        uint8_t color[4];
+        for (int c = 0; c < 4; c++) {
+            color[c] = unorm16_to_byte[scb.constant_color[c] & 0xffff];
+        }
+        for (int i = 0; i < texel_count; i++) {
+            memcpy(&texels[i * 4], color, 4);
+        }
+        return true;
+    }
+
+    const int partition_count = scb.partition_count;
+    int endpoints[4][2][4];
+    for (int p = 0; p < partition_count; p++) {
+        int rgb_hdr, alpha_hdr, nan_endpoint;
+        ushort4 color0, color1;
+        unpack_color_endpoints(DECODE_LDR, scb.color_formats[p], scb.color_quantization_level,
+                               scb.color_values[p], &rgb_hdr, &alpha_hdr, &nan_endpoint,
+                               &color0, &color1);
+        if (rgb_hdr || alpha_hdr || nan_endpoint) {
+            return false;
+        }
+        endpoints[p][0][0] = color0.x;
+        endpoints[p][0][1] = color0.y;
+        endpoints[p][0][2] = color0.z;
+        endpoints[p][0][3] = color0.w;
+        endpoints[p][1][0] = color1.x;
+        endpoints[p][1][1] = color1.y;
+        endpoints[p][1][2] = color1.z;
+        endpoints[p][1][3] = color1.w;
+    }
+
+    const block_size_descriptor* bsd = get_block_size_descriptor(block_width, block_height, 1);
+    const block_mode& mode = bsd->block_modes[scb.block_mode];
+    const decimation_table* it = bsd->decimation_tables[mode.decimation_mode];
+    const partition_info* pt =
+        get_partition_table(block_width, block_height, 1, partition_count) + scb.partition_index;
+    const quantization_and_transfer_table* qat = &quant_and_xfer_tables[mode.quantization_mode];
+
+    int plane1_weights[MAX_WEIGHTS_PER_BLOCK];
+    int plane2_weights[MAX_WEIGHTS_PER_BLOCK];
+    for (int i = 0; i < it->num_weights; i++) {
+        plane1_weights[i] = qat->unquantized_value[scb.plane1_weights[i]];
+    }
+    const int plane2_component = mode.is_dual_plane ? scb.plane2_color_component : -1;
+    if (plane2_component >= 0) {
+        for (int i = 0; i < it->num_weights; i++) {
+            plane2_weights[i] = qat->unquantized_value[scb.plane2_weights[i]];
+        }
+    }
+
+    for (int i = 0; i < texel_count; i++) {
+        const int (*e)[4] = endpoints[pt->partition_of_texel[i]];
+        int w[4];
+        w[0] = w[1] = w[2] = w[3] = texel_weight(it, i, plane1_weights);
+        if (plane2_component >= 0) {
+            w[plane2_component] = texel_weight(it, i, plane2_weights);
+        }
+        uint8_t* texel = &texels[i * 4];
+        for (int c = 0; c < 4; c++) {
+            int color = (e[0][c] * (64 - w[c]) + e[1][c] * w[c] + 32) >> 6;
+            texel[c] = unorm16_to_byte[color & 0xffff];
+        }
+    }
+    return true;
+}
+
+// Decodes the block rows [first_row, end_row) of the image.
+void decompress_rows(const uint8_t* in, uint8_t* out, const astc_image& image,
+                     uint32_t first_row, uint32_t end_row) {
+    const uint32_t block_width = image.block_width;
+    const uint32_t block_height = image.block_height;
+    const uint32_t blocks_x = (image.width + block_width - 1) / block_width;
+
+    uint8_t texels[MAX_TEXELS_PER_BLOCK * 4];
+    in += image.in_offset + size_t(first_row) * blocks_x * 16;
+    out += image.out_offset;
+    for (uint32_t by = first_row; by < end_row; by++) {
+        for (uint32_t bx = 0; bx < blocks_x; bx++) {
+            physical_compressed_block pcb;
+            memcpy(&pcb, in, sizeof(pcb));
+            symbolic_compressed_block scb;
+            physical_to_symbolic(block_width, block_height, 1, pcb, &scb);
+            if (!decode_block_ldr(block_width, block_height, scb, texels)) {
+                decode_block_float(block_width, block_height, scb, texels);
+            }
+            in += 16;
+
+            uint32_t x = bx * block_width;
+            uint32_t row_bytes = std::min(block_width, image.width - x) * 4;
+            for (uint32_t dy = 0; dy < block_height; dy++) {
+                uint32_t y = by * block_height + dy;
+                if (y >= image.height) {
+                    break;
+                }
+                memcpy(&out[(size_t(image.width) * y + x) * 4],
+                       &texels[dy * block_width * 4], row_bytes);
+            }
+        }
+    }
+}
+
+}  // anonymous namespace
+
 extern "C" void init_astc() {
     build_quantization_mode_table();
+
+    // Convert each UNORM16 value the way the float decoder does.
+    imageblock pb;
+    memset(&pb, 0, sizeof(pb));
+    for (uint32_t value = 0; value < 65536; value++) {
+        pb.work_data[0] = pb.work_data[1] = pb.work_data[2] = pb.work_data[3] = value;
+        imageblock_initialize_orig_from_work(&pb, 1);
+        unorm16_to_byte[value] = float2byte(pb.orig_data[0]);
+    }
 }
 
 extern "C" void decompress_astc(
@@ -51,10 +229,61 @@ extern "C" void decompress_astc(
         uint32_t height,
         uint32_t block_width,
         uint32_t block_height) {
+    astc_image image = {0, 0, width, height, block_width, block_height};
+    decompress_astc_batch(in, out, &image, 1, 1);
+}
+
+extern "C" void decompress_astc_batch(
+        uint8_t* in,
+        uint8_t* out,
+        const astc_image* images,
+        uint32_t count,
+        uint32_t threads) {
+    // Split the images into rows of blocks, that the threads take in turn.
+    struct row { uint32_t image, row; };
+    std::vector<row> rows;
+    uint64_t blocks = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const astc_image& image = images[i];
+        build_tables(image.block_width, image.block_height);
+        uint32_t blocks_x = (image.width + image.block_width - 1) / image.block_width;
+        uint32_t blocks_y = (image.height + image.block_height - 1) / image.block_height;
+        for (uint32_t by = 0; by < blocks_y; by++) {
+            rows.push_back(row{i, by});
+        }
+        blocks += uint64_t(blocks_x) * blocks_y;
+    }
+
+    threads = std::min<uint64_t>(threads, blocks / kMinBlocksPerThread);
+    threads = std::max(threads, 1u);
+    std::atomic<size_t> next(0);
+    auto decode = [&]() {
+        for (size_t i = next++; i < rows.size(); i = next++) {
+            decompress_rows(in, out, images[rows[i].image], rows[i].row, rows[i].row + 1);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (uint32_t i = 1; i < threads; i++) {
+        workers.emplace_back(decode);
+    }
+    decode();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+extern "C" void decompress_astc_float(
+        uint8_t* in,
+        uint8_t* out,
+        uint32_t width,
+        uint32_t height,
+        uint32_t block_width,
+        uint32_t block_height) {
 
     uint32_t blocks_x = (width + block_width - 1) / block_width;
     uint32_t blocks_y = (height + block_height - 1) / block_height;
 
+    build_tables(block_width, block_height);
     imageblock pb;
     for (uint32_t by = 0; by < blocks_y; by++) {
         for (uint32_t bx = 0; bx < blocks_x; bx++) {
@@ -81,4 +310,4 @@ extern "C" void decompress_astc(
             }
         }
     }
-}
\ No newline at end of file
+}
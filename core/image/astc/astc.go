@@ -22,6 +22,8 @@ package astc
 import "C"
 
 import (
+	"fmt"
+	"runtime"
 	"unsafe"
 
 	"github.com/google/gapid/core/image"
@@ -125,23 +127,106 @@ func init() {
 	} {
 		f := f
 		image.RegisterConverter(f.src, f.dst, func(src []byte, w, h, d int) ([]byte, error) {
-			dst := make([]byte, w*h*d*4)
-			sliceSize := f.src.Size(w, h, 1)
-			for z := 0; z < d; z++ {
-				dst, src := dst[z*w*h*4:], src[z*sliceSize:]
-				in := (unsafe.Pointer)(&src[0])
-				out := (unsafe.Pointer)(&dst[0])
-				blockW := f.src.GetAstc().BlockWidth
-				blockH := f.src.GetAstc().BlockHeight
-				C.decompress_astc(
-					(*C.uint8_t)(in),
-					(*C.uint8_t)(out),
-					(C.uint32_t)(w),
-					(C.uint32_t)(h),
-					(C.uint32_t)(blockW),
-					(C.uint32_t)(blockH))
+			out, err := DecompressAll([]*image.Data{{
+				Format: f.src,
+				Width:  uint32(w),
+				Height: uint32(h),
+				Depth:  uint32(d),
+				Bytes:  src,
+			}})
+			if err != nil {
+				return nil, err
 			}
-			return dst, nil
+			return out[0].Bytes, nil
 		})
 	}
 }
+
+// DecompressAll decompresses the ASTC images, such as the mip levels of a
+// texture, to RGBA_U8_NORM or SRGBA_U8_NORM, in a single call that decodes
+// the blocks of all of the images in parallel.
+func DecompressAll(images []*image.Data) ([]*image.Data, error) {
+	inSize, outSize, slices := 0, 0, []C.astc_image{}
+	for _, img := range images {
+		f := img.Format.GetAstc()
+		if f == nil {
+			return nil, fmt.Errorf("%v is not an ASTC format", img.Format)
+		}
+		w, h, d := int(img.Width), int(img.Height), int(img.Depth)
+		sliceSize := img.Format.Size(w, h, 1)
+		if len(img.Bytes) != sliceSize*d {
+			return nil, fmt.Errorf("Image data size (0x%x) did not match expected (0x%x) for dimensions %dx%dx%d",
+				len(img.Bytes), sliceSize*d, w, h, d)
+		}
+		for z := 0; z < d; z++ {
+			slices = append(slices, C.astc_image{
+				in_offset:    C.uint64_t(inSize + z*sliceSize),
+				out_offset:   C.uint64_t(outSize + z*w*h*4),
+				width:        C.uint32_t(w),
+				height:       C.uint32_t(h),
+				block_width:  C.uint32_t(f.BlockWidth),
+				block_height: C.uint32_t(f.BlockHeight),
+			})
+		}
+		inSize += len(img.Bytes)
+		outSize += w * h * d * 4
+	}
+
+	// The blocks of all of the images are passed in one buffer, so that no Go
+	// pointers are passed in the image descriptions.
+	var in []byte
+	if len(images) == 1 {
+		in = images[0].Bytes
+	} else {
+		in = make([]byte, 0, inSize)
+		for _, img := range images {
+			in = append(in, img.Bytes...)
+		}
+	}
+	out := make([]byte, outSize)
+	if len(slices) > 0 && inSize > 0 && outSize > 0 {
+		C.decompress_astc_batch(
+			(*C.uint8_t)(unsafe.Pointer(&in[0])),
+			(*C.uint8_t)(unsafe.Pointer(&out[0])),
+			&slices[0],
+			(C.uint32_t)(len(slices)),
+			(C.uint32_t)(runtime.NumCPU()))
+	}
+
+	res := make([]*image.Data, len(images))
+	for i, img := range images {
+		size := int(img.Width) * int(img.Height) * int(img.Depth) * 4
+		format := image.RGBA_U8_NORM
+		if img.Format.GetAstc().Srgb {
+			format = image.SRGBA_U8_NORM
+		}
+		res[i] = &image.Data{
+			Format: format,
+			Width:  img.Width,
+			Height: img.Height,
+			Depth:  img.Depth,
+			Bytes:  out[:size:size],
+		}
+		out = out[size:]
+	}
+	return res, nil
+}
+
+// decompressFloat decompresses the image with the astc-encoder float decoder
+// only, to check the result of DecompressAll.
+func decompressFloat(img *image.Data) []byte {
+	f := img.Format.GetAstc()
+	w, h, d := int(img.Width), int(img.Height), int(img.Depth)
+	sliceSize := img.Format.Size(w, h, 1)
+	out := make([]byte, w*h*d*4)
+	for z := 0; z < d; z++ {
+		C.decompress_astc_float(
+			(*C.uint8_t)(unsafe.Pointer(&img.Bytes[z*sliceSize])),
+			(*C.uint8_t)(unsafe.Pointer(&out[z*w*h*4])),
+			(C.uint32_t)(w),
+			(C.uint32_t)(h),
+			(C.uint32_t)(f.BlockWidth),
+			(C.uint32_t)(f.BlockHeight))
+	}
+	return out
+}
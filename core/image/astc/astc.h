@@ -18,11 +18,35 @@
 extern "C" {
 #endif
 
+// An ASTC compressed 2D image, in the input buffer of
+// decompress_astc_batch, and where to decompress it in the output buffer.
+typedef struct astc_image_t {
+  uint64_t in_offset;   // The offset of the blocks in the input buffer.
+  uint64_t out_offset;  // The offset of the RGBA8 texels in the output buffer.
+  uint32_t width;
+  uint32_t height;
+  uint32_t block_width;
+  uint32_t block_height;
+} astc_image;
+
 void init_astc();
 
 void decompress_astc(uint8_t* in, uint8_t* out, uint32_t width, uint32_t height,
                      uint32_t block_width, uint32_t block_height);
 
+// Decompresses the count images, splitting the blocks of all of the images
+// across up to threads threads. The result is the same as decompressing each
+// image with decompress_astc.
+void decompress_astc_batch(uint8_t* in, uint8_t* out, const astc_image* images,
+                           uint32_t count, uint32_t threads);
+
+// Decompresses the image with the astc-encoder float decoder only. This is
+// slower than decompress_astc, which decodes the LDR blocks in the integer
+// domain, and is used to check that both give the same result.
+void decompress_astc_float(uint8_t* in, uint8_t* out, uint32_t width,
+                           uint32_t height, uint32_t block_width,
+                           uint32_t block_height);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
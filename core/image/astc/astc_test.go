@@ -0,0 +1,90 @@
+// Copyright (C) 2020 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package astc
+
+import (
+	"bytes"
+	"math/rand"
+	"testing"
+
+	"github.com/google/gapid/core/image"
+)
+
+// randomImage returns an image of random blocks, a quarter of which are
+// LDR void-extent blocks.
+func randomImage(r *rand.Rand, f *image.Format, w, h, d int) *image.Data {
+	data := make([]byte, f.Size(w, h, 1)*d)
+	r.Read(data)
+	for i := 0; i < len(data); i += 16 {
+		if r.Intn(4) == 0 {
+			data[i] = 0xfc
+			data[i+1] = data[i+1]&^0x02 | 0x01
+		}
+	}
+	return &image.Data{
+		Format: f,
+		Width:  uint32(w),
+		Height: uint32(h),
+		Depth:  uint32(d),
+		Bytes:  data,
+	}
+}
+
+func TestDecompressAllMatchesFloatDecoder(t *testing.T) {
+	r := rand.New(rand.NewSource(1))
+	images := []*image.Data{}
+	for _, f := range []*image.Format{
+		RGBA_4x4, RGBA_5x4, RGBA_5x5, RGBA_6x5, RGBA_6x6, RGBA_8x5, RGBA_8x6,
+		RGBA_8x8, RGBA_10x5, RGBA_10x6, RGBA_10x8, RGBA_10x10, RGBA_12x10,
+		RGBA_12x12, SRGB8_ALPHA8_6x6,
+	} {
+		bw, bh := int(f.GetAstc().BlockWidth), int(f.GetAstc().BlockHeight)
+		// Sizes that are not a multiple of the block size, with a depth.
+		images = append(images, randomImage(r, f, bw*19+1, bh*11+bh-1, 2))
+	}
+	// A large image, to be split across threads.
+	images = append(images, randomImage(r, RGBA_4x4, 1023, 517, 1))
+
+	got, err := DecompressAll(images)
+	if err != nil {
+		t.Fatalf("DecompressAll returned error: %v", err)
+	}
+	for i, img := range images {
+		if !bytes.Equal(got[i].Bytes, decompressFloat(img)) {
+			t.Errorf("%v %dx%dx%d did not match the float decoder",
+				img.Format.Name, img.Width, img.Height, img.Depth)
+		}
+		format := image.RGBA_U8_NORM
+		if img.Format.GetAstc().Srgb {
+			format = image.SRGBA_U8_NORM
+		}
+		if got[i].Format != format {
+			t.Errorf("%v was decompressed to %v", img.Format.Name, got[i].Format.Name)
+		}
+	}
+}
+
+func TestDecompressAllRejectsBadSize(t *testing.T) {
+	img := &image.Data{
+		Format: RGBA_4x4,
+		Width:  8,
+		Height: 8,
+		Depth:  1,
+		Bytes:  make([]byte, 16*3),
+	}
+	if _, err := DecompressAll([]*image.Data{img}); err == nil {
+		t.Errorf("DecompressAll of bad size returned no error")
+	}
+}
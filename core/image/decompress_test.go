@@ -309,3 +309,39 @@ func s16ToU8(src []byte, w, h, d int) ([]byte, error) {
 	}
 	return out, nil
 }
+
+func BenchmarkASTC(b *testing.B) {
+	data, err := ioutil.ReadFile(filepath.Join("test_data", "ASTC_RGBA_4x4.astc"))
+	if err != nil {
+		b.Fatalf("Failed to read test data: %v", err)
+	}
+	in, err := loadASTC(data)
+	if err != nil {
+		b.Fatalf("Failed to load test data: %v", err)
+	}
+	size := int64(in.Width * in.Height * in.Depth * 4)
+
+	b.Run("Convert", func(b *testing.B) {
+		b.SetBytes(size)
+		for i := 0; i < b.N; i++ {
+			if _, err := in.Convert(image.RGBA_U8_NORM); err != nil {
+				b.Fatalf("Convert returned error: %v", err)
+			}
+		}
+	})
+
+	// Decode the image as the many mip levels or textures of a capture.
+	const batch = 32
+	images := make([]*image.Data, batch)
+	for i := range images {
+		images[i] = in
+	}
+	b.Run("DecompressAll", func(b *testing.B) {
+		b.SetBytes(size * batch)
+		for i := 0; i < b.N; i++ {
+			if _, err := astc.DecompressAll(images); err != nil {
+				b.Fatalf("DecompressAll returned error: %v", err)
+			}
+		}
+	})
+}
@@ -95,6 +95,23 @@ func (a Arena) assertNotNil() {
 	}
 }
 
+// NewScratch constructs a new scratch arena, for allocations that do not
+// outlive a command or a frame. It allocates its memory from parent, and
+// releases all of its allocations at once with Reset.
+// You must call Dispose to free the scratch arena before parent is disposed.
+func NewScratch(parent Arena) Arena {
+	parent.assertNotNil()
+	return Arena{Pointer: unsafe.Pointer(C.scratch_arena_create((*C.arena)(parent.Pointer)))}
+}
+
+// Reset releases all the allocations of the scratch arena, which must have
+// been constructed with NewScratch. The allocations that are not freed yet
+// are handed over to the parent arena, and are kept until they are freed.
+func (a Arena) Reset() {
+	a.assertNotNil()
+	C.scratch_arena_reset((*C.arena)(a.Pointer))
+}
+
 type arenaKeyTy string
 
 const arenaKey = arenaKeyTy("arena")
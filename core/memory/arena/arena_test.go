@@ -34,3 +34,21 @@ func TestArenaStats(t *testing.T) {
 	assert.For(ctx, "num alloc").ThatInteger(a.Stats().NumAllocations).Equals(1)
 	assert.For(ctx, "bytes alloc").ThatInteger(a.Stats().NumBytesAllocated).IsAtLeast(10)
 }
+
+func TestScratchArena(t *testing.T) {
+	ctx := log.Testing(t)
+
+	parent := arena.New()
+	defer parent.Dispose()
+	a := arena.NewScratch(parent)
+
+	p := a.Allocate(10, 4)
+	a.Allocate(20, 4)
+	a.Free(p)
+	assert.For(ctx, "num alloc").ThatInteger(a.Stats().NumAllocations).Equals(1)
+	a.Reset()
+	assert.For(ctx, "num alloc after reset").ThatInteger(a.Stats().NumAllocations).Equals(0)
+	a.Dispose()
+	// The allocation that escaped the reset is kept by the parent.
+	assert.For(ctx, "parent num alloc").ThatInteger(parent.Stats().NumAllocations).Equals(1)
+}
@@ -23,6 +23,7 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
+#include <mutex>
 
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
@@ -40,24 +41,76 @@
 namespace {
 
 // k[Min,Max]BlockSize are the smallest and largest allocatable
-// blocks. Anything smaller will be rounded up, anything larger
-// will get a dedicated allocation.
+// blocks that are cached per thread. Anything smaller will be rounded up.
 static const uint32_t kMinBlockSize = 1 << core::kMinBlockSizePower;
 static const uint32_t kMaxBlockSize = 1 << core::kMaxBlockSizePower;
+// kMaxLargeBlockSize is the largest block. Anything larger will get a
+// dedicated allocation.
+static const uint32_t kMaxLargeBlockSize = 1 << core::kMaxLargeBlockSizePower;
+
+static const uint32_t kNumCachedBuckets =
+    core::kMaxBlockSizePower - core::kMinBlockSizePower + 1;
 
 // A single chunk is 2^kChunkSizePower bytes large.
 static const uint32_t kChunkSizePower = 21;
-static_assert(kChunkSizePower > core::kMaxBlockSizePower,
-              "There must be at least 2 blocks in every chunk");
+static_assert(kChunkSizePower > core::kMaxLargeBlockSizePower + 2,
+              "There must be at least 8 blocks in every chunk");
 
 static const uint32_t kChunkSize = 1 << kChunkSizePower;
 static const uintptr_t kChunkMask = ~(static_cast<uintptr_t>(kChunkSize) - 1);
 
 static_assert(sizeof(core::chunk_header) <= kMinBlockSize,
               "Cannot fit the chunk header inside a single block");
+static_assert(sizeof(core::free_batch) <= kMinBlockSize,
+              "Cannot fit a batch header inside a single block");
+
+// The blocks are moved between the thread caches and the arena in batches of
+// about kBatchBytes, and of at least kMinBatchCount blocks.
+static const uint32_t kBatchBytes = 32 * 1024;
+static const uint32_t kMinBatchCount = 4;
+static const uint32_t kMaxBatchCount = 64;
+
+// The number of arenas whose cache is held by each thread at once.
+static const uint32_t kCacheSlots = 8;
+
+// The chunk map records which chunk sized ranges of the address space are
+// chunks, so that a dedicated allocation, which is not chunk aligned, is told
+// apart from a block. It is indexed by the kChunkMapBits bits of the address
+// above the chunk offset, through kChunkMapRoot leaves of kChunkMapLeaf
+// entries that are allocated when their first chunk is added. The bits above
+// kAddressBits, which may hold a pointer tag, are ignored.
+static const uint32_t kAddressBits = sizeof(void*) == 8 ? 48 : 32;
+static const uint32_t kChunkMapBits = kAddressBits - kChunkSizePower;
+static const uint32_t kChunkMapLeafBits = kChunkMapBits / 2;
+static const uintptr_t kChunkMapRoot = uintptr_t(1)
+                                       << (kChunkMapBits - kChunkMapLeafBits);
+static const uintptr_t kChunkMapLeaf = uintptr_t(1) << kChunkMapLeafBits;
+
+// Scratch arenas bump their allocations out of regions of kScratchRegionSize
+// bytes, allocated from the parent arena with that alignment. Allocations
+// larger than kMaxScratchBump get a region of their own, and up to
+// kMaxSpareScratchRegions unused regions are kept for reuse.
+static const uint32_t kScratchRegionSize = 64 * 1024;
+static const uintptr_t kScratchRegionMask =
+    ~(static_cast<uintptr_t>(kScratchRegionSize) - 1);
+static const uint32_t kMaxScratchBump = kScratchRegionSize / 4;
+static const uint32_t kMaxSpareScratchRegions = 16;
+static const uint32_t kMinScratchAlign = 8;
+static_assert(kScratchRegionSize > kMaxBlockSize &&
+                  kScratchRegionSize <= kMaxLargeBlockSize,
+              "Scratch regions must be aligned blocks of the parent arena");
+
+// gCachesMutex guards the links between the thread caches and the arenas.
+std::mutex gCachesMutex;
+// gNextArenaId is the id of the next arena.
+std::atomic<uint64_t> gNextArenaId(1);
+
+// Returns the number of blocks in a batch of the given bucket.
+uint32_t batch_count(uint32_t bucket) {
+  uint32_t count = kBatchBytes >> (bucket + core::kMinBlockSizePower);
+  return std::max(kMinBatchCount, std::min(kMaxBatchCount, count));
+}
 
-// Returns the exponent of the next power of 2 larger than
-// val
 uint32_t next_power_of_2(uint32_t val) { return (33 - __builtin_clz(val - 1)); }
 
 // round_up_to rounds the given value to the next multiple.
@@ -88,6 +141,68 @@ void free_aligned(void* val) {
 #endif
 }
 
+typedef std::array<std::atomic<bool>, kChunkMapLeaf> chunk_map_leaf;
+std::array<std::atomic<chunk_map_leaf*>, kChunkMapRoot> gChunkMap;
+
+// Marks whether the chunk holding ptr is a chunk of an arena.
+void set_chunk(void* ptr, bool chunk) {
+  const uintptr_t index =
+      (reinterpret_cast<uintptr_t>(ptr) >> kChunkSizePower) &
+      ((uintptr_t(1) << kChunkMapBits) - 1);
+  auto& root = gChunkMap[index >> kChunkMapLeafBits];
+  chunk_map_leaf* leaf = root.load(std::memory_order_acquire);
+  if (leaf == nullptr) {
+    chunk_map_leaf* created = new chunk_map_leaf();
+    for (auto& entry : *created) {
+      entry.store(false, std::memory_order_relaxed);
+    }
+    if (root.compare_exchange_strong(leaf, created,
+                                     std::memory_order_acq_rel)) {
+      leaf = created;
+    } else {
+      delete created;
+    }
+  }
+  (*leaf)[index & (kChunkMapLeaf - 1)].store(chunk,
+                                             std::memory_order_relaxed);
+}
+
+// Returns true if ptr is in a chunk of an arena.
+bool is_chunk(void* ptr) {
+  const uintptr_t index =
+      (reinterpret_cast<uintptr_t>(ptr) >> kChunkSizePower) &
+      ((uintptr_t(1) << kChunkMapBits) - 1);
+  chunk_map_leaf* leaf =
+      gChunkMap[index >> kChunkMapLeafBits].load(std::memory_order_acquire);
+  return leaf != nullptr &&
+         (*leaf)[index & (kChunkMapLeaf - 1)].load(std::memory_order_relaxed);
+}
+
+core::scratch_region* region_of(void* ptr) {
+  return reinterpret_cast<core::scratch_region*>(
+      reinterpret_cast<uintptr_t>(ptr) & kScratchRegionMask);
+}
+
+void link_region(core::scratch_region** list, core::scratch_region* region) {
+  region->prev = nullptr;
+  region->next = *list;
+  if (*list != nullptr) {
+    (*list)->prev = region;
+  }
+  *list = region;
+}
+
+void unlink_region(core::scratch_region** list, core::scratch_region* region) {
+  if (region->prev != nullptr) {
+    region->prev->next = region->next;
+  } else {
+    *list = region->next;
+  }
+  if (region->next != nullptr) {
+    region->next->prev = region->prev;
+  }
+}
+
 void protect_range(void* val, uint32_t size) {
 #if TARGET_OS == GAPID_OS_WINDOWS
   DWORD old_protect = 0;
@@ -110,7 +225,142 @@ void unprotect_range(void* val, uint32_t size) {
 
 namespace core {
 
-Arena::Arena() : lock_(0), protected_(false) {
+// thread_cache holds the unused blocks of an arena that are cached by a
+// thread. Blocks are allocated from and freed to the cache of the calling
+// thread without locking. The blocks of each bucket are held in a list of up
+// to a batch of blocks, and in a spare full batch. When both are full, the
+// spare batch is returned to the arena without locking, to be taken by the
+// next thread that runs out of blocks.
+struct thread_cache {
+  struct magazine {
+    // head is the list of cached blocks.
+    free_list_node* head = nullptr;
+    // count is the number of blocks in head.
+    uint32_t count = 0;
+    // full is a full batch of cached blocks, or nullptr.
+    free_batch* full = nullptr;
+  };
+
+  explicit thread_cache(Arena* a) : arena_id(a->id_), arena(a), prev(nullptr) {
+    for (auto& count : allocations) {
+      count.store(0, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> guard(gCachesMutex);
+    a->lock();
+    next = a->caches_;
+    if (next != nullptr) {
+      next->prev = this;
+    }
+    a->caches_ = this;
+    a->unlock();
+  }
+
+  // Returns the cached blocks to the arena, if it still exists, and deletes
+  // the cache.
+  static void release(thread_cache* cache) {
+    {
+      std::lock_guard<std::mutex> guard(gCachesMutex);
+      if (Arena* a = cache->arena) {
+        for (uint32_t bucket = 0; bucket < kNumCachedBuckets; ++bucket) {
+          magazine& m = cache->magazines[bucket];
+          if (m.head != nullptr) {
+            free_batch* batch = reinterpret_cast<free_batch*>(m.head);
+            batch->count = m.count;
+            a->return_batch(bucket, batch);
+          }
+          if (m.full != nullptr) {
+            a->return_batch(bucket, m.full);
+          }
+        }
+        a->lock();
+        for (uint32_t bucket = 0; bucket < kNumCachedBuckets; ++bucket) {
+          a->blocks_[bucket].num_allocations +=
+              cache->allocations[bucket].load(std::memory_order_relaxed);
+        }
+        if (cache->prev != nullptr) {
+          cache->prev->next = cache->next;
+        } else {
+          a->caches_ = cache->next;
+        }
+        if (cache->next != nullptr) {
+          cache->next->prev = cache->prev;
+        }
+        a->unlock();
+      }
+    }
+    delete cache;
+  }
+
+  // Updates the number of blocks allocated through this cache. Only the
+  // owning thread updates the counts, the arena reads them for its stats.
+  void count(uint32_t bucket, int64_t delta) {
+    auto& c = allocations[bucket];
+    c.store(c.load(std::memory_order_relaxed) + delta,
+            std::memory_order_relaxed);
+  }
+
+  // arena_id is the id of the arena of this cache.
+  const uint64_t arena_id;
+  // arena is the arena of this cache, or nullptr once it is destroyed.
+  Arena* arena;
+  // prev and next link the caches of the arena.
+  thread_cache* prev;
+  thread_cache* next;
+  std::array<magazine, kNumCachedBuckets> magazines;
+  // allocations is, for each bucket, the number of blocks allocated minus
+  // the number of blocks freed through this cache.
+  std::array<std::atomic<int64_t>, kNumCachedBuckets> allocations;
+};
+
+}  // namespace core
+
+namespace {
+
+// thread_caches holds the arena caches of a thread.
+struct thread_caches {
+  ~thread_caches() {
+    for (auto cache : slots) {
+      if (cache != nullptr) {
+        core::thread_cache::release(cache);
+      }
+    }
+  }
+
+  std::array<core::thread_cache*, kCacheSlots> slots = {};
+};
+
+thread_local thread_caches tCaches;
+
+}  // anonymous namespace
+
+namespace core {
+
+Arena::Arena() : Arena(nullptr) {}
+
+Arena::Arena(Arena* parent)
+    : id_(gNextArenaId.fetch_add(1)),
+      caches_(nullptr),
+      dedicated_(nullptr),
+      num_dedicated_(0),
+      dedicated_bytes_(0),
+      lock_(0),
+      protected_(false),
+      adopted_(nullptr),
+      num_adopted_(0),
+      parent_(parent),
+      region_(nullptr),
+      bump_(nullptr),
+      bump_end_(nullptr),
+      last_(nullptr),
+      active_(nullptr),
+      spare_(nullptr),
+      num_spare_(0),
+      num_escaped_(0) {
+  GAPID_ASSERT_MSG(parent == nullptr || !parent->is_scratch(),
+                   "The parent of a scratch arena cannot be a scratch arena");
+  for (auto& batches : returned_) {
+    batches.store(nullptr, std::memory_order_relaxed);
+  }
 #if (TARGET_OS == GAPID_OS_LINUX) || (TARGET_OS == GAPID_OS_ANDROID) || \
     (TARGET_OS == GAPID_OS_OSX)
   page_size_ = getpagesize();
@@ -122,95 +372,263 @@ Arena::Arena() : lock_(0), protected_(false) {
 }
 
 Arena::~Arena() {
+  if (parent_ != nullptr) {
+    // The regions of the allocations that are still live are handed over to
+    // the parent, the others are freed.
+    reset();
+    while (spare_ != nullptr) {
+      scratch_region* next = spare_->next;
+      parent_->free(spare_);
+      spare_ = next;
+    }
+  }
+  {
+    // The blocks cached by the threads belong to the chunks freed below.
+    // The caches are deleted by their threads.
+    std::lock_guard<std::mutex> guard(gCachesMutex);
+    for (thread_cache* cache = caches_; cache != nullptr; cache = cache->next) {
+      cache->arena = nullptr;
+    }
+    caches_ = nullptr;
+  }
   if (protected_) {
     unprotect();
   }
-  for (auto& it : dedicated_allocations_) {
-    free_aligned(it.first);
+  while (dedicated_ != nullptr) {
+    dedicated_header* next = dedicated_->next;
+    free_aligned(dedicated_);
+    dedicated_ = next;
   }
   for (auto chunk : chunks_) {
+    set_chunk(chunk, false);
     free_aligned(chunk);
   }
 }
 
+thread_cache* Arena::cache() {
+  // The slots hold the caches from the most to the least recently used.
+  auto& slots = tCaches.slots;
+  if (slots[0] != nullptr && slots[0]->arena_id == id_) {
+    return slots[0];
+  }
+  uint32_t i = 1;
+  while (i < kCacheSlots - 1 && slots[i] != nullptr &&
+         slots[i]->arena_id != id_) {
+    ++i;
+  }
+  thread_cache* c = slots[i];
+  if (c == nullptr || c->arena_id != id_) {
+    // Evict the least recently used cache if all the slots are taken.
+    if (c != nullptr) {
+      thread_cache::release(c);
+    }
+    c = new thread_cache(this);
+  }
+  for (; i > 0; --i) {
+    slots[i] = slots[i - 1];
+  }
+  slots[0] = c;
+  return c;
+}
+
 void* Arena::allocate(uint32_t size, uint32_t align) {
+  if (parent_ != nullptr) {
+    return scratch_allocate(size, std::max(align, kMinScratchAlign));
+  }
   size = std::max(size, kMinBlockSize);
-  void* allocation = nullptr;
+  if (size > kMaxLargeBlockSize) {
+    return allocate_dedicated(size, align);
+  }
+  // Calculate the bucket index.
+  const uint32_t bucket = next_power_of_2(size) - kMinBlockSizePower - 1;
   if (size > kMaxBlockSize) {
-    // Align must be a power of 2.
-    // Use normal assert here so it goes away in release.
-    assert((align & (align - 1)) == 0);
-
-    // posix_memalign states that the alignment must be a multiple
-    // of sizeof(void*).
-    align = std::max(align, page_size_);
-    allocation = allocate_aligned(round_up_to(size, page_size_), align);
-    lock();
-    { dedicated_allocations_[reinterpret_cast<uint8_t*>(allocation)] = size; }
-    unlock();
-  } else {
-    // Calculate the bucket index.
-    const uint32_t bucket = next_power_of_2(size) - kMinBlockSizePower - 1;
-    const uint32_t block_size = 1 << (bucket + kMinBlockSizePower);
-    block_data& data = blocks_[bucket];
-    chunk_header* header;
-    lock();
-    if (data.next) {
-      // If there was a free block in the freelist, use that.
-      allocation = data.next;
-      data.next = data.next->next;
-      uintptr_t val = reinterpret_cast<uintptr_t>(allocation);
-      val &= kChunkMask;
-      header = reinterpret_cast<chunk_header*>(val);
-    } else if (data.current_chunk) {
-      // If there was no free block in the free-list, but we
-      // have at least one free block in the current chunk
-      // then use that.
-      allocation = data.current_chunk + data.offset_of_next_allocation_in_chunk;
-      header = reinterpret_cast<chunk_header*>(data.current_chunk);
-      data.offset_of_next_allocation_in_chunk += block_size;
-      if (data.offset_of_next_allocation_in_chunk == kChunkSize) {
-        // If this was the last block in the chunk, then stop using
-        // this chunk.
-        data.offset_of_next_allocation_in_chunk = 0;
-        data.current_chunk = nullptr;
-      }
+    return allocate_block(bucket);
+  }
+  thread_cache* c = cache();
+  thread_cache::magazine& m = c->magazines[bucket];
+  if (m.head == nullptr) {
+    if (m.full != nullptr) {
+      m.head = reinterpret_cast<free_list_node*>(m.full);
+      m.count = m.full->count;
+      m.full = nullptr;
     } else {
-      chunk_header* val = 0;
-      // If we can't actually allocate memory that is a problem.
-      val =
-          static_cast<chunk_header*>(allocate_aligned(kChunkSize, kChunkSize));
-      data.current_chunk = reinterpret_cast<uint8_t*>(val);
-      chunks_.push_back(val);
-      val->block_size = block_size;
-      val->block_index = bucket;
-      val->num_allocations = 0;
-      // The first allocation is offset by 1 block.
-      allocation = data.current_chunk + block_size;
-      data.offset_of_next_allocation_in_chunk = 2 * block_size;
-      header = reinterpret_cast<chunk_header*>(data.current_chunk);
+      refill(c, bucket);
+    }
+  }
+  free_list_node* allocation = m.head;
+  m.head = allocation->next;
+  m.count--;
+  c->count(bucket, 1);
+  return allocation;
+}
+
+void Arena::refill(thread_cache* c, uint32_t bucket) {
+  thread_cache::magazine& m = c->magazines[bucket];
+  auto& returned = returned_[bucket];
+  if (returned.load(std::memory_order_relaxed) != nullptr) {
+    // Batches can only be taken all at once, as another thread may take and
+    // return the first batch while this thread is reading it. Take the first
+    // one, and return the others.
+    free_batch* batch = returned.exchange(nullptr, std::memory_order_acquire);
+    if (batch != nullptr) {
+      if (batch->next_batch != nullptr) {
+        free_batch* last = batch->next_batch;
+        while (last->next_batch != nullptr) {
+          last = last->next_batch;
+        }
+        free_batch* head = returned.load(std::memory_order_relaxed);
+        do {
+          last->next_batch = head;
+        } while (!returned.compare_exchange_weak(head, batch->next_batch,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed));
+      }
+      m.head = reinterpret_cast<free_list_node*>(batch);
+      m.count = batch->count;
+      return;
     }
-    header->num_allocations += 1;
-    unlock();
   }
+
+  uint32_t count = batch_count(bucket);
+  lock();
+  uint8_t* blocks = carve_blocks(bucket, &count);
+  unlock();
+  const uint32_t block_size = 1 << (bucket + kMinBlockSizePower);
+  for (uint32_t i = 0; i < count; ++i) {
+    auto node = reinterpret_cast<free_list_node*>(blocks + i * block_size);
+    node->next = (i + 1 < count)
+                     ? reinterpret_cast<free_list_node*>(blocks +
+                                                         (i + 1) * block_size)
+                     : nullptr;
+  }
+  m.head = reinterpret_cast<free_list_node*>(blocks);
+  m.count = count;
+}
+
+void Arena::return_batch(uint32_t bucket, free_batch* batch) {
+  auto& returned = returned_[bucket];
+  free_batch* head = returned.load(std::memory_order_relaxed);
+  do {
+    batch->next_batch = head;
+  } while (!returned.compare_exchange_weak(
+      head, batch, std::memory_order_release, std::memory_order_relaxed));
+}
+
+uint8_t* Arena::carve_blocks(uint32_t bucket, uint32_t* count) {
+  const uint32_t block_size = 1 << (bucket + kMinBlockSizePower);
+  block_data& data = blocks_[bucket];
+  if (data.current_chunk == nullptr) {
+    // If we can't actually allocate memory that is a problem.
+    chunk_header* val =
+        static_cast<chunk_header*>(allocate_aligned(kChunkSize, kChunkSize));
+    data.current_chunk = reinterpret_cast<uint8_t*>(val);
+    chunks_.push_back(val);
+    set_chunk(val, true);
+    val->block_size = block_size;
+    val->block_index = bucket;
+    // The first allocation is offset by 1 block.
+    data.offset_of_next_allocation_in_chunk = block_size;
+  }
+  uint32_t available =
+      (kChunkSize - data.offset_of_next_allocation_in_chunk) / block_size;
+  *count = std::min(*count, available);
+  uint8_t* blocks =
+      data.current_chunk + data.offset_of_next_allocation_in_chunk;
+  data.offset_of_next_allocation_in_chunk += *count * block_size;
+  if (data.offset_of_next_allocation_in_chunk == kChunkSize) {
+    // If this was the last block in the chunk, then stop using
+    // this chunk.
+    data.offset_of_next_allocation_in_chunk = 0;
+    data.current_chunk = nullptr;
+  }
+  return blocks;
+}
+
+void* Arena::allocate_block(uint32_t bucket) {
+  block_data& data = blocks_[bucket];
+  void* allocation;
+  lock();
+  if (data.next) {
+    // If there was a free block in the freelist, use that.
+    allocation = data.next;
+    data.next = data.next->next;
+  } else {
+    uint32_t count = 1;
+    allocation = carve_blocks(bucket, &count);
+  }
+  data.num_allocations += 1;
+  unlock();
   return allocation;
 }
 
+void* Arena::allocate_dedicated(uint32_t size, uint32_t align) {
+  // Align must be a power of 2.
+  // Use normal assert here so it goes away in release.
+  assert((align & (align - 1)) == 0);
+
+  // The header is placed at the start of the allocation, and is pointed to by
+  // the word before the allocated memory. Allocations of a huge page or more
+  // are chunk aligned, so that they can be backed by huge pages.
+  const uint32_t offset = std::max(align, page_size_);
+  const uint32_t alignment = size >= kChunkSize ? kChunkSize : offset;
+  auto header = static_cast<dedicated_header*>(
+      allocate_aligned(offset + round_up_to(size, page_size_), alignment));
+  header->size = size;
+  header->offset = offset;
+  header->prev = nullptr;
+  lock();
+  header->next = dedicated_;
+  if (dedicated_ != nullptr) {
+    dedicated_->prev = header;
+  }
+  dedicated_ = header;
+  num_dedicated_ += 1;
+  dedicated_bytes_ += size;
+  unlock();
+  uint8_t* ptr = reinterpret_cast<uint8_t*>(header) + offset;
+  reinterpret_cast<dedicated_header**>(ptr)[-1] = header;
+  return ptr;
+}
+
+dedicated_header* Arena::dedicated_header_of(void* ptr) const {
+  // Dedicated allocations are page aligned, and are not in a chunk.
+  uintptr_t val = reinterpret_cast<uintptr_t>(ptr);
+  if ((val & (page_size_ - 1)) != 0 || is_chunk(ptr)) {
+    return nullptr;
+  }
+  return reinterpret_cast<dedicated_header**>(ptr)[-1];
+}
+
+void Arena::free_dedicated(dedicated_header* header) {
+  lock();
+  if (header->prev != nullptr) {
+    header->prev->next = header->next;
+  } else {
+    dedicated_ = header->next;
+  }
+  if (header->next != nullptr) {
+    header->next->prev = header->prev;
+  }
+  num_dedicated_ -= 1;
+  dedicated_bytes_ -= header->size;
+  unlock();
+  free_aligned(header);
+}
+
 void* Arena::reallocate(void* ptr, uint32_t size, uint32_t align) {
   if (ptr == nullptr) {
     return allocate(size, align);
   }
+  if (parent_ != nullptr) {
+    return scratch_reallocate(ptr, size, std::max(align, kMinScratchAlign));
+  }
 
   bool reallocate = false;
   uint32_t old_size = 0;
-  lock();
-  auto it = dedicated_allocations_.find(static_cast<uint8_t*>(ptr));
-  if (it != dedicated_allocations_.end()) {
+  if (dedicated_header* dedicated = dedicated_header_of(ptr)) {
     reallocate = true;
-    old_size = it->second;
-    unlock();
+    old_size = dedicated->size;
   } else {
-    unlock();
     uintptr_t val = reinterpret_cast<uintptr_t>(ptr);
     val &= kChunkMask;
     chunk_header* header = reinterpret_cast<chunk_header*>(val);
@@ -233,82 +651,312 @@ void Arena::free(void* ptr) {
   if (!ptr) {
     return;
   }
-  bool dedicated = false;
-  lock();
-  dedicated = dedicated_allocations_.erase(static_cast<uint8_t*>(ptr));
-
-  if (!dedicated) {
-    uintptr_t val = reinterpret_cast<uintptr_t>(ptr);
-    val &= kChunkMask;
-    chunk_header* header = reinterpret_cast<chunk_header*>(val);
-    header->num_allocations -= 1;
-    const uint16_t bucket = header->block_index;
+  if (parent_ != nullptr) {
+    scratch_free(ptr);
+    return;
+  }
+  if (num_adopted_.load(std::memory_order_relaxed) != 0 && free_escaped(ptr)) {
+    return;
+  }
+  if (dedicated_header* dedicated = dedicated_header_of(ptr)) {
+    free_dedicated(dedicated);
+    return;
+  }
+  uintptr_t val = reinterpret_cast<uintptr_t>(ptr);
+  val &= kChunkMask;
+  chunk_header* header = reinterpret_cast<chunk_header*>(val);
+  const uint32_t bucket = header->block_index;
+  auto node = reinterpret_cast<free_list_node*>(ptr);
 
-    reinterpret_cast<free_list_node*>(ptr)->next = blocks_[bucket].next;
-    blocks_[bucket].next = reinterpret_cast<free_list_node*>(ptr);
+  if (bucket >= kNumCachedBuckets) {
+    lock();
+    node->next = blocks_[bucket].next;
+    blocks_[bucket].next = node;
+    blocks_[bucket].num_allocations -= 1;
     unlock();
   } else {
+    thread_cache* c = cache();
+    thread_cache::magazine& m = c->magazines[bucket];
+    if (m.count == batch_count(bucket)) {
+      if (m.full != nullptr) {
+        return_batch(bucket, m.full);
+      }
+      m.full = reinterpret_cast<free_batch*>(m.head);
+      m.full->count = m.count;
+      m.head = nullptr;
+      m.count = 0;
+    }
+    node->next = m.head;
+    m.head = node;
+    m.count++;
+    c->count(bucket, -1);
+  }
+}
+
+void* Arena::scratch_allocate_slow(uint32_t size, uint32_t align) {
+  GAPID_ASSERT(align <= kScratchRegionSize);
+  if (size + align > kMaxScratchBump) {
+    const uint32_t offset =
+        round_up_to(sizeof(scratch_region) + sizeof(uint32_t), align);
+    scratch_region* region =
+        new_region(std::max(kScratchRegionSize, offset + size));
+    link_region(&active_, region);
+    region->live = 1;
+    uint8_t* ptr = reinterpret_cast<uint8_t*>(region) + offset;
+    reinterpret_cast<uint32_t*>(ptr)[-1] = size;
+    return ptr;
+  }
+  if (region_ != nullptr && region_->live == 0) {
+    unlink_region(&active_, region_);
+    release_region(region_);
+  }
+  region_ = new_region(kScratchRegionSize);
+  link_region(&active_, region_);
+  bump_ = reinterpret_cast<uint8_t*>(region_) + sizeof(scratch_region);
+  bump_end_ = reinterpret_cast<uint8_t*>(region_) + kScratchRegionSize;
+  return scratch_allocate(size, align);
+}
+
+void* Arena::scratch_reallocate(void* ptr, uint32_t size, uint32_t align) {
+  uint8_t* old = static_cast<uint8_t*>(ptr);
+  if (old == last_ && (reinterpret_cast<uintptr_t>(old) & (align - 1)) == 0 &&
+      old + size <= bump_end_) {
+    // The last allocation grows or shrinks in place.
+    bump_ = old + size;
+    reinterpret_cast<uint32_t*>(old)[-1] = size;
+    return old;
+  }
+  const uint32_t old_size = reinterpret_cast<uint32_t*>(old)[-1];
+  void* new_ptr = scratch_allocate(size, align);
+  memcpy(new_ptr, old, std::min(size, old_size));
+  scratch_free(ptr);
+  return new_ptr;
+}
+
+void Arena::scratch_free(void* ptr) {
+  scratch_region* region = region_of(ptr);
+  if (region->escaped) {
+    // The region was handed over to the parent by a reset.
+    parent_->free_escaped(ptr);
+    return;
+  }
+  assert(region->live > 0);
+  if (ptr == last_) {
+    bump_ = last_;
+    last_ = nullptr;
+  }
+  if (--region->live > 0) {
+    return;
+  }
+  if (region == region_) {
+    // Nothing is left in the current region, start it over.
+    bump_ = reinterpret_cast<uint8_t*>(region) + sizeof(scratch_region);
+    last_ = nullptr;
+    return;
+  }
+  unlink_region(&active_, region);
+  release_region(region);
+}
+
+scratch_region* Arena::new_region(uint32_t size) {
+  scratch_region* region = spare_;
+  if (size == kScratchRegionSize && region != nullptr) {
+    spare_ = region->next;
+    num_spare_--;
+  } else {
+    region = static_cast<scratch_region*>(
+        parent_->allocate(size, kScratchRegionSize));
+    GAPID_ASSERT((reinterpret_cast<uintptr_t>(region) &
+                  ~kScratchRegionMask) == 0);
+  }
+  region->size = size;
+  region->live = 0;
+  region->escaped = false;
+  return region;
+}
+
+void Arena::release_region(scratch_region* region) {
+  if (region->size == kScratchRegionSize &&
+      num_spare_ < kMaxSpareScratchRegions) {
+    region->next = spare_;
+    spare_ = region;
+    num_spare_++;
+  } else {
+    parent_->free(region);
+  }
+}
+
+void Arena::adopt_region(scratch_region* region) {
+  region->escaped = true;
+  lock();
+  link_region(&adopted_, region);
+  num_adopted_.fetch_add(1, std::memory_order_relaxed);
+  unlock();
+}
+
+bool Arena::free_escaped(void* ptr) {
+  // Only the addresses in an adopted region have it as their region.
+  scratch_region* region = region_of(ptr);
+  lock();
+  scratch_region* adopted = adopted_;
+  while (adopted != nullptr && adopted != region) {
+    adopted = adopted->next;
+  }
+  if (adopted == nullptr) {
     unlock();
-    free_aligned(ptr);
+    return false;
+  }
+  assert(region->live > 0);
+  const bool empty = --region->live == 0;
+  if (empty) {
+    unlink_region(&adopted_, region);
+    num_adopted_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  unlock();
+  if (empty) {
+    free(region);
+  }
+  return true;
+}
+
+void Arena::reset() {
+  GAPID_ASSERT_MSG(parent_ != nullptr, "Only scratch arenas can be reset");
+  size_t escaped = 0;
+  size_t promoted = 0;
+  while (active_ != nullptr) {
+    scratch_region* region = active_;
+    active_ = region->next;
+    if (region->live == 0) {
+      release_region(region);
+    } else {
+      // The live allocations outlive the reset: the parent keeps their region
+      // until they are all freed.
+      escaped += region->live;
+      promoted++;
+      parent_->adopt_region(region);
+    }
+  }
+  region_ = nullptr;
+  bump_ = nullptr;
+  bump_end_ = nullptr;
+  last_ = nullptr;
+  if (escaped > 0) {
+    // Report the first escape, as they indicate objects that should have been
+    // allocated from the long-lived arena.
+    if (num_escaped_ == 0) {
+      GAPID_WARNING(
+          "%zu scratch allocations escaped a reset, handing %zu regions over "
+          "to the parent arena",
+          escaped, promoted);
+    } else {
+      GAPID_DEBUG(
+          "%zu scratch allocations escaped a reset, handing %zu regions over "
+          "to the parent arena",
+          escaped, promoted);
+    }
+    num_escaped_ += escaped;
   }
 }
 
 size_t Arena::num_allocations() const {
+  if (parent_ != nullptr) {
+    size_t alloc_count = 0;
+    for (scratch_region* r = active_; r != nullptr; r = r->next) {
+      alloc_count += r->live;
+    }
+    return alloc_count;
+  }
+  std::lock_guard<std::mutex> guard(gCachesMutex);
   lock();
-  size_t alloc_count = dedicated_allocations_.size();
-  for (auto chunk : chunks_) {
-    alloc_count += chunk->num_allocations;
+  int64_t alloc_count = num_dedicated_;
+  for (auto& block : blocks_) {
+    alloc_count += block.num_allocations;
+  }
+  for (thread_cache* cache = caches_; cache != nullptr; cache = cache->next) {
+    for (auto& count : cache->allocations) {
+      alloc_count += count.load(std::memory_order_relaxed);
+    }
   }
   unlock();
   return alloc_count;
 }
 
 size_t Arena::num_bytes_allocated() const {
+  if (parent_ != nullptr) {
+    // Count the regions that hold the allocations.
+    size_t alloc_amount = 0;
+    for (scratch_region* r = active_; r != nullptr; r = r->next) {
+      alloc_amount += r->size;
+    }
+    return alloc_amount;
+  }
+  std::lock_guard<std::mutex> guard(gCachesMutex);
   lock();
-  size_t alloc_amount = 0;
-  for (auto& it : dedicated_allocations_) {
-    alloc_amount += it.second;
+  int64_t alloc_amount = dedicated_bytes_;
+  for (uint32_t i = 0; i < blocks_.size(); ++i) {
+    alloc_amount += blocks_[i].num_allocations << (i + kMinBlockSizePower);
   }
-  for (auto chunk : chunks_) {
-    alloc_amount += chunk->num_allocations * chunk->block_size;
+  for (thread_cache* cache = caches_; cache != nullptr; cache = cache->next) {
+    for (uint32_t i = 0; i < kNumCachedBuckets; ++i) {
+      alloc_amount += cache->allocations[i].load(std::memory_order_relaxed)
+                      << (i + kMinBlockSizePower);
+    }
   }
   unlock();
   return alloc_amount;
 }
 
 void Arena::dump_allocator_stats() const {
-  uint32_t total_chunk_memory = chunks_.size() * kChunkSize;
-  uint32_t total_dedicated_memory = 0;
-  uint32_t total_used_dedicated_memory = 0;
-  for (auto& it : dedicated_allocations_) {
-    total_dedicated_memory += round_up_to(it.second, page_size_);
-    total_used_dedicated_memory += it.second;
-  }
-  uint32_t total_used_chunk_memory = 0;
-  uint32_t total_header_memory = 0;
+  std::lock_guard<std::mutex> guard(gCachesMutex);
+  lock();
+  uint64_t total_chunk_memory = uint64_t(chunks_.size()) * kChunkSize;
+  uint64_t total_dedicated_memory = 0;
+  uint64_t total_used_dedicated_memory = 0;
+  for (auto header = dedicated_; header != nullptr; header = header->next) {
+    total_dedicated_memory += round_up_to(header->size, page_size_);
+    total_used_dedicated_memory += header->size;
+  }
+  uint64_t total_header_memory = 0;
   for (auto chunk : chunks_) {
-    total_used_chunk_memory += chunk->num_allocations * chunk->block_size;
     total_header_memory += chunk->block_size;
   }
+  std::array<int64_t, kMaxLargeBlockSizePower - kMinBlockSizePower + 1>
+      block_counts;
+  for (uint32_t i = 0; i < blocks_.size(); ++i) {
+    block_counts[i] = blocks_[i].num_allocations;
+  }
+  std::array<uint64_t, kNumCachedBuckets> cached_counts = {};
+  for (thread_cache* cache = caches_; cache != nullptr; cache = cache->next) {
+    for (uint32_t i = 0; i < kNumCachedBuckets; ++i) {
+      block_counts[i] += cache->allocations[i].load(std::memory_order_relaxed);
+      cached_counts[i] +=
+          cache->magazines[i].count +
+          (cache->magazines[i].full ? cache->magazines[i].full->count : 0);
+    }
+  }
+  uint64_t total_used_chunk_memory = 0;
+  for (uint32_t i = 0; i < blocks_.size(); ++i) {
+    total_used_chunk_memory += uint64_t(block_counts[i])
+                               << (i + kMinBlockSizePower);
+  }
 
   GAPID_ERROR("----------------- ARENA STATS -----------------");
   GAPID_ERROR("Num Chunks: %35zu", chunks_.size());
-  GAPID_ERROR("Num Dedicated Allocations: %20zu",
-              dedicated_allocations_.size());
-  GAPID_ERROR("Total Memory Reserved: %24" PRIu32,
+  GAPID_ERROR("Num Dedicated Allocations: %20zu", num_dedicated_);
+  GAPID_ERROR("Total Memory Reserved: %24" PRIu64,
               total_chunk_memory + total_dedicated_memory);
-  GAPID_ERROR("Total Memory Reserved [Chunks]: %15" PRIu32, total_chunk_memory);
-  GAPID_ERROR("Total Memory Reserved [Dedicated]: %12" PRIu32,
+  GAPID_ERROR("Total Memory Reserved [Chunks]: %15" PRIu64, total_chunk_memory);
+  GAPID_ERROR("Total Memory Reserved [Dedicated]: %12" PRIu64,
               total_dedicated_memory);
-  GAPID_ERROR("Total Memory Used [Chunks]: %19" PRIu32,
+  GAPID_ERROR("Total Memory Used [Chunks]: %19" PRIu64,
               total_used_chunk_memory);
-  GAPID_ERROR("Total Memory Used [Dedicated]: %16" PRIu32,
+  GAPID_ERROR("Total Memory Used [Dedicated]: %16" PRIu64,
               total_used_dedicated_memory);
-  GAPID_ERROR("Memory Overhead [Headers]: %20" PRIu32, total_header_memory);
+  GAPID_ERROR("Memory Overhead [Headers]: %20" PRIu64, total_header_memory);
   GAPID_ERROR(
-      "Memory Overhead [Unused]: %21" PRIu32,
+      "Memory Overhead [Unused]: %21" PRIu64,
       total_chunk_memory - total_header_memory - total_used_chunk_memory);
-  GAPID_ERROR("Memory Overhead [Dedicated]: %18" PRIu32,
+  GAPID_ERROR("Memory Overhead [Dedicated]: %18" PRIu64,
               total_dedicated_memory - total_used_dedicated_memory);
   GAPID_ERROR("Memory Efficiency [Chunks] %20f",
               (float)total_used_chunk_memory / (float)total_chunk_memory);
@@ -317,23 +965,30 @@ void Arena::dump_allocator_stats() const {
       (float)total_used_dedicated_memory / (float)total_dedicated_memory);
   GAPID_ERROR("---------------- FREELIST STATS ---------------");
 
-  uint32_t i = 0;
-  for (auto& block : blocks_) {
-    uint32_t freelist_count = 0;
-    for (free_list_node* node = block.next; node != nullptr;
+  for (uint32_t i = 0; i < blocks_.size(); ++i) {
+    uint64_t freelist_count = 0;
+    for (free_list_node* node = blocks_[i].next; node != nullptr;
          node = node->next) {
       freelist_count += 1;
     }
-    GAPID_ERROR("Freelist [%6" PRIu32 "]: %28" PRIu32,
+    if (i < kNumCachedBuckets) {
+      for (free_batch* batch = returned_[i].load(std::memory_order_acquire);
+           batch != nullptr; batch = batch->next_batch) {
+        freelist_count += batch->count;
+      }
+      freelist_count += cached_counts[i];
+    }
+    GAPID_ERROR("Freelist [%6" PRIu32 "]: %28" PRIu64,
                 1 << (kMinBlockSizePower + i), freelist_count);
-    i++;
   }
   GAPID_ERROR("-----------------------------------------------");
+  unlock();
 }
 
 void Arena::protect() {
-  for (auto& it : dedicated_allocations_) {
-    protect_range(it.first, round_up_to(it.second, page_size_));
+  for (auto header = dedicated_; header != nullptr; header = header->next) {
+    protect_range(header,
+                  header->offset + round_up_to(header->size, page_size_));
   }
   for (auto chunk : chunks_) {
     protect_range(chunk, kChunkSize);
@@ -342,8 +997,9 @@ void Arena::protect() {
 }
 
 void Arena::unprotect() {
-  for (auto& it : dedicated_allocations_) {
-    unprotect_range(it.first, round_up_to(it.second, page_size_));
+  for (auto header = dedicated_; header != nullptr; header = header->next) {
+    unprotect_range(header,
+                    header->offset + round_up_to(header->size, page_size_));
   }
   for (auto chunk : chunks_) {
     unprotect_range(chunk, kChunkSize);
@@ -379,4 +1035,15 @@ void arena_stats(arena* a, size_t* num_allocations,
   *num_bytes_allocated = arena->num_bytes_allocated();
 }
 
+arena* scratch_arena_create(arena* parent) {
+  return reinterpret_cast<arena*>(
+      new core::Arena(reinterpret_cast<core::Arena*>(parent)));
+}
+
+void scratch_arena_reset(arena* a) {
+  auto arena = reinterpret_cast<core::Arena*>(a);
+  GAPID_ASSERT_MSG(arena->is_scratch(), "Only scratch arenas can be reset");
+  arena->reset();
+}
+
 }  // extern "C"
@@ -23,14 +23,18 @@
 #include <array>
 #include <atomic>
 #include <list>
-#include <unordered_map>
 
 namespace core {
 
 // Blocks will be created with sizes that range from
 // [2^kMinBlockSizePower, 2^kMaxBlockSizePower] in powers of 2.
+// These blocks are cached per thread.
 static const uint32_t kMinBlockSizePower = 5;
 static const uint32_t kMaxBlockSizePower = 14;
+// Larger blocks, up to 2^kMaxLargeBlockSizePower, are allocated from chunks
+// too, but are not cached per thread. Anything larger gets a dedicated
+// allocation.
+static const uint32_t kMaxLargeBlockSizePower = 18;
 
 // free_list_node is a simple linked list node that is used
 // to track all of the currently unused blocks.
@@ -38,6 +42,16 @@ struct free_list_node {
   free_list_node* next;
 };
 
+// free_batch is the first node of a list of unused blocks that is moved
+// between the thread caches and the arena at once.
+struct free_batch {
+  free_list_node* next;
+  // next_batch is the next batch in a list of batches.
+  free_batch* next_batch;
+  // count is the number of blocks in the batch, including this one.
+  uint32_t count;
+};
+
 // block_data contains metadata for all blocks if a particular
 // size.
 struct block_data {
@@ -49,25 +63,84 @@ struct block_data {
   // in current_chunk that has never been touched. Used
   // when there are no blocks left in the free_list.
   size_t offset_of_next_allocation_in_chunk = 0;
+  // num_allocations is the number of blocks of this size allocated outside
+  // of the thread caches.
+  int64_t num_allocations = 0;
 };
 
 // The header data for a chunk of memory. We can
 // use this area to store information. It should always be
 // smaller than the smallest block size.
 struct chunk_header {
-  uint16_t block_size;
-  uint16_t block_index;
-  uint32_t num_allocations;
+  uint32_t block_size;
+  uint32_t block_index;
+};
+
+// The header of a dedicated allocation, which is placed at the start of the
+// allocation. The allocated memory is preceded by a pointer to the header.
+struct dedicated_header {
+  // size is the requested size of the allocation.
+  uint32_t size;
+  // offset is the offset of the allocated memory from this header.
+  uint32_t offset;
+  // prev and next link all the dedicated allocations of the arena.
+  dedicated_header* prev;
+  dedicated_header* next;
+};
+
+// The header of a region of a scratch arena, which is placed at the start of
+// the region. Regions are aligned to their minimum size, so that the header
+// is found from any allocation of the region.
+struct scratch_region {
+  // prev and next link the regions of the list holding the region.
+  scratch_region* prev;
+  scratch_region* next;
+  // size is the size of the region, including this header.
+  uint32_t size;
+  // live is the number of allocations of the region that are not freed.
+  uint32_t live;
+  // escaped is true if the region held live allocations when the scratch
+  // arena was reset or destroyed, and was handed over to the parent arena.
+  bool escaped;
 };
 
+struct thread_cache;
+
 // Arena is a memory allocator that owns each of the allocations made by it.
 // If there are any outstanding allocations when the Arena is destructed then
 // these allocations are automatically freed.
+// Each thread caches unused blocks of up to 2^kMaxBlockSizePower bytes, so
+// that most allocations and frees do not synchronize with other threads.
+//
+// An arena constructed with a parent arena is a scratch arena, for objects
+// that do not outlive a command or a frame. Allocations are bumped out of
+// regions allocated from the parent arena, and are all released at once by
+// reset(). Allocations that are not freed when the scratch arena is reset or
+// destroyed have escaped: their regions are handed over to the parent arena,
+// which keeps them until the escaped allocations are freed, through either
+// arena, and they are reported. Scratch arenas are not synchronized, and must
+// only be used by one thread at a time.
 class Arena {
  public:
   Arena();
+  // Constructs a scratch arena allocating its regions from parent, which must
+  // not be a scratch arena itself, and must outlive the scratch arena and the
+  // allocations that escaped it.
+  explicit Arena(Arena* parent);
   ~Arena();
 
+  // returns true if this is a scratch arena.
+  inline bool is_scratch() const { return parent_ != nullptr; }
+
+  // reset releases all the allocations of this scratch arena at once. The
+  // regions of the allocations that are not freed yet are handed over to the
+  // parent arena, and are kept until the allocations are freed.
+  void reset();
+
+  // returns the number of allocations of this scratch arena that were not
+  // freed when it was reset, since it was constructed.
+  size_t num_escaped_allocations() const { return num_escaped_; }
+
   // allocates a contiguous block of memory of at least the requested size and
   // alignment. This is internally synchronized and may be called from
   // multiple threads at once.
@@ -120,6 +193,8 @@ class Arena {
   void unprotect();
 
  private:
+  friend struct thread_cache;
+
   void lock() const {
     uint32_t l = 0;
     while (!lock_.compare_exchange_weak(l, 1, std::memory_order_acquire)) {
@@ -128,13 +203,62 @@ class Arena {
   }
   void unlock() const { lock_.store(0, std::memory_order_release); }
 
+  // Returns the cache of this arena for the calling thread.
+  thread_cache* cache();
+  // Fills the thread cache with a batch of blocks of the given bucket.
+  void refill(thread_cache* cache, uint32_t bucket);
+  // Returns a batch of blocks to the arena. This does not lock.
+  void return_batch(uint32_t bucket, free_batch* batch);
+  // Allocates a block of the given bucket outside of the thread caches.
+  void* allocate_block(uint32_t bucket);
+  // Carves up to count new blocks of the given bucket out of a chunk.
+  // Must be called with the lock held.
+  uint8_t* carve_blocks(uint32_t bucket, uint32_t* count);
+  void* allocate_dedicated(uint32_t size, uint32_t align);
+  void free_dedicated(dedicated_header* header);
+  // Returns the header of ptr if it is a dedicated allocation, or nullptr if
+  // it is a block.
+  dedicated_header* dedicated_header_of(void* ptr) const;
+
+  // The scratch arena counterparts of allocate, reallocate and free.
+  inline void* scratch_allocate(uint32_t size, uint32_t align);
+  void* scratch_allocate_slow(uint32_t size, uint32_t align);
+  void* scratch_reallocate(void* ptr, uint32_t size, uint32_t align);
+  void scratch_free(void* ptr);
+  // Returns a region of the given size, which is kScratchRegionSize for
+  // the regions that are reused, from the spare regions or the parent.
+  scratch_region* new_region(uint32_t size);
+  // Returns a region that has no live allocation to the spare regions or to
+  // the parent.
+  void release_region(scratch_region* region);
+  // Takes over a region of a scratch arena that holds escaped allocations.
+  void adopt_region(scratch_region* region);
+  // Frees ptr if it is an escaped allocation of an adopted region, releasing
+  // the region with its last allocation. Returns false otherwise.
+  bool free_escaped(void* ptr);
+
+  // id_ identifies this arena in the thread caches. Ids are never reused.
+  const uint64_t id_;
+  // caches_ is the list of the thread caches of this arena. It is guarded by
+  // the global thread cache mutex.
+  thread_cache* caches_;
   // chunks_ contains every chunk that has ever been allocated.
   std::list<chunk_header*> chunks_;
-  // dedicated_allocations_ contains data about every allocation
-  // that was too large for a block.
-  std::unordered_map<uint8_t*, uint32_t> dedicated_allocations_;
+  // dedicated_ is the list of allocations that were too large for a block.
+  dedicated_header* dedicated_;
+  // num_dedicated_ and dedicated_bytes_ are the number and requested size
+  // of the dedicated allocations.
+  size_t num_dedicated_;
+  size_t dedicated_bytes_;
   // blocks_ contains all of the freelists and blocksize specific information.
-  std::array<block_data, kMaxBlockSizePower - kMinBlockSizePower + 1> blocks_;
+  std::array<block_data, kMaxLargeBlockSizePower - kMinBlockSizePower + 1>
+      blocks_;
+  // returned_ holds, for each bucket cached per thread, the batches of
+  // blocks returned by the thread caches. Batches are pushed and taken
+  // without locking.
+  std::array<std::atomic<free_batch*>,
+             kMaxBlockSizePower - kMinBlockSizePower + 1>
+      returned_;
   // lock_ is a simple atomic lock spinlock for locking. We have this lock
   // only for very brief periods of time.
   // We mark this mutable, so we can use lock/unlock in
@@ -146,6 +270,60 @@ class Arena {
   // protected_ is true when the memory in this allocator has been
   // protected.
   bool protected_;
+  // adopted_ is the list of the regions handed over by scratch arenas, which
+  // hold escaped allocations. It is guarded by lock_, and num_adopted_ is its
+  // length, read without locking.
+  scratch_region* adopted_;
+  std::atomic<uint32_t> num_adopted_;
+
+  // parent_ is the arena of the regions of a scratch arena, or nullptr.
+  Arena* const parent_;
+  // region_ is the region allocations are bumped from, and bump_ and
+  // bump_end_ are the next and end addresses of its unused memory.
+  scratch_region* region_;
+  uint8_t* bump_;
+  uint8_t* bump_end_;
+  // last_ is the last allocation bumped from region_, which can be resized
+  // in place.
+  uint8_t* last_;
+  // active_ is the list of the regions allocated from since the last reset,
+  // and spare_ the list of the unused regions kept for reuse.
+  scratch_region* active_;
+  scratch_region* spare_;
+  uint32_t num_spare_;
+  // num_escaped_ is the number of allocations that escaped a reset.
+  size_t num_escaped_;
+};
+
+inline void* Arena::scratch_allocate(uint32_t size, uint32_t align) {
+  // The size of each allocation is stored just before it.
+  uintptr_t p =
+      (reinterpret_cast<uintptr_t>(bump_) + sizeof(uint32_t) + align - 1) &
+      ~static_cast<uintptr_t>(align - 1);
+  if (p + size <= reinterpret_cast<uintptr_t>(bump_end_)) {
+    last_ = reinterpret_cast<uint8_t*>(p);
+    bump_ = last_ + size;
+    reinterpret_cast<uint32_t*>(last_)[-1] = size;
+    region_->live++;
+    return last_;
+  }
+  return scratch_allocate_slow(size, align);
+}
+
+// ScratchScope resets a scratch arena when it goes out of scope, at the end
+// of a command or of a frame.
+class ScratchScope {
+ public:
+  inline explicit ScratchScope(Arena* scratch) : scratch_(scratch) {}
+  inline ~ScratchScope() { scratch_->reset(); }
+
+  inline Arena* arena() const { return scratch_; }
+
+ private:
+  ScratchScope(const ScratchScope&) = delete;
+  ScratchScope& operator=(const ScratchScope&) = delete;
+
+  Arena* scratch_;
 };
 
 template <typename T, typename... ARGS>
@@ -191,6 +369,15 @@ void arena_free(arena* arena, void* ptr);
 void arena_stats(arena* arena, size_t* num_allocations,
                  size_t* num_bytes_allocated);
 
+// scratch_arena_create constructs and returns a new scratch arena, which
+// allocates its memory from parent. See core::Arena. The scratch arena is
+// used and destroyed with the other arena functions.
+arena* scratch_arena_create(arena* parent);
+
+// scratch_arena_reset releases all the allocations of the specified scratch
+// arena, which must have been created with scratch_arena_create.
+void scratch_arena_reset(arena* arena);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Synthetic benchmark of concurrent allocations from a single arena, as made
+// by the app threads during a capture. Each thread keeps a window of live
+// small allocations, freeing the oldest one for each new one. In the cross
+// thread mode, half of the frees are of allocations made by another thread.
+// malloc and free are timed with the same pattern for reference.
+
+#include "core/memory/arena/cc/arena.h"
+
+#include "core/cc/timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kOperations = 2000000;
+const int kWindow = 256;
+
+struct MallocAllocator {
+  void* allocate(uint32_t size, uint32_t) { return malloc(size); }
+  void free(void* p) { ::free(p); }
+};
+
+struct ArenaAllocator {
+  void* allocate(uint32_t size, uint32_t align) {
+    return arena.allocate(size, align);
+  }
+  void free(void* p) { arena.free(p); }
+  core::Arena arena;
+};
+
+// Returns the nanoseconds per allocation and free pair.
+template <typename Allocator>
+double run(int numThreads, bool crossThread) {
+  Allocator allocator;
+  // Each thread hands allocations to the next one through these slots.
+  std::vector<std::atomic<void*>> handoff(numThreads * kWindow);
+  for (auto& slot : handoff) {
+    slot.store(nullptr);
+  }
+  const int operations = kOperations / numThreads;
+
+  uint64_t start = core::GetNanoseconds();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < numThreads; t++) {
+    threads.emplace_back([&, t] {
+      std::mt19937 rng(t);
+      std::vector<void*> window(kWindow, nullptr);
+      std::atomic<void*>* next = &handoff[((t + 1) % numThreads) * kWindow];
+      for (int i = 0; i < operations; i++) {
+        // Sizes of the small objects of the gapil state: mostly tiny, few
+        // up to 4KB.
+        uint32_t size = 16u << (rng() % 9 == 0 ? rng() % 9 : rng() % 3);
+        void* p = allocator.allocate(size, 8);
+        *static_cast<uint8_t*>(p) = 1;
+        void*& slot = window[i % kWindow];
+        if (crossThread && i % 2 == 0) {
+          // Give the allocation to the next thread, and free the one it
+          // gave instead.
+          p = next[i % kWindow].exchange(p);
+        }
+        if (slot != nullptr) {
+          allocator.free(slot);
+        }
+        slot = p;
+      }
+      for (void* p : window) {
+        if (p != nullptr) {
+          allocator.free(p);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (auto& slot : handoff) {
+    if (void* p = slot.load()) {
+      allocator.free(p);
+    }
+  }
+  return double(core::GetNanoseconds() - start) / kOperations;
+}
+
+}  // anonymous namespace
+
+int main() {
+  printf("%8s %12s %12s %12s %12s   (ns per allocation)\n", "threads",
+         "arena", "malloc", "arena xthr", "malloc xthr");
+  int maxThreads = std::max(4u, std::thread::hardware_concurrency());
+  for (int n = 1; n <= maxThreads; n *= 2) {
+    printf("%8d %12.1f %12.1f %12.1f %12.1f\n", n,
+           run<ArenaAllocator>(n, false), run<MallocAllocator>(n, false),
+           run<ArenaAllocator>(n, true), run<MallocAllocator>(n, true));
+  }
+  return 0;
+}
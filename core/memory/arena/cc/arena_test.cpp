@@ -14,9 +14,12 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <memory>
 #include <random>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
@@ -100,6 +103,251 @@ TEST(allocate_memory, random_alloc_free) {
   EXPECT_EQ(0, a.num_bytes_allocated());
 }
 
+TEST(allocate_memory, multithreaded_alloc_free) {
+  Arena a;
+  const int kThreads = 4;
+  const int kAllocations = 10000;
+  std::vector<std::vector<void*>> allocations(kThreads);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&a, &allocations, t] {
+      std::default_random_engine generator(t);
+      std::uniform_int_distribution<int> distribution(1, 40000);
+      for (int i = 0; i < kAllocations; ++i) {
+        void* p = a.allocate(distribution(generator), 16);
+        memset(p, t, 16);
+        allocations[t].push_back(p);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(kThreads * kAllocations, a.num_allocations());
+
+  // Free the blocks from other threads than the ones that allocated them.
+  threads.clear();
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&a, &allocations, t] {
+      for (void* p : allocations[(t + 1) % kThreads]) {
+        EXPECT_EQ((t + 1) % kThreads, *static_cast<uint8_t*>(p));
+        a.free(p);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(0, a.num_allocations());
+  EXPECT_EQ(0, a.num_bytes_allocated());
+
+  // The blocks returned by the exited threads are reused.
+  std::unordered_set<void*> reused;
+  for (int i = 0; i < kAllocations; ++i) {
+    reused.insert(a.allocate(32, 16));
+  }
+  EXPECT_EQ(kAllocations, reused.size());
+  EXPECT_EQ(kAllocations, a.num_allocations());
+}
+
+// More arenas than a thread holds caches for are used in turn, so that their
+// caches are evicted and created again.
+TEST(allocate_memory, many_arenas) {
+  const int kArenas = 20;
+  std::vector<std::unique_ptr<Arena>> arenas;
+  std::vector<std::vector<void*>> allocations(kArenas);
+  for (int i = 0; i < kArenas; ++i) {
+    arenas.emplace_back(new Arena());
+  }
+  for (int round = 0; round < 100; ++round) {
+    for (int i = 0; i < kArenas; ++i) {
+      void* p = arenas[i]->allocate(64, 16);
+      memset(p, i, 64);
+      allocations[i].push_back(p);
+    }
+  }
+  for (int i = 0; i < kArenas; ++i) {
+    EXPECT_EQ(100, arenas[i]->num_allocations());
+    for (void* p : allocations[i]) {
+      EXPECT_EQ(i, *static_cast<uint8_t*>(p));
+      arenas[i]->free(p);
+    }
+    EXPECT_EQ(0, arenas[i]->num_allocations());
+  }
+  // Destroy an arena whose cache is still held by this thread.
+  arenas[kArenas - 1].reset();
+  void* p = arenas[0]->allocate(64, 16);
+  arenas[0]->free(p);
+}
+
+// Dedicated allocations smaller than a chunk are not chunk aligned, and are
+// told apart from the page aligned blocks.
+TEST(allocate_memory, dedicated_allocations) {
+  Arena a;
+  std::vector<void*> allocations;
+  for (uint32_t size : {300 * 1024, 1024 * 1024, 4096, 3 * 1024 * 1024,
+                        512 * 1024, 16384}) {
+    void* p = a.allocate(size, 16);
+    memset(p, 1, size);
+    allocations.push_back(p);
+  }
+  EXPECT_EQ(6, a.num_allocations());
+  allocations[0] = a.reallocate(allocations[0], 600 * 1024, 16);
+  EXPECT_EQ(1, static_cast<uint8_t*>(allocations[0])[300 * 1024 - 1]);
+  allocations[3] = a.reallocate(allocations[3], 1024, 16);
+  EXPECT_EQ(1, static_cast<uint8_t*>(allocations[3])[1023]);
+  EXPECT_EQ(6, a.num_allocations());
+  for (void* p : allocations) {
+    a.free(p);
+  }
+  EXPECT_EQ(0, a.num_allocations());
+  EXPECT_EQ(0, a.num_bytes_allocated());
+}
+
+TEST(scratch_arena, reset) {
+  Arena parent;
+  Arena a(&parent);
+  std::default_random_engine generator;
+  std::uniform_int_distribution<int> distribution(1, 100000);
+  for (int frame = 0; frame < 4; ++frame) {
+    std::vector<uint8_t*> allocations;
+    for (int i = 0; i < 1000; ++i) {
+      uint32_t size = 1 + (distribution(generator) >> (i % 8));
+      auto p = static_cast<uint8_t*>(a.allocate(size, 16));
+      EXPECT_EQ(0, reinterpret_cast<uintptr_t>(p) & 0xF);
+      memset(p, i, size);
+      allocations.push_back(p);
+    }
+    for (int i = 0; i < 1000; ++i) {
+      EXPECT_EQ(static_cast<uint8_t>(i), *allocations[i]);
+    }
+    EXPECT_EQ(1000, a.num_allocations());
+    // Freeing only counts the allocations, the memory is released by reset.
+    std::shuffle(allocations.begin(), allocations.end(), generator);
+    for (auto p : allocations) {
+      a.free(p);
+    }
+    a.reset();
+    EXPECT_EQ(0, a.num_allocations());
+  }
+  // Only the spare regions are left in the parent.
+  EXPECT_EQ(0, a.num_escaped_allocations());
+  EXPECT_GT(parent.num_allocations(), 0);
+  EXPECT_LT(parent.num_allocations(), 20);
+}
+
+TEST(scratch_arena, escaped_allocations) {
+  Arena parent;
+  Arena a(&parent);
+  std::vector<void*> freed;
+  std::vector<uint8_t*> escaped;
+  for (int i = 0; i < 10000; ++i) {
+    auto p = static_cast<uint8_t*>(a.allocate(64, 8));
+    if (i % 1000 == 0) {
+      *p = static_cast<uint8_t>(i / 1000);
+      escaped.push_back(p);
+    } else {
+      freed.push_back(p);
+    }
+  }
+  for (void* p : freed) {
+    a.free(p);
+  }
+  const size_t parent_allocations = parent.num_allocations();
+  {
+    ScratchScope scope(&a);
+    EXPECT_EQ(&a, scope.arena());
+  }
+  // The regions of the escaped allocations are handed over to the parent.
+  EXPECT_EQ(escaped.size(), a.num_escaped_allocations());
+  EXPECT_EQ(0, a.num_allocations());
+  EXPECT_GT(parent.num_allocations(), 0);
+  EXPECT_LE(parent.num_allocations(), parent_allocations);
+
+  // The escaped allocations are not reused by the next command.
+  for (int i = 0; i < 10000; ++i) {
+    void* p = a.allocate(64, 8);
+    memset(p, 0xff, 64);
+    a.free(p);
+  }
+  a.reset();
+  for (size_t i = 0; i < escaped.size(); ++i) {
+    EXPECT_EQ(i, *escaped[i]);
+  }
+  // They are freed through either arena.
+  for (size_t i = 0; i < escaped.size(); ++i) {
+    if (i % 2 == 0) {
+      a.free(escaped[i]);
+    } else {
+      parent.free(escaped[i]);
+    }
+  }
+  EXPECT_EQ(0, a.num_allocations());
+}
+
+TEST(scratch_arena, destroyed_with_escaped_allocations) {
+  Arena parent;
+  void* block = parent.allocate(100, 8);
+  const std::vector<uint32_t> sizes = {64, 1000, 100000};
+  std::vector<uint8_t*> escaped;
+  {
+    Arena a(&parent);
+    for (uint32_t size : sizes) {
+      auto p = static_cast<uint8_t*>(a.allocate(size, 8));
+      memset(p, size & 0xff, size);
+      escaped.push_back(p);
+      a.free(a.allocate(size, 8));
+    }
+  }
+  // The escaped allocations outlive the scratch arena, in the regions handed
+  // over to the parent.
+  EXPECT_EQ(3, parent.num_allocations());
+  for (size_t i = 0; i < sizes.size(); i++) {
+    for (uint32_t j = 0; j < sizes[i]; j++) {
+      ASSERT_EQ(sizes[i] & 0xff, escaped[i][j]);
+    }
+    parent.free(escaped[i]);
+  }
+  EXPECT_EQ(1, parent.num_allocations());
+  parent.free(block);
+  EXPECT_EQ(0, parent.num_allocations());
+}
+
+TEST(scratch_arena, reallocate) {
+  Arena parent;
+  arena* a = scratch_arena_create(reinterpret_cast<arena*>(&parent));
+  std::vector<uint8_t> pattern;
+  for (size_t i = 0; i < 100000; i++) {
+    pattern.push_back(static_cast<uint8_t>(i * 7));
+  }
+  auto other = static_cast<uint8_t*>(arena_alloc(a, 100, 8));
+  memset(other, 1, 100);
+  // Grow in place, and by copy into a new region, and as a large allocation.
+  void* moved = nullptr;
+  auto p = static_cast<uint8_t*>(arena_alloc(a, 10, 8));
+  memcpy(p, &pattern[0], 10);
+  for (uint32_t size : {100, 1000, 10000, 30000, 100000}) {
+    p = static_cast<uint8_t*>(arena_realloc(a, p, size, 8));
+    EXPECT_EQ(0, memcmp(p, &pattern[0], size / 10));
+    memcpy(p, &pattern[0], size);
+    if (size == 1000) {
+      // Moves the allocation out of the last position.
+      moved = arena_alloc(a, 100, 8);
+    }
+  }
+  EXPECT_EQ(0, memcmp(p, &pattern[0], pattern.size()));
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(1, other[i]);
+  }
+  arena_free(a, other);
+  arena_free(a, moved);
+  arena_free(a, p);
+  scratch_arena_reset(a);
+  arena_destroy(a);
+  EXPECT_EQ(0, parent.num_allocations());
+}
+
 using reallocate_memory_tests = ::testing::TestWithParam<uint32_t>;
 
 TEST_P(reallocate_memory_tests, reallocate) {
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Synthetic benchmark of the allocations made while capturing a command. For
+// each command, the message, its arguments, a few slices and strings are
+// allocated, and are freed when the command returns. The allocator time per
+// command is reported for the long-lived arena, and for a scratch arena that
+// is reset after each command. In the escape mode, some of the objects are
+// kept in the state for a hundred commands, and are promoted by the resets.
+
+#include "core/memory/arena/cc/arena.h"
+
+#include "core/cc/timer.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <vector>
+
+namespace {
+
+const int kCommands = 200000;
+const int kStateLifetime = 100;
+
+struct Result {
+  double command;     // ns per command.
+  double allocation;  // ns per allocation.
+  size_t escaped;
+};
+
+// Returns the sizes of the allocations of each command.
+std::vector<std::vector<uint32_t>> commands() {
+  std::mt19937 rng(1234);
+  std::vector<std::vector<uint32_t>> out(1024);
+  for (auto& sizes : out) {
+    sizes.push_back(64);                  // message
+    sizes.push_back(32u << (rng() % 4));  // arguments
+    for (uint32_t i = rng() % 8; i > 0; i--) {
+      sizes.push_back(16u << (rng() % 11));  // slices, up to 16KB
+    }
+    for (uint32_t i = rng() % 3; i > 0; i--) {
+      sizes.push_back(24 + rng() % 64);  // strings
+    }
+  }
+  return out;
+}
+
+Result run(bool scratch, int escapeEvery) {
+  const auto sizes = commands();
+  core::Arena parent;
+  core::Arena scratchArena(&parent);
+  core::Arena* arena = scratch ? &scratchArena : &parent;
+
+  std::vector<void*> live;
+  std::deque<std::pair<int, void*>> state;
+  size_t allocations = 0;
+  int n = 0;
+  uint64_t start = core::GetNanoseconds();
+  for (int c = 0; c < kCommands; c++) {
+    for (uint32_t size : sizes[c % sizes.size()]) {
+      void* p = arena->allocate(size, 8);
+      *static_cast<uint8_t*>(p) = 1;
+      if (escapeEvery > 0 && ++n % escapeEvery == 0) {
+        state.emplace_back(c, p);
+      } else {
+        live.push_back(p);
+      }
+    }
+    allocations += sizes[c % sizes.size()].size();
+    // The command returns.
+    while (!live.empty()) {
+      arena->free(live.back());
+      live.pop_back();
+    }
+    while (!state.empty() && state.front().first + kStateLifetime < c) {
+      arena->free(state.front().second);
+      state.pop_front();
+    }
+    if (scratch) {
+      scratchArena.reset();
+    }
+  }
+  uint64_t elapsed = core::GetNanoseconds() - start;
+  for (auto& s : state) {
+    arena->free(s.second);
+  }
+  return Result{double(elapsed) / kCommands, double(elapsed) / allocations,
+                scratchArena.num_escaped_allocations()};
+}
+
+}  // anonymous namespace
+
+int main() {
+  printf("%-10s %8s %14s %14s %10s\n", "arena", "escape", "ns/command",
+         "ns/allocation", "escaped");
+  for (int escapeEvery : {0, 1000, 100}) {
+    for (bool scratch : {false, true}) {
+      Result r = run(scratch, escapeEvery);
+      printf("%-10s %8s %14.1f %14.1f %10zu\n",
+             scratch ? "scratch" : "long-lived",
+             escapeEvery == 0 ? "none"
+                              : escapeEvery == 100 ? "1/100" : "1/1000",
+             r.command, r.allocation, r.escaped);
+    }
+  }
+  return 0;
+}
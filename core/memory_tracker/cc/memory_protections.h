@@ -27,6 +27,21 @@ enum class PageProtections {
   kReadWrite = 0x1 | 0x2
 };
 
+// TrackingBackend selects how writes to the tracked memory ranges are
+// detected.
+enum class TrackingBackend {
+  // Write-protects the tracked pages and takes a segfault on the first write
+  // to each group of pages. Available on all platforms.
+  kSegfault,
+  // Scans the soft-dirty bits of the tracked pages in /proc/self/pagemap when
+  // the dirty pages are requested. Linux only.
+  kSoftDirty,
+  // Write-protects the tracked pages with userfaultfd, and resolves the write
+  // faults on a dedicated thread instead of in a signal handler. Linux only,
+  // requires anonymous or shared memory mappings.
+  kUserfaultfd,
+};
+
 }  // namespace track_memory
 }  // namespace gapii
 
@@ -38,6 +38,20 @@ MemoryTracker::FirstOverlappedRange(uintptr_t addr, size_t size) {
   return tracking_ranges_.end();
 }
 
+template <>
+bool MemoryTracker::CollectDirtyPages() {
+  bool result = true;
+  for (auto& it : tracking_ranges_) {
+    tracking_range_type* rng = it.second.get();
+    result &= ForEachDirtyPage(
+        rng->aligned_start(), rng->aligned_size(), [rng](uintptr_t page) {
+          rng->SetDirty(page, GetPageSize(),
+                        [](uintptr_t, size_t) -> bool { return true; });
+        });
+  }
+  return result && ClearDirtyPages();
+}
+
 template <>
 bool MemoryTracker::TrackRangeImpl(void* start, size_t size) {
   if (!EnableMemoryTrackerImpl()) {
@@ -50,10 +64,33 @@ bool MemoryTracker::TrackRangeImpl(void* start, size_t size) {
   if (overlap != tracking_ranges_.end()) {
     return false;
   }
+  // Writes made before the range is tracked must not be reported, but
+  // resetting the written state of the pages also affects the ranges that
+  // are already tracked.
+  if (ScansDirtyPages() && !CollectDirtyPages()) {
+    return false;
+  }
   auto new_rng = std::unique_ptr<MemoryTracker::tracking_range_type>(
       new MemoryTracker::tracking_range_type(reinterpret_cast<uintptr_t>(start),
                                              size));
-  bool result = set_protection(
+  // Boundary pages shared with other ranges are already watched.
+  uintptr_t watch_start = new_rng->aligned_start();
+  uintptr_t watch_end = watch_start + new_rng->aligned_size();
+  if (FirstOverlappedRange(watch_start, GetPageSize()) !=
+      tracking_ranges_.end()) {
+    watch_start += GetPageSize();
+  }
+  if (watch_start < watch_end &&
+      FirstOverlappedRange(watch_end - GetPageSize(), GetPageSize()) !=
+          tracking_ranges_.end()) {
+    watch_end -= GetPageSize();
+  }
+  if (watch_start < watch_end &&
+      !WatchPages(reinterpret_cast<void*>(watch_start),
+                  watch_end - watch_start)) {
+    return false;
+  }
+  bool result = ProtectPages(
       reinterpret_cast<void*>(new_rng->aligned_start()),
       new_rng->aligned_size(),
       track_read_ ? PageProtections::kNone : PageProtections::kRead);
@@ -80,20 +117,24 @@ bool MemoryTracker::UntrackRangeImpl(void* start, size_t size) {
   // in other ranges, and their flag should not be reset to ReadWrite if other
   // ranges are tracking them.
   if (first_page < last_page) {
-    result &= set_protection(
-        reinterpret_cast<void*>(first_page + GetPageSize()),
-        aligned_size - 2 * GetPageSize(), PageProtections::kReadWrite);
+    void* p = reinterpret_cast<void*>(first_page + GetPageSize());
+    size_t s = aligned_size - 2 * GetPageSize();
+    result &= UnprotectPages(p, s);
+    result &= UnwatchPages(p, s);
   }
 
   if (FirstOverlappedRange(first_page, GetPageSize()) ==
       tracking_ranges_.end()) {
-    result &= set_protection(reinterpret_cast<void*>(first_page), GetPageSize(),
-                             PageProtections::kReadWrite);
+    void* p = reinterpret_cast<void*>(first_page);
+    result &= UnprotectPages(p, GetPageSize());
+    result &= UnwatchPages(p, GetPageSize());
   }
-  if (FirstOverlappedRange(last_page, GetPageSize()) ==
-      tracking_ranges_.end()) {
-    result &= set_protection(reinterpret_cast<void*>(last_page), GetPageSize(),
-                             PageProtections::kReadWrite);
+  if (last_page != first_page &&
+      FirstOverlappedRange(last_page, GetPageSize()) ==
+          tracking_ranges_.end()) {
+    void* p = reinterpret_cast<void*>(last_page);
+    result &= UnprotectPages(p, GetPageSize());
+    result &= UnwatchPages(p, GetPageSize());
   }
 
   return result;
@@ -109,12 +150,16 @@ bool MemoryTracker::HandleAndClearDirtyIntersectsImpl(
   addr = RoundDownAlignedAddress(addr, GetPageSize());
   size = end - addr;
 
+  if (ScansDirtyPages() && !CollectDirtyPages()) {
+    return false;
+  }
+
   bool set_protection_result = true;
 
   auto clear_dirty_intersects = [&handle_dirty, &set_protection_result, this](
                                     uintptr_t i_addr, size_t i_size) -> bool {
     handle_dirty(reinterpret_cast<void*>(i_addr), i_size);
-    set_protection_result = set_protection(
+    set_protection_result = ProtectPages(
         reinterpret_cast<void*>(i_addr), i_size,
         track_read_ ? PageProtections::kNone : PageProtections::kRead);
     // Return true so that in ForDirtyIntersects, marked dirty pages will
@@ -147,9 +192,9 @@ bool MemoryTracker::HandleSegfaultImpl(void* fault_addr) {
     if (it->second->Overlaps(addr, end)) {
       result &= it->second->SetDirty(
           addr, end - addr,
-          [](uintptr_t dirty_addr, size_t dirty_size) -> bool {
-            return set_protection(reinterpret_cast<void*>(dirty_addr),
-                                  dirty_size, PageProtections::kReadWrite);
+          [this](uintptr_t dirty_addr, size_t dirty_size) -> bool {
+            return UnprotectPages(reinterpret_cast<void*>(dirty_addr),
+                                  dirty_size);
           });
     } else {
       break;
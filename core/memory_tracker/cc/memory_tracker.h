@@ -80,6 +80,12 @@ class SpinLock {
       l = kUnlocked;
     }
   }
+  // TryLock acquires the lock if it is not held. Returns true if the lock is
+  // acquired, otherwise returns false.
+  bool TryLock() {
+    uint32_t l = kUnlocked;
+    return var_.compare_exchange_strong(l, kLocked);
+  }
   // Unlock releases the lock.
   void Unlock() { var_.exchange(kUnlocked); }
 
@@ -236,8 +242,6 @@ struct PageCell {
 template <typename PageCellIndex>
 class TrackingRange {
  public:
-  using OnSetDirty = bool (*)(uintptr_t dirty_addr, size_t dirty_size);
-
   TrackingRange(uintptr_t start, size_t size)
       : start_(start),
         aligned_start_(RoundDownAlignedAddress(start, GetPageSize())),
@@ -289,8 +293,10 @@ class TrackingRange {
   // given memory range specified with |addr| and |size|. The actual 'dirty'
   // range is guaranteed to fully cover the range of |addr| and |size| and is
   // page aligned. The given |on_set| callback will be called with the acutal
-  // 'dirty' range. The |on_set| callback is enforce to be a function pointer
-  // to avoid extra memory allocations (which is not safe in signal handler).
+  // 'dirty' range. The |on_set| callback is taken by value rather than as a
+  // std::function to avoid extra memory allocations (which is not safe in
+  // signal handler).
+  template <typename OnSetDirty>
   bool SetDirty(uintptr_t addr, size_t size, OnSetDirty on_set) {
     PageCellIndex start_id = 0;
     PageCellIndex end_id = 0;
@@ -366,7 +372,9 @@ class TrackingRange {
 };
 
 // MemoryTrackerImpl utilizes Segfault signal on Linux to track accesses to
-// memories.
+// memories. On Linux, the writes can alternatively be detected with the
+// soft-dirty bits of the page table entries, or with userfaultfd
+// write-protection, see SetBackend().
 template <typename SpecificMemoryTracker>
 class MemoryTrackerImpl : public SpecificMemoryTracker {
  public:
@@ -394,6 +402,7 @@ class MemoryTrackerImpl : public SpecificMemoryTracker {
         CONSTRUCT_SIGNAL_SAFE(HandleAndClearDirtyIntersects),
         CONSTRUCT_SIGNAL_SAFE(EnableMemoryTracker),
         CONSTRUCT_SIGNAL_SAFE(DisableMemoryTracker),
+        CONSTRUCT_SIGNAL_SAFE(SetBackend),
 #undef CONSTRUCT_SIGNAL_SAFE
 #define CONSTRUCT_LOCKED(function) \
   function(this, &MemoryTrackerImpl::function##Impl, &l_)
@@ -447,6 +456,28 @@ class MemoryTrackerImpl : public SpecificMemoryTracker {
       void* start, size_t size,
       std::function<void(void* dirty_addr, size_t dirty_size)> handle_dirty);
 
+  // Selects how the writes to the tracked ranges are detected. The backend
+  // can only be changed while no range is tracked and the tracker is not
+  // enabled. Backends other than TrackingBackend::kSegfault cannot track
+  // read operations. Returns true if the backend is selected successfully,
+  // otherwise returns false.
+  bool SetBackendImpl(TrackingBackend backend) {
+    if (!tracking_ranges_.empty()) {
+      return false;
+    }
+    if (track_read_ && backend != TrackingBackend::kSegfault) {
+      return false;
+    }
+    return derived_tracker_type::SetBackendImpl(backend);
+  }
+
+  // For the backends that scan for dirty pages, records the pages written
+  // since the last scan as 'dirty' in all the tracking ranges, then resets
+  // the written state of the pages of the process. As the reset is not
+  // limited to the tracked ranges, all the tracking ranges must be scanned
+  // before each reset.
+  bool CollectDirtyPages();
+
   bool DisableMemoryTrackerImpl() {
     // Loop over tracking_ranges_ but DO NOT use an iterator, as
     // UntrackRangeImpl() itself uses an iterator over tracking_ranges_ to
@@ -472,7 +503,18 @@ class MemoryTrackerImpl : public SpecificMemoryTracker {
   }
 
   // Dummy function that we can pass down to the specific memory tracker.
-  bool DoHandleSegfault(void* v) { return HandleSegfault(v); }
+  // The lock is polled rather than waited on, so that a fault handling thread
+  // can give up when it is being stopped by a thread that holds the lock.
+  bool DoHandleSegfault(void* v) {
+    while (!l_.TryLock()) {
+      if (derived_tracker_type::IsStopping()) {
+        return false;
+      }
+    }
+    bool result = HandleSegfaultImpl(v);
+    l_.Unlock();
+    return result;
+  }
 
   // A helper function that returns the first tracking range that overlaps with
   // the given address specified by starting |addr| and |size|.
@@ -503,6 +545,7 @@ class MemoryTrackerImpl : public SpecificMemoryTracker {
   SIGNAL_SAFE(HandleAndClearDirtyIntersects);
   SIGNAL_SAFE(EnableMemoryTracker);
   SIGNAL_SAFE(DisableMemoryTracker);
+  SIGNAL_SAFE(SetBackend);
 #undef SIGNAL_SAFE
 
 // SpinLockGuarded wrapped methods that access critical region.
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Synthetic benchmark of the coherent memory tracking backends. A large
+// mapped buffer is tracked, and each frame a fraction of its pages is written
+// before the dirty pages of the whole buffer are handled. The time spent in
+// the writes (which includes the fault handling of the fault based backends)
+// and in handling the dirty pages (which includes the scan of the scan based
+// backend) are reported separately.
+
+#include "core/memory_tracker/cc/memory_tracker.h"
+
+#include "core/cc/timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#if COHERENT_TRACKING_ENABLED
+
+namespace {
+
+using gapii::track_memory::GetPageSize;
+using gapii::track_memory::MemoryTracker;
+using gapii::track_memory::TrackingBackend;
+
+const int kFrames = 20;
+
+const char* backendName(TrackingBackend backend) {
+  switch (backend) {
+    case TrackingBackend::kSegfault:
+      return "segfault";
+    case TrackingBackend::kSoftDirty:
+      return "soft-dirty";
+    case TrackingBackend::kUserfaultfd:
+      return "userfaultfd";
+  }
+  return "unknown";
+}
+
+// run tracks a buffer of size bytes and writes one page in every stride pages
+// each frame.
+void run(TrackingBackend backend, size_t size, size_t stride) {
+  if (!MemoryTracker::IsBackendSupported(backend)) {
+    printf("%-12s not supported\n", backendName(backend));
+    return;
+  }
+  const size_t page_size = GetPageSize();
+  void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    printf("mmap failed\n");
+    return;
+  }
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(mem);
+  // Populate the buffer, as mapped device memory would be.
+  for (size_t i = 0; i < size; i += page_size) {
+    bytes[i] = 0;
+  }
+
+  MemoryTracker tracker;
+  tracker.SetBackend(backend);
+  tracker.EnableMemoryTracker();
+  tracker.TrackRange(mem, size);
+
+  uint64_t write_ns = 0;
+  uint64_t handle_ns = 0;
+  size_t dirty_bytes = 0;
+  for (int frame = 0; frame < kFrames; frame++) {
+    uint64_t start = core::GetNanoseconds();
+    for (size_t i = (frame % stride) * page_size; i < size;
+         i += stride * page_size) {
+      bytes[i] = uint8_t(frame);
+    }
+    uint64_t written = core::GetNanoseconds();
+    tracker.HandleAndClearDirtyIntersects(
+        mem, size, [&dirty_bytes](void*, size_t dirty_size) {
+          dirty_bytes += dirty_size;
+        });
+    uint64_t handled = core::GetNanoseconds();
+    write_ns += written - start;
+    handle_ns += handled - written;
+  }
+
+  tracker.UntrackRange(mem, size);
+  tracker.DisableMemoryTracker();
+  munmap(mem, size);
+
+  printf("%-12s %8zu MB %8zu %12.3f %12.3f %12.2f\n", backendName(backend),
+         size >> 20, stride, write_ns / 1e6 / kFrames,
+         handle_ns / 1e6 / kFrames, dirty_bytes / 1048576.0 / kFrames);
+}
+
+}  // anonymous namespace
+
+int main(int argc, char** argv) {
+  size_t size = size_t(argc > 1 ? atoi(argv[1]) : 256) << 20;
+  printf("%-12s %11s %8s %12s %12s %12s\n", "backend", "size", "stride",
+         "write ms", "handle ms", "dirty MB");
+  for (size_t stride : {1, 8, 64, 1024}) {
+    for (auto backend :
+         {TrackingBackend::kSegfault, TrackingBackend::kSoftDirty,
+          TrackingBackend::kUserfaultfd}) {
+      run(backend, size, stride);
+    }
+  }
+  return 0;
+}
+
+#else  // COHERENT_TRACKING_ENABLED
+
+int main() {
+  printf("Coherent memory tracking is not supported on this platform\n");
+  return 0;
+}
+
+#endif  // COHERENT_TRACKING_ENABLED
@@ -591,7 +591,7 @@ class MemoryTrackerForHelperTest : public MemoryTracker {
 };
 }  // namespace
 
-TEST(MemoryTrackerTest, FirstOverlappedRange) {
+TEST(MemoryTrackerHelperTest, FirstOverlappedRange) {
   MemoryTrackerForHelperTest t;
   auto it = t.FirstOverlappedRange(0x0, 0x0);
   EXPECT_EQ(it, t.ranges().end());
@@ -640,10 +640,54 @@ TEST(MemoryTrackerTest, FirstOverlappedRange) {
   EXPECT_EQ(it, t.ranges().find(0x200));
 }
 
+namespace {
+// MemoryTrackerTest runs each test with each of the tracking backends.
+class MemoryTrackerTest : public ::testing::TestWithParam<TrackingBackend> {
+ protected:
+  // Selects the backend of the test for |t|. Returns false if the backend is
+  // not supported on this machine, in which case the test is skipped.
+  bool SelectBackend(MemoryTracker* t) {
+    if (!MemoryTracker::IsBackendSupported(GetParam())) {
+      return false;
+    }
+    EXPECT_TRUE(t->SetBackend(GetParam()));
+    return true;
+  }
+};
+}  // namespace
+
+INSTANTIATE_TEST_CASE_P(Backends, MemoryTrackerTest,
+                        ::testing::Values(TrackingBackend::kSegfault,
+                                          TrackingBackend::kSoftDirty,
+                                          TrackingBackend::kUserfaultfd));
+
+// The backend can only be changed while no range is tracked, and reads can
+// only be tracked with TrackingBackend::kSegfault.
+TEST(MemoryTrackerHelperTest, SetBackend) {
+  const size_t page_size = GetPageSize();
+  AlignedMemory m(page_size, page_size);
+  MemoryTracker t;
+  EXPECT_TRUE(t.SetBackend(TrackingBackend::kSegfault));
+  ASSERT_TRUE(t.EnableMemoryTracker());
+  EXPECT_TRUE(t.TrackRange(m.mem(), page_size));
+  EXPECT_FALSE(t.SetBackend(TrackingBackend::kSoftDirty));
+  EXPECT_FALSE(t.SetBackend(TrackingBackend::kUserfaultfd));
+  EXPECT_EQ(TrackingBackend::kSegfault, t.backend());
+  EXPECT_TRUE(t.UntrackRange(m.mem(), page_size));
+  ASSERT_TRUE(t.DisableMemoryTracker());
+
+  MemoryTracker read_tracker(true);
+  EXPECT_FALSE(read_tracker.SetBackend(TrackingBackend::kSoftDirty));
+  EXPECT_FALSE(read_tracker.SetBackend(TrackingBackend::kUserfaultfd));
+}
+
 // Allocates one page of memory, adds the memory range to the memory tracker,
 // touches the allocated memory, the tracker should record the touched page.
-TEST(MemoryTrackerTest, BasicUse) {
+TEST_P(MemoryTrackerTest, BasicUse) {
   MemoryTracker t;
+  if (!SelectBackend(&t)) {
+    return;
+  }
   const size_t page_size = GetPageSize();
   AlignedMemory m(page_size, page_size);
   ASSERT_TRUE(t.EnableMemoryTracker());
@@ -663,8 +707,11 @@ TEST(MemoryTrackerTest, BasicUse) {
 }
 
 // Test for HandleAndClearDirtyIntersects.
-TEST(MemoryTrackerTest, HandleAndClear) {
+TEST_P(MemoryTrackerTest, HandleAndClear) {
   MemoryTracker t;
+  if (!SelectBackend(&t)) {
+    return;
+  }
   const size_t page_size = GetPageSize();
   AlignedMemory m(page_size, page_size);
   ASSERT_TRUE(t.EnableMemoryTracker());
@@ -729,8 +776,11 @@ TEST(MemoryTrackerTest, HandleAndClear) {
 // Allocates one page of memory, does not add the memory range to the memory
 // tracker, touches the allocated memory, the tracker should not record
 // anything.
-TEST(MemoryTrackerTest, NoTrackingMemory) {
+TEST_P(MemoryTrackerTest, NoTrackingMemory) {
   MemoryTracker t;
+  if (!SelectBackend(&t)) {
+    return;
+  }
   const size_t page_size = GetPageSize();
   AlignedMemory m(page_size, page_size);
   // Still register the segfault handler, even though it should not be
@@ -749,8 +799,11 @@ TEST(MemoryTrackerTest, NoTrackingMemory) {
 // Allocates one page of memory, adds the same memory range to the memory
 // tracker and touches the memory range to the tracker in two threads, the
 // tracker should have just one record of the touched page.
-TEST(MemoryTrackerTest, MultithreadSamePage) {
+TEST_P(MemoryTrackerTest, MultithreadSamePage) {
   MemoryTracker t;
+  if (!SelectBackend(&t)) {
+    return;
+  }
   const size_t page_size = GetPageSize();
   // allocates one pages.
   AlignedMemory m(page_size, page_size);
@@ -784,8 +837,11 @@ TEST(MemoryTrackerTest, MultithreadSamePage) {
 // Allocates two pages of memory, adds the two pages and touches them in two
 // threads respectively. The tracker should have the records of both touched
 // pages.
-TEST(MemoryTrackerTest, MultithreadDifferentPage) {
+TEST_P(MemoryTrackerTest, MultithreadDifferentPage) {
   MemoryTracker t;
+  if (!SelectBackend(&t)) {
+    return;
+  }
   const size_t page_size = GetPageSize();
   // allocates two pages.
   AlignedMemory m(page_size, page_size * 2);
@@ -827,12 +883,15 @@ TEST(MemoryTrackerTest, MultithreadDifferentPage) {
 // Allocates one page of memory, add part of the page as an un-aligned range to
 // the tracker and touches the memory in that range. The tracker should have
 // the record of that page.
-TEST(MemoryTrackerTest, UnalignedRangeTrackingMemory) {
+TEST_P(MemoryTrackerTest, UnalignedRangeTrackingMemory) {
   const size_t start_offset = 128;
   const size_t range_size = 97;
   const size_t page_size = GetPageSize();
 
   MemoryTracker t;
+  if (!SelectBackend(&t)) {
+    return;
+  }
   AlignedMemory m(page_size, page_size);
 
   void* range_start = VoidPointerAdd(m.mem(), start_offset);
@@ -884,7 +943,7 @@ void SilentSignal<SIGSEGV>::IgnoreSignal(int, siginfo_t* info, void*) {
 }
 }  // namespace
 
-TEST(MemoryTrackerTest, RegisterAndUnregister) {
+TEST_P(MemoryTrackerTest, RegisterAndUnregister) {
   SilentSignal<SIGSEGV> ss;
   SilentSignal<SIGTRAP> st;
   ASSERT_TRUE(st.succeeded());
@@ -892,6 +951,9 @@ TEST(MemoryTrackerTest, RegisterAndUnregister) {
   const size_t page_size = GetPageSize();
 
   MemoryTracker t;
+  if (!SelectBackend(&t)) {
+    return;
+  }
   AlignedMemory m(page_size, page_size);
   ASSERT_TRUE(t.EnableMemoryTracker());
   // A second call to register segfault handler should return true.
@@ -917,7 +979,7 @@ TEST(MemoryTrackerTest, RegisterAndUnregister) {
 // Allocates one page of memory, add a memory range to the tracker, add another
 // memory range which has overlapping region with the first one. The second
 // range should not be accepted by the tracker.
-TEST(MemoryTrackerTest, OverlappedTrackingRange) {
+TEST_P(MemoryTrackerTest, OverlappedTrackingRange) {
   SilentSignal<SIGSEGV> ss;
   SilentSignal<SIGTRAP> st;
   ASSERT_TRUE(st.succeeded());
@@ -927,6 +989,9 @@ TEST(MemoryTrackerTest, OverlappedTrackingRange) {
   const size_t second_range_offset = 1024;
   const size_t page_size = GetPageSize();
   MemoryTracker t;
+  if (!SelectBackend(&t)) {
+    return;
+  }
   AlignedMemory m(page_size, page_size);
 
   void* second_range_start = VoidPointerAdd(m.mem(), second_range_offset);
@@ -940,7 +1005,7 @@ TEST(MemoryTrackerTest, OverlappedTrackingRange) {
 // Allocates a page of memory, add a not-aligned range of space to the tracker,
 // touches an address higher than the tracking range, the tracker should record
 // the touched page.
-TEST(MemoryTrackerTest, UnalignedRangeTrackingHigherAddress) {
+TEST_P(MemoryTrackerTest, UnalignedRangeTrackingHigherAddress) {
   SilentSignal<SIGSEGV> ss;
   SilentSignal<SIGTRAP> st;
   ASSERT_TRUE(st.succeeded());
@@ -951,6 +1016,9 @@ TEST(MemoryTrackerTest, UnalignedRangeTrackingHigherAddress) {
   const size_t page_size = GetPageSize();
 
   MemoryTracker t;
+  if (!SelectBackend(&t)) {
+    return;
+  }
   AlignedMemory m(page_size, page_size);
 
   void* range_start = VoidPointerAdd(m.mem(), start_offset);
@@ -977,7 +1045,7 @@ TEST(MemoryTrackerTest, UnalignedRangeTrackingHigherAddress) {
 // Allocates a page of memory, add a not-aligned range of space to the tracker,
 // touches an address lower than the tracking range, the tracker should record
 // the touched page.
-TEST(MemoryTrackerTest, UnalignedRangeNotTrackingLowerAddress) {
+TEST_P(MemoryTrackerTest, UnalignedRangeNotTrackingLowerAddress) {
   SilentSignal<SIGSEGV> ss;
   SilentSignal<SIGTRAP> st;
 
@@ -986,6 +1054,9 @@ TEST(MemoryTrackerTest, UnalignedRangeNotTrackingLowerAddress) {
   const size_t page_size = GetPageSize();
 
   MemoryTracker t;
+  if (!SelectBackend(&t)) {
+    return;
+  }
   AlignedMemory m(page_size, page_size);
 
   void* range_start = VoidPointerAdd(m.mem(), start_offset);
@@ -1011,7 +1082,7 @@ TEST(MemoryTrackerTest, UnalignedRangeNotTrackingLowerAddress) {
 
 // Two not overlapping ranges in the same page. Removing just one of them
 // should not affect tracking of the other one.
-TEST(MemoryTrackerTest, RemoveOneRangeShouldNotAffectOthersInSamePage) {
+TEST_P(MemoryTrackerTest, RemoveOneRangeShouldNotAffectOthersInSamePage) {
   SilentSignal<SIGSEGV> ss;
   SilentSignal<SIGTRAP> st;
 
@@ -1023,6 +1094,9 @@ TEST(MemoryTrackerTest, RemoveOneRangeShouldNotAffectOthersInSamePage) {
   const size_t second_size = 97;
 
   MemoryTracker t;
+  if (!SelectBackend(&t)) {
+    return;
+  }
   AlignedMemory m(page_size, page_size);
 
   void* first_start = VoidPointerAdd(m.mem(), first_offset);
@@ -1048,13 +1122,16 @@ TEST(MemoryTrackerTest, RemoveOneRangeShouldNotAffectOthersInSamePage) {
 }
 
 // Allocates a lot of pages and tracking/touches them in multiple threads.
-TEST(MemoryTrackerTest, ManyPagesMultithread) {
+TEST_P(MemoryTrackerTest, ManyPagesMultithread) {
   const size_t num_threads = 128;
   const size_t num_pages_per_thread = 16;
   const size_t num_pages = num_pages_per_thread * num_threads;
   const size_t page_size = GetPageSize();
 
   MemoryTracker t;
+  if (!SelectBackend(&t)) {
+    return;
+  }
   ASSERT_TRUE(t.EnableMemoryTracker());
   AlignedMemory m(page_size, num_pages * page_size);
   void* mem_start_addr = m.mem();
@@ -18,6 +18,8 @@
 #define GAPII_MEMORY_TRACKER_POSIX_H
 
 #include "core/memory_tracker/cc/memory_protections.h"
+#include "core/memory_tracker/cc/posix/soft_dirty.h"
+#include "core/memory_tracker/cc/posix/userfaultfd.h"
 
 #include <pthread.h>
 #include <signal.h>
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GAPII_MEMORY_TRACKER_POSIX_SOFT_DIRTY_H
+#define GAPII_MEMORY_TRACKER_POSIX_SOFT_DIRTY_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdint>
+
+namespace gapii {
+namespace track_memory {
+
+// SoftDirtyPages reads the soft-dirty bits of the page table entries of this
+// process from /proc/self/pagemap. The kernel sets the soft-dirty bit of a
+// page when the page is written, and clears the bits of all the pages of the
+// process when "4" is written to /proc/self/clear_refs. Pages of VM_PFNMAP
+// mappings (e.g. some device memory mappings) are not tracked by the kernel.
+class SoftDirtyPages {
+ public:
+  SoftDirtyPages() : pagemap_fd_(-1), clear_refs_fd_(-1) {}
+  ~SoftDirtyPages() { Close(); }
+
+  // Not copyable, not movable.
+  SoftDirtyPages(const SoftDirtyPages&) = delete;
+  SoftDirtyPages(SoftDirtyPages&&) = delete;
+  SoftDirtyPages& operator=(const SoftDirtyPages&) = delete;
+  SoftDirtyPages& operator=(SoftDirtyPages&&) = delete;
+
+  // Returns true if the kernel maintains the soft-dirty bits. The first call
+  // clears the soft-dirty bits of the process.
+  static bool IsSupported() {
+    static const bool supported = Probe();
+    return supported;
+  }
+
+  // Opens the pagemap and clear_refs files of this process. Returns true if
+  // the files are opened, or have already been opened.
+  bool Open() {
+    if (IsOpen()) {
+      return true;
+    }
+    pagemap_fd_ = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    clear_refs_fd_ = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (pagemap_fd_ < 0 || clear_refs_fd_ < 0) {
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  void Close() {
+    if (pagemap_fd_ >= 0) {
+      close(pagemap_fd_);
+    }
+    if (clear_refs_fd_ >= 0) {
+      close(clear_refs_fd_);
+    }
+    pagemap_fd_ = -1;
+    clear_refs_fd_ = -1;
+  }
+
+  bool IsOpen() const { return pagemap_fd_ >= 0; }
+
+  // Clears the soft-dirty bits of all the pages of this process.
+  bool Clear() { return write(clear_refs_fd_, "4", 1) == 1; }
+
+  // Calls |on_dirty| with the address of each soft-dirty page in the page
+  // aligned range specified by |start| and |size|. Returns false if the
+  // pagemap cannot be read.
+  template <typename OnDirty>
+  bool ForEachDirty(uintptr_t start, size_t size, OnDirty on_dirty) const {
+    const size_t page_size = getpagesize();
+    uint64_t entries[kBatchSize];
+    size_t num_pages = size / page_size;
+    for (size_t i = 0; i < num_pages;) {
+      size_t count = num_pages - i;
+      if (count > kBatchSize) {
+        count = kBatchSize;
+      }
+      uintptr_t page = start + i * page_size;
+      off_t offset = static_cast<off_t>(page / page_size * sizeof(uint64_t));
+      ssize_t bytes = pread(pagemap_fd_, entries, count * sizeof(uint64_t),
+                            offset);
+      if (bytes <= 0 || bytes % sizeof(uint64_t) != 0) {
+        return false;
+      }
+      count = bytes / sizeof(uint64_t);
+      for (size_t j = 0; j < count; j++) {
+        if (entries[j] & kSoftDirtyBit) {
+          on_dirty(page + j * page_size);
+        }
+      }
+      i += count;
+    }
+    return true;
+  }
+
+ private:
+  // Bit 55 of a pagemap entry is the soft-dirty bit.
+  static const uint64_t kSoftDirtyBit = uint64_t(1) << 55;
+  // The number of pagemap entries read at a time.
+  static const size_t kBatchSize = 512;
+
+  // Writes to a new page after clearing the soft-dirty bits, and checks the
+  // bit is set for that page only after the write.
+  static bool Probe() {
+    SoftDirtyPages pages;
+    if (!pages.Open()) {
+      return false;
+    }
+    const size_t page_size = getpagesize();
+    void* p = mmap(nullptr, page_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+    uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+    volatile uint8_t* b = reinterpret_cast<volatile uint8_t*>(p);
+    bool before = false;
+    bool after = false;
+    b[0] = 1;
+    bool ok = pages.Clear() &&
+              pages.ForEachDirty(addr, page_size,
+                                 [&before](uintptr_t) { before = true; });
+    b[0] = 2;
+    ok = ok && pages.ForEachDirty(addr, page_size,
+                                  [&after](uintptr_t) { after = true; });
+    munmap(p, page_size);
+    return ok && !before && after;
+  }
+
+  int pagemap_fd_;     // The file descriptor of /proc/self/pagemap
+  int clear_refs_fd_;  // The file descriptor of /proc/self/clear_refs
+};
+
+}  // namespace track_memory
+}  // namespace gapii
+
+#endif  // GAPII_MEMORY_TRACKER_POSIX_SOFT_DIRTY_H
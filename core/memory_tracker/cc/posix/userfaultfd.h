@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GAPII_MEMORY_TRACKER_POSIX_USERFAULTFD_H
+#define GAPII_MEMORY_TRACKER_POSIX_USERFAULTFD_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/userfaultfd.h>
+#include <sys/eventfd.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_userfaultfd) && \
+    defined(UFFDIO_WRITEPROTECT)
+#define USERFAULTFD_WP_AVAILABLE 1
+#else
+#define USERFAULTFD_WP_AVAILABLE 0
+#endif
+
+namespace gapii {
+namespace track_memory {
+
+// UserfaultfdWriteProtect write-protects memory pages with the userfaultfd
+// write-protect mode. A write to a protected page blocks the writing thread
+// until the page is unprotected. Instead of raising a signal, the fault is
+// reported to a dedicated thread that calls the |on_write| callback given to
+// Start(). Only anonymous and shared memory mappings can be registered.
+class UserfaultfdWriteProtect {
+ public:
+  UserfaultfdWriteProtect()
+      : fd_(-1), stop_fd_(-1), stopping_(false), populate_(false) {}
+  ~UserfaultfdWriteProtect() { Stop(); }
+
+  // Not copyable, not movable.
+  UserfaultfdWriteProtect(const UserfaultfdWriteProtect&) = delete;
+  UserfaultfdWriteProtect(UserfaultfdWriteProtect&&) = delete;
+  UserfaultfdWriteProtect& operator=(const UserfaultfdWriteProtect&) = delete;
+  UserfaultfdWriteProtect& operator=(UserfaultfdWriteProtect&&) = delete;
+
+  // Returns true if userfaultfd write-protection is available to this
+  // process.
+  static bool IsSupported() {
+    static const bool supported = Probe();
+    return supported;
+  }
+
+  // Creates the userfaultfd and starts the fault handling thread. For each
+  // write to a protected page, |on_write| is called with the fault address on
+  // that thread. |on_write| must unprotect the page and return true; if it
+  // returns false, the page is unprotected so that the writing thread can
+  // continue. Returns true if started, or if already started.
+  bool Start(std::function<bool(void*)> on_write);
+
+  // Stops the fault handling thread and closes the userfaultfd, which
+  // unregisters and unprotects all the pages.
+  bool Stop();
+
+  bool IsStarted() const { return fd_ >= 0; }
+
+  // Returns true while Stop() is waiting for the fault handling thread.
+  bool IsStopping() const { return stopping_.load(); }
+
+  // Registers the page aligned range for write-protection. The range is not
+  // protected until Protect() is called.
+  bool Register(void* p, size_t size);
+
+  // Unregisters the page aligned range.
+  bool Unregister(void* p, size_t size);
+
+  // Write-protects the page aligned range if |protect| is true, otherwise
+  // removes the protection and wakes the threads waiting on the range.
+  bool Protect(void* p, size_t size, bool protect);
+
+ private:
+  // Opens a new userfaultfd.
+  static int Open();
+  // Creates a userfaultfd with write-protection enabled. |populate| is set to
+  // true if the kernel only reports writes to populated pages.
+  static int Create(bool* populate);
+  static bool Probe() {
+    bool populate = false;
+    int fd = Create(&populate);
+    if (fd < 0) {
+      return false;
+    }
+    close(fd);
+    return true;
+  }
+  // The loop of the fault handling thread.
+  void Run();
+
+  int fd_;       // The userfaultfd
+  int stop_fd_;  // An eventfd signaled to stop the fault handling thread
+  std::atomic<bool> stopping_;
+  // True if pages must be populated before they can be protected.
+  bool populate_;
+  std::function<bool(void*)> on_write_;
+  std::thread thread_;
+};
+
+#if USERFAULTFD_WP_AVAILABLE
+
+inline int UserfaultfdWriteProtect::Open() {
+  // Kernel mode faults can only be handled by privileged processes, unless
+  // vm.unprivileged_userfaultfd is set.
+  int fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+#ifdef UFFD_USER_MODE_ONLY
+  if (fd < 0 && errno == EPERM) {
+    fd = syscall(__NR_userfaultfd,
+                 O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+  }
+#endif
+  return fd;
+}
+
+inline int UserfaultfdWriteProtect::Create(bool* populate) {
+  int fd = Open();
+  if (fd < 0) {
+    return -1;
+  }
+  // The API handshake can only be done once per userfaultfd, and fails if a
+  // requested feature is not supported. Query the features first.
+  struct uffdio_api api = {};
+  api.api = UFFD_API;
+  if (ioctl(fd, UFFDIO_API, &api) != 0 ||
+      !(api.features & UFFD_FEATURE_PAGEFAULT_FLAG_WP)) {
+    close(fd);
+    return -1;
+  }
+  uint64_t features = UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+  *populate = true;
+#ifdef UFFD_FEATURE_WP_UNPOPULATED
+  if (api.features & UFFD_FEATURE_WP_UNPOPULATED) {
+    features |= UFFD_FEATURE_WP_UNPOPULATED;
+    *populate = false;
+  }
+#endif
+#ifndef MADV_POPULATE_WRITE
+  if (*populate) {
+    close(fd);
+    return -1;
+  }
+#endif
+  close(fd);
+  fd = Open();
+  if (fd < 0) {
+    return -1;
+  }
+  api = {};
+  api.api = UFFD_API;
+  api.features = features;
+  if (ioctl(fd, UFFDIO_API, &api) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+inline bool UserfaultfdWriteProtect::Start(
+    std::function<bool(void*)> on_write) {
+  if (IsStarted()) {
+    return true;
+  }
+  fd_ = Create(&populate_);
+  if (fd_ < 0) {
+    return false;
+  }
+  stop_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (stop_fd_ < 0) {
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  on_write_ = on_write;
+  thread_ = std::thread([this]() { Run(); });
+  return true;
+}
+
+inline bool UserfaultfdWriteProtect::Stop() {
+  if (!IsStarted()) {
+    return true;
+  }
+  stopping_.store(true);
+  uint64_t one = 1;
+  bool result = write(stop_fd_, &one, sizeof(one)) == sizeof(one);
+  thread_.join();
+  close(stop_fd_);
+  close(fd_);
+  stop_fd_ = -1;
+  fd_ = -1;
+  stopping_.store(false);
+  return result;
+}
+
+inline bool UserfaultfdWriteProtect::Register(void* p, size_t size) {
+#ifdef MADV_POPULATE_WRITE
+  // Writes to pages that are not populated are not reported as write-protect
+  // faults by older kernels. Populating the pages does not change their
+  // content.
+  if (populate_ && madvise(p, size, MADV_POPULATE_WRITE) != 0) {
+    return false;
+  }
+#endif
+  struct uffdio_register reg = {};
+  reg.range.start = reinterpret_cast<uintptr_t>(p);
+  reg.range.len = size;
+  reg.mode = UFFDIO_REGISTER_MODE_WP;
+  if (ioctl(fd_, UFFDIO_REGISTER, &reg) != 0) {
+    return false;
+  }
+  if (!(reg.ioctls & (uint64_t(1) << _UFFDIO_WRITEPROTECT))) {
+    Unregister(p, size);
+    return false;
+  }
+  return true;
+}
+
+inline bool UserfaultfdWriteProtect::Unregister(void* p, size_t size) {
+  struct uffdio_range range = {};
+  range.start = reinterpret_cast<uintptr_t>(p);
+  range.len = size;
+  return ioctl(fd_, UFFDIO_UNREGISTER, &range) == 0;
+}
+
+inline bool UserfaultfdWriteProtect::Protect(void* p, size_t size,
+                                             bool protect) {
+  struct uffdio_writeprotect wp = {};
+  wp.range.start = reinterpret_cast<uintptr_t>(p);
+  wp.range.len = size;
+  wp.mode = protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+  // EAGAIN is returned while the memory map of the process is changing.
+  int ret;
+  do {
+    ret = ioctl(fd_, UFFDIO_WRITEPROTECT, &wp);
+  } while (ret != 0 && errno == EAGAIN);
+  return ret == 0;
+}
+
+inline void UserfaultfdWriteProtect::Run() {
+  struct pollfd fds[2] = {{fd_, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+  const uintptr_t page_size = getpagesize();
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    if (fds[1].revents != 0) {
+      return;
+    }
+    struct uffd_msg msg;
+    if (read(fd_, &msg, sizeof(msg)) != sizeof(msg)) {
+      continue;
+    }
+    if (msg.event != UFFD_EVENT_PAGEFAULT) {
+      continue;
+    }
+    void* addr = reinterpret_cast<void*>(msg.arg.pagefault.address);
+    if (!(msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP) ||
+        !on_write_(addr)) {
+      uintptr_t page = msg.arg.pagefault.address & ~(page_size - 1u);
+      Protect(reinterpret_cast<void*>(page), page_size, false);
+    }
+  }
+}
+
+#else  // USERFAULTFD_WP_AVAILABLE
+
+inline int UserfaultfdWriteProtect::Open() { return -1; }
+inline int UserfaultfdWriteProtect::Create(bool*) { return -1; }
+inline bool UserfaultfdWriteProtect::Start(std::function<bool(void*)>) {
+  return false;
+}
+inline bool UserfaultfdWriteProtect::Stop() { return true; }
+inline bool UserfaultfdWriteProtect::Register(void*, size_t) { return false; }
+inline bool UserfaultfdWriteProtect::Unregister(void*, size_t) {
+  return false;
+}
+inline bool UserfaultfdWriteProtect::Protect(void*, size_t, bool) {
+  return false;
+}
+inline void UserfaultfdWriteProtect::Run() {}
+
+#endif  // USERFAULTFD_WP_AVAILABLE
+
+}  // namespace track_memory
+}  // namespace gapii
+
+#endif  // GAPII_MEMORY_TRACKER_POSIX_USERFAULTFD_H
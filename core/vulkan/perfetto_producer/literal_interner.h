@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __LITERAL_INTERNER_H__
+#define __LITERAL_INTERNER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+
+namespace core {
+
+// LiteralCache is a direct mapped cache of values of type V, keyed by the
+// address of string literals. A lookup is a couple of loads, without hashing
+// or comparing the strings, which is only correct for strings that do not
+// change while they are cached, as string literals. N must be a power of two.
+template <typename V, size_t N>
+class LiteralCache {
+ public:
+  LiteralCache() { Clear(); }
+
+  // Copies the cached value of str to value, and returns true if there is
+  // one.
+  bool Find(const char* str, V* value) const {
+    const Entry& entry = entries_[Index(str)];
+    if (entry.str != str) {
+      return false;
+    }
+    *value = entry.value;
+    return true;
+  }
+
+  // Caches the value of str, evicting the value of the string cached in the
+  // same entry, if any.
+  void Set(const char* str, const V& value) {
+    Entry& entry = entries_[Index(str)];
+    entry.str = str;
+    entry.value = value;
+  }
+
+  void Clear() {
+    for (auto& entry : entries_) {
+      entry = Entry{nullptr, V()};
+    }
+  }
+
+ private:
+  struct Entry {
+    const char* str;
+    V value;
+  };
+
+  static size_t Index(const char* str) {
+    // String literals are packed together, with little alignment.
+    uintptr_t p = reinterpret_cast<uintptr_t>(str);
+    return (p ^ (p >> 10)) & (N - 1);
+  }
+
+  Entry entries_[N];
+};
+
+// LiteralInterner assigns ids, starting at 1, to the strings interned in a
+// trace sequence. The strings are looked up by address first, and are only
+// compared, and copied, the first time an address is interned, or when it
+// was evicted from the cache. The interned strings must not change while
+// they are interned, as string literals.
+class LiteralInterner {
+ public:
+  // Returns the id of str, and sets added to whether str was interned by
+  // this call.
+  uint64_t Intern(const char* str, bool* added) {
+    uint64_t id = 0;
+    *added = false;
+    if (cache_.Find(str, &id)) {
+      return id;
+    }
+    auto it = ids_.find(str);
+    if (it != ids_.end()) {
+      id = it->second;
+    } else {
+      id = ids_.size() + 1;
+      ids_.emplace(str, id);
+      *added = true;
+    }
+    cache_.Set(str, id);
+    return id;
+  }
+
+  void Clear() {
+    cache_.Clear();
+    ids_.clear();
+  }
+
+ private:
+  static const size_t kCacheSize = 512;
+
+  LiteralCache<uint64_t, kCacheSize> cache_;
+  std::unordered_map<std::string, uint64_t> ids_;
+};
+
+}  // namespace core
+
+#endif  // __LITERAL_INTERNER_H__
@@ -61,12 +61,17 @@ class PerfettoProducerData {
   void OnStart(const typename perfetto::DataSourceBase::StartArgs&);
   void OnStop(const typename perfetto::DataSourceBase::StopArgs&);
   void OnSetup(const typename perfetto::DataSourceBase::SetupArgs&);
+  // Sets a function that is called when tracing stops, before the emitters
+  // are stopped, so that the data held back by the threads can still be
+  // emitted.
+  void SetStopHandler(void (*handler)());
 
  private:
   core::Arena arena_;
   core::RecursiveSpinLock emitter_lock_;
   gapil::Map<ThreadlocalEmitterBase*, bool, false> emitters_;
   bool started_ = false;
+  void (*stop_handler_)() = nullptr;
 };
 }  // namespace core
 
@@ -19,6 +19,7 @@
 #define __PERFETTO_THREADLOCAL_EMITTER_H__
 #include <atomic>
 #include "core/memory/arena/cc/arena.h"
+#include "core/vulkan/perfetto_producer/literal_interner.h"
 #include "core/vulkan/perfetto_producer/perfetto_proto_structs.h"
 #include "core/vulkan/perfetto_producer/threadlocal_emitter_base.h"
 #include "gapil/runtime/cc/map.h"
@@ -52,15 +53,39 @@ class ThreadlocalEmitter : ThreadlocalEmitterBase {
       const typename perfetto::DataSourceBase::SetupArgs&) override;
   void StopTracing() override { enabled_ = false; }
   bool Enabled() { return enabled_; }
+  // Returns whether the category is enabled by the trace config, or true if
+  // tracing was never set up.
   bool CategoryEnabled(const char* category) {
-    return enabled_categories_.empty() ||
-           enabled_categories_.contains(category);
+    return config_generation_ == 0 || IsCategoryEnabled(category);
   }
+  // Returns whether category is one of the enabled categories. The result is
+  // cached by the address of category, until the trace config changes.
+  bool IsCategoryEnabled(const char* category);
+  // Returns the number of times tracing was set up, so that the users of
+  // Option can tell when the trace config changed.
+  uint32_t ConfigGeneration() { return config_generation_; }
+  // Returns the value of the option key, given as "key=value" in the trace
+  // config, or default_value if the option is not given.
+  uint64_t Option(const char* key, uint64_t default_value);
+  // The category and name of the events are interned by address, so they
+  // must be string literals.
   void StartEvent(const char* catagory, const char* name);
   void EndEvent(const char* category);
+  // Starts and ends events at the given boot time timestamps, for callers
+  // which time their events themselves.
+  void StartEvent(const char* category, const char* name, uint64_t timestamp);
+  void EndEvent(const char* category, uint64_t timestamp);
+  // Emits an instant event with count unsigned annotations, named by the
+  // string literals of keys.
+  void EmitSummaryEvent(const char* category, const char* name,
+                        uint64_t timestamp, const char* const* keys,
+                        const uint64_t* values, size_t count);
   void EmitVulkanMemoryUsageEvent(const VulkanMemoryEvent* vulkan_memory_event);
 
  private:
+  void EmitStartEvent(const char* category, const char* name,
+                      uint64_t timestamp);
+  void EmitEndEvent(const char* category, uint64_t timestamp);
   void ResetIfNecessary();
   void EmitThreadData();
   void EmitProcessData();
@@ -92,12 +117,17 @@ class ThreadlocalEmitter : ThreadlocalEmitterBase {
   uint64_t process_id_;
 
   core::Arena arena_;
-  gapil::Map<std::string, uint64_t, false> interned_names_;
-  gapil::Map<std::string, uint64_t, false> interned_annotation_names_;
-  gapil::Map<std::string, uint64_t, false> interned_categories_;
+  LiteralInterner interned_names_;
+  LiteralInterner interned_annotation_names_;
+  LiteralInterner interned_categories_;
   gapil::Map<std::string, uint64_t, false> interned_function_names_;
   gapil::Map<std::string, uint64_t, false> interned_vulkan_annotation_keys_;
   gapil::Map<std::string, uint64_t, false> enabled_categories_;
+  gapil::Map<std::string, uint64_t, false> options_;
+  // Incremented each time the enabled categories and options are set up.
+  std::atomic<uint32_t> config_generation_;
+  LiteralCache<bool, 64> enabled_category_cache_;
+  uint32_t enabled_category_cache_generation_ = 0;
   bool emitted_thread_data_ = false;
   bool emitted_process_data_ = false;
   uint64_t last_reset_timestamp_;
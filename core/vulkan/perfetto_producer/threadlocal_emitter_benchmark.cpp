@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Synthetic benchmark of the events of the ThreadlocalEmitter. Threads start
+// and end an event the way the CPU timing layer does around each Vulkan call,
+// with tracing enabled. The producer is a stub, which encodes the packets in
+// a heap buffer instead of sending them to the tracing service, so that the
+// cost of the emitter is measured. The events per second of each thread are
+// reported for events of an enabled and of a disabled category.
+
+#include <stdio.h>
+
+#include <thread>
+#include <vector>
+
+#include "core/cc/timer.h"
+#include "core/vulkan/perfetto_producer/perfetto_data_source.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+#include "protozero/scattered_heap_buffer.h"
+
+namespace {
+
+struct BenchmarkTypeTraits {
+  static constexpr const char* producer_name = "EmitterBenchmark";
+};
+
+}  // anonymous namespace
+
+namespace core {
+
+// The stub producer of the benchmark.
+template <>
+class PerfettoProducer<BenchmarkTypeTraits> {
+ public:
+  class TraceContext {
+   public:
+    class TracePacketHandle {
+     public:
+      explicit TracePacketHandle(perfetto::protos::pbzero::TracePacket* packet)
+          : packet_(packet) {}
+      perfetto::protos::pbzero::TracePacket* operator->() { return packet_; }
+
+     private:
+      perfetto::protos::pbzero::TracePacket* packet_;
+    };
+
+    TracePacketHandle NewTracePacket() {
+      using Packet = perfetto::protos::pbzero::TracePacket;
+      thread_local protozero::HeapBuffered<Packet> packet;
+      packet.Reset();
+      return TracePacketHandle(packet.get());
+    }
+  };
+
+  class Data {
+   public:
+    void RegisterEmitter(ThreadlocalEmitterBase*) {}
+    void UnregisterEmitter(ThreadlocalEmitterBase*) {}
+  };
+
+  static Data& Get() {
+    static Data data;
+    return data;
+  }
+
+  template <typename F>
+  static void Trace(F f) {
+    f(TraceContext());
+  }
+};
+
+}  // namespace core
+
+#include "core/vulkan/perfetto_producer/perfetto_threadlocal_emitter.h"
+
+namespace {
+
+auto const Emit = &core::tracing::Emit<BenchmarkTypeTraits>;
+
+const int kEvents = 1000000;
+
+const char* const kNames[] = {
+    "vkCmdBindPipeline", "vkCmdBindDescriptorSets", "vkCmdBindVertexBuffers",
+    "vkCmdBindIndexBuffer", "vkCmdPushConstants", "vkCmdDrawIndexed",
+    "vkCmdDraw", "vkCmdSetViewport", "vkCmdSetScissor", "vkCmdPipelineBarrier",
+    "vkCmdBeginRenderPass", "vkCmdEndRenderPass", "vkBeginCommandBuffer",
+    "vkEndCommandBuffer", "vkQueueSubmit", "vkAcquireNextImageKHR",
+    "vkQueuePresentKHR", "vkWaitForFences", "vkResetFences",
+    "vkUpdateDescriptorSets",
+};
+const size_t kNumNames = sizeof(kNames) / sizeof(kNames[0]);
+
+// Returns the events per second of a thread starting and ending events of
+// the given category.
+double run(const char* category, const perfetto::DataSourceConfig* config) {
+  perfetto::DataSourceBase::SetupArgs args;
+  args.config = config;
+  Emit().SetupTracing(args);
+  Emit().StartTracing();
+
+  uint64_t start = core::GetNanoseconds();
+  for (int i = 0; i < kEvents; i++) {
+    Emit().StartEvent(category, kNames[i % kNumNames]);
+    Emit().EndEvent(category);
+  }
+  uint64_t end = core::GetNanoseconds();
+  Emit().StopTracing();
+  return kEvents * 1e9 / (end - start);
+}
+
+// Returns the average events per second of threads threads.
+double measure(const char* category, int threads) {
+  perfetto::DataSourceConfig config;
+  config.set_legacy_config("CommandBuffer:Queue:Device");
+  std::vector<std::thread> workers;
+  std::vector<double> rates(threads);
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back(
+        [=, &config, &rates] { rates[i] = run(category, &config); });
+  }
+  double total = 0;
+  for (int i = 0; i < threads; i++) {
+    workers[i].join();
+    total += rates[i];
+  }
+  return total / threads;
+}
+
+}  // anonymous namespace
+
+int main() {
+  printf("%8s %16s %16s   (events per second per thread)\n", "threads",
+         "enabled", "disabled");
+  for (int threads : {1, 2, 4, 8}) {
+    double enabled = measure("CommandBuffer", threads);
+    double disabled = measure("Instance", threads);
+    printf("%8d %16.0f %16.0f\n", threads, enabled, disabled);
+  }
+  return 0;
+}
@@ -16,6 +16,9 @@
 
 #include "image.h"
 
+#include <cstring>
+#include <vector>
+
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
@@ -28,6 +31,107 @@ void WriteDataToStream(void* context, void* data, int size) {
   stream->write(static_cast<char*>(data), size);
 }
 
+// The opcodes of QOI images.
+const uint8_t kQoiOpIndex = 0x00;
+const uint8_t kQoiOpDiff = 0x40;
+const uint8_t kQoiOpLuma = 0x80;
+const uint8_t kQoiOpRun = 0xc0;
+const uint8_t kQoiOpRgb = 0xfe;
+const uint8_t kQoiOpRgba = 0xff;
+const uint32_t kQoiMaxRun = 62;
+
+struct QoiPixel {
+  uint8_t r, g, b, a;
+
+  bool operator==(const QoiPixel& other) const {
+    return r == other.r && g == other.g && b == other.b && a == other.a;
+  }
+  uint32_t Hash() const { return (r * 3 + g * 5 + b * 7 + a * 11) % 64; }
+};
+
+uint8_t* PutBigEndian32(uint8_t* out, uint32_t value) {
+  out[0] = uint8_t(value >> 24);
+  out[1] = uint8_t(value >> 16);
+  out[2] = uint8_t(value >> 8);
+  out[3] = uint8_t(value);
+  return out + 4;
+}
+
+// Encodes the RGBA or, if |bgra|, BGRA pixels of |image_data| as a QOI image
+// into |out|.
+void EncodeQoi(const uint8_t* image_data, uint32_t width, uint32_t height,
+               bool bgra, std::vector<uint8_t>* out) {
+  const size_t pixels = size_t(width) * height;
+  // The worst case is an RGBA op per pixel.
+  out->resize(14 + pixels * 5 + 8);
+  uint8_t* o = out->data();
+  memcpy(o, "qoif", 4);
+  o = PutBigEndian32(o + 4, width);
+  o = PutBigEndian32(o, height);
+  *o++ = 4;  // channels
+  *o++ = 0;  // sRGB with linear alpha
+
+  const int red = bgra ? 2 : 0;
+  const int blue = bgra ? 0 : 2;
+  QoiPixel index[64] = {};
+  QoiPixel prev = {0, 0, 0, 255};
+  uint32_t run = 0;
+  for (size_t i = 0; i < pixels; i++) {
+    const uint8_t* p = image_data + i * 4;
+    QoiPixel px = {p[red], p[1], p[blue], p[3]};
+    if (px == prev) {
+      run++;
+      if (run == kQoiMaxRun || i == pixels - 1) {
+        *o++ = uint8_t(kQoiOpRun | (run - 1));
+        run = 0;
+      }
+      continue;
+    }
+    if (run > 0) {
+      *o++ = uint8_t(kQoiOpRun | (run - 1));
+      run = 0;
+    }
+    uint32_t hash = px.Hash();
+    if (index[hash] == px) {
+      *o++ = uint8_t(kQoiOpIndex | hash);
+    } else {
+      index[hash] = px;
+      if (px.a == prev.a) {
+        int8_t dr = int8_t(px.r - prev.r);
+        int8_t dg = int8_t(px.g - prev.g);
+        int8_t db = int8_t(px.b - prev.b);
+        int8_t dr_dg = int8_t(dr - dg);
+        int8_t db_dg = int8_t(db - dg);
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 &&
+            db <= 1) {
+          *o++ = uint8_t(kQoiOpDiff | (dr + 2) << 4 | (dg + 2) << 2 |
+                         (db + 2));
+        } else if (dr_dg >= -8 && dr_dg <= 7 && dg >= -32 && dg <= 31 &&
+                   db_dg >= -8 && db_dg <= 7) {
+          *o++ = uint8_t(kQoiOpLuma | (dg + 32));
+          *o++ = uint8_t((dr_dg + 8) << 4 | (db_dg + 8));
+        } else {
+          *o++ = kQoiOpRgb;
+          *o++ = px.r;
+          *o++ = px.g;
+          *o++ = px.b;
+        }
+      } else {
+        *o++ = kQoiOpRgba;
+        *o++ = px.r;
+        *o++ = px.g;
+        *o++ = px.b;
+        *o++ = px.a;
+      }
+    }
+    prev = px;
+  }
+  static const uint8_t kEnd[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+  memcpy(o, kEnd, sizeof(kEnd));
+  o += sizeof(kEnd);
+  out->resize(o - out->data());
+}
+
 }  // namespace
 
 namespace vk_tools {
@@ -71,4 +175,43 @@ bool WritePng(std::ostream* stream, uint8_t* image_data, size_t size,
   return false;
 }
 
+bool WriteQoi(std::ostream* stream, const uint8_t* image_data, size_t size,
+              uint32_t width, uint32_t height, VkFormat image_format) {
+  bool bgra = false;
+  switch (image_format) {
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_UINT:
+      bgra = true;
+      break;
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_UINT:
+      break;
+    default:
+      return false;
+  }
+  if (width * height * 4u != size) {
+    return false;
+  }
+  std::vector<uint8_t> encoded;
+  EncodeQoi(image_data, width, height, bgra, &encoded);
+  stream->write(reinterpret_cast<const char*>(encoded.data()),
+                encoded.size());
+  return true;
+}
+
+bool WriteRaw(std::ostream* stream, const uint8_t* image_data, size_t size,
+              uint32_t width, uint32_t height, VkFormat image_format) {
+  RawImageHeader header;
+  memcpy(header.magic, "VKRI", sizeof(header.magic));
+  header.version = kRawImageVersion;
+  header.width = width;
+  header.height = height;
+  header.format = static_cast<uint32_t>(image_format);
+  header.reserved = 0;
+  header.size = size;
+  stream->write(reinterpret_cast<const char*>(&header), sizeof(header));
+  stream->write(reinterpret_cast<const char*>(image_data), size);
+  return true;
+}
+
 }  // namespace vk_tools
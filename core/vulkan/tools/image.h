@@ -33,6 +33,35 @@ namespace vk_tools {
 bool WritePng(std::ostream* stream, uint8_t* image_data, size_t size,
               uint32_t width, uint32_t height, VkFormat image_format);
 
+// If |image_format| is a suitable format, the image in |image_data| is
+// encoded as a QOI image, a lossless format which is much faster to encode
+// than PNG, with the data being sent to |stream|. The format is described at
+// https://qoiformat.org. The image data is not modified.
+// Returns true if the data has been sent to the stream.
+// Returns false otherwise, and also if |size| does not match the expected
+// size from |width|, |height| and |image_format|.
+bool WriteQoi(std::ostream* stream, const uint8_t* image_data, size_t size,
+              uint32_t width, uint32_t height, VkFormat image_format);
+
+// The header of the images written by WriteRaw, in little endian.
+struct RawImageHeader {
+  char magic[4];      // "VKRI"
+  uint32_t version;   // kRawImageVersion
+  uint32_t width;     // The width of the image, in pixels.
+  uint32_t height;    // The height of the image, in pixels.
+  uint32_t format;    // The VkFormat of the image.
+  uint32_t reserved;  // Zero.
+  uint64_t size;      // The number of bytes of image data following.
+};
+
+const uint32_t kRawImageVersion = 1;
+
+// Sends a RawImageHeader followed by the |size| bytes of |image_data|, as is,
+// to |stream|. This is the fastest way to dump an image, in any format.
+// Returns true if the data has been sent to the stream.
+bool WriteRaw(std::ostream* stream, const uint8_t* image_data, size_t size,
+              uint32_t width, uint32_t height, VkFormat image_format);
+
 }  // namespace vk_tools
 
 #endif  //  VULKAN_TOOLS_IMAGE_H_
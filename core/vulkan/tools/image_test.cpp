@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "image.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace vk_tools {
+namespace test {
+
+uint32_t GetBigEndian32(const uint8_t* p) {
+  return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 |
+         p[3];
+}
+
+// Decodes the QOI image in data to RGBA pixels, following the reference
+// decoder of the format.
+bool DecodeQoi(const std::string& data, uint32_t* width, uint32_t* height,
+               std::vector<uint8_t>* rgba) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data.data());
+  const uint8_t* end = p + data.size();
+  if (data.size() < 22 || memcmp(p, "qoif", 4) != 0) {
+    return false;
+  }
+  *width = GetBigEndian32(p + 4);
+  *height = GetBigEndian32(p + 8);
+  p += 14;
+  end -= 8;
+
+  uint8_t index[64][4] = {};
+  uint8_t px[4] = {0, 0, 0, 255};
+  size_t pixels = size_t(*width) * *height;
+  rgba->clear();
+  uint32_t run = 0;
+  for (size_t i = 0; i < pixels; i++) {
+    if (run > 0) {
+      run--;
+    } else {
+      if (p >= end) {
+        return false;
+      }
+      uint8_t op = *p++;
+      if (op == 0xfe) {
+        px[0] = p[0];
+        px[1] = p[1];
+        px[2] = p[2];
+        p += 3;
+      } else if (op == 0xff) {
+        memcpy(px, p, 4);
+        p += 4;
+      } else if ((op & 0xc0) == 0x00) {
+        memcpy(px, index[op], 4);
+      } else if ((op & 0xc0) == 0x40) {
+        px[0] += ((op >> 4) & 3) - 2;
+        px[1] += ((op >> 2) & 3) - 2;
+        px[2] += (op & 3) - 2;
+      } else if ((op & 0xc0) == 0x80) {
+        int dg = (op & 0x3f) - 32;
+        uint8_t b = *p++;
+        px[0] += dg - 8 + ((b >> 4) & 0x0f);
+        px[1] += dg;
+        px[2] += dg - 8 + (b & 0x0f);
+      } else {
+        run = op & 0x3f;
+      }
+      memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64], px,
+             4);
+    }
+    rgba->insert(rgba->end(), px, px + 4);
+  }
+  return p == end;
+}
+
+// Returns an image with runs, repeated colors, small and large differences.
+std::vector<uint8_t> TestImage(uint32_t width, uint32_t height) {
+  std::mt19937 rng(1);
+  std::vector<uint8_t> image(width * height * 4);
+  for (size_t i = 0; i < image.size(); i += 4) {
+    size_t x = (i / 4) % width;
+    switch ((i / 4 / 37) % 4) {
+      case 0:  // A gradient.
+        image[i] = uint8_t(x);
+        image[i + 1] = uint8_t(x * 2);
+        image[i + 2] = uint8_t(x * 3);
+        image[i + 3] = 255;
+        break;
+      case 1:  // A run.
+        image[i] = 10;
+        image[i + 1] = 20;
+        image[i + 2] = 30;
+        image[i + 3] = 255;
+        break;
+      default:  // Noise, with varying alpha.
+        for (int c = 0; c < 4; c++) {
+          image[i + c] = uint8_t(rng() % (c == 3 ? 2 : 256) + (c == 3) * 254);
+        }
+        break;
+    }
+  }
+  return image;
+}
+
+TEST(ImageTest, QoiRoundTrip) {
+  const uint32_t kWidth = 67;
+  const uint32_t kHeight = 31;
+  std::vector<uint8_t> image = TestImage(kWidth, kHeight);
+  std::ostringstream stream;
+  ASSERT_TRUE(WriteQoi(&stream, image.data(), image.size(), kWidth, kHeight,
+                       VK_FORMAT_R8G8B8A8_UNORM));
+
+  uint32_t width = 0, height = 0;
+  std::vector<uint8_t> decoded;
+  ASSERT_TRUE(DecodeQoi(stream.str(), &width, &height, &decoded));
+  EXPECT_EQ(kWidth, width);
+  EXPECT_EQ(kHeight, height);
+  EXPECT_EQ(image, decoded);
+  EXPECT_LT(stream.str().size(), image.size());
+}
+
+TEST(ImageTest, QoiSwizzlesBgra) {
+  const uint32_t kWidth = 16;
+  const uint32_t kHeight = 16;
+  std::vector<uint8_t> image = TestImage(kWidth, kHeight);
+  std::vector<uint8_t> bgra = image;
+  for (size_t i = 0; i < bgra.size(); i += 4) {
+    std::swap(bgra[i], bgra[i + 2]);
+  }
+  std::ostringstream stream;
+  ASSERT_TRUE(WriteQoi(&stream, bgra.data(), bgra.size(), kWidth, kHeight,
+                       VK_FORMAT_B8G8R8A8_UNORM));
+
+  uint32_t width = 0, height = 0;
+  std::vector<uint8_t> decoded;
+  ASSERT_TRUE(DecodeQoi(stream.str(), &width, &height, &decoded));
+  EXPECT_EQ(image, decoded);
+}
+
+TEST(ImageTest, QoiRejectsBadSize) {
+  std::vector<uint8_t> image(16 * 4);
+  std::ostringstream stream;
+  EXPECT_FALSE(WriteQoi(&stream, image.data(), image.size(), 4, 5,
+                        VK_FORMAT_R8G8B8A8_UNORM));
+  EXPECT_TRUE(stream.str().empty());
+}
+
+TEST(ImageTest, Raw) {
+  std::vector<uint8_t> image = TestImage(8, 4);
+  std::ostringstream stream;
+  ASSERT_TRUE(WriteRaw(&stream, image.data(), image.size(), 8, 4,
+                       VK_FORMAT_B8G8R8A8_UNORM));
+  std::string data = stream.str();
+  ASSERT_EQ(sizeof(RawImageHeader) + image.size(), data.size());
+
+  RawImageHeader header;
+  memcpy(&header, data.data(), sizeof(header));
+  EXPECT_EQ(0, memcmp(header.magic, "VKRI", 4));
+  EXPECT_EQ(kRawImageVersion, header.version);
+  EXPECT_EQ(8u, header.width);
+  EXPECT_EQ(4u, header.height);
+  EXPECT_EQ(uint32_t(VK_FORMAT_B8G8R8A8_UNORM), header.format);
+  EXPECT_EQ(image.size(), header.size);
+  EXPECT_EQ(0, memcmp(image.data(), data.data() + sizeof(header),
+                      image.size()));
+}
+
+}  // namespace test
+}  // namespace vk_tools
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "core/vulkan/vk_api_timing_layer/cc/call_latencies.h"
+
+#include "core/vulkan/vk_api_timing_layer/cc/tracing_helpers.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace api_timing {
+
+namespace {
+
+const uint64_t kDefaultPeriodMs = 1000;
+const uint64_t kNoThreshold = ~uint64_t(0);
+// kStopTimeoutMs is how long tracing waits for the threads to emit their
+// latencies when it stops.
+const uint64_t kStopTimeoutMs = 100;
+
+const char* const kSummaryKeys[] = {
+    "count", "sum_ns", "p50_ns", "p90_ns", "p99_ns", "max_ns",
+};
+const size_t kNumSummaryKeys = sizeof(kSummaryKeys) / sizeof(kSummaryKeys[0]);
+
+// gMutex guards gPending, the number of threads holding latencies that are
+// not emitted yet. gStopping is set while tracing stops, for these threads to
+// emit them on their next call.
+std::mutex gMutex;
+std::condition_variable gFlushed;
+uint32_t gPending = 0;
+std::atomic<bool> gStopping(false);
+
+// Waits for the threads to emit their latencies before tracing stops.
+void OnStop() {
+  std::unique_lock<std::mutex> lock(gMutex);
+  gStopping.store(true, std::memory_order_relaxed);
+  gFlushed.wait_for(lock, std::chrono::milliseconds(kStopTimeoutMs),
+                    [] { return gPending == 0; });
+  gStopping.store(false, std::memory_order_relaxed);
+}
+
+}  // anonymous namespace
+
+CallLatencies::CallLatencies() {
+  // The emitter of the thread is constructed first so that it is destructed
+  // last, and the latencies can still be emitted on exit.
+  Emit();
+  Producer::Get().SetStopHandler(&OnStop);
+}
+
+CallLatencies::~CallLatencies() {
+  if (pending_) {
+    Flush(Now());
+  }
+}
+
+bool CallLatencies::Aggregated(const char* category) {
+  if (!Emit().Enabled()) {
+    return false;
+  }
+  UpdateOptions();
+  return enabled_ && (!category || Emit().IsCategoryEnabled(category));
+}
+
+void CallLatencies::UpdateOptions() {
+  uint32_t generation = Emit().ConfigGeneration();
+  if (generation == config_generation_) {
+    return;
+  }
+  config_generation_ = generation;
+  enabled_ = Emit().Option("latency_histograms", 0) != 0;
+  uint64_t threshold_us = Emit().Option("slow_call_threshold_us", kNoThreshold);
+  slow_call_threshold_ns_ =
+      threshold_us < kNoThreshold / 1000 ? threshold_us * 1000 : kNoThreshold;
+  period_ns_ = Emit().Option("histogram_period_ms", kDefaultPeriodMs) * 1000000;
+  // The latencies of a previous trace that were not emitted when it stopped
+  // are dropped.
+  for (auto& it : entry_points_) {
+    it.second->histogram.Clear();
+  }
+  last_flush_ = 0;
+  if (pending_) {
+    SetPending(false);
+  }
+}
+
+CallLatencies::EntryPoint* CallLatencies::Find(const char* category,
+                                               const char* name) {
+  EntryPoint* entry_point = nullptr;
+  if (cache_.Find(name, &entry_point)) {
+    return entry_point;
+  }
+  auto& slot = entry_points_[name];
+  if (!slot) {
+    slot.reset(new EntryPoint{category, name, LatencyHistogram()});
+  }
+  cache_.Set(name, slot.get());
+  return slot.get();
+}
+
+void CallLatencies::Record(const char* category, const char* name,
+                           uint64_t start, uint64_t end) {
+  uint64_t latency = end - start;
+  Find(category, name)->histogram.Record(latency);
+  if (latency >= slow_call_threshold_ns_) {
+    Emit().StartEvent(category, name, start);
+    Emit().EndEvent(category, end);
+  }
+  if (last_flush_ == 0) {
+    last_flush_ = start;
+  }
+  if (!pending_) {
+    SetPending(true);
+  }
+  if (end - last_flush_ >= period_ns_ ||
+      gStopping.load(std::memory_order_relaxed)) {
+    Flush(end);
+  }
+}
+
+void CallLatencies::Flush(uint64_t timestamp) {
+  for (auto& it : entry_points_) {
+    LatencyHistogram& histogram = it.second->histogram;
+    if (histogram.Count() == 0) {
+      continue;
+    }
+    const uint64_t values[kNumSummaryKeys] = {
+        histogram.Count(),          histogram.Sum(),
+        histogram.Percentile(0.5),  histogram.Percentile(0.9),
+        histogram.Percentile(0.99), histogram.Max(),
+    };
+    Emit().EmitSummaryEvent(it.second->category, it.second->name, timestamp,
+                            kSummaryKeys, values, kNumSummaryKeys);
+    histogram.Clear();
+  }
+  last_flush_ = timestamp;
+  if (pending_) {
+    SetPending(false);
+  }
+}
+
+void CallLatencies::SetPending(bool pending) {
+  std::lock_guard<std::mutex> lock(gMutex);
+  pending_ = pending;
+  if (pending) {
+    gPending++;
+  } else if (--gPending == 0) {
+    gFlushed.notify_all();
+  }
+}
+
+}  // namespace api_timing
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CORE_VULKAN_VK_API_TIMING_LAYER_CC_CALL_LATENCIES_H__
+#define __CORE_VULKAN_VK_API_TIMING_LAYER_CC_CALL_LATENCIES_H__
+
+#include <stdint.h>
+
+#include <memory>
+#include <unordered_map>
+
+#include "core/vulkan/perfetto_producer/literal_interner.h"
+#include "core/vulkan/vk_api_timing_layer/cc/latency_histogram.h"
+#include "perfetto/base/time.h"
+
+namespace api_timing {
+
+// CallLatencies aggregates the latencies of the Vulkan calls of a thread in a
+// histogram per entry point, when the trace config has the option
+// "latency_histograms=1". Instead of an event per call, the thread emits a
+// summary event per entry point every "histogram_period_ms" (1000 by
+// default), with the count, the sum and percentiles of the latencies of the
+// period. As the histograms belong to their thread, the summaries are emitted
+// by the first call of the thread after the period. The calls slower than
+// "slow_call_threshold_us", if given, are also emitted as events.
+//
+// When tracing stops, the threads holding latencies of a partial period
+// emit them on their next call, which tracing waits for up to 100 ms, and on
+// exit. The partial period of a thread that makes no call in that time is
+// lost.
+class CallLatencies {
+ public:
+  CallLatencies();
+  ~CallLatencies();
+
+  // Returns the latencies of the calling thread.
+  static CallLatencies& Get() {
+    thread_local CallLatencies latencies;
+    return latencies;
+  }
+
+  // Returns the boot time in nanoseconds, the clock of the trace events.
+  static uint64_t Now() { return perfetto::base::GetBootTimeNs().count(); }
+
+  // Returns whether the calls of category are aggregated, rather than traced
+  // as events.
+  bool Aggregated(const char* category);
+
+  // Records the call to the entry point name of category, from start to end.
+  // The name must be a string literal.
+  void Record(const char* category, const char* name, uint64_t start,
+              uint64_t end);
+
+ private:
+  struct EntryPoint {
+    const char* category;
+    const char* name;
+    LatencyHistogram histogram;
+  };
+
+  // Reads the options of the trace config, if it changed.
+  void UpdateOptions();
+  EntryPoint* Find(const char* category, const char* name);
+  void Flush(uint64_t timestamp);
+  // Counts whether this thread holds latencies that are not emitted yet.
+  void SetPending(bool pending);
+
+  uint32_t config_generation_ = 0;
+  bool enabled_ = false;
+  uint64_t slow_call_threshold_ns_ = 0;
+  uint64_t period_ns_ = 0;
+  uint64_t last_flush_ = 0;
+  bool pending_ = false;
+  core::LiteralCache<EntryPoint*, 512> cache_;
+  // Keyed by the address of the name of the entry point.
+  std::unordered_map<const char*, std::unique_ptr<EntryPoint>> entry_points_;
+};
+
+}  // namespace api_timing
+
+#endif  // __CORE_VULKAN_VK_API_TIMING_LAYER_CC_CALL_LATENCIES_H__
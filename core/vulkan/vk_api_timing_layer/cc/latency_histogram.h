@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CORE_VULKAN_VK_API_TIMING_LAYER_CC_LATENCY_HISTOGRAM_H__
+#define __CORE_VULKAN_VK_API_TIMING_LAYER_CC_LATENCY_HISTOGRAM_H__
+
+#include <stdint.h>
+#include <string.h>
+
+namespace api_timing {
+
+// LatencyHistogram counts latencies in nanoseconds in buckets of log-linear
+// widths, as HDR histograms do: the latencies below kSubBuckets have a bucket
+// each, and each power of two above is split in kSubBuckets buckets. The
+// percentiles are the upper bounds of their buckets, so they are within
+// 1/kSubBuckets of the recorded latencies. Recording a latency is a few
+// instructions, without allocating.
+class LatencyHistogram {
+ public:
+  static const uint32_t kSubBucketBits = 3;
+  static const uint32_t kSubBuckets = 1 << kSubBucketBits;
+  // Enough buckets for any 64 bit latency.
+  static const uint32_t kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  LatencyHistogram() { Clear(); }
+
+  void Record(uint64_t ns) {
+    buckets_[Bucket(ns)]++;
+    count_++;
+    sum_ += ns;
+    if (ns > max_) {
+      max_ = ns;
+    }
+  }
+
+  // Returns the latency which fraction of the recorded latencies are not
+  // above, or 0 if no latency is recorded.
+  uint64_t Percentile(double fraction) const {
+    if (count_ == 0) {
+      return 0;
+    }
+    uint64_t rank = uint64_t(fraction * count_ + 0.5);
+    if (rank < 1) {
+      rank = 1;
+    }
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < kNumBuckets; i++) {
+      seen += buckets_[i];
+      if (seen >= rank) {
+        uint64_t bound = BucketMax(i);
+        return bound < max_ ? bound : max_;
+      }
+    }
+    return max_;
+  }
+
+  uint64_t Count() const { return count_; }
+  uint64_t Sum() const { return sum_; }
+  uint64_t Max() const { return max_; }
+
+  void Clear() {
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+    memset(buckets_, 0, sizeof(buckets_));
+  }
+
+ private:
+  static uint32_t Bucket(uint64_t ns) {
+    if (ns < kSubBuckets) {
+      return uint32_t(ns);
+    }
+    uint32_t shift = 63 - __builtin_clzll(ns) - kSubBucketBits;
+    return (shift + 1) * kSubBuckets +
+           uint32_t((ns >> shift) & (kSubBuckets - 1));
+  }
+
+  // Returns the largest latency counted in bucket.
+  static uint64_t BucketMax(uint32_t bucket) {
+    if (bucket < kSubBuckets) {
+      return bucket;
+    }
+    uint32_t shift = bucket / kSubBuckets - 1;
+    uint64_t mantissa = kSubBuckets + bucket % kSubBuckets;
+    return ((mantissa + 1) << shift) - 1;
+  }
+
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+  // The counts are reset when the histogram is flushed, which is long before
+  // they can overflow.
+  uint32_t buckets_[kNumBuckets];
+};
+
+}  // namespace api_timing
+
+#endif  // __CORE_VULKAN_VK_API_TIMING_LAYER_CC_LATENCY_HISTOGRAM_H__
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "core/vulkan/vk_api_timing_layer/cc/latency_histogram.h"
+
+#include <gtest/gtest.h>
+
+namespace api_timing {
+namespace test {
+
+TEST(LatencyHistogramTest, Empty) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(0u, histogram.Count());
+  EXPECT_EQ(0u, histogram.Percentile(0.5));
+}
+
+TEST(LatencyHistogramTest, SmallLatenciesAreExact) {
+  LatencyHistogram histogram;
+  for (uint64_t ns = 0; ns < 8; ns++) {
+    histogram.Record(ns);
+  }
+  EXPECT_EQ(8u, histogram.Count());
+  EXPECT_EQ(3u, histogram.Percentile(0.5));
+  EXPECT_EQ(7u, histogram.Percentile(1));
+  EXPECT_EQ(7u, histogram.Max());
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+  LatencyHistogram histogram;
+  for (uint64_t us = 1; us <= 1000; us++) {
+    histogram.Record(us * 1000);
+  }
+  EXPECT_EQ(1000u, histogram.Count());
+  EXPECT_EQ(500500000u, histogram.Sum());
+  EXPECT_EQ(1000000u, histogram.Max());
+
+  // The percentiles are not below the exact ones, and within a sub-bucket.
+  const uint64_t sub_buckets = LatencyHistogram::kSubBuckets;
+  const double fractions[] = {0.01, 0.5, 0.9, 0.99};
+  for (double fraction : fractions) {
+    uint64_t exact = uint64_t(fraction * 1000 + 0.5) * 1000;
+    uint64_t percentile = histogram.Percentile(fraction);
+    EXPECT_GE(percentile, exact) << fraction;
+    EXPECT_LE(percentile, exact + exact / sub_buckets) << fraction;
+  }
+  EXPECT_EQ(histogram.Max(), histogram.Percentile(1));
+}
+
+TEST(LatencyHistogramTest, LargestLatency) {
+  LatencyHistogram histogram;
+  histogram.Record(~uint64_t(0));
+  EXPECT_EQ(~uint64_t(0), histogram.Percentile(0.5));
+}
+
+TEST(LatencyHistogramTest, Clear) {
+  LatencyHistogram histogram;
+  histogram.Record(12345);
+  histogram.Clear();
+  EXPECT_EQ(0u, histogram.Count());
+  EXPECT_EQ(0u, histogram.Sum());
+  EXPECT_EQ(0u, histogram.Max());
+  histogram.Record(10);
+  EXPECT_EQ(10u, histogram.Percentile(0.99));
+}
+
+}  // namespace test
+}  // namespace api_timing
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CORE_VULKAN_VK_MEMORY_TRACKER_LAYER_CC_EVENT_LOG_H__
+#define __CORE_VULKAN_VK_MEMORY_TRACKER_LAYER_CC_EVENT_LOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "core/vulkan/layer_helpers/threading.h"
+
+namespace memory_tracker {
+
+// EventLog is a bounded log of fixed size records of type T, held in a ring
+// buffer. Any number of threads can append records at the same time without
+// taking a lock, and records are consumed in the order they were appended.
+// Only one thread at a time may consume records.
+//
+// Each slot of the ring has a sequence number, which tells whether the slot
+// is free for the append of a given position, or holds the record of that
+// position. Appending a record claims a position with a compare-and-swap of
+// the tail position, writes the record, then publishes the slot by updating
+// its sequence number.
+template <typename T>
+class EventLog {
+ public:
+  // Constructs a log holding up to capacity records, which must be a power
+  // of two.
+  explicit EventLog(size_t capacity);
+  EventLog(const EventLog&) = delete;
+  EventLog& operator=(const EventLog&) = delete;
+
+  // Appends record to the log, and returns true, or returns false if the log
+  // is full.
+  bool TryAppend(const T& record);
+
+  // Removes up to max records from the log, in the order they were appended,
+  // and calls f(record) for each of them. Stops at the first record that is
+  // still being appended. Returns the number of records removed.
+  template <typename F>
+  size_t Consume(size_t max, F&& f);
+
+  // Returns whether the next record to consume has been appended.
+  bool HasRecord() const;
+
+  // Returns the maximum number of records of the log.
+  size_t Capacity() const { return mask_ + 1; }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T record;
+  };
+
+  // The head and the tail are on their own cache lines, so that appends do
+  // not invalidate the head read by the consumer, and conversely.
+  alignas(64) std::atomic<size_t> tail_;  // position of the next append.
+  alignas(64) std::atomic<size_t> head_;  // position of the next consume.
+  alignas(64) const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+};
+
+template <typename T>
+EventLog<T>::EventLog(size_t capacity)
+    : tail_(0), head_(0), mask_(capacity - 1), slots_(new Slot[capacity]) {
+  for (size_t i = 0; i < capacity; i++) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+template <typename T>
+bool EventLog<T>::TryAppend(const T& record) {
+  size_t pos = tail_.load(std::memory_order_relaxed);
+  for (;;) {
+    Slot& slot = slots_[pos & mask_];
+    size_t seq = slot.sequence.load(std::memory_order_acquire);
+    intptr_t diff = intptr_t(seq) - intptr_t(pos);
+    if (diff == 0) {
+      // The slot is free: claim the position.
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        slot.record = record;
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      // The slot still holds the record appended a lap before.
+      return false;
+    } else {
+      // Another thread claimed the position.
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template <typename T>
+template <typename F>
+size_t EventLog<T>::Consume(size_t max, F&& f) {
+  size_t pos = head_.load(std::memory_order_relaxed);
+  size_t count = 0;
+  for (; count < max; count++, pos++) {
+    Slot& slot = slots_[pos & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+      break;
+    }
+    f(static_cast<const T&>(slot.record));
+    // Free the slot for the append of the position a lap later.
+    slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+  }
+  head_.store(pos, std::memory_order_relaxed);
+  return count;
+}
+
+template <typename T>
+bool EventLog<T>::HasRecord() const {
+  size_t pos = head_.load(std::memory_order_relaxed);
+  return slots_[pos & mask_].sequence.load(std::memory_order_acquire) ==
+         pos + 1;
+}
+
+// EventLogger holds the records logged by the hooks in an EventLog, until
+// they are either applied to the stored state, while the trace is not
+// enabled, or emitted once the stored state has been sent. Applying and
+// emitting the records consume the log under a mutex, so that the stored
+// state is always sent before the records logged after it.
+//
+// When the trace is stopped, the records are applied to the stored state
+// again, so that a full log never waits for an emitter that does not emit.
+//
+// The emitter sleeps in Wait until records are logged while the trace is
+// enabled. Log only takes the lock of the condition to wake it when it is
+// waiting, so that the hooks do not signal it while it is emitting.
+template <typename T>
+class EventLogger {
+ public:
+  explicit EventLogger(size_t capacity)
+      : log_(capacity),
+        state_sent_(false),
+        waiting_(false),
+        interrupted_(false) {}
+  EventLogger(const EventLogger&) = delete;
+  EventLogger& operator=(const EventLogger&) = delete;
+
+  // Appends record to the log. While the log is full, applies the logged
+  // records with store if Collapse can, or waits for Emit otherwise.
+  // enabled() returns whether the trace is enabled, and is called again each
+  // time the log is found full. Wakes the thread in Wait if the trace is
+  // enabled.
+  template <typename E, typename S>
+  void Log(const T& record, E&& enabled, S&& store);
+
+  // Applies the logged records with store(record), and returns true, unless
+  // the trace is enabled and the stored state was sent, in which case the
+  // records are left for Emit and it returns false. enabled() is called
+  // under the lock that SendStateOnce takes, so that no record is applied
+  // after the state was sent because the trace looked stopped.
+  template <typename E, typename S>
+  bool Collapse(E&& enabled, S&& store);
+
+  // Sends the stored state with send() if it was not sent yet.
+  template <typename F>
+  void SendStateOnce(F&& send);
+
+  // Emits the logged records with emit(record), in batches of batch_size
+  // records, once the stored state was sent. Returns the number of records
+  // emitted.
+  template <typename E>
+  size_t Emit(size_t batch_size, E&& emit);
+
+  // Waits until there are logged records and enabled() returns true, or
+  // until Interrupt is called. Returns false if it was interrupted, in which
+  // case the interruption is cleared.
+  template <typename E>
+  bool Wait(E&& enabled);
+
+  // Makes the current or next call to Wait return false.
+  void Interrupt();
+
+ private:
+  using mutex = layer_helpers::threading::mutex;
+  using condition_variable = layer_helpers::threading::condition_variable;
+
+  // Wakes the thread in Wait, if any.
+  void Wake();
+
+  EventLog<T> log_;
+  mutex mutex_;  // held while consuming the log or sending the state.
+  std::atomic<bool> state_sent_;
+
+  // Leave the mutex above its associated condition_variable.
+  mutex wait_mutex_;  // held while checking or changing the wait state.
+  condition_variable logged_;  // Signaled by Wake and Interrupt.
+  std::atomic<bool> waiting_;  // whether a thread is in Wait.
+  bool interrupted_;
+};
+
+template <typename T>
+template <typename E, typename S>
+void EventLogger<T>::Log(const T& record, E&& enabled, S&& store) {
+  while (!log_.TryAppend(record)) {
+    if (!Collapse(enabled, store)) {
+      std::this_thread::yield();
+    }
+  }
+  // Orders the append before the load of waiting_, as Wait orders the store
+  // of waiting_ before it checks the log, so that either Wait sees the
+  // record, or this sees that it has to wake Wait.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting_.load(std::memory_order_relaxed) && enabled()) {
+    Wake();
+  }
+}
+
+template <typename T>
+template <typename E, typename S>
+bool EventLogger<T>::Collapse(E&& enabled, S&& store) {
+  std::lock_guard<mutex> lock(mutex_);
+  if (state_sent_ && enabled()) {
+    return false;
+  }
+  log_.Consume(log_.Capacity(), store);
+  return true;
+}
+
+template <typename T>
+template <typename F>
+void EventLogger<T>::SendStateOnce(F&& send) {
+  if (state_sent_) {
+    return;
+  }
+  std::lock_guard<mutex> lock(mutex_);
+  if (state_sent_) {
+    return;
+  }
+  state_sent_ = true;
+  send();
+}
+
+template <typename T>
+template <typename E>
+size_t EventLogger<T>::Emit(size_t batch_size, E&& emit) {
+  if (!state_sent_) {
+    return 0;
+  }
+  size_t emitted = 0;
+  size_t count = 0;
+  do {
+    std::lock_guard<mutex> lock(mutex_);
+    count = log_.Consume(batch_size, emit);
+    emitted += count;
+  } while (count == batch_size);
+  return emitted;
+}
+
+template <typename T>
+template <typename E>
+bool EventLogger<T>::Wait(E&& enabled) {
+  std::unique_lock<mutex> lock(wait_mutex_);
+  waiting_.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  while (!interrupted_ && !(log_.HasRecord() && enabled())) {
+    logged_.wait(lock);
+  }
+  waiting_.store(false, std::memory_order_relaxed);
+  if (interrupted_) {
+    interrupted_ = false;
+    return false;
+  }
+  return true;
+}
+
+template <typename T>
+void EventLogger<T>::Interrupt() {
+  std::lock_guard<mutex> lock(wait_mutex_);
+  interrupted_ = true;
+  logged_.notify_all();
+}
+
+template <typename T>
+void EventLogger<T>::Wake() {
+  std::lock_guard<mutex> lock(wait_mutex_);
+  logged_.notify_all();
+}
+
+}  // namespace memory_tracker
+
+#endif  // __CORE_VULKAN_VK_MEMORY_TRACKER_LAYER_CC_EVENT_LOG_H__
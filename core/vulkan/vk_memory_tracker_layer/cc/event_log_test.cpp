@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "core/vulkan/vk_memory_tracker_layer/cc/event_log.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace memory_tracker {
+namespace test {
+
+// A synthetic event: thread allocates or frees the object id.
+struct Event {
+  uint32_t thread;
+  uint32_t seq;  // per thread.
+  uint64_t id;
+  bool free;
+};
+
+using State = std::map<uint64_t, uint32_t>;  // live id -> thread.
+
+void Apply(State* state, const Event& e) {
+  if (e.free) {
+    state->erase(e.id);
+  } else {
+    (*state)[e.id] = e.thread;
+  }
+}
+
+// Returns the events of thread: allocations of ids, every other one freed.
+std::vector<Event> Events(uint32_t thread, uint32_t count) {
+  std::vector<Event> events;
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t id = (uint64_t(thread) << 32) | (i / 2);
+    events.push_back(Event{thread, i, id, i % 4 == 3});
+  }
+  return events;
+}
+
+TEST(EventLogTest, ConsumeInOrder) {
+  EventLog<Event> log(8);
+  EXPECT_EQ(8u, log.Capacity());
+  auto events = Events(0, 6);
+  for (const auto& e : events) {
+    EXPECT_TRUE(log.TryAppend(e));
+  }
+
+  std::vector<uint32_t> got;
+  auto f = [&](const Event& e) { got.push_back(e.seq); };
+  EXPECT_EQ(4u, log.Consume(4, f));
+  EXPECT_EQ(2u, log.Consume(8, f));
+  EXPECT_EQ(0u, log.Consume(8, f));
+  EXPECT_EQ((std::vector<uint32_t>{0, 1, 2, 3, 4, 5}), got);
+}
+
+TEST(EventLogTest, Full) {
+  EventLog<Event> log(4);
+  auto events = Events(0, 12);
+  for (size_t i = 0; i < 4; i++) {
+    EXPECT_TRUE(log.TryAppend(events[i]));
+  }
+  EXPECT_FALSE(log.TryAppend(events[4]));
+
+  // Consuming frees the slots for the appends of the next lap.
+  std::vector<uint32_t> got;
+  auto f = [&](const Event& e) { got.push_back(e.seq); };
+  EXPECT_EQ(1u, log.Consume(1, f));
+  EXPECT_TRUE(log.TryAppend(events[4]));
+  EXPECT_FALSE(log.TryAppend(events[5]));
+  for (size_t i = 5; i < 12; i++) {
+    log.Consume(1, f);
+    EXPECT_TRUE(log.TryAppend(events[i]));
+  }
+  log.Consume(4, f);
+  ASSERT_EQ(12u, got.size());
+  for (uint32_t i = 0; i < 12; i++) {
+    EXPECT_EQ(i, got[i]);
+  }
+}
+
+// Logs the events of the threads through the logger, applying them to stored
+// while the log is full and the trace is not enabled, as the tracker does.
+// Emits the logged events on another thread while the trace is enabled,
+// after sending a snapshot of the stored state. Thread 0 starts the trace
+// at start_at, stops it at stop_at and restarts it at restart_at of its
+// events.
+struct LoggerRun {
+  State stored;
+  State snapshot;
+  size_t collapsed = 0;
+  std::vector<Event> emitted;
+
+  void Run(uint32_t threads, uint32_t events_per_thread, size_t capacity,
+           uint32_t start_at, uint32_t stop_at, uint32_t restart_at) {
+    EventLogger<Event> logger(capacity);
+    std::atomic<bool> enabled(false);
+    std::atomic<uint32_t> finished(0);
+    auto store = [this](const Event& e) {
+      Apply(&stored, e);
+      collapsed++;
+    };
+
+    std::vector<std::thread> producers;
+    for (uint32_t t = 0; t < threads; t++) {
+      producers.emplace_back([&, t] {
+        for (const auto& e : Events(t, events_per_thread)) {
+          logger.Log(e, [&] { return enabled.load(); }, store);
+          if (t == 0 && (e.seq == start_at || e.seq == restart_at)) {
+            enabled = true;
+          } else if (t == 0 && e.seq == stop_at) {
+            enabled = false;
+          }
+        }
+        finished++;
+      });
+    }
+
+    for (;;) {
+      bool done = finished == threads;
+      if (enabled) {
+        logger.SendStateOnce([this] { snapshot = stored; });
+        logger.Emit(16, [this](const Event& e) { emitted.push_back(e); });
+      }
+      if (done) break;
+      std::this_thread::yield();
+    }
+    for (auto& p : producers) {
+      p.join();
+    }
+    // Apply the events left in the log once everything is logged.
+    logger.Collapse([&] { return enabled.load(); }, store);
+    logger.Emit(capacity, [this](const Event& e) { emitted.push_back(e); });
+  }
+};
+
+TEST(EventLoggerTest, StartStopRestart) {
+  EventLogger<Event> logger(8);
+  bool enabled = false;
+  auto events = Events(0, 64);
+  std::vector<uint32_t> stored;
+  std::vector<uint32_t> emitted;
+  int sent = 0;
+  auto store = [&](const Event& e) { stored.push_back(e.seq); };
+  auto emit = [&](const Event& e) { emitted.push_back(e.seq); };
+  auto is_enabled = [&] { return enabled; };
+  auto send = [&] { sent++; };
+  size_t next = 0;
+  auto log = [&](size_t count) {
+    for (size_t end = next + count; next < end; next++) {
+      logger.Log(events[next], is_enabled, store);
+    }
+  };
+
+  // Before the trace is started, a full log is applied to the stored state.
+  log(20);
+  EXPECT_EQ(16u, stored.size());
+  EXPECT_EQ(0u, logger.Emit(8, emit));
+
+  // Once the trace is started, the log is only emitted after the state.
+  enabled = true;
+  EXPECT_TRUE(logger.Collapse(is_enabled, store));
+  EXPECT_EQ(20u, stored.size());
+  log(4);
+  logger.SendStateOnce(send);
+  logger.SendStateOnce(send);
+  EXPECT_EQ(1, sent);
+  EXPECT_FALSE(logger.Collapse(is_enabled, store));
+  EXPECT_EQ(4u, logger.Emit(3, emit));
+  log(8);
+  EXPECT_FALSE(logger.Collapse(is_enabled, store));
+
+  // Once the trace is stopped, a full log is applied to the stored state
+  // again, instead of waiting for the emitter.
+  enabled = false;
+  log(12);
+  EXPECT_EQ(36u, stored.size());
+
+  // Once the trace is restarted, the logged events are emitted again, without
+  // sending the state again.
+  enabled = true;
+  logger.SendStateOnce(send);
+  EXPECT_EQ(1, sent);
+  EXPECT_EQ(4u, logger.Emit(8, emit));
+  log(6);
+  EXPECT_EQ(6u, logger.Emit(8, emit));
+
+  std::vector<uint32_t> expected_stored;
+  std::vector<uint32_t> expected_emitted;
+  for (uint32_t i = 0; i < 20; i++) expected_stored.push_back(i);
+  for (uint32_t i = 20; i < 24; i++) expected_emitted.push_back(i);
+  for (uint32_t i = 24; i < 40; i++) expected_stored.push_back(i);
+  for (uint32_t i = 40; i < 50; i++) expected_emitted.push_back(i);
+  EXPECT_EQ(expected_stored, stored);
+  EXPECT_EQ(expected_emitted, emitted);
+}
+
+// The emitter only wakes for the events logged while the trace is enabled,
+// and returns once interrupted.
+TEST(EventLoggerTest, WaitForEvents) {
+  EventLogger<Event> logger(8);
+  std::atomic<bool> enabled(false);
+  auto is_enabled = [&] { return enabled.load(); };
+  auto store = [](const Event&) {};
+  auto events = Events(0, 4);
+  logger.SendStateOnce([] {});
+  std::atomic<size_t> wakeups(0);
+  std::atomic<size_t> emitted(0);
+  std::thread emitter([&] {
+    while (logger.Wait(is_enabled)) {
+      wakeups++;
+      emitted += logger.Emit(8, [](const Event&) {});
+    }
+  });
+
+  logger.Log(events[0], is_enabled, store);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(0u, wakeups.load());
+
+  enabled = true;
+  logger.Log(events[1], is_enabled, store);
+  while (emitted.load() < 2) {
+    std::this_thread::yield();
+  }
+  logger.Interrupt();
+  emitter.join();
+  EXPECT_EQ(2u, emitted.load());
+
+  // An interruption is not lost if there is no waiting thread, and only
+  // stops one wait.
+  logger.Interrupt();
+  EXPECT_FALSE(logger.Wait(is_enabled));
+  logger.Log(events[2], is_enabled, store);
+  EXPECT_TRUE(logger.Wait(is_enabled));
+}
+
+// Each event must be either applied to the stored state or emitted once,
+// the events of each thread must be emitted in order, and the snapshot
+// followed by the emitted events must give the same state as all the events.
+TEST(EventLoggerTest, ConcurrentLogsWithCollapse) {
+  const uint32_t kThreads = 4;
+  const uint32_t kEventsPerThread = 20000;
+  LoggerRun run;
+  run.Run(kThreads, kEventsPerThread, 64, kEventsPerThread / 2,
+          kEventsPerThread, kEventsPerThread);
+
+  EXPECT_GT(run.collapsed, 0u);
+  EXPECT_GT(run.emitted.size(), 0u);
+  EXPECT_EQ(kThreads * kEventsPerThread, run.collapsed + run.emitted.size());
+
+  std::vector<int64_t> last(kThreads, -1);
+  State state = run.snapshot;
+  for (const auto& e : run.emitted) {
+    EXPECT_LT(last[e.thread], int64_t(e.seq));
+    last[e.thread] = e.seq;
+    Apply(&state, e);
+  }
+
+  State expected;
+  for (uint32_t t = 0; t < kThreads; t++) {
+    for (const auto& e : Events(t, kEventsPerThread)) {
+      Apply(&expected, e);
+    }
+  }
+  EXPECT_EQ(expected, state);
+}
+
+// The threads keep logging once the trace is stopped and restarted, so the
+// log fills up while there is no emitter, which must not block the threads.
+TEST(EventLoggerTest, ConcurrentLogsWithStopAndRestart) {
+  const uint32_t kThreads = 4;
+  const uint32_t kEventsPerThread = 20000;
+  LoggerRun run;
+  run.Run(kThreads, kEventsPerThread, 64, kEventsPerThread / 4,
+          kEventsPerThread / 2, kEventsPerThread * 3 / 4);
+
+  EXPECT_GT(run.emitted.size(), 0u);
+  EXPECT_EQ(kThreads * kEventsPerThread, run.collapsed + run.emitted.size());
+  std::vector<int64_t> last(kThreads, -1);
+  for (const auto& e : run.emitted) {
+    EXPECT_LT(last[e.thread], int64_t(e.seq));
+    last[e.thread] = e.seq;
+  }
+}
+
+}  // namespace test
+}  // namespace memory_tracker
@@ -20,6 +20,29 @@ namespace memory_tracker {
 
 extern MemoryTracker memory_tracker_instance;
 
+VkResult vkCreateInstance(PFN_vkCreateInstance fn,
+                          VkInstanceCreateInfo const* pCreateInfo,
+                          AllocationCallbacks pAllocator,
+                          VkInstance* pInstance) {
+  AllocationCallbacks trackedAllocator =
+      memory_tracker_instance.GetTrackedAllocator(pAllocator,
+                                                  "vkCreateInstance");
+  VkResult result = fn(pCreateInfo, trackedAllocator, pInstance);
+  if (result == VK_SUCCESS) {
+    memory_tracker_instance.ProcessCreateInstanceEvent();
+  }
+  return result;
+}
+
+void vkDestroyInstance(PFN_vkDestroyInstance fn, VkInstance instance,
+                       AllocationCallbacks pAllocator) {
+  AllocationCallbacks trackedAllocator =
+      memory_tracker_instance.GetTrackedAllocator(pAllocator,
+                                                  "vkDestroyInstance");
+  memory_tracker_instance.ProcessDestroyInstanceEvent();
+  return fn(instance, trackedAllocator);
+}
+
 VkResult vkCreateDevice(PFN_vkCreateDevice fn, VkPhysicalDevice physicalDevice,
                         VkDeviceCreateInfo const* pCreateInfo,
                         AllocationCallbacks pAllocator, VkDevice* pDevice) {
@@ -16,6 +16,7 @@
 
 #include <stdlib.h>
 #include <algorithm>
+#include <cassert>
 #include <sstream>
 #include <thread>
 
@@ -40,6 +41,14 @@ MemoryTracker memory_tracker_instance;
 rwlock rwl_global_unique_handles;
 std::unordered_map<uint64_t, uint64_t> global_unique_handles;
 
+// Returns the unique handle generated for the Vulkan handle, or 0 if there is
+// none.
+UniqueHandle GetUniqueHandle(uint64_t handle) {
+  scoped_read_lock rlock(&rwl_global_unique_handles);
+  auto it = global_unique_handles.find(handle);
+  return it == global_unique_handles.end() ? 0 : it->second;
+}
+
 template <typename T, typename... Args>
 std::unique_ptr<T> make_unique(Args&&... args) {
   return std::unique_ptr<T>(new T(std::forward<Args>(args)...));
@@ -77,51 +86,30 @@ UniqueHandle UniqueHandleGenerator::GetDeviceMemoryHandle(
 
 // ----------------------- Wrapping allocation callbacks -----------------------
 
-rwlock AllocationCallbacksTracker::rwl_global_callback_mapping;
-std::unordered_map<uintptr_t, const VkAllocationCallbacks*>
-    AllocationCallbacksTracker::global_callback_mapping;
-
-rwlock AllocationCallbacksTracker::rwl_global_user_data_mapping;
-std::unordered_map<uintptr_t, uintptr_t>
-    AllocationCallbacksTracker::global_user_data_mapping;
-
-rwlock AllocationCallbacksTracker::rwl_global_caller_api_mapping;
-std::unordered_map<uintptr_t, std::string>
-    AllocationCallbacksTracker::global_caller_api_mapping;
-
-#if !defined(WIN32)
-rwlock AllocationCallbacksTracker::rwl_global_allocation_size_mapping;
-std::unordered_map<uintptr_t, size_t>
-    AllocationCallbacksTracker::global_allocation_size_mapping;
-#endif
+CallerApi InternCallerApi(const std::string& name) {
+  // The names are never freed, as the host allocations of the trackers, which
+  // are never destroyed either, refer to them.
+  static mutex* mu = new mutex();
+  static std::unordered_set<std::string>* names =
+      new std::unordered_set<std::string>();
+  std::lock_guard<mutex> lock(*mu);
+  return &*names->insert(name).first;
+}
 
 AllocationCallbacksTracker::AllocationCallbacksTracker(
-    const VkAllocationCallbacks* user_allocator,
-    const std::string& caller_api) {
-  if (user_allocator) {
-    {
-      scoped_write_lock wlock(&rwl_global_user_data_mapping);
-      global_user_data_mapping[(uintptr_t)this] =
-          (uintptr_t)(user_allocator->pUserData);
-    }
-    {
-      scoped_write_lock wlock(&rwl_global_callback_mapping);
-      global_callback_mapping[(uintptr_t)this] = user_allocator;
-    }
-  }
-  {
-    scoped_write_lock wlock(&rwl_global_caller_api_mapping);
-    global_caller_api_mapping[(uintptr_t)this] = caller_api;
+    const VkAllocationCallbacks* user_allocator_,
+    const std::string& caller_api_)
+    : caller_api(InternCallerApi(caller_api_)) {
+  if (user_allocator_) {
+    user_allocator = *user_allocator_;
   }
   tracked_allocator.pUserData = this;
   tracked_allocator.pfnAllocation = &TrackedAllocationFunction;
   tracked_allocator.pfnReallocation = &TrackedReallocationFunction;
   tracked_allocator.pfnFree = &TrackedFreeFunction;
-  if (user_allocator) {
-    tracked_allocator.pfnInternalAllocation =
-        user_allocator->pfnInternalAllocation;
-    tracked_allocator.pfnInternalFree = user_allocator->pfnInternalFree;
-  }
+  tracked_allocator.pfnInternalAllocation =
+      user_allocator.pfnInternalAllocation;
+  tracked_allocator.pfnInternalFree = user_allocator.pfnInternalFree;
 }
 
 AllocationCallbacksHandle
@@ -144,31 +132,15 @@ AllocationCallbacksTracker::GetAllocationCallbacksHandle(
 void* AllocationCallbacksTracker::TrackedAllocationFunction(
     void* pUserData, size_t size, size_t alignment,
     VkSystemAllocationScope allocationScope) {
+  auto tracker = static_cast<AllocationCallbacksTracker*>(pUserData);
+  const VkAllocationCallbacks& user_allocator = tracker->user_allocator;
   void* ptr = nullptr;
-  void* user_data = nullptr;
-  const VkAllocationCallbacks* user_allocator = nullptr;
   AllocatorType allocator_type = atDefault;
 
-  {
-    scoped_read_lock rlock(&rwl_global_user_data_mapping);
-    if (global_user_data_mapping.find((uintptr_t)pUserData) !=
-        global_user_data_mapping.end()) {
-      user_data = (void*)(global_user_data_mapping[(uintptr_t)pUserData]);
-    }
-  }
-
-  {
-    scoped_read_lock rlock(&rwl_global_callback_mapping);
-    if (global_callback_mapping.find((uintptr_t)pUserData) !=
-        global_callback_mapping.end()) {
-      user_allocator = global_callback_mapping[(uintptr_t)pUserData];
-    }
-  }
-
-  if (user_allocator && user_allocator->pfnAllocation) {
+  if (user_allocator.pfnAllocation) {
     allocator_type = atUser;
-    ptr = user_allocator->pfnAllocation(user_data, size, alignment,
-                                        allocationScope);
+    ptr = user_allocator.pfnAllocation(user_allocator.pUserData, size,
+                                       alignment, allocationScope);
   } else {
 #if defined(WIN32)
     ptr = _aligned_malloc(size, alignment);
@@ -180,20 +152,8 @@ void* AllocationCallbacksTracker::TrackedAllocationFunction(
 #endif
   }
   if (ptr) {
-    {
-      scoped_write_lock wlock(&rwl_global_allocation_size_mapping);
-      global_allocation_size_mapping[(uintptr_t)ptr] = size;
-    }
-    std::string caller_api = "Unknown";
-    {
-      scoped_read_lock rlock(&rwl_global_caller_api_mapping);
-      if (global_caller_api_mapping.find((uintptr_t)pUserData) !=
-          global_caller_api_mapping.end()) {
-        caller_api = global_caller_api_mapping[(uintptr_t)pUserData];
-      }
-    }
     memory_tracker::memory_tracker_instance.ProcessHostMemoryAllocationEvent(
-        (uintptr_t)ptr, size, alignment, allocationScope, caller_api,
+        (uintptr_t)ptr, size, alignment, allocationScope, tracker->caller_api,
         allocator_type);
   }
   return ptr;
@@ -210,45 +170,23 @@ void* AllocationCallbacksTracker::TrackedReallocationFunction(
     TrackedFreeFunction(pUserData, pOriginal);
     return nullptr;
   }
-  size_t osize = 0;
-  {
-    scoped_read_lock rlock(&rwl_global_allocation_size_mapping);
-    osize = (global_allocation_size_mapping.find((uintptr_t)pOriginal) ==
-             global_allocation_size_mapping.end())
-                ? 0
-                : global_allocation_size_mapping[(uintptr_t)pOriginal];
-  }
+  size_t osize = memory_tracker::memory_tracker_instance.GetHostAllocationSize(
+      (uintptr_t)pOriginal);
   if (osize == 0) {
     return TrackedAllocationFunction(pUserData, size, alignment,
                                      allocationScope);
   }
   if (osize == size) return pOriginal;
 
+  auto tracker = static_cast<AllocationCallbacksTracker*>(pUserData);
+  const VkAllocationCallbacks& user_allocator = tracker->user_allocator;
   void* ptr = nullptr;
-  void* user_data = nullptr;
-  const VkAllocationCallbacks* user_allocator = nullptr;
   AllocatorType allocator_type = atDefault;
 
-  {
-    scoped_read_lock rlock(&rwl_global_user_data_mapping);
-    if (global_user_data_mapping.find((uintptr_t)pUserData) !=
-        global_user_data_mapping.end()) {
-      user_data = (void*)(global_user_data_mapping[(uintptr_t)pUserData]);
-    }
-  }
-
-  {
-    scoped_read_lock rlock(&rwl_global_callback_mapping);
-    if (global_callback_mapping.find((uintptr_t)pUserData) !=
-        global_callback_mapping.end()) {
-      user_allocator = global_callback_mapping[(uintptr_t)pUserData];
-    }
-  }
-
-  if (user_allocator && user_allocator->pfnReallocation) {
+  if (user_allocator.pfnReallocation) {
     allocator_type = atUser;
-    ptr = user_allocator->pfnReallocation(user_data, pOriginal, size, alignment,
-                                          allocationScope);
+    ptr = user_allocator.pfnReallocation(user_allocator.pUserData, pOriginal,
+                                         size, alignment, allocationScope);
   } else {
 #if defined(WIN32)
     ptr = _aligned_realloc(pOriginal, size, alignment);
@@ -269,49 +207,23 @@ void* AllocationCallbacksTracker::TrackedReallocationFunction(
     }
   }
   if (ptr) {
-    {
-      scoped_write_lock wlock(&rwl_global_allocation_size_mapping);
-      global_allocation_size_mapping[(uintptr_t)ptr] = size;
-    }
-    std::string caller_api = "Unknown";
-    {
-      scoped_read_lock rlock(&rwl_global_caller_api_mapping);
-      if (global_caller_api_mapping.find((uintptr_t)pUserData) !=
-          global_caller_api_mapping.end()) {
-        caller_api = global_caller_api_mapping[(uintptr_t)pUserData];
-      }
-    }
     memory_tracker::memory_tracker_instance.ProcessHostMemoryReallocationEvent(
         (uintptr_t)ptr, (uintptr_t)pOriginal, size, alignment, allocationScope,
-        caller_api, allocator_type);
+        tracker->caller_api, allocator_type);
   }
   return ptr;
 }
 
 void AllocationCallbacksTracker::TrackedFreeFunction(void* pUserData,
                                                      void* pMemory) {
-  const VkAllocationCallbacks* user_allocator = nullptr;
-  {
-    scoped_read_lock rlock(&rwl_global_callback_mapping);
-    if (global_callback_mapping.find((uintptr_t)pUserData) !=
-        global_callback_mapping.end()) {
-      user_allocator = global_callback_mapping[(uintptr_t)pUserData];
-    }
-  }
+  auto tracker = static_cast<AllocationCallbacksTracker*>(pUserData);
+  const VkAllocationCallbacks& user_allocator = tracker->user_allocator;
 
   memory_tracker::memory_tracker_instance.ProcessHostMemoryFreeEvent(
       (uintptr_t)pMemory);
 
-  if (user_allocator && user_allocator->pfnFree) {
-    void* user_data = nullptr;
-    {
-      scoped_read_lock rlock(&rwl_global_user_data_mapping);
-      if (global_user_data_mapping.find((uintptr_t)pUserData) !=
-          global_user_data_mapping.end()) {
-        user_data = (void*)(global_user_data_mapping[(uintptr_t)pUserData]);
-      }
-    }
-    user_allocator->pfnFree(user_data, pMemory);
+  if (user_allocator.pfnFree) {
+    user_allocator.pfnFree(user_allocator.pUserData, pMemory);
   } else {
 #if defined(WIN32)
     _aligned_free(pMemory);
@@ -321,245 +233,164 @@ void AllocationCallbacksTracker::TrackedFreeFunction(void* pUserData,
   }
 }
 
-// ------------------------ Bookkeeping memory events --------------------------
-
-BindMemoryInfo::BindMemoryInfo(VkDeviceMemory device_memory,
-                               UniqueHandle device_memory_handle,
-                               VkDeviceSize memory_offset,
-                               uint32_t memory_type) {
-  timestamp_ = perfetto::base::GetBootTimeNs().count();
-  device_memory_ = device_memory;
-  device_memory_handle_ = device_memory_handle;
-  memory_offset_ = memory_offset;
-  memory_type_ = memory_type;
-}
+// ------------------------------ Memory events --------------------------------
 
-VulkanMemoryEventPtr BindMemoryInfo::GetVulkanMemoryEvent() {
+VulkanMemoryEventPtr MemoryEventRecord::GetVulkanMemoryEvent() const {
   auto event = make_unique<VulkanMemoryEvent>();
-  // event->source will be set by the object that this bind memory info is
-  // attached to, which can be a buffer or an image.
-  event->operation = perfetto::protos::pbzero::VulkanMemoryEvent_Operation::
-      VulkanMemoryEvent_Operation_OP_BIND;
-  event->timestamp = timestamp_;
-  event->has_device_memory = true;
-  event->device_memory = device_memory_handle_;
-  event->has_memory_address = true;
-  event->memory_address = memory_offset_;
-  event->has_memory_type = true;
-  event->memory_type = memory_type_;
-  return event;
-}
-
-//                     ------------------------------------
-
-CreateBufferInfo::CreateBufferInfo(VkBufferCreateInfo const* create_buffer_info,
-                                   VkDevice device) {
-  timestamp = perfetto::base::GetBootTimeNs().count();
-  this->device = device;
-  flags = create_buffer_info->flags;
-  size = create_buffer_info->size;
-  usage = create_buffer_info->usage;
-  sharing_mode = create_buffer_info->sharingMode;
-  if (sharing_mode == VK_SHARING_MODE_CONCURRENT) {
-    for (uint32_t i = 0; i < create_buffer_info->queueFamilyIndexCount; i++)
-      queue_family_indices.push_back(
-          create_buffer_info->pQueueFamilyIndices[i]);
-  }
-}
-
-VulkanMemoryEventPtr CreateBufferInfo::GetVulkanMemoryEvent() {
-  auto event = make_unique<VulkanMemoryEvent>();
-  event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
-      VulkanMemoryEvent_Source_SOURCE_BUFFER;
-  event->operation = perfetto::protos::pbzero::VulkanMemoryEvent_Operation::
-      VulkanMemoryEvent_Operation_OP_CREATE;
   event->timestamp = timestamp;
   event->has_device = true;
   event->device = (uint64_t)(device);
-
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("flags", (int)(flags)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("usage", (int)(usage)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("sharing_mode", (int)(sharing_mode)));
-  for (auto index : queue_family_indices) {
-    event->annotations.push_back(
-        VulkanMemoryEventAnnotation("queue_family_index", (int)(index)));
+  switch (kind) {
+    case mekAllocateMemory:
+      event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
+          VulkanMemoryEvent_Source_SOURCE_DEVICE_MEMORY;
+      event->operation = perfetto::protos::pbzero::VulkanMemoryEvent_Operation::
+          VulkanMemoryEvent_Operation_OP_CREATE;
+      event->has_object_handle = true;
+      event->object_handle = unique_handle;
+      event->has_memory_size = true;
+      event->memory_size = size;
+      event->has_memory_type = true;
+      event->memory_type = memory_type;
+      event->has_heap = true;
+      event->heap = heap;
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("vk_handle", handle));
+      break;
+
+    case mekFreeMemory:
+      event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
+          VulkanMemoryEvent_Source_SOURCE_DEVICE_MEMORY;
+      event->operation = perfetto::protos::pbzero::VulkanMemoryEvent_Operation::
+          VulkanMemoryEvent_Operation_OP_DESTROY;
+      event->has_object_handle = true;
+      event->object_handle = handle;
+      break;
+
+    case mekCreateBuffer:
+      event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
+          VulkanMemoryEvent_Source_SOURCE_BUFFER;
+      event->operation = perfetto::protos::pbzero::VulkanMemoryEvent_Operation::
+          VulkanMemoryEvent_Operation_OP_CREATE;
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("flags", (int)(flags)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("usage", (int)(usage)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("sharing_mode", (int)(sharing_mode)));
+      for (uint32_t i = 0; i < kMaxRecordedQueueFamilies; i++) {
+        if (queue_families & (uint64_t(1) << i)) {
+          event->annotations.push_back(
+              VulkanMemoryEventAnnotation("queue_family_index", (int)(i)));
+        }
+      }
+      event->has_object_handle = true;
+      event->object_handle = unique_handle;
+      event->has_memory_size = true;
+      event->memory_size = size;
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("vk_handle", handle));
+      break;
+
+    case mekCreateImage:
+      event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
+          VulkanMemoryEvent_Source_SOURCE_IMAGE;
+      event->operation = perfetto::protos::pbzero::VulkanMemoryEvent_Operation::
+          VulkanMemoryEvent_Operation_OP_CREATE;
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("flags", (int)(flags)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("image_type", (int)(image_type)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("format", (int)(format)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("extent.width", (int)(extent.width)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("extent.height", (int)(extent.height)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("extent.depth", (int)(extent.depth)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("mip_levels", (int)(mip_levels)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("array_layers", (int)(array_layers)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("samples", (int)(samples)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("tiling", (int)(tiling)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("usage", (int)(usage)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("sharing_mode", (int)(sharing_mode)));
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("initial_layout", (int)(initial_layout)));
+      for (uint32_t i = 0; i < kMaxRecordedQueueFamilies; i++) {
+        if (queue_families & (uint64_t(1) << i)) {
+          event->annotations.push_back(
+              VulkanMemoryEventAnnotation("queue_family_index", (int)(i)));
+        }
+      }
+      event->has_object_handle = true;
+      event->object_handle = unique_handle;
+      event->has_memory_size = true;
+      event->memory_size = size;
+      event->annotations.push_back(
+          VulkanMemoryEventAnnotation("vk_handle", handle));
+      break;
+
+    case mekBindBuffer:
+    case mekBindImage:
+      event->source =
+          kind == mekBindBuffer
+              ? perfetto::protos::pbzero::VulkanMemoryEvent_Source::
+                    VulkanMemoryEvent_Source_SOURCE_BUFFER
+              : perfetto::protos::pbzero::VulkanMemoryEvent_Source::
+                    VulkanMemoryEvent_Source_SOURCE_IMAGE;
+      event->operation = perfetto::protos::pbzero::VulkanMemoryEvent_Operation::
+          VulkanMemoryEvent_Operation_OP_BIND;
+      event->has_device_memory = true;
+      event->device_memory = memory_handle;
+      event->has_memory_address = true;
+      event->memory_address = memory_offset;
+      event->has_memory_type = true;
+      event->memory_type = memory_type;
+      event->has_heap = true;
+      event->heap = heap;
+      event->has_object_handle = true;
+      event->object_handle = unique_handle;
+      event->has_memory_size = true;
+      event->memory_size = size;
+      break;
+
+    case mekDestroyBuffer:
+    case mekDestroyImage:
+      event->source =
+          kind == mekDestroyBuffer
+              ? perfetto::protos::pbzero::VulkanMemoryEvent_Source::
+                    VulkanMemoryEvent_Source_SOURCE_BUFFER
+              : perfetto::protos::pbzero::VulkanMemoryEvent_Source::
+                    VulkanMemoryEvent_Source_SOURCE_IMAGE;
+      event->operation = perfetto::protos::pbzero::VulkanMemoryEvent_Operation::
+          VulkanMemoryEvent_Operation_OP_DESTROY;
+      event->has_object_handle = true;
+      event->object_handle = unique_handle;
+      break;
   }
   return event;
 }
 
-Buffer::Buffer(VkBuffer buffer_, CreateBufferInfoPtr create_buffer_info_)
-    : vk_buffer(buffer_) {
-  is_bound = false;
-  unique_handle = UniqueHandleGenerator::GetBufferHandle(buffer_);
-  create_buffer_info = std::move(create_buffer_info_);
-}
-
-VulkanMemoryEventContainerPtr Buffer::GetVulkanMemoryEvents() {
-  auto events = make_unique<VulkanMemoryEventContainer>();
-  auto create_event = create_buffer_info->GetVulkanMemoryEvent();
-  create_event->has_object_handle = true;
-  create_event->object_handle = unique_handle;
-  VkMemoryRequirements memory_requirements;
-  GetGlobalContext()
-      .GetVkDeviceData(create_buffer_info->GetVkDevice())
-      ->functions->vkGetBufferMemoryRequirements(
-          create_buffer_info->GetVkDevice(), vk_buffer, &memory_requirements);
-  auto memory_size = memory_requirements.size;
-  create_event->has_memory_size = true;
-  create_event->memory_size = memory_size;
-  create_event->annotations.push_back(
-      VulkanMemoryEventAnnotation("vk_handle", (uint64_t)(vk_buffer)));
-  events->push_back(std::move(create_event));
-
-  if (is_bound) {
-    auto bind_event = bind_buffer_info->GetVulkanMemoryEvent();
-    bind_event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
-        VulkanMemoryEvent_Source_SOURCE_BUFFER;
-    bind_event->has_memory_size = true;
-    bind_event->memory_size = memory_size;
-    bind_event->has_object_handle = true;
-    bind_event->object_handle = unique_handle;
-    events->push_back(std::move(bind_event));
-  }
-  return events;
-}
-
 //                     ------------------------------------
 
-CreateImageInfo::CreateImageInfo(VkImageCreateInfo const* create_image_info,
-                                 VkDevice device) {
-  timestamp = perfetto::base::GetBootTimeNs().count();
-  this->device = device;
-  flags = create_image_info->flags;
-  image_type = create_image_info->imageType;
-  format = create_image_info->format;
-  extent = create_image_info->extent;
-  mip_levels = create_image_info->mipLevels;
-  array_layers = create_image_info->arrayLayers;
-  samples = create_image_info->samples;
-  tiling = create_image_info->tiling;
-  usage = create_image_info->usage;
-  sharing_mode = create_image_info->sharingMode;
-  if (sharing_mode == VK_SHARING_MODE_CONCURRENT) {
-    for (uint32_t i = 0; i < create_image_info->queueFamilyIndexCount; i++)
-      queue_family_indices.push_back(create_image_info->pQueueFamilyIndices[i]);
-  }
-  initial_layout = create_image_info->initialLayout;
-}
-
-VulkanMemoryEventPtr CreateImageInfo::GetVulkanMemoryEvent() {
-  auto event = make_unique<VulkanMemoryEvent>();
-  event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
-      VulkanMemoryEvent_Source_SOURCE_IMAGE;
-  event->operation = perfetto::protos::pbzero::VulkanMemoryEvent_Operation::
-      VulkanMemoryEvent_Operation_OP_CREATE;
-  event->timestamp = timestamp;
-  event->has_device = true;
-  event->device = (uint64_t)(device);
-
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("flags", (int)(flags)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("image_type", (int)(image_type)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("format", (int)(format)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("extent.width", (int)(extent.width)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("extent.height", (int)(extent.height)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("extent.depth", (int)(extent.depth)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("mip_levels", (int)(mip_levels)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("array_layers", (int)(array_layers)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("samples", (int)(samples)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("tiling", (int)(tiling)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("usage", (int)(usage)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("sharing_mode", (int)(sharing_mode)));
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("initial_layout", (int)(initial_layout)));
-  for (auto index : queue_family_indices) {
-    event->annotations.push_back(
-        VulkanMemoryEventAnnotation("queue_family_index", (int)(index)));
-  }
-  return event;
-}
-
-Image::Image(VkImage image_, CreateImageInfoPtr create_image_info_)
-    : vk_image(image_) {
-  is_bound = false;
-  unique_handle = UniqueHandleGenerator::GetImageHandle(image_);
-  create_image_info = std::move(create_image_info_);
-}
-
-VulkanMemoryEventContainerPtr Image::GetVulkanMemoryEvents() {
+VulkanMemoryEventContainerPtr MemoryObject::GetVulkanMemoryEvents() {
   auto events = make_unique<VulkanMemoryEventContainer>();
-  auto create_event = create_image_info->GetVulkanMemoryEvent();
-  create_event->has_object_handle = true;
-  create_event->object_handle = unique_handle;
-  VkMemoryRequirements memory_requirements;
-  GetGlobalContext()
-      .GetVkDeviceData(create_image_info->GetVkDevice())
-      ->functions->vkGetImageMemoryRequirements(
-          create_image_info->GetVkDevice(), vk_image, &memory_requirements);
-  auto memory_size = memory_requirements.size;
-  create_event->has_memory_size = true;
-  create_event->memory_size = memory_size;
-
-  create_event->annotations.push_back(
-      VulkanMemoryEventAnnotation("vk_handle", (uint64_t)(vk_image)));
-  events->push_back(std::move(create_event));
-
+  events->push_back(create_record.GetVulkanMemoryEvent());
   if (is_bound) {
-    auto bind_event = bind_image_info->GetVulkanMemoryEvent();
-    bind_event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
-        VulkanMemoryEvent_Source_SOURCE_IMAGE;
-    bind_event->has_memory_size = true;
-    bind_event->memory_size = memory_size;
-    events->push_back(std::move(bind_event));
+    events->push_back(bind_record.GetVulkanMemoryEvent());
   }
   return events;
 }
 
 //                     ------------------------------------
 
-DeviceMemory::DeviceMemory(VkDeviceMemory memory_,
-                           VkMemoryAllocateInfo const* allocate_info)
-    : memory(memory_) {
-  timestamp = perfetto::base::GetBootTimeNs().count();
-  allocation_size = allocate_info->allocationSize;
-  memory_type = allocate_info->memoryTypeIndex;
-  unique_handle = UniqueHandleGenerator::GetDeviceMemoryHandle(memory_);
-}
-
-VulkanMemoryEventPtr DeviceMemory::GetVulkanMemoryEvent() {
-  auto event = make_unique<VulkanMemoryEvent>();
-  event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
-      VulkanMemoryEvent_Source_SOURCE_DEVICE_MEMORY;
-  event->operation = perfetto::protos::pbzero::VulkanMemoryEvent_Operation::
-      VulkanMemoryEvent_Operation_OP_CREATE;
-  event->timestamp = timestamp;
-  event->has_object_handle = true;
-  event->object_handle = unique_handle;
-  event->has_memory_size = true;
-  event->memory_size = allocation_size;
-  event->has_memory_type = true;
-  event->memory_type = memory_type;
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("vk_handle", (uint64_t)(memory)));
-  return event;
-}
-
-//                     ------------------------------------
-
 Heap::Heap(VkDeviceSize size_, VkMemoryHeapFlags flags_)
     : size(size_), flags(flags_) {}
 
@@ -614,24 +445,19 @@ void Heap::DestroyDeviceMemory(VkDeviceMemory vk_device_memory) {
   }
 }
 
-void Heap::BindBuffer(BufferPtr buffer, VkDeviceMemory device_memory,
-                      VkDeviceSize memory_offset) {
-  uint32_t memory_type = UINT32_MAX;
-  UniqueHandle device_memory_handle = UINT64_MAX;
+void Heap::BindBuffer(BufferPtr buffer,
+                      const MemoryEventRecord& bind_record) {
   {
     scoped_read_lock rlock(&rwl_device_memories);
-    if (device_memories.find(device_memory) == device_memories.end()) return;
-    device_memory_handle = device_memories[device_memory]->GetUniqueHandle();
-    memory_type = device_memories[device_memory]->GetMemoryType();
+    if (device_memories.find(bind_record.memory) == device_memories.end())
+      return;
   }
-
-  buffer->SetBound();
-  buffer->SetBindBufferInfo(make_unique<BindMemoryInfo>(
-      device_memory, device_memory_handle, memory_offset, memory_type));
+  buffer->SetBound(bind_record);
   // Add to the device memory list of bound buffers
   {
     scoped_write_lock wlock(&rwl_device_memories);
-    device_memories[device_memory]->EmplaceBoundBuffer(buffer->GetVkBuffer());
+    device_memories[bind_record.memory]->EmplaceBoundBuffer(
+        buffer->GetVkBuffer());
   }
   {
     scoped_write_lock wlock(&rwl_buffers);
@@ -659,23 +485,17 @@ void Heap::DestroyBuffer(VkBuffer vk_buffer) {
   }
 }
 
-void Heap::BindImage(ImagePtr image, VkDeviceMemory device_memory,
-                     VkDeviceSize memory_offset) {
-  uint32_t memory_type = UINT32_MAX;
-  UniqueHandle device_memory_handle = UINT64_MAX;
+void Heap::BindImage(ImagePtr image, const MemoryEventRecord& bind_record) {
   {
     scoped_read_lock rlock(&rwl_device_memories);
-    if (device_memories.find(device_memory) == device_memories.end()) return;
-    device_memory_handle = device_memories[device_memory]->GetUniqueHandle();
-    memory_type = device_memories[device_memory]->GetMemoryType();
+    if (device_memories.find(bind_record.memory) == device_memories.end())
+      return;
   }
-  image->SetBound();
-  image->SetBindImageInfo(make_unique<BindMemoryInfo>(
-      device_memory, device_memory_handle, memory_offset, memory_type));
+  image->SetBound(bind_record);
   // Add to the device memory list of bound images
   {
     scoped_write_lock wlock(&rwl_device_memories);
-    device_memories[device_memory]->EmplaceBoundImage(image->GetVkImage());
+    device_memories[bind_record.memory]->EmplaceBoundImage(image->GetVkImage());
   }
   {
     scoped_write_lock wlock(&rwl_images);
@@ -778,6 +598,10 @@ void PhysicalDevice::AddDeviceMemory(VkDevice device,
     scoped_write_lock wlock(&rwl_heaps);
     heaps[heap_index]->AddDeviceMemory(std::move(device_memory));
   }
+  {
+    scoped_write_lock wlock(&rwl_device_memory_to_heap_index);
+    device_memory_to_heap_index[vk_handle] = heap_index;
+  }
   {
     scoped_write_lock wlock(&rwl_device_to_device_memory_set);
     if (device_to_device_memory_set.find(device) ==
@@ -830,26 +654,24 @@ void PhysicalDevice::DestroyAllDeviceMemories(VkDevice device) {
     for (auto& it : *device_memory_set) DestroyDeviceMemory(device, it, false);
 }
 
-void PhysicalDevice::BindBuffer(BufferPtr buffer, VkDeviceMemory device_memory,
-                                VkDeviceSize size) {
-  auto vk_buffer = buffer->GetVkBuffer();
-  uint32_t heap_index = 0;
+void PhysicalDevice::BindBuffer(BufferPtr buffer,
+                                const MemoryEventRecord& bind_record) {
+  if (bind_record.memory_type >= memory_type_index_to_heap_index.size()) return;
+  auto heap_index = memory_type_index_to_heap_index[bind_record.memory_type];
   {
-    scoped_read_lock rlock(&rwl_buffer_to_heap_index);
-    if (buffer_to_heap_index.find(vk_buffer) == buffer_to_heap_index.end())
-      return;
-    heap_index = buffer_to_heap_index[vk_buffer];
+    scoped_write_lock wlock(&rwl_buffer_to_heap_index);
+    buffer_to_heap_index[buffer->GetVkBuffer()] = heap_index;
   }
   {
-    scoped_write_lock wlock(&rwl_heaps);
-    heaps[heap_index]->BindBuffer(std::move(buffer), device_memory, size);
+    scoped_read_lock rlock(&rwl_heaps);
+    heaps[heap_index]->BindBuffer(std::move(buffer), bind_record);
   }
 }
 
 void PhysicalDevice::DestroyBuffer(VkBuffer vk_buffer) {
   uint32_t heap_index = 0;
   {
-    scoped_read_lock rlock(&rwl_buffer_to_heap_index);
+    scoped_write_lock wlock(&rwl_buffer_to_heap_index);
     if (buffer_to_heap_index.find(vk_buffer) == buffer_to_heap_index.end())
       return;
     heap_index = buffer_to_heap_index[vk_buffer];
@@ -861,25 +683,24 @@ void PhysicalDevice::DestroyBuffer(VkBuffer vk_buffer) {
   }
 }
 
-void PhysicalDevice::BindImage(ImagePtr image, VkDeviceMemory device_memory,
-                               VkDeviceSize size) {
-  auto vk_image = image->GetVkImage();
-  uint32_t heap_index = 0;
+void PhysicalDevice::BindImage(ImagePtr image,
+                               const MemoryEventRecord& bind_record) {
+  if (bind_record.memory_type >= memory_type_index_to_heap_index.size()) return;
+  auto heap_index = memory_type_index_to_heap_index[bind_record.memory_type];
   {
-    scoped_read_lock rlock(&rwl_image_to_heap_index);
-    if (image_to_heap_index.find(vk_image) == image_to_heap_index.end()) return;
-    heap_index = image_to_heap_index[vk_image];
+    scoped_write_lock wlock(&rwl_image_to_heap_index);
+    image_to_heap_index[image->GetVkImage()] = heap_index;
   }
   {
     scoped_read_lock rlock(&rwl_heaps);
-    heaps[heap_index]->BindImage(std::move(image), device_memory, size);
+    heaps[heap_index]->BindImage(std::move(image), bind_record);
   }
 }
 
 void PhysicalDevice::DestroyImage(VkImage vk_image) {
   uint32_t heap_index = 0;
   {
-    scoped_read_lock rlock(&rwl_image_to_heap_index);
+    scoped_write_lock wlock(&rwl_image_to_heap_index);
     if (image_to_heap_index.find(vk_image) == image_to_heap_index.end()) return;
     heap_index = image_to_heap_index[vk_image];
     image_to_heap_index.erase(vk_image);
@@ -949,8 +770,8 @@ void Device::AddBuffer(BufferPtr buffer_) {
   buffers[buffer_->GetVkBuffer()] = std::move(buffer_);
 }
 
-void Device::BindBuffer(VkBuffer vk_buffer, VkDeviceMemory device_memory,
-                        VkDeviceSize size) {
+void Device::BindBuffer(const MemoryEventRecord& bind_record) {
+  auto vk_buffer = (VkBuffer)(bind_record.handle);
   {
     scoped_read_lock rlock(&rwl_buffers);
     if (buffers.find(vk_buffer) == buffers.end()) return;
@@ -959,7 +780,7 @@ void Device::BindBuffer(VkBuffer vk_buffer, VkDeviceMemory device_memory,
     scoped_write_lock wlock(&rwl_buffers);
     BufferPtr buffer = std::move(buffers[vk_buffer]);
     buffers.erase(vk_buffer);
-    physical_device->BindBuffer(std::move(buffer), device_memory, size);
+    physical_device->BindBuffer(std::move(buffer), bind_record);
   }
 }
 
@@ -980,8 +801,8 @@ void Device::AddImage(ImagePtr image_) {
   images[image_->GetVkImage()] = std::move(image_);
 }
 
-void Device::BindImage(VkImage vk_image, VkDeviceMemory device_memory,
-                       VkDeviceSize size) {
+void Device::BindImage(const MemoryEventRecord& bind_record) {
+  auto vk_image = (VkImage)(bind_record.handle);
   {
     scoped_read_lock rlock(&rwl_images);
     if (images.find(vk_image) == images.end()) return;
@@ -990,7 +811,7 @@ void Device::BindImage(VkImage vk_image, VkDeviceMemory device_memory,
     scoped_write_lock wlock(&rwl_images);
     ImagePtr image = std::move(images[vk_image]);
     images.erase(vk_image);
-    physical_device->BindImage(std::move(image), device_memory, size);
+    physical_device->BindImage(std::move(image), bind_record);
   }
 }
 
@@ -1068,7 +889,7 @@ VulkanMemoryEventContainerSetPtr Device::GetVulkanMemoryEvents() {
 
 //                     ------------------------------------
 
-VulkanMemoryEventPtr HostAllocation::GetVulkanMemoryEvent() {
+VulkanMemoryEventPtr HostAllocation::GetVulkanMemoryEvent() const {
   auto event = make_unique<core::VulkanMemoryEvent>();
   event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
       VulkanMemoryEvent_Source_SOURCE_DRIVER;
@@ -1079,7 +900,7 @@ VulkanMemoryEventPtr HostAllocation::GetVulkanMemoryEvent() {
   event->memory_address = ptr;
   event->has_memory_size = true;
   event->memory_size = size;
-  event->function_name = caller_api;
+  event->function_name = *caller_api;
   event->has_allocation_scope = true;
   event->allocation_scope =
       static_cast<perfetto::protos::pbzero::VulkanMemoryEvent::AllocationScope>(
@@ -1093,7 +914,8 @@ VulkanMemoryEventPtr HostAllocation::GetVulkanMemoryEvent() {
 }
 
 // --------------------------- Memory events tracker ---------------------------
-MemoryTracker::MemoryTracker() : initial_state_is_sent_(false) {}
+MemoryTracker::MemoryTracker()
+    : event_logger(kEventLogCapacity) {}
 
 const VkAllocationCallbacks* MemoryTracker::GetTrackedAllocator(
     const VkAllocationCallbacks* pUserAllocator, const std::string& caller) {
@@ -1132,6 +954,9 @@ void MemoryTracker::StoreCreateDeviceEvent(
 }
 
 void MemoryTracker::StoreDestoryDeviceEvent(VkDevice vk_device) {
+  // Apply the logged events of the device before it is destroyed, as its
+  // handle may be reused by a device created later.
+  CollapseEventLog();
   DevicePtr device = nullptr;
   {
     scoped_write_lock wlock(&rwl_devices);
@@ -1143,107 +968,63 @@ void MemoryTracker::StoreDestoryDeviceEvent(VkDevice vk_device) {
   if (device) device->DestroyAllDeviceMemories();
 }
 
-void MemoryTracker::StoreAllocateMemoryEvent(
-    VkDevice device, VkDeviceMemory memory,
-    VkMemoryAllocateInfo const* allocate_info) {
-  auto device_memory = make_unique<DeviceMemory>(memory, allocate_info);
-  {
-    scoped_read_lock rlock(&rwl_devices);
-    if (devices.find(device) != devices.end())
-      devices[device]->AddDeviceMemory(std::move(device_memory));
-  }
-  {
-    scoped_write_lock wlock(&rwl_device_memory_type_map);
-    device_memory_type_map[memory] = allocate_info->memoryTypeIndex;
-  }
-}
-
-void MemoryTracker::StoreFreeMemoryEvent(VkDevice device,
-                                         VkDeviceMemory device_memory) {
+void MemoryTracker::StoreEvent(const MemoryEventRecord& record) {
   scoped_read_lock rlock(&rwl_devices);
-  if (devices.find(device) != devices.end())
-    devices[device]->DestroyDeviceMemory(device_memory);
-}
-
-void MemoryTracker::StoreCreateBufferEvent(
-    VkDevice device, VkBuffer buffer, VkBufferCreateInfo const* create_info) {
-  CreateBufferInfoPtr create_info_ptr =
-      make_unique<CreateBufferInfo>(create_info, device);
-  BufferPtr buffer_ptr =
-      make_unique<Buffer>(buffer, std::move(create_info_ptr));
-  scoped_read_lock rlock(&rwl_devices);
-  if (devices.find(device) != devices.end())
-    devices[device]->AddBuffer(std::move(buffer_ptr));
-}
-
-void MemoryTracker::StoreBindBufferEvent(VkDevice device, VkBuffer buffer,
-                                         VkDeviceMemory memory, size_t offset) {
-  scoped_read_lock rlock(&rwl_devices);
-  if (devices.find(device) != devices.end())
-    devices[device]->BindBuffer(buffer, memory, offset);
-}
-
-void MemoryTracker::StoreDestroyBufferEvent(VkDevice device, VkBuffer buffer) {
-  scoped_read_lock rlock(&rwl_devices);
-  if (devices.find(device) != devices.end())
-    devices[device]->DestroyBuffer(buffer);
-}
-
-void MemoryTracker::StoreCreateImageEvent(
-    VkDevice device, VkImage image, const VkImageCreateInfo* create_info) {
-  CreateImageInfoPtr create_info_ptr =
-      make_unique<CreateImageInfo>(create_info, device);
-  ImagePtr image_ptr = make_unique<Image>(image, std::move(create_info_ptr));
-  scoped_read_lock rlock(&rwl_devices);
-  if (devices.find(device) != devices.end())
-    devices[device]->AddImage(std::move(image_ptr));
-}
-
-void MemoryTracker::StoreBindImageEvent(VkDevice device, VkImage image,
-                                        VkDeviceMemory memory, size_t offset) {
-  scoped_read_lock rlock(&rwl_devices);
-  if (devices.find(device) != devices.end())
-    devices[device]->BindImage(image, memory, offset);
-}
-
-void MemoryTracker::StoreDestroyImageEvent(VkDevice device, VkImage image) {
-  scoped_read_lock rlock(&rwl_devices);
-  if (devices.find(device) != devices.end())
-    devices[device]->DestroyImage(image);
+  auto it = devices.find(record.device);
+  if (it == devices.end()) return;
+  auto& device = it->second;
+  switch (record.kind) {
+    case mekAllocateMemory:
+      device->AddDeviceMemory(make_unique<DeviceMemory>(record));
+      break;
+    case mekFreeMemory:
+      device->DestroyDeviceMemory((VkDeviceMemory)(record.handle));
+      break;
+    case mekCreateBuffer:
+      device->AddBuffer(make_unique<Buffer>(record));
+      break;
+    case mekBindBuffer:
+      device->BindBuffer(record);
+      break;
+    case mekDestroyBuffer:
+      device->DestroyBuffer((VkBuffer)(record.handle));
+      break;
+    case mekCreateImage:
+      device->AddImage(make_unique<Image>(record));
+      break;
+    case mekBindImage:
+      device->BindImage(record);
+      break;
+    case mekDestroyImage:
+      device->DestroyImage((VkImage)(record.handle));
+      break;
+  }
 }
 
 void MemoryTracker::StoreHostMemoryAllocationEvent(
     uintptr_t ptr, size_t size, size_t alignment, VkSystemAllocationScope scope,
-    const std::string& caller_api, AllocatorType allocator_type) {
+    CallerApi caller_api, AllocatorType allocator_type) {
   auto timestamp = perfetto::base::GetBootTimeNs().count();
-  HostAllocationPtr allocation = make_unique<HostAllocation>(
-      timestamp, ptr, size, alignment, scope, caller_api, allocator_type);
-  scoped_write_lock wlock(&rwl_host_allocations);
-  host_allocations[ptr] = std::move(allocation);
+  host_allocations.Set(ptr,
+                       HostAllocation(timestamp, ptr, size, alignment, scope,
+                                      caller_api, allocator_type));
 }
 
 void MemoryTracker::StoreHostMemoryReallocationEvent(
     uintptr_t ptr, uintptr_t original, size_t size, size_t alignment,
-    VkSystemAllocationScope scope, const std::string& caller_api,
+    VkSystemAllocationScope scope, CallerApi caller_api,
     AllocatorType allocator_type) {
   auto timestamp = perfetto::base::GetBootTimeNs().count();
-  HostAllocationPtr allocation = make_unique<HostAllocation>(
-      timestamp, ptr, size, alignment, scope, caller_api, allocator_type);
-  scoped_write_lock wlock(&rwl_host_allocations);
-  host_allocations[ptr] = std::move(allocation);
-  if (original != ptr &&
-      host_allocations.find(original) != host_allocations.end()) {
-    host_allocations[original].reset(nullptr);
-    host_allocations.erase(original);
+  if (original != ptr) {
+    host_allocations.Erase(original);
   }
+  host_allocations.Set(ptr,
+                       HostAllocation(timestamp, ptr, size, alignment, scope,
+                                      caller_api, allocator_type));
 }
 
 void MemoryTracker::StoreHostMemoryFreeEvent(uintptr_t ptr) {
-  scoped_write_lock wlock(&rwl_host_allocations);
-  if (host_allocations.find(ptr) != host_allocations.end()) {
-    host_allocations[ptr].reset(nullptr);
-    host_allocations.erase(ptr);
-  }
+  host_allocations.Erase(ptr);
 }
 
 void MemoryTracker::EmitAndClearAllStoredEvents() {
@@ -1264,22 +1045,96 @@ void MemoryTracker::EmitAndClearAllStoredEvents() {
 
   // Emit and clear host memory events
   if (Emit().CategoryEnabled("Driver")) {
-    scoped_read_lock rlock(&rwl_host_allocations);
-    for (auto it = host_allocations.begin(); it != host_allocations.end();
-         it++) {
-      Emit().EmitVulkanMemoryUsageEvent(
-          it->second->GetVulkanMemoryEvent().get());
-    }
+    host_allocations.ForEach(
+        [](uintptr_t, const HostAllocation& allocation) {
+          Emit().EmitVulkanMemoryUsageEvent(
+              allocation.GetVulkanMemoryEvent().get());
+        });
   }
 }
 
 void MemoryTracker::EmitAllStoredEventsIfNecessary() {
-  if (initial_state_is_sent_) return;
-  initial_state_is_sent_ = true;
-  // While generating the memory usage events, we do not care about the thread
-  // info. Therefore, we can safely delegate sending the stored events to
-  // another thread.
-  std::thread emitter(&MemoryTracker::EmitAndClearAllStoredEvents, this);
+  // The event log is not consumed while the stored events are emitted, so
+  // that the logged events are emitted after the stored state they follow.
+  event_logger.SendStateOnce([this] {
+    // While generating the memory usage events, we do not care about the
+    // thread info. Therefore, we can safely delegate sending the stored events
+    // to another thread.
+    std::thread emitter(&MemoryTracker::EmitAndClearAllStoredEvents, this);
+    emitter.join();
+  });
+}
+
+// ------------------------- Logging the memory events -------------------------
+
+// Returns the mask of the count queue family indices.
+uint64_t QueueFamilyMask(uint32_t count, const uint32_t* indices) {
+  uint64_t mask = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    assert(indices[i] < kMaxRecordedQueueFamilies);
+    if (indices[i] < kMaxRecordedQueueFamilies) {
+      mask |= uint64_t(1) << indices[i];
+    }
+  }
+  return mask;
+}
+
+MemoryEventRecord MemoryTracker::NewRecord(MemoryEventKind kind,
+                                           VkDevice device) {
+  MemoryEventRecord record = {};
+  record.kind = kind;
+  record.timestamp = perfetto::base::GetBootTimeNs().count();
+  record.device = device;
+  return record;
+}
+
+uint32_t MemoryTracker::GetHeapIndex(VkDevice device, uint32_t memory_type) {
+  scoped_read_lock rlock(&rwl_devices);
+  auto it = devices.find(device);
+  if (it == devices.end() || memory_type == UINT32_MAX) return UINT32_MAX;
+  return it->second->GetHeapIndex(memory_type);
+}
+
+void MemoryTracker::LogEvent(const MemoryEventRecord& record) {
+  // While the log is full, make room by applying the logged events to the
+  // stored state, or wait for the emitter thread to catch up if the trace is
+  // started and the stored state was sent.
+  event_logger.Log(
+      record, [] { return Emit().Enabled(); },
+      [this](const MemoryEventRecord& r) { StoreEvent(r); });
+}
+
+bool MemoryTracker::CollapseEventLog() {
+  return event_logger.Collapse(
+      [] { return Emit().Enabled(); },
+      [this](const MemoryEventRecord& r) { StoreEvent(r); });
+}
+
+void MemoryTracker::RunEmitter() {
+  for (;;) {
+    // Once interrupted, the events logged so far are still emitted.
+    bool running = event_logger.Wait([] { return Emit().Enabled(); });
+    if (Emit().Enabled()) {
+      EmitAllStoredEventsIfNecessary();
+      event_logger.Emit(kEmitBatchSize, [](const MemoryEventRecord& r) {
+        Emit().EmitVulkanMemoryUsageEvent(r.GetVulkanMemoryEvent().get());
+      });
+    }
+    if (!running) return;
+  }
+}
+
+void MemoryTracker::ProcessCreateInstanceEvent() {
+  std::lock_guard<mutex> lock(instances_mutex);
+  if (instance_count++ == 0) {
+    emitter = std::thread(&MemoryTracker::RunEmitter, this);
+  }
+}
+
+void MemoryTracker::ProcessDestroyInstanceEvent() {
+  std::lock_guard<mutex> lock(instances_mutex);
+  if (instance_count == 0 || --instance_count > 0) return;
+  event_logger.Interrupt();
   emitter.join();
 }
 
@@ -1331,207 +1186,31 @@ void MemoryTracker::EmitDestoryDeviceEvent(VkDevice device) {
   Emit().EmitVulkanMemoryUsageEvent(event.get());
 }
 
-void MemoryTracker::EmitAllocateMemoryEvent(
-    VkDevice device, VkDeviceMemory memory,
-    VkMemoryAllocateInfo const* allocate_info) {
-  EmitAllStoredEventsIfNecessary();
-  auto device_memory = make_unique<DeviceMemory>(memory, allocate_info);
-  auto event = device_memory->GetVulkanMemoryEvent();
-  event->has_device = true;
-  event->device = (uint64_t)(device);
-  auto memory_type = allocate_info->memoryTypeIndex;
-  event->has_heap = true;
-  if (!devices[device])
-    event->heap = UINT32_MAX;
-  else
-    event->heap = devices[device]->GetHeapIndex(memory_type);
-  event->has_memory_type = true;
-  event->memory_type = memory_type;
-  {
-    scoped_write_lock wlock(&rwl_device_memory_type_map);
-    device_memory_type_map[memory] = memory_type;
-  }
-  Emit().EmitVulkanMemoryUsageEvent(event.get());
-}
-
-void MemoryTracker::EmitFreeMemoryEvent(VkDevice device,
-                                        VkDeviceMemory device_memory) {
-  EmitAllStoredEventsIfNecessary();
-  auto event = make_unique<VulkanMemoryEvent>();
-  event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
-      VulkanMemoryEvent_Source_SOURCE_DEVICE_MEMORY;
-  event->operation = perfetto::protos::pbzero::VulkanMemoryEvent_Operation::
-      VulkanMemoryEvent_Operation_OP_DESTROY;
-  event->timestamp = perfetto::base::GetBootTimeNs().count();
-  event->has_device = true;
-  event->device = (uint64_t)(device);
-  event->has_object_handle = true;
-  event->object_handle = (uint64_t)(device_memory);
-  Emit().EmitVulkanMemoryUsageEvent(event.get());
-}
-
-void MemoryTracker::EmitCreateBufferEvent(
-    VkDevice device, VkBuffer buffer, VkBufferCreateInfo const* create_info) {
-  EmitAllStoredEventsIfNecessary();
-  auto crinfo = CreateBufferInfo(create_info, device);
-  auto event = crinfo.GetVulkanMemoryEvent();
-  event->has_device = true;
-  event->device = (uint64_t)(device);
-  VkMemoryRequirements memory_requirements;
-  GetGlobalContext()
-      .GetVkDeviceData(device)
-      ->functions->vkGetBufferMemoryRequirements(device, buffer,
-                                                 &memory_requirements);
-  event->has_memory_size = true;
-  event->memory_size = memory_requirements.size;
-  event->has_object_handle = true;
-  auto buffer_handle = UniqueHandleGenerator::GetBufferHandle(buffer);
-  event->object_handle = buffer_handle;
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("vk_handle", (uint64_t)(buffer)));
-  Emit().EmitVulkanMemoryUsageEvent(event.get());
-}
-
-void MemoryTracker::EmitBindBufferEvent(VkDevice device, VkBuffer buffer,
-                                        VkDeviceMemory device_memory,
-                                        size_t offset) {
-  EmitAllStoredEventsIfNecessary();
-  uint32_t memory_type = UINT32_MAX;
-  {
-    scoped_read_lock rlock(&rwl_device_memory_type_map);
-    memory_type = device_memory_type_map[device_memory];
-  }
-  auto bindinfo = BindMemoryInfo(
-      device_memory, global_unique_handles[(uint64_t)(device_memory)], offset,
-      memory_type);
-  auto event = bindinfo.GetVulkanMemoryEvent();
-  event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
-      VulkanMemoryEvent_Source_SOURCE_BUFFER;
-  event->has_device = true;
-  event->device = (uint64_t)(device);
-  event->has_heap = true;
-  {
-    scoped_read_lock rlock(&rwl_devices);
-    event->heap = devices[device]->GetHeapIndex(memory_type);
-  }
-  event->has_object_handle = true;
-  event->object_handle = global_unique_handles[(uint64_t)(buffer)];
-  VkMemoryRequirements memory_requirements;
-  GetGlobalContext()
-      .GetVkDeviceData(device)
-      ->functions->vkGetBufferMemoryRequirements(device, buffer,
-                                                 &memory_requirements);
-  event->has_memory_size = true;
-  event->memory_size = memory_requirements.size;
-  Emit().EmitVulkanMemoryUsageEvent(event.get());
-}
-
-void MemoryTracker::EmitDestroyBufferEvent(VkDevice device, VkBuffer buffer) {
-  EmitAllStoredEventsIfNecessary();
-  auto event = make_unique<VulkanMemoryEvent>();
-  event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
-      VulkanMemoryEvent_Source_SOURCE_BUFFER;
-  event->operation = perfetto::protos::pbzero::VulkanMemoryEvent_Operation::
-      VulkanMemoryEvent_Operation_OP_DESTROY;
-  event->timestamp = perfetto::base::GetBootTimeNs().count();
-  event->has_device = true;
-  event->device = (uint64_t)(device);
-  event->has_object_handle = true;
-  event->object_handle = global_unique_handles[(uint64_t)(buffer)];
-  Emit().EmitVulkanMemoryUsageEvent(event.get());
-}
-
-void MemoryTracker::EmitCreateImageEvent(VkDevice device, VkImage image,
-                                         VkImageCreateInfo const* create_info) {
-  EmitAllStoredEventsIfNecessary();
-  auto crinfo = CreateImageInfo(create_info, device);
-  auto event = crinfo.GetVulkanMemoryEvent();
-  event->has_device = true;
-  event->device = (uint64_t)(device);
-  VkMemoryRequirements memory_requirements;
-  GetGlobalContext()
-      .GetVkDeviceData(device)
-      ->functions->vkGetImageMemoryRequirements(device, image,
-                                                &memory_requirements);
-  event->has_memory_size = true;
-  event->memory_size = memory_requirements.size;
-  event->has_object_handle = true;
-  auto image_handle = UniqueHandleGenerator::GetImageHandle(image);
-  event->object_handle = image_handle;
-  event->annotations.push_back(
-      VulkanMemoryEventAnnotation("vk_handle", (uint64_t)(image)));
-  Emit().EmitVulkanMemoryUsageEvent(event.get());
-}
-
-void MemoryTracker::EmitBindImageEvent(VkDevice device, VkImage image,
-                                       VkDeviceMemory device_memory,
-                                       size_t offset) {
-  EmitAllStoredEventsIfNecessary();
-  uint32_t memory_type = UINT32_MAX;
-  {
-    scoped_read_lock rlock(&rwl_device_memory_type_map);
-    memory_type = device_memory_type_map[device_memory];
-  }
-  auto bindinfo = BindMemoryInfo(
-      device_memory, global_unique_handles[(uint64_t)(device_memory)], offset,
-      memory_type);
-  auto event = bindinfo.GetVulkanMemoryEvent();
-  event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
-      VulkanMemoryEvent_Source_SOURCE_IMAGE;
-  event->has_device = true;
-  event->device = (uint64_t)(device);
-  event->has_heap = true;
-  {
-    scoped_read_lock rlock(&rwl_devices);
-    event->heap = devices[device]->GetHeapIndex(memory_type);
-  }
-  event->has_object_handle = true;
-  event->object_handle = global_unique_handles[(uint64_t)(image)];
-  VkMemoryRequirements memory_requirements;
-  GetGlobalContext()
-      .GetVkDeviceData(device)
-      ->functions->vkGetImageMemoryRequirements(device, image,
-                                                &memory_requirements);
-  event->has_memory_size = true;
-  event->memory_size = memory_requirements.size;
-  Emit().EmitVulkanMemoryUsageEvent(event.get());
-}
-
-void MemoryTracker::EmitDestroyImageEvent(VkDevice device, VkImage image) {
-  EmitAllStoredEventsIfNecessary();
-  auto event = make_unique<VulkanMemoryEvent>();
-  event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
-      VulkanMemoryEvent_Source_SOURCE_IMAGE;
-  event->operation = perfetto::protos::pbzero::VulkanMemoryEvent_Operation::
-      VulkanMemoryEvent_Operation_OP_DESTROY;
-  event->timestamp = perfetto::base::GetBootTimeNs().count();
-  event->has_device = true;
-  event->device = (uint64_t)(device);
-  event->has_object_handle = true;
-  event->object_handle = global_unique_handles[(uint64_t)(image)];
-  Emit().EmitVulkanMemoryUsageEvent(event.get());
-}
-
 void MemoryTracker::EmitHostMemoryAllocationEvent(
     uintptr_t ptr, size_t size, size_t alignment, VkSystemAllocationScope scope,
-    const std::string& caller_api, AllocatorType allocator_type) {
+    CallerApi caller_api, AllocatorType allocator_type) {
   EmitAllStoredEventsIfNecessary();
   auto timestamp = perfetto::base::GetBootTimeNs().count();
-  HostAllocationPtr allocation = make_unique<HostAllocation>(
-      timestamp, ptr, size, alignment, scope, caller_api, allocator_type);
-  auto event = allocation->GetVulkanMemoryEvent();
+  HostAllocation allocation(timestamp, ptr, size, alignment, scope, caller_api,
+                            allocator_type);
+  host_allocations.Set(ptr, allocation);
+  auto event = allocation.GetVulkanMemoryEvent();
   Emit().EmitVulkanMemoryUsageEvent(event.get());
 }
 
 void MemoryTracker::EmitHostMemoryReallocationEvent(
     uintptr_t ptr, uintptr_t original, size_t size, size_t alignment,
-    VkSystemAllocationScope scope, const std::string& caller_api,
+    VkSystemAllocationScope scope, CallerApi caller_api,
     AllocatorType allocator_type) {
   EmitAllStoredEventsIfNecessary();
   auto timestamp = perfetto::base::GetBootTimeNs().count();
-  HostAllocationPtr allocation = make_unique<HostAllocation>(
-      timestamp, ptr, size, alignment, scope, caller_api, allocator_type);
-  auto event = allocation->GetVulkanMemoryEvent();
+  HostAllocation allocation(timestamp, ptr, size, alignment, scope, caller_api,
+                            allocator_type);
+  if (original != ptr) {
+    host_allocations.Erase(original);
+  }
+  host_allocations.Set(ptr, allocation);
+  auto event = allocation.GetVulkanMemoryEvent();
   event->annotations.push_back(
       VulkanMemoryEventAnnotation("original_ptr", (int)(original)));
   Emit().EmitVulkanMemoryUsageEvent(event.get());
@@ -1539,6 +1218,7 @@ void MemoryTracker::EmitHostMemoryReallocationEvent(
 
 void MemoryTracker::EmitHostMemoryFreeEvent(uintptr_t ptr) {
   EmitAllStoredEventsIfNecessary();
+  host_allocations.Erase(ptr);
   auto event = make_unique<core::VulkanMemoryEvent>();
   event->source = perfetto::protos::pbzero::VulkanMemoryEvent_Source::
       VulkanMemoryEvent_Source_SOURCE_DRIVER;
@@ -1571,67 +1251,151 @@ void MemoryTracker::ProcessAllocateMemoryEvent(
     VkDevice device, VkDeviceMemory memory,
     VkMemoryAllocateInfo const* allocate_info) {
   if (!Emit().CategoryEnabled("Device")) return;
-  if (Emit().Enabled())
-    return EmitAllocateMemoryEvent(device, memory, allocate_info);
-  return StoreAllocateMemoryEvent(device, memory, allocate_info);
+  auto record = NewRecord(mekAllocateMemory, device);
+  record.handle = (uint64_t)(memory);
+  record.unique_handle = UniqueHandleGenerator::GetDeviceMemoryHandle(memory);
+  record.size = allocate_info->allocationSize;
+  record.memory_type = allocate_info->memoryTypeIndex;
+  record.heap = GetHeapIndex(device, record.memory_type);
+  {
+    scoped_write_lock wlock(&rwl_device_memory_type_map);
+    device_memory_type_map[memory] = record.memory_type;
+  }
+  LogEvent(record);
 }
 
 void MemoryTracker::ProcessFreeMemoryEvent(VkDevice vk_device,
                                            VkDeviceMemory vk_device_memory) {
   if (!Emit().CategoryEnabled("Device")) return;
-  if (Emit().Enabled()) return EmitFreeMemoryEvent(vk_device, vk_device_memory);
-  return StoreFreeMemoryEvent(vk_device, vk_device_memory);
+  auto record = NewRecord(mekFreeMemory, vk_device);
+  record.handle = (uint64_t)(vk_device_memory);
+  LogEvent(record);
 }
 
 void MemoryTracker::ProcessCreateBufferEvent(
     VkDevice device, VkBuffer buffer, VkBufferCreateInfo const* create_info) {
   if (!Emit().CategoryEnabled("Device")) return;
-  if (Emit().Enabled())
-    return EmitCreateBufferEvent(device, buffer, create_info);
-  return StoreCreateBufferEvent(device, buffer, create_info);
+  auto record = NewRecord(mekCreateBuffer, device);
+  record.handle = (uint64_t)(buffer);
+  record.unique_handle = UniqueHandleGenerator::GetBufferHandle(buffer);
+  VkMemoryRequirements memory_requirements;
+  GetGlobalContext()
+      .GetVkDeviceData(device)
+      ->functions->vkGetBufferMemoryRequirements(device, buffer,
+                                                 &memory_requirements);
+  record.size = memory_requirements.size;
+  record.flags = create_info->flags;
+  record.usage = create_info->usage;
+  record.sharing_mode = create_info->sharingMode;
+  if (record.sharing_mode == VK_SHARING_MODE_CONCURRENT) {
+    record.queue_families = QueueFamilyMask(
+        create_info->queueFamilyIndexCount, create_info->pQueueFamilyIndices);
+  }
+  LogEvent(record);
 }
 
 void MemoryTracker::ProcessBindBufferEvent(VkDevice device, VkBuffer buffer,
                                            VkDeviceMemory memory,
                                            size_t offset) {
   if (!Emit().CategoryEnabled("Device")) return;
-  if (Emit().Enabled())
-    return EmitBindBufferEvent(device, buffer, memory, offset);
-  return StoreBindBufferEvent(device, buffer, memory, offset);
+  auto record = NewRecord(mekBindBuffer, device);
+  record.handle = (uint64_t)(buffer);
+  record.memory = memory;
+  record.memory_offset = offset;
+  {
+    scoped_read_lock rlock(&rwl_device_memory_type_map);
+    auto it = device_memory_type_map.find(memory);
+    record.memory_type =
+        it == device_memory_type_map.end() ? UINT32_MAX : it->second;
+  }
+  record.unique_handle = GetUniqueHandle((uint64_t)(buffer));
+  record.memory_handle = GetUniqueHandle((uint64_t)(memory));
+  record.heap = GetHeapIndex(device, record.memory_type);
+  VkMemoryRequirements memory_requirements;
+  GetGlobalContext()
+      .GetVkDeviceData(device)
+      ->functions->vkGetBufferMemoryRequirements(device, buffer,
+                                                 &memory_requirements);
+  record.size = memory_requirements.size;
+  LogEvent(record);
 }
 
 void MemoryTracker::ProcessDestroyBufferEvent(VkDevice device,
                                               VkBuffer buffer) {
   if (!Emit().CategoryEnabled("Device")) return;
-  if (Emit().Enabled()) return EmitDestroyBufferEvent(device, buffer);
-  return StoreDestroyBufferEvent(device, buffer);
+  auto record = NewRecord(mekDestroyBuffer, device);
+  record.handle = (uint64_t)(buffer);
+  record.unique_handle = GetUniqueHandle((uint64_t)(buffer));
+  LogEvent(record);
 }
 
 void MemoryTracker::ProcessCreateImageEvent(
     VkDevice device, VkImage image, const VkImageCreateInfo* create_info) {
   if (!Emit().CategoryEnabled("Device")) return;
-  if (Emit().Enabled()) return EmitCreateImageEvent(device, image, create_info);
-  return StoreCreateImageEvent(device, image, create_info);
+  auto record = NewRecord(mekCreateImage, device);
+  record.handle = (uint64_t)(image);
+  record.unique_handle = UniqueHandleGenerator::GetImageHandle(image);
+  VkMemoryRequirements memory_requirements;
+  GetGlobalContext()
+      .GetVkDeviceData(device)
+      ->functions->vkGetImageMemoryRequirements(device, image,
+                                                &memory_requirements);
+  record.size = memory_requirements.size;
+  record.flags = create_info->flags;
+  record.image_type = create_info->imageType;
+  record.format = create_info->format;
+  record.extent = create_info->extent;
+  record.mip_levels = create_info->mipLevels;
+  record.array_layers = create_info->arrayLayers;
+  record.samples = create_info->samples;
+  record.tiling = create_info->tiling;
+  record.usage = create_info->usage;
+  record.sharing_mode = create_info->sharingMode;
+  if (record.sharing_mode == VK_SHARING_MODE_CONCURRENT) {
+    record.queue_families = QueueFamilyMask(
+        create_info->queueFamilyIndexCount, create_info->pQueueFamilyIndices);
+  }
+  record.initial_layout = create_info->initialLayout;
+  LogEvent(record);
 }
 
 void MemoryTracker::ProcessBindImageEvent(VkDevice device, VkImage image,
                                           VkDeviceMemory memory,
                                           size_t offset) {
   if (!Emit().CategoryEnabled("Device")) return;
-  if (Emit().Enabled())
-    return EmitBindImageEvent(device, image, memory, offset);
-  return StoreBindImageEvent(device, image, memory, offset);
+  auto record = NewRecord(mekBindImage, device);
+  record.handle = (uint64_t)(image);
+  record.memory = memory;
+  record.memory_offset = offset;
+  {
+    scoped_read_lock rlock(&rwl_device_memory_type_map);
+    auto it = device_memory_type_map.find(memory);
+    record.memory_type =
+        it == device_memory_type_map.end() ? UINT32_MAX : it->second;
+  }
+  record.unique_handle = GetUniqueHandle((uint64_t)(image));
+  record.memory_handle = GetUniqueHandle((uint64_t)(memory));
+  record.heap = GetHeapIndex(device, record.memory_type);
+  VkMemoryRequirements memory_requirements;
+  GetGlobalContext()
+      .GetVkDeviceData(device)
+      ->functions->vkGetImageMemoryRequirements(device, image,
+                                                &memory_requirements);
+  record.size = memory_requirements.size;
+  LogEvent(record);
 }
 
 void MemoryTracker::ProcessDestroyImageEvent(VkDevice device, VkImage image) {
   if (!Emit().CategoryEnabled("Device")) return;
-  if (Emit().Enabled()) return EmitDestroyImageEvent(device, image);
-  return StoreDestroyImageEvent(device, image);
+  auto record = NewRecord(mekDestroyImage, device);
+  record.handle = (uint64_t)(image);
+  record.unique_handle = GetUniqueHandle((uint64_t)(image));
+  LogEvent(record);
 }
 
 void MemoryTracker::ProcessHostMemoryAllocationEvent(
     uintptr_t ptr, size_t size, size_t alignment, VkSystemAllocationScope scope,
-    const std::string& caller_api, AllocatorType allocator_type) {
+    CallerApi caller_api, AllocatorType allocator_type) {
   if (Emit().Enabled())
     return EmitHostMemoryAllocationEvent(ptr, size, alignment, scope,
                                          caller_api, allocator_type);
@@ -1641,7 +1405,7 @@ void MemoryTracker::ProcessHostMemoryAllocationEvent(
 
 void MemoryTracker::ProcessHostMemoryReallocationEvent(
     uintptr_t ptr, uintptr_t original, size_t size, size_t alignment,
-    VkSystemAllocationScope scope, const std::string& caller_api,
+    VkSystemAllocationScope scope, CallerApi caller_api,
     AllocatorType allocator_type) {
   if (Emit().Enabled())
     return EmitHostMemoryReallocationEvent(ptr, original, size, alignment,
@@ -1655,4 +1419,9 @@ void MemoryTracker::ProcessHostMemoryFreeEvent(uintptr_t ptr) {
   return StoreHostMemoryFreeEvent(ptr);
 }
 
+size_t MemoryTracker::GetHostAllocationSize(uintptr_t ptr) {
+  HostAllocation allocation;
+  return host_allocations.Get(ptr, &allocation) ? allocation.Size() : 0;
+}
+
 }  // namespace memory_tracker
\ No newline at end of file
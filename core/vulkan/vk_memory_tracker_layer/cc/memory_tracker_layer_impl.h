@@ -19,20 +19,25 @@
 
 #include <city.h>
 
+#include <atomic>
 #include <chrono>
 #include <deque>
 #include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
 #include "core/vulkan/layer_helpers/threading.h"
 #include "core/vulkan/perfetto_producer/perfetto_proto_structs.h"
+#include "core/vulkan/vk_memory_tracker_layer/cc/event_log.h"
 #include "core/vulkan/vk_memory_tracker_layer/cc/layer.h"
+#include "core/vulkan/vk_memory_tracker_layer/cc/sharded_pointer_map.h"
 
 namespace memory_tracker {
 
@@ -73,113 +78,102 @@ using VulkanMemoryEventContainerSet = std::deque<VulkanMemoryEventContainerPtr>;
 using VulkanMemoryEventContainerSetPtr =
     std::unique_ptr<VulkanMemoryEventContainerSet>;
 
-// Used for CreateImageInfo and
-class BindMemoryInfo {
- public:
-  BindMemoryInfo(VkDeviceMemory, UniqueHandle, VkDeviceSize,
-                 uint32_t /*memory_type*/);
-  VulkanMemoryEventPtr GetVulkanMemoryEvent();
-  VkDeviceMemory GetDeviceMemory() { return device_memory_; }
-
- private:
-  uint64_t timestamp_;
-  VkDeviceMemory device_memory_;
-  UniqueHandle device_memory_handle_;
-  VkDeviceSize memory_offset_;
-  uint32_t memory_type_;
+// ------------------------------ Memory events ------------------------------
+
+enum MemoryEventKind {
+  mekAllocateMemory,
+  mekFreeMemory,
+  mekCreateBuffer,
+  mekBindBuffer,
+  mekDestroyBuffer,
+  mekCreateImage,
+  mekBindImage,
+  mekDestroyImage,
 };
-using BindMemoryInfoPtr = std::unique_ptr<BindMemoryInfo>;
-
-class CreateBufferInfo {
- public:
-  CreateBufferInfo(VkBufferCreateInfo const*, VkDevice);
-  VulkanMemoryEventPtr GetVulkanMemoryEvent();
-  VkDevice GetVkDevice() { return device; }
 
- private:
+// The queue families of the buffers and images created with
+// VK_SHARING_MODE_CONCURRENT are recorded as a mask of their indices, which
+// must be below kMaxRecordedQueueFamilies. Devices expose far fewer queue
+// families.
+const uint32_t kMaxRecordedQueueFamilies = 64;
+
+// MemoryEventRecord is the fixed size record of a device memory, buffer or
+// image event. It holds all the data required to emit the event, or to apply
+// it to the stored state of the memory, as they were when the event happened,
+// so that the event can be processed later on another thread.
+struct MemoryEventRecord {
+  MemoryEventKind kind;
   uint64_t timestamp;
   VkDevice device;
-  VkBufferCreateFlags flags;
+  uint64_t handle;             // VkDeviceMemory, VkBuffer or VkImage.
+  UniqueHandle unique_handle;  // of the device memory, buffer or image.
+  // The allocation size of the device memory, or the required memory size of
+  // the buffer or image.
   VkDeviceSize size;
-  VkBufferUsageFlags usage;
+  uint32_t memory_type;  // allocate and bind events.
+  uint32_t heap;         // allocate and bind events.
+
+  // Bind events
+  VkDeviceMemory memory;
+  UniqueHandle memory_handle;
+  VkDeviceSize memory_offset;
+
+  // Create events
+  VkFlags flags;
+  VkFlags usage;
   VkSharingMode sharing_mode;
-  std::deque<uint32_t> queue_family_indices;
+  uint64_t queue_families;  // bit i is set if queue family i is recorded.
+
+  // Create image events
+  VkImageType image_type;
+  VkFormat format;
+  VkExtent3D extent;
+  uint32_t mip_levels;
+  uint32_t array_layers;
+  VkSampleCountFlagBits samples;
+  VkImageTiling tiling;
+  VkImageLayout initial_layout;
+
+  VulkanMemoryEventPtr GetVulkanMemoryEvent() const;
 };
-using CreateBufferInfoPtr = std::unique_ptr<CreateBufferInfo>;
+
+// ----------------------------- Memory objects -----------------------------
 
 // Parent class for Buffer and Image
 class MemoryObject {
  public:
-  UniqueHandle GetUniqueHandle() { return unique_handle; }
-  void SetBound() { is_bound = true; }
+  MemoryObject(const MemoryEventRecord& create_record_)
+      : is_bound(false), create_record(create_record_), bind_record() {}
+  UniqueHandle GetUniqueHandle() { return create_record.unique_handle; }
+  void SetBound(const MemoryEventRecord& bind_record_) {
+    is_bound = true;
+    bind_record = bind_record_;
+  }
   bool Bound() { return is_bound; }
+  VkDeviceMemory GetDeviceMemory() { return bind_record.memory; }
+  VulkanMemoryEventContainerPtr GetVulkanMemoryEvents();
 
  protected:
   bool is_bound;
-  UniqueHandle unique_handle;
+  MemoryEventRecord create_record;
+  MemoryEventRecord bind_record;
 };
 
 class Buffer : public MemoryObject {
  public:
-  Buffer(VkBuffer, CreateBufferInfoPtr);
-  VulkanMemoryEventContainerPtr GetVulkanMemoryEvents();
-  VkBuffer GetVkBuffer() { return vk_buffer; }
-  VkDeviceMemory GetDeviceMemory() {
-    return bind_buffer_info->GetDeviceMemory();
-  }
-  void SetBindBufferInfo(BindMemoryInfoPtr info) {
-    bind_buffer_info = std::move(info);
-  }
-
- private:
-  const VkBuffer vk_buffer;
-  CreateBufferInfoPtr create_buffer_info;
-  BindMemoryInfoPtr bind_buffer_info;
+  Buffer(const MemoryEventRecord& create_record_)
+      : MemoryObject(create_record_) {}
+  VkBuffer GetVkBuffer() { return (VkBuffer)(create_record.handle); }
 };
 using BufferPtr = std::unique_ptr<Buffer>;
 using BufferMap = std::unordered_map<VkBuffer, BufferPtr>;
 using BufferMapInvalid = std::unordered_map<UniqueHandle, BufferPtr>;
 
-class CreateImageInfo {
- public:
-  CreateImageInfo(VkImageCreateInfo const*, VkDevice);
-  VulkanMemoryEventPtr GetVulkanMemoryEvent();
-  VkDevice GetVkDevice() { return device; }
-
- private:
-  uint64_t timestamp;
-  VkDevice device;
-  VkImageCreateFlags flags;
-  VkImageType image_type;
-  VkFormat format;
-  VkExtent3D extent;
-  uint32_t mip_levels;
-  uint32_t array_layers;
-  VkSampleCountFlagBits samples;
-  VkImageTiling tiling;
-  VkImageUsageFlags usage;
-  VkSharingMode sharing_mode;
-  std::deque<uint32_t> queue_family_indices;
-  VkImageLayout initial_layout;
-};
-using CreateImageInfoPtr = std::unique_ptr<CreateImageInfo>;
-
 class Image : public MemoryObject {
  public:
-  Image(VkImage, CreateImageInfoPtr);
-  VulkanMemoryEventContainerPtr GetVulkanMemoryEvents();
-  VkImage GetVkImage() { return vk_image; }
-  VkDeviceMemory GetDeviceMemory() {
-    return bind_image_info->GetDeviceMemory();
-  }
-  void SetBindImageInfo(BindMemoryInfoPtr info) {
-    bind_image_info = std::move(info);
-  }
-
- private:
-  const VkImage vk_image;
-  CreateImageInfoPtr create_image_info;
-  BindMemoryInfoPtr bind_image_info;
+  Image(const MemoryEventRecord& create_record_)
+      : MemoryObject(create_record_) {}
+  VkImage GetVkImage() { return (VkImage)(create_record.handle); }
 };
 using ImagePtr = std::unique_ptr<Image>;
 using ImageMap = std::unordered_map<VkImage, ImagePtr>;
@@ -187,11 +181,16 @@ using ImageMapInvalid = std::unordered_map<UniqueHandle, ImagePtr>;
 
 class DeviceMemory {
  public:
-  DeviceMemory(VkDeviceMemory, VkMemoryAllocateInfo const*);
-  VulkanMemoryEventPtr GetVulkanMemoryEvent();
-  VkDeviceMemory GetVkHandle() { return memory; }
-  UniqueHandle GetUniqueHandle() { return unique_handle; }
-  uint32_t GetMemoryType() { return memory_type; }
+  DeviceMemory(const MemoryEventRecord& allocate_record_)
+      : allocate_record(allocate_record_) {}
+  VulkanMemoryEventPtr GetVulkanMemoryEvent() {
+    return allocate_record.GetVulkanMemoryEvent();
+  }
+  VkDeviceMemory GetVkHandle() {
+    return (VkDeviceMemory)(allocate_record.handle);
+  }
+  UniqueHandle GetUniqueHandle() { return allocate_record.unique_handle; }
+  uint32_t GetMemoryType() { return allocate_record.memory_type; }
 
   void ClearBoundImages() { bound_images.clear(); }
   void EmplaceBoundImage(VkImage image) { bound_images.emplace(image); }
@@ -214,11 +213,7 @@ class DeviceMemory {
   }
 
  private:
-  uint64_t timestamp;
-  const VkDeviceMemory memory;
-  VkDeviceSize allocation_size;
-  uint32_t memory_type;
-  UniqueHandle unique_handle;
+  const MemoryEventRecord allocate_record;
   // We need this to invalidate the bound images and buffers when the device
   // memory is destroyed.
   std::unordered_set<VkImage> bound_images;
@@ -238,9 +233,9 @@ class Heap {
   Heap(VkDeviceSize, VkMemoryHeapFlags);
   void AddDeviceMemory(DeviceMemoryPtr);
   void DestroyDeviceMemory(VkDeviceMemory);
-  void BindBuffer(BufferPtr, VkDeviceMemory, VkDeviceSize);
+  void BindBuffer(BufferPtr, const MemoryEventRecord& bind_record);
   void DestroyBuffer(VkBuffer);
-  void BindImage(ImagePtr, VkDeviceMemory, VkDeviceSize);
+  void BindImage(ImagePtr, const MemoryEventRecord& bind_record);
   void DestroyImage(VkImage);
   VkDeviceSize GetSize() { return size; }
   VkMemoryHeapFlags GetFlags() { return flags; }
@@ -280,8 +275,8 @@ class PhysicalDevice {
   PhysicalDevice(VkPhysicalDevice);
   VkPhysicalDevice GetVkPhysicalDevice() { return physical_device; }
   void AddDeviceMemory(VkDevice, DeviceMemoryPtr);
-  void BindBuffer(BufferPtr, VkDeviceMemory, VkDeviceSize);
-  void BindImage(ImagePtr, VkDeviceMemory, VkDeviceSize);
+  void BindBuffer(BufferPtr, const MemoryEventRecord& bind_record);
+  void BindImage(ImagePtr, const MemoryEventRecord& bind_record);
 
   void DestroyDeviceMemory(VkDevice, VkDeviceMemory, bool);
   void DestroyAllDeviceMemories(VkDevice);
@@ -326,10 +321,10 @@ class Device {
   void DestroyDeviceMemory(VkDeviceMemory);
   void DestroyAllDeviceMemories();
   void AddBuffer(BufferPtr);
-  void BindBuffer(VkBuffer, VkDeviceMemory, VkDeviceSize);
+  void BindBuffer(const MemoryEventRecord& bind_record);
   void DestroyBuffer(VkBuffer);
   void AddImage(ImagePtr);
-  void BindImage(VkImage, VkDeviceMemory, VkDeviceSize);
+  void BindImage(const MemoryEventRecord& bind_record);
   void DestroyImage(VkImage);
   uint32_t GetHeapIndex(uint32_t /*memory_type*/);
   VulkanMemoryEventContainerSetPtr GetVulkanMemoryEvents();
@@ -357,32 +352,26 @@ using DeviceMap = std::unordered_map<VkDevice, DevicePtr>;
 enum AllocatorType { atDefault, atUser };
 using AllocationCallbacksHandle = uint64_t;
 
+// The name of the Vulkan function that requested the memory. Caller API names
+// are interned, so that the host allocations only hold a pointer to the name
+// of their caller, and names can be compared by pointer.
+using CallerApi = const std::string*;
+CallerApi InternCallerApi(const std::string& name);
+
 class AllocationCallbacksTracker {
  private:
   VkAllocationCallbacks tracked_allocator = {};
 
-  // Since function pointers must be static members of the class, we need to
-  // keep all the required information in static map objects. For now, we store
-  // the following data items:
-  // - user provided allocation callbacks
-  // - user provided data (pUserData parameter)
-  // - name of the Vulkan function that requested the memory
-  // - size of the allocations, to be used in non-WIN32 code for realloc
-
-  static rwlock rwl_global_callback_mapping;
-  static std::unordered_map<uintptr_t, const VkAllocationCallbacks*>
-      global_callback_mapping;
-
-  static rwlock rwl_global_user_data_mapping;
-  static std::unordered_map<uintptr_t, uintptr_t> global_user_data_mapping;
-
-  static rwlock rwl_global_caller_api_mapping;
-  static std::unordered_map<uintptr_t, std::string> global_caller_api_mapping;
-
-#if !defined(WIN32)
-  static rwlock rwl_global_allocation_size_mapping;
-  static std::unordered_map<uintptr_t, size_t> global_allocation_size_mapping;
-#endif
+  // Since function pointers must be static members of the class, the tracked
+  // allocation functions get the tracker from their pUserData parameter, and
+  // the tracker holds the data they require:
+  // - a copy of the user provided allocation callbacks, and of their
+  //   pUserData, or zeros if the default allocator is used
+  // - the interned name of the Vulkan function that requested the memory
+  // The trackers are never destroyed, as the driver may use the allocation
+  // callbacks until the objects created with them are destroyed.
+  VkAllocationCallbacks user_allocator = {};
+  CallerApi caller_api;
 
   // Static tracked allocation functions. We don't care about internal
   // allocation and free notification functions.
@@ -406,11 +395,14 @@ using AllocationCallbacksTrackerMap =
 
 // -------------------------- Host allocation classes --------------------------
 
+// HostAllocations are plain values, so that recording one in the
+// HostAllocationMap does not allocate memory.
 class HostAllocation {
  public:
+  HostAllocation() = default;
   HostAllocation(uint64_t timestamp_, uintptr_t ptr_, size_t size_,
                  size_t alignment_, VkSystemAllocationScope scope_,
-                 const std::string& caller_api_, AllocatorType allocator_type_)
+                 CallerApi caller_api_, AllocatorType allocator_type_)
       : timestamp(timestamp_),
         ptr(ptr_),
         size(size_),
@@ -418,23 +410,23 @@ class HostAllocation {
         scope(scope_),
         caller_api(caller_api_),
         allocator_type(allocator_type_){};
-  VulkanMemoryEventPtr GetVulkanMemoryEvent();
+  VulkanMemoryEventPtr GetVulkanMemoryEvent() const;
+  size_t Size() const { return size; }
 
  private:
-  const uint64_t timestamp;
-  const uintptr_t ptr;
-  const size_t size;
-  const size_t alignment;
-  const VkSystemAllocationScope scope;
-  const std::string caller_api;
-  const AllocatorType allocator_type;
+  uint64_t timestamp = 0;
+  uintptr_t ptr = 0;
+  size_t size = 0;
+  size_t alignment = 0;
+  VkSystemAllocationScope scope = VK_SYSTEM_ALLOCATION_SCOPE_COMMAND;
+  CallerApi caller_api = nullptr;
+  AllocatorType allocator_type = atDefault;
 };
-using HostAllocationPtr = std::unique_ptr<HostAllocation>;
 // At the moment, we don't care about the allocation history of an object if
 // the memory is reallocated. The allocation history can be easily added by
 // using a map of a container of HostAllocation and adding the proper logic to
 // respective functions in class MemoryTracker.
-using HostAllocationMap = std::unordered_map<uintptr_t, HostAllocationPtr>;
+using HostAllocationMap = ShardedPointerMap<HostAllocation>;
 
 // --------------------------- Memory events tracker ---------------------------
 
@@ -442,6 +434,11 @@ class MemoryTracker {
  public:
   MemoryTracker();
 
+  // Starts the emitter thread with the first instance, and stops it once the
+  // last instance is destroyed.
+  void ProcessCreateInstanceEvent();
+  void ProcessDestroyInstanceEvent();
+
   const VkAllocationCallbacks* GetTrackedAllocator(const VkAllocationCallbacks*,
                                                    const std::string& caller);
 
@@ -468,15 +465,19 @@ class MemoryTracker {
   void ProcessHostMemoryAllocationEvent(uintptr_t ptr, size_t size,
                                         size_t alignment,
                                         VkSystemAllocationScope scope,
-                                        const std::string& caller_api,
+                                        CallerApi caller_api,
                                         AllocatorType allocator_type);
   void ProcessHostMemoryReallocationEvent(uintptr_t ptr, uintptr_t original,
                                           size_t size, size_t alignment,
                                           VkSystemAllocationScope scope,
-                                          const std::string& caller_api,
+                                          CallerApi caller_api,
                                           AllocatorType allocator_type);
   void ProcessHostMemoryFreeEvent(uintptr_t ptr);
 
+  // Returns the size of the live host allocation at ptr, or 0 if there is no
+  // such allocation.
+  size_t GetHostAllocationSize(uintptr_t ptr);
+
  private:
   rwlock rwl_devices;
   DeviceMap devices;
@@ -484,45 +485,61 @@ class MemoryTracker {
   rwlock rwl_allocation_trackers;
   AllocationCallbacksTrackerMap m_allocation_callbacks_trackers;
 
-  rwlock rwl_host_allocations;
+  // The live host allocations. They are recorded whether the events are
+  // stored or emitted, as the reallocations need the size of the original
+  // allocations.
   HostAllocationMap host_allocations;
 
   rwlock rwl_physical_devices;
   PhysicalDeviceMap physical_devices;
 
-  bool initial_state_is_sent_;
-
   rwlock rwl_device_memory_type_map;
   std::unordered_map<VkDeviceMemory, uint32_t> device_memory_type_map;
 
+  // The device memory, buffer and image events are logged by the hooks, and
+  // emitted in batches by the emitter thread once the trace is started. While
+  // the trace is not started, the logged events are only applied to the
+  // stored state of the memory when the log is full. The event logger also
+  // tracks whether the stored state was sent. The emitter thread runs while
+  // there are instances.
+  static const size_t kEventLogCapacity = 1 << 14;
+  static const size_t kEmitBatchSize = 256;
+  EventLogger<MemoryEventRecord> event_logger;
+  mutex instances_mutex;
+  uint32_t instance_count = 0;
+  std::thread emitter;
+
+  // Returns a record of an event of the given kind happening now.
+  MemoryEventRecord NewRecord(MemoryEventKind kind, VkDevice device);
+  // Returns the heap index of memory_type on device.
+  uint32_t GetHeapIndex(VkDevice device, uint32_t memory_type);
+  // Adds the record to the event log, collapsing the log into the stored
+  // state of the memory if it is full.
+  void LogEvent(const MemoryEventRecord& record);
+  // Applies the logged events to the stored state of the memory, unless the
+  // trace is started and the stored state was sent, in which case it returns
+  // false.
+  bool CollapseEventLog();
+  // Emits the logged events while the trace is started, until the event
+  // logger is interrupted.
+  void RunEmitter();
+
   // Add the event to the current state of the memory usage.
   void StoreCreateDeviceEvent(VkPhysicalDevice physical_device,
                               VkDeviceCreateInfo const* create_info,
                               VkDevice device);
   void StoreDestoryDeviceEvent(VkDevice device);
-  void StoreAllocateMemoryEvent(VkDevice device, VkDeviceMemory memory,
-                                VkMemoryAllocateInfo const* allocate_info);
-  void StoreFreeMemoryEvent(VkDevice device, VkDeviceMemory memory);
-  void StoreCreateBufferEvent(VkDevice device, VkBuffer buffer,
-                              const VkBufferCreateInfo* create_info);
-  void StoreBindBufferEvent(VkDevice device, VkBuffer buffer,
-                            VkDeviceMemory memory, size_t offset);
-  void StoreDestroyBufferEvent(VkDevice device, VkBuffer buffer);
-  void StoreCreateImageEvent(VkDevice device, VkImage image,
-                             const VkImageCreateInfo* create_info);
-  void StoreBindImageEvent(VkDevice device, VkImage image,
-                           VkDeviceMemory memory, size_t offset);
-  void StoreDestroyImageEvent(VkDevice device, VkImage image);
+  void StoreEvent(const MemoryEventRecord& record);
 
   void StoreHostMemoryAllocationEvent(uintptr_t ptr, size_t size,
                                       size_t alignment,
                                       VkSystemAllocationScope scope,
-                                      const std::string& caller_api,
+                                      CallerApi caller_api,
                                       AllocatorType allocator_type);
   void StoreHostMemoryReallocationEvent(uintptr_t ptr, uintptr_t original,
                                         size_t size, size_t alignment,
                                         VkSystemAllocationScope scope,
-                                        const std::string& caller_api,
+                                        CallerApi caller_api,
                                         AllocatorType allocator_type);
   void StoreHostMemoryFreeEvent(uintptr_t ptr);
 
@@ -534,29 +551,16 @@ class MemoryTracker {
                              VkDeviceCreateInfo const* create_info,
                              VkDevice device);
   void EmitDestoryDeviceEvent(VkDevice device);
-  void EmitAllocateMemoryEvent(VkDevice device, VkDeviceMemory memory,
-                               VkMemoryAllocateInfo const* allocate_info);
-  void EmitFreeMemoryEvent(VkDevice device, VkDeviceMemory memory);
-  void EmitCreateBufferEvent(VkDevice device, VkBuffer buffer,
-                             const VkBufferCreateInfo* create_info);
-  void EmitBindBufferEvent(VkDevice device, VkBuffer buffer,
-                           VkDeviceMemory memory, size_t offset);
-  void EmitDestroyBufferEvent(VkDevice device, VkBuffer buffer);
-  void EmitCreateImageEvent(VkDevice device, VkImage image,
-                            const VkImageCreateInfo* create_info);
-  void EmitBindImageEvent(VkDevice device, VkImage image, VkDeviceMemory memory,
-                          size_t offset);
-  void EmitDestroyImageEvent(VkDevice device, VkImage image);
 
   void EmitHostMemoryAllocationEvent(uintptr_t ptr, size_t size,
                                      size_t alignment,
                                      VkSystemAllocationScope scope,
-                                     const std::string& caller_api,
+                                     CallerApi caller_api,
                                      AllocatorType allocator_type);
   void EmitHostMemoryReallocationEvent(uintptr_t ptr, uintptr_t original,
                                        size_t size, size_t alignment,
                                        VkSystemAllocationScope scope,
-                                       const std::string& caller_api,
+                                       CallerApi caller_api,
                                        AllocatorType allocator_type);
   void EmitHostMemoryFreeEvent(uintptr_t ptr);
 };
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CORE_VULKAN_VK_MEMORY_TRACKER_LAYER_CC_SHARDED_POINTER_MAP_H__
+#define __CORE_VULKAN_VK_MEMORY_TRACKER_LAYER_CC_SHARDED_POINTER_MAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+#include "core/vulkan/layer_helpers/threading.h"
+
+namespace memory_tracker {
+
+// ShardedPointerMap is a thread-safe map from non-null addresses to values of
+// type V, for the host allocations made by the drivers, of which there can be
+// millions.
+//
+// The map is split into kNumShards shards by the hash of the address, each
+// guarded by its own mutex, so that threads allocating at the same time
+// rarely contend for a lock. Each shard is an open addressing hash table with
+// linear probing, so that adding and removing values does not allocate memory
+// unless the shard has to grow.
+template <typename V>
+class ShardedPointerMap {
+ public:
+  static const size_t kNumShards = 64;
+
+  ShardedPointerMap() = default;
+  ShardedPointerMap(const ShardedPointerMap&) = delete;
+  ShardedPointerMap& operator=(const ShardedPointerMap&) = delete;
+
+  // Sets the value of the address ptr, which must not be 0.
+  inline void Set(uintptr_t ptr, const V& value);
+
+  // Copies the value of the address ptr to out, and returns true if the map
+  // has a value for ptr.
+  inline bool Get(uintptr_t ptr, V* out);
+
+  // Removes the value of the address ptr, and returns true if there was one.
+  inline bool Erase(uintptr_t ptr);
+
+  // Returns the number of values in the map.
+  inline size_t Count();
+
+  // Calls f(ptr, value) for all the values of the map. The shards are locked
+  // one after the other while f is called for their values, so f must not
+  // modify the map.
+  template <typename F>
+  inline void ForEach(F&& f);
+
+ private:
+  using mutex = layer_helpers::threading::mutex;
+  using lock_guard = std::lock_guard<mutex>;
+
+  static const size_t kMinCapacity = 64;
+
+  struct Slot {
+    uintptr_t ptr;  // 0 if the slot is empty.
+    V value;
+  };
+
+  // Shards are aligned on cache lines, so that threads locking neighbouring
+  // shards do not share a cache line.
+  struct alignas(64) Shard {
+    mutex mu;
+    std::vector<Slot> slots;  // empty or a power of two slots.
+    size_t count = 0;
+
+    // Returns the index of the slot of ptr, or of the empty slot where ptr
+    // would be added. slots must not be empty.
+    inline size_t find(uintptr_t ptr, uint64_t hash) const;
+    inline void grow();
+  };
+
+  static inline uint64_t hash(uintptr_t ptr);
+  inline Shard& shard(uint64_t hash);
+
+  Shard shards_[kNumShards];
+};
+
+template <typename V>
+const size_t ShardedPointerMap<V>::kNumShards;
+
+template <typename V>
+const size_t ShardedPointerMap<V>::kMinCapacity;
+
+template <typename V>
+uint64_t ShardedPointerMap<V>::hash(uintptr_t ptr) {
+  // The low bits of addresses are mostly zeros, so mix the bits of the
+  // address into the bits used for the shard and the slot.
+  uint64_t h = static_cast<uint64_t>(ptr) * 0x9e3779b97f4a7c15ull;
+  return h ^ (h >> 32);
+}
+
+template <typename V>
+typename ShardedPointerMap<V>::Shard& ShardedPointerMap<V>::shard(
+    uint64_t hash) {
+  return shards_[hash % kNumShards];
+}
+
+template <typename V>
+size_t ShardedPointerMap<V>::Shard::find(uintptr_t ptr, uint64_t hash) const {
+  size_t mask = slots.size() - 1;
+  size_t i = (hash / kNumShards) & mask;
+  while (slots[i].ptr != 0 && slots[i].ptr != ptr) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+template <typename V>
+void ShardedPointerMap<V>::Shard::grow() {
+  std::vector<Slot> old(slots.empty() ? kMinCapacity : slots.size() * 2);
+  old.swap(slots);
+  for (auto& slot : old) {
+    if (slot.ptr != 0) {
+      slots[find(slot.ptr, hash(slot.ptr))] = slot;
+    }
+  }
+}
+
+template <typename V>
+void ShardedPointerMap<V>::Set(uintptr_t ptr, const V& value) {
+  uint64_t h = hash(ptr);
+  Shard& s = shard(h);
+  lock_guard lock(s.mu);
+  // Keep the shard at most 3/4 full, so that the probes stay short.
+  if ((s.count + 1) * 4 > s.slots.size() * 3) {
+    s.grow();
+  }
+  Slot& slot = s.slots[s.find(ptr, h)];
+  if (slot.ptr == 0) {
+    slot.ptr = ptr;
+    s.count++;
+  }
+  slot.value = value;
+}
+
+template <typename V>
+bool ShardedPointerMap<V>::Get(uintptr_t ptr, V* out) {
+  uint64_t h = hash(ptr);
+  Shard& s = shard(h);
+  lock_guard lock(s.mu);
+  if (s.count == 0) {
+    return false;
+  }
+  const Slot& slot = s.slots[s.find(ptr, h)];
+  if (slot.ptr == 0) {
+    return false;
+  }
+  *out = slot.value;
+  return true;
+}
+
+template <typename V>
+bool ShardedPointerMap<V>::Erase(uintptr_t ptr) {
+  uint64_t h = hash(ptr);
+  Shard& s = shard(h);
+  lock_guard lock(s.mu);
+  if (s.count == 0) {
+    return false;
+  }
+  size_t i = s.find(ptr, h);
+  if (s.slots[i].ptr == 0) {
+    return false;
+  }
+  // Shift back the following slots of the probe sequence that would not be
+  // found anymore once slot i is empty, instead of leaving a tombstone.
+  size_t mask = s.slots.size() - 1;
+  for (size_t j = (i + 1) & mask; s.slots[j].ptr != 0; j = (j + 1) & mask) {
+    size_t home = (hash(s.slots[j].ptr) / kNumShards) & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      s.slots[i] = s.slots[j];
+      i = j;
+    }
+  }
+  s.slots[i] = Slot{0, V()};
+  s.count--;
+  return true;
+}
+
+template <typename V>
+size_t ShardedPointerMap<V>::Count() {
+  size_t count = 0;
+  for (auto& s : shards_) {
+    lock_guard lock(s.mu);
+    count += s.count;
+  }
+  return count;
+}
+
+template <typename V>
+template <typename F>
+void ShardedPointerMap<V>::ForEach(F&& f) {
+  for (auto& s : shards_) {
+    lock_guard lock(s.mu);
+    for (const auto& slot : s.slots) {
+      if (slot.ptr != 0) {
+        f(slot.ptr, slot.value);
+      }
+    }
+  }
+}
+
+}  // namespace memory_tracker
+
+#endif  // __CORE_VULKAN_VK_MEMORY_TRACKER_LAYER_CC_SHARDED_POINTER_MAP_H__
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "core/vulkan/vk_memory_tracker_layer/cc/sharded_pointer_map.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace memory_tracker {
+namespace test {
+
+using Map = ShardedPointerMap<uint64_t>;
+
+// Checks that map holds exactly the values of expected.
+void ExpectEqual(const std::map<uintptr_t, uint64_t>& expected, Map* map) {
+  EXPECT_EQ(expected.size(), map->Count());
+  for (const auto& it : expected) {
+    uint64_t value = 0;
+    EXPECT_TRUE(map->Get(it.first, &value)) << it.first;
+    EXPECT_EQ(it.second, value);
+  }
+  std::map<uintptr_t, uint64_t> got;
+  map->ForEach([&](uintptr_t ptr, uint64_t value) { got[ptr] = value; });
+  EXPECT_EQ(expected, got);
+}
+
+TEST(ShardedPointerMapTest, SetGetErase) {
+  Map map;
+  uint64_t value = 0;
+  EXPECT_FALSE(map.Get(0x1000, &value));
+  EXPECT_FALSE(map.Erase(0x1000));
+
+  map.Set(0x1000, 1);
+  map.Set(0x2000, 2);
+  map.Set(0x1000, 3);
+  EXPECT_EQ(2u, map.Count());
+  EXPECT_TRUE(map.Get(0x1000, &value));
+  EXPECT_EQ(3u, value);
+  EXPECT_TRUE(map.Erase(0x1000));
+  EXPECT_FALSE(map.Erase(0x1000));
+  EXPECT_FALSE(map.Get(0x1000, &value));
+  EXPECT_TRUE(map.Get(0x2000, &value));
+  EXPECT_EQ(2u, value);
+  EXPECT_EQ(1u, map.Count());
+}
+
+// Fills the shards up to their load limit many times over, so that they grow
+// and their probe sequences cross each other, and checks every value after
+// each batch of erasures, which shift back the following slots.
+TEST(ShardedPointerMapTest, RandomizedAgainstStdMap) {
+  Map map;
+  std::map<uintptr_t, uint64_t> expected;
+  std::mt19937_64 rng(42);
+  // Allocation-like addresses: few distinct values, 16-byte aligned, so that
+  // the same addresses are set and erased again.
+  auto address = [&] {
+    return uintptr_t(0x7f0000000000ull + (rng() % 8192) * 16);
+  };
+
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < 2000; i++) {
+      uintptr_t ptr = address();
+      uint64_t value = rng();
+      map.Set(ptr, value);
+      expected[ptr] = value;
+    }
+    for (int i = 0; i < 1500; i++) {
+      uintptr_t ptr = address();
+      EXPECT_EQ(expected.erase(ptr) == 1, map.Erase(ptr));
+    }
+    ExpectEqual(expected, &map);
+  }
+  for (const auto& it : expected) {
+    EXPECT_TRUE(map.Erase(it.first));
+  }
+  EXPECT_EQ(0u, map.Count());
+}
+
+// Erasing the values of a long probe sequence from the front, the middle and
+// the back must keep the other values reachable.
+TEST(ShardedPointerMapTest, EraseWithinProbeSequences) {
+  Map map;
+  std::map<uintptr_t, uint64_t> expected;
+  // Fill each shard up to its load limit, so that it has runs of occupied
+  // slots, then erase every third value forwards and others backwards.
+  const uintptr_t kCount = Map::kNumShards * 48;
+  for (uintptr_t i = 0; i < kCount; i++) {
+    map.Set((i + 1) << 12, i);
+    expected[(i + 1) << 12] = i;
+  }
+  ExpectEqual(expected, &map);
+  for (uintptr_t i = 0; i < kCount; i += 3) {
+    EXPECT_TRUE(map.Erase((i + 1) << 12));
+    expected.erase((i + 1) << 12);
+  }
+  ExpectEqual(expected, &map);
+  for (uintptr_t i = kCount; i-- > 0;) {
+    if (i % 3 == 1) {
+      EXPECT_TRUE(map.Erase((i + 1) << 12));
+      expected.erase((i + 1) << 12);
+    }
+  }
+  ExpectEqual(expected, &map);
+}
+
+TEST(ShardedPointerMapTest, Grow) {
+  Map map;
+  std::map<uintptr_t, uint64_t> expected;
+  for (uintptr_t i = 1; i <= 100000; i++) {
+    map.Set(i * 64, i);
+    expected[i * 64] = i;
+  }
+  ExpectEqual(expected, &map);
+}
+
+// Threads set and erase their own addresses while another thread iterates
+// the map. Run under TSan to check the locking of the shards.
+TEST(ShardedPointerMapTest, ConcurrentSetEraseForEach) {
+  const uintptr_t kThreads = 4;
+  const uintptr_t kPerThread = 20000;
+  Map map;
+  std::atomic<bool> done(false);
+
+  std::thread reader([&] {
+    while (!done) {
+      map.ForEach([&](uintptr_t ptr, uint64_t value) {
+        // Each thread sets the value of its addresses to the address.
+        EXPECT_EQ(ptr, value);
+      });
+    }
+  });
+  std::vector<std::thread> writers;
+  for (uintptr_t t = 0; t < kThreads; t++) {
+    writers.emplace_back([&, t] {
+      for (uintptr_t i = 0; i < kPerThread; i++) {
+        uintptr_t ptr = ((i * kThreads + t) + 1) * 16;
+        map.Set(ptr, ptr);
+        // Keep every fourth address.
+        if (i % 4 != 0) {
+          EXPECT_TRUE(map.Erase(ptr));
+        }
+      }
+    });
+  }
+  for (auto& w : writers) {
+    w.join();
+  }
+  done = true;
+  reader.join();
+
+  std::map<uintptr_t, uint64_t> expected;
+  for (uintptr_t t = 0; t < kThreads; t++) {
+    for (uintptr_t i = 0; i < kPerThread; i += 4) {
+      uintptr_t ptr = ((i * kThreads + t) + 1) * 16;
+      expected[ptr] = ptr;
+    }
+  }
+  ExpectEqual(expected, &map);
+}
+
+}  // namespace test
+}  // namespace memory_tracker
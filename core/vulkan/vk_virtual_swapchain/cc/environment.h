@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VK_VIRTUAL_SWAPCHAIN_ENVIRONMENT_H_
+#define VK_VIRTUAL_SWAPCHAIN_ENVIRONMENT_H_
+
+#include <cstdint>
+#include <cstdlib>
+
+namespace swapchain {
+
+// Returns the value of the environment variable name, or default_value if it
+// is not set.
+inline uint32_t GetEnvUint(const char* name, uint32_t default_value) {
+  const char* const value = std::getenv(name);
+  if (value == nullptr) {
+    return default_value;
+  }
+  return static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+}
+
+}  // namespace swapchain
+
+#endif  // VK_VIRTUAL_SWAPCHAIN_ENVIRONMENT_H_
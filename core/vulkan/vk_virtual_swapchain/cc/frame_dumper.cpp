@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "frame_dumper.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "core/vulkan/tools/image.h"
+#include "environment.h"
+
+namespace {
+
+const char* kImageDumpPathEnv = "IMAGE_DUMP_PATH";
+const char* kImageDumpFormatEnv = "IMAGE_DUMP_FORMAT";
+const char* kImageDumpThreadsEnv = "IMAGE_DUMP_THREADS";
+const char* kImageDumpQueueDepthEnv = "IMAGE_DUMP_QUEUE_DEPTH";
+const char* kImageDumpDropFramesEnv = "IMAGE_DUMP_DROP_FRAMES";
+
+const uint32_t kDefaultThreads = 2;
+
+}  // namespace
+
+namespace swapchain {
+
+FrameDumper::FrameDumper(const std::string& dir, Format format,
+                         uint32_t threads, uint32_t queue_depth,
+                         bool drop_frames, uint32_t width, uint32_t height,
+                         VkFormat image_format)
+    : dir_(dir),
+      format_(format),
+      width_(width),
+      height_(height),
+      image_format_(image_format),
+      frames_(std::max(std::max(queue_depth, threads), 1u)) {
+  stats_.open(dir_ + "/frame_dump_stats.txt", std::ios::out);
+  stats_ << "# frame encode_us bytes" << std::endl;
+  pipeline_.reset(new ReadbackPipeline(
+      static_cast<uint32_t>(frames_.size()), std::max(threads, 1u),
+      drop_frames, [this](uint32_t slot) { Encode(slot); }));
+}
+
+FrameDumper::~FrameDumper() { pipeline_->Stop(); }
+
+std::unique_ptr<FrameDumper> FrameDumper::FromEnvironment(
+    uint32_t width, uint32_t height, VkFormat image_format) {
+  const char* const dir = std::getenv(kImageDumpPathEnv);
+  if (dir == nullptr) {
+    return nullptr;
+  }
+  Format format = Format::kPng;
+  const char* const format_name = std::getenv(kImageDumpFormatEnv);
+  if (format_name != nullptr && strcmp(format_name, "qoi") == 0) {
+    format = Format::kQoi;
+  } else if (format_name != nullptr && strcmp(format_name, "raw") == 0) {
+    format = Format::kRaw;
+  }
+  uint32_t threads = GetEnvUint(kImageDumpThreadsEnv, kDefaultThreads);
+  uint32_t queue_depth = GetEnvUint(kImageDumpQueueDepthEnv, threads * 2);
+  bool drop_frames = GetEnvUint(kImageDumpDropFramesEnv, 0) != 0;
+  return std::unique_ptr<FrameDumper>(
+      new FrameDumper(dir, format, threads, queue_depth, drop_frames, width,
+                      height, image_format));
+}
+
+void FrameDumper::Dump(const uint8_t* data, size_t size, uint32_t number) {
+  uint32_t slot = 0;
+  if (!pipeline_->AcquireSlot(&slot)) {
+    WriteStats(std::to_string(number) + " dropped");
+    return;
+  }
+  Frame& frame = frames_[slot];
+  // The buffer keeps its capacity, so it is only allocated once.
+  frame.data.assign(data, data + size);
+  frame.number = number;
+  frame.timestamp = std::chrono::system_clock::now().time_since_epoch().count();
+  pipeline_->Publish(slot);
+}
+
+void FrameDumper::Encode(uint32_t slot) {
+  Frame& frame = frames_[slot];
+  auto start = std::chrono::steady_clock::now();
+
+  const char* extension = ".png";
+  if (format_ == Format::kQoi) {
+    extension = ".qoi";
+  } else if (format_ == Format::kRaw) {
+    extension = ".raw";
+  }
+  auto image_path = dir_ + "/image_" + std::to_string(frame.number) + "_ts_" +
+                    std::to_string(frame.timestamp) + extension;
+  std::ofstream output_file;
+  output_file.open(image_path, std::ios::binary | std::ios::out);
+  switch (format_) {
+    case Format::kPng:
+      vk_tools::WritePng(&output_file, frame.data.data(), frame.data.size(),
+                         width_, height_, image_format_);
+      break;
+    case Format::kQoi:
+      vk_tools::WriteQoi(&output_file, frame.data.data(), frame.data.size(),
+                         width_, height_, image_format_);
+      break;
+    case Format::kRaw:
+      vk_tools::WriteRaw(&output_file, frame.data.data(), frame.data.size(),
+                         width_, height_, image_format_);
+      break;
+  }
+  output_file.close();
+
+  auto encode_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  WriteStats(std::to_string(frame.number) + " " + std::to_string(encode_us) +
+             " " + std::to_string(frame.data.size()));
+}
+
+void FrameDumper::WriteStats(const std::string& line) {
+  std::unique_lock<threading::mutex> lock(stats_lock_);
+  stats_ << line << '\n';
+}
+
+}  // namespace swapchain
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VK_VIRTUAL_SWAPCHAIN_FRAME_DUMPER_H_
+#define VK_VIRTUAL_SWAPCHAIN_FRAME_DUMPER_H_
+
+#include <vulkan/vulkan.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "readback_pipeline.h"
+#include "threading.h"
+
+namespace swapchain {
+
+// The FrameDumper writes the frames of a swapchain to files, on a fixed pool
+// of encoder threads. Frames are copied into a bounded set of reused
+// buffers, so that the memory of the dumper does not grow when the encoders
+// fall behind: the frame is either dropped, or Dump waits for a buffer.
+//
+// For each frame written, a line with the frame number, the time spent
+// encoding and writing the frame, in microseconds, and the size of the
+// frame is appended to "frame_dump_stats.txt" in the output directory, as
+// is a line for each frame dropped.
+class FrameDumper {
+ public:
+  enum class Format {
+    kPng,  // Compressed, but slow to encode.
+    kQoi,  // Lossless, and much faster to encode than PNG.
+    kRaw,  // A vk_tools::RawImageHeader followed by the image, as is.
+  };
+
+  // Creates a dumper writing width by height frames of image_format to dir.
+  // queue_depth is the number of frames buffered, including those being
+  // encoded, and is at least threads.
+  FrameDumper(const std::string& dir, Format format, uint32_t threads,
+              uint32_t queue_depth, bool drop_frames, uint32_t width,
+              uint32_t height, VkFormat image_format);
+  // Writes the frames buffered, and stops the encoder threads.
+  ~FrameDumper();
+
+  // Creates a dumper writing the frames to the directory set by the
+  // environment variable "IMAGE_DUMP_PATH", or returns null if it is not
+  // set. The environment variables "IMAGE_DUMP_FORMAT" ("png" by default,
+  // "qoi" or "raw"), "IMAGE_DUMP_THREADS" (2 by default),
+  // "IMAGE_DUMP_QUEUE_DEPTH" (twice the threads by default) and
+  // "IMAGE_DUMP_DROP_FRAMES" (0 by default) configure it.
+  static std::unique_ptr<FrameDumper> FromEnvironment(uint32_t width,
+                                                      uint32_t height,
+                                                      VkFormat image_format);
+
+  // Queues a copy of the size bytes of data to be written as the frame
+  // number, starting at 1. Frames may be dumped out of order.
+  void Dump(const uint8_t* data, size_t size, uint32_t number);
+
+  // Returns the number of frames written.
+  uint64_t WrittenFrames() const { return pipeline_->DeliveredFrames(); }
+  // Returns the number of frames dropped, as the encoders were behind.
+  uint64_t DroppedFrames() const { return pipeline_->DroppedFrames(); }
+
+ private:
+  // A frame to encode, held in a reused buffer.
+  struct Frame {
+    std::vector<uint8_t> data;
+    uint32_t number;    // The number of the frame, starting at 1.
+    int64_t timestamp;  // The system clock time of the frame.
+  };
+
+  // Encodes and writes the frame in the given slot. Runs on the encoder
+  // threads.
+  void Encode(uint32_t slot);
+  // Appends line to the stats file.
+  void WriteStats(const std::string& line);
+
+  const std::string dir_;
+  const Format format_;
+  const uint32_t width_;
+  const uint32_t height_;
+  const VkFormat image_format_;
+  std::vector<Frame> frames_;
+
+  threading::mutex stats_lock_;  // The lock for writing stats_.
+  std::ofstream stats_;          // The stats file.
+
+  // Leave the pipeline last, so that its encoder threads are stopped before
+  // the frames are destroyed.
+  std::unique_ptr<ReadbackPipeline> pipeline_;
+};
+
+}  // namespace swapchain
+
+#endif  // VK_VIRTUAL_SWAPCHAIN_FRAME_DUMPER_H_
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "readback_pipeline.h"
+
+#include <utility>
+
+namespace swapchain {
+
+ReadbackPipeline::ReadbackPipeline(uint32_t depth, uint32_t consumer_threads,
+                                   bool drop_frames,
+                                   std::function<void(uint32_t)> consume)
+    : drop_frames_(drop_frames),
+      consume_(std::move(consume)),
+      stopping_(false),
+      delivered_frames_(0),
+      dropped_frames_(0) {
+  for (uint32_t i = 0; i < depth; ++i) {
+    free_slots_.push_back(i);
+  }
+  for (uint32_t i = 0; i < consumer_threads; ++i) {
+#ifdef _WIN32
+    threads_.push_back(CreateThread(NULL, 0,
+                                    [](void* data) -> DWORD {
+                                      ((ReadbackPipeline*)data)
+                                          ->ConsumerThreadFunc();
+                                      return 0;
+                                    },
+                                    this, 0, nullptr));
+#else
+    pthread_t thread;
+    pthread_create(&thread, nullptr,
+                   +[](void* data) -> void* {
+                     ((ReadbackPipeline*)data)->ConsumerThreadFunc();
+                     return nullptr;
+                   },
+                   this);
+    threads_.push_back(thread);
+#endif
+  }
+}
+
+ReadbackPipeline::~ReadbackPipeline() { Stop(); }
+
+bool ReadbackPipeline::AcquireSlot(uint32_t* slot) {
+  std::unique_lock<threading::mutex> lock(lock_);
+  while (free_slots_.empty()) {
+    if (drop_frames_) {
+      dropped_frames_++;
+      return false;
+    }
+    slot_freed_.wait(lock);
+  }
+  *slot = free_slots_.front();
+  free_slots_.pop_front();
+  return true;
+}
+
+void ReadbackPipeline::Publish(uint32_t slot) {
+  {
+    std::unique_lock<threading::mutex> lock(lock_);
+    ready_slots_.push_back(slot);
+  }
+  slot_ready_.notify_one();
+}
+
+void ReadbackPipeline::Stop() {
+  {
+    std::unique_lock<threading::mutex> lock(lock_);
+    stopping_ = true;
+  }
+  slot_ready_.notify_all();
+  for (auto& thread : threads_) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, nullptr);
+#endif
+  }
+  threads_.clear();
+}
+
+void ReadbackPipeline::ConsumerThreadFunc() {
+  while (true) {
+    uint32_t slot = 0;
+    {
+      std::unique_lock<threading::mutex> lock(lock_);
+      while (ready_slots_.empty()) {
+        if (stopping_) {
+          return;
+        }
+        slot_ready_.wait(lock);
+      }
+      slot = ready_slots_.front();
+      ready_slots_.pop_front();
+    }
+
+    consume_(slot);
+
+    {
+      std::unique_lock<threading::mutex> lock(lock_);
+      free_slots_.push_back(slot);
+    }
+    delivered_frames_++;
+    slot_freed_.notify_one();
+  }
+}
+
+}  // namespace swapchain
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VK_VIRTUAL_SWAPCHAIN_READBACK_PIPELINE_H_
+#define VK_VIRTUAL_SWAPCHAIN_READBACK_PIPELINE_H_
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <vector>
+#include "threading.h"
+
+namespace swapchain {
+
+// The ReadbackPipeline hands the frames read back by the swapchain to
+// consumer threads. Frames are read back into a ring of slots: a slot is
+// acquired before the copy of a frame is submitted, published once the copy
+// has completed, and freed once a consumer thread has consumed it. This
+// decouples the swapchain images, which can be reused as soon as their copy
+// has completed, from the consumers, which can lag up to the depth of the
+// ring behind.
+//
+// With one consumer thread, the frames are consumed in the order they are
+// published. With more, they are consumed concurrently, in any order.
+class ReadbackPipeline {
+ public:
+  // Starts consumer_threads threads calling consume(slot) for each published
+  // slot, in a ring of depth slots. If drop_frames is true, a frame for which
+  // no slot is free is dropped, otherwise AcquireSlot waits for a slot.
+  ReadbackPipeline(uint32_t depth, uint32_t consumer_threads, bool drop_frames,
+                   std::function<void(uint32_t)> consume);
+  ReadbackPipeline(const ReadbackPipeline&) = delete;
+  ReadbackPipeline& operator=(const ReadbackPipeline&) = delete;
+  ~ReadbackPipeline();
+
+  // Returns in *slot a free slot to read the next frame back into, and
+  // returns true. If no slot is free and frames are dropped, counts the frame
+  // as dropped and returns false.
+  bool AcquireSlot(uint32_t* slot);
+  // Hands slot, which holds a frame, to the consumer threads.
+  void Publish(uint32_t slot);
+  // Waits for the published slots to be consumed, and stops the consumer
+  // threads.
+  void Stop();
+
+  // Returns the number of frames consumed.
+  uint64_t DeliveredFrames() const { return delivered_frames_.load(); }
+  // Returns the number of frames dropped, as no slot was free.
+  uint64_t DroppedFrames() const { return dropped_frames_.load(); }
+
+ private:
+  // This is the entry-point of the consumer threads.
+  void ConsumerThreadFunc();
+
+  const bool drop_frames_;
+  const std::function<void(uint32_t)> consume_;
+
+  std::deque<uint32_t> free_slots_;   // Slots that can be acquired.
+  std::deque<uint32_t> ready_slots_;  // Slots published but not consumed yet.
+  bool stopping_;  // If true, the consumers return once ready_slots_ is empty.
+
+  std::atomic<uint64_t> delivered_frames_;
+  std::atomic<uint64_t> dropped_frames_;
+
+// Some versions of the STL do not handle std::thread correctly,
+// use pthread/win thread instead.
+#ifdef _WIN32
+  std::vector<HANDLE> threads_;
+#else
+  std::vector<pthread_t> threads_;
+#endif
+
+  // Leave the mutex above its associated condition_variables.
+  threading::mutex lock_;  // The lock for the slot lists and stopping_.
+  threading::condition_variable slot_freed_;  // Signaled when a slot is freed.
+  threading::condition_variable slot_ready_;  // Signaled when a slot is
+                                              // published, or on Stop.
+};
+
+}  // namespace swapchain
+
+#endif  // VK_VIRTUAL_SWAPCHAIN_READBACK_PIPELINE_H_
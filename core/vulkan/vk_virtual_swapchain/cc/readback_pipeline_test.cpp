@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "readback_pipeline.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+namespace swapchain {
+namespace test {
+
+// The frames are read back in a ring of slots, as the swapchain does: each
+// slot holds the number of the frame copied into it.
+TEST(ReadbackPipelineTest, DeliversFramesInOrder) {
+  const uint32_t kDepth = 3;
+  const uint32_t kFrames = 1000;
+  std::vector<uint32_t> slots(kDepth);
+  std::vector<uint32_t> consumed;
+  ReadbackPipeline pipeline(kDepth, 1, false, [&](uint32_t slot) {
+    consumed.push_back(slots[slot]);
+  });
+
+  for (uint32_t frame = 0; frame < kFrames; frame++) {
+    uint32_t slot = 0;
+    ASSERT_TRUE(pipeline.AcquireSlot(&slot));
+    ASSERT_LT(slot, kDepth);
+    slots[slot] = frame;
+    pipeline.Publish(slot);
+  }
+  pipeline.Stop();
+
+  EXPECT_EQ(kFrames, pipeline.DeliveredFrames());
+  EXPECT_EQ(0u, pipeline.DroppedFrames());
+  ASSERT_EQ(kFrames, consumed.size());
+  for (uint32_t frame = 0; frame < kFrames; frame++) {
+    EXPECT_EQ(frame, consumed[frame]);
+  }
+}
+
+TEST(ReadbackPipelineTest, DropsFramesWhenBehind) {
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool blocked = true;
+  ReadbackPipeline pipeline(2, 1, true, [&](uint32_t) {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [&] { return !blocked; });
+  });
+
+  uint32_t slot = 0;
+  ASSERT_TRUE(pipeline.AcquireSlot(&slot));
+  pipeline.Publish(slot);
+  ASSERT_TRUE(pipeline.AcquireSlot(&slot));
+  pipeline.Publish(slot);
+  EXPECT_FALSE(pipeline.AcquireSlot(&slot));
+  EXPECT_FALSE(pipeline.AcquireSlot(&slot));
+  EXPECT_EQ(2u, pipeline.DroppedFrames());
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    blocked = false;
+  }
+  condition.notify_all();
+  pipeline.Stop();
+  EXPECT_EQ(2u, pipeline.DeliveredFrames());
+  EXPECT_EQ(2u, pipeline.DroppedFrames());
+}
+
+// Each callback waits for all of the consumer threads to be in a callback,
+// which only happens if the callbacks run concurrently.
+TEST(ReadbackPipelineTest, ConsumersRunConcurrently) {
+  const uint32_t kThreads = 4;
+  std::mutex mutex;
+  std::condition_variable condition;
+  uint32_t running = 0;
+  uint32_t met = 0;
+  ReadbackPipeline pipeline(kThreads, kThreads, false, [&](uint32_t) {
+    std::unique_lock<std::mutex> lock(mutex);
+    running++;
+    condition.notify_all();
+    if (condition.wait_for(lock, std::chrono::seconds(10),
+                           [&] { return running >= kThreads; })) {
+      met++;
+    }
+  });
+
+  for (uint32_t i = 0; i < kThreads; i++) {
+    uint32_t slot = 0;
+    ASSERT_TRUE(pipeline.AcquireSlot(&slot));
+    pipeline.Publish(slot);
+  }
+  pipeline.Stop();
+  EXPECT_EQ(kThreads, pipeline.DeliveredFrames());
+  EXPECT_EQ(kThreads, met);
+}
+
+}  // namespace test
+}  // namespace swapchain
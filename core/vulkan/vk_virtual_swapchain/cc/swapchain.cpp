@@ -342,6 +342,8 @@ vkQueuePresentKHR(VkQueue queue, const VkPresentInfoKHR* pPresentInfo) {
     uint32_t image_index = pPresentInfo->pImageIndices[i];
     VirtualSwapchain* swp =
         reinterpret_cast<VirtualSwapchain*>(pPresentInfo->pSwapchains[i]);
+    // The command buffer is null if the frame is not read back.
+    VkCommandBuffer command_buffer = swp->PrepareReadback(image_index);
 
     VkSubmitInfo submitInfo{
         VK_STRUCTURE_TYPE_SUBMIT_INFO,                     // sType
@@ -349,8 +351,8 @@ vkQueuePresentKHR(VkQueue queue, const VkPresentInfoKHR* pPresentInfo) {
         i == 0 ? pPresentInfo->waitSemaphoreCount : 0,     // waitSemaphoreCount
         i == 0 ? pPresentInfo->pWaitSemaphores : nullptr,  // pWaitSemaphores
         i == 0 ? pipeline_stages.data() : nullptr,         // pWaitDstStageMask
-        1,                                                 // commandBufferCount
-        &swp->GetCommandBuffer(image_index),               // pCommandBuffers
+        command_buffer != VK_NULL_HANDLE ? 1u : 0u,        // commandBufferCount
+        &command_buffer,                                   // pCommandBuffers
         0,                                                 // semaphoreCount
         nullptr                                            // pSemaphores
     };
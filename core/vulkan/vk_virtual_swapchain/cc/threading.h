@@ -24,8 +24,10 @@
 #include <windows.h>
 #else
 #include <pthread.h>
+#include <time.h>
 #endif
 
+#include <chrono>
 #include <mutex>
 
 namespace swapchain {
@@ -112,13 +114,19 @@ class condition_variable {
                ? cv_status::no_timeout
                : cv_status::timeout;
 #else
+    // pthread_cond_timedwait takes an absolute time on the realtime clock.
     timespec tv;
+    clock_gettime(CLOCK_REALTIME, &tv);
     const std::chrono::seconds sec =
         std::chrono::duration_cast<std::chrono::seconds>(rel_time);
-    tv.tv_sec = sec.count();
-    tv.tv_nsec =
+    tv.tv_sec += sec.count();
+    tv.tv_nsec +=
         std::chrono::duration_cast<std::chrono::nanoseconds>(rel_time - sec)
             .count();
+    if (tv.tv_nsec >= 1000000000) {
+      tv.tv_sec++;
+      tv.tv_nsec -= 1000000000;
+    }
 
     return (0 == pthread_cond_timedwait(&condition_, &native_handle, &tv))
                ? cv_status::no_timeout
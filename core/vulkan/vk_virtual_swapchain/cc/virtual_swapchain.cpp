@@ -15,18 +15,15 @@
  */
 
 #include "virtual_swapchain.h"
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
 #include <functional>
-#include <iomanip>
-#include <iostream>
-#include <sstream>
 #include <string>
-#include <thread>
 
-#include "core/vulkan/tools/image.h"
+#include "environment.h"
 
 namespace {
 
@@ -46,17 +43,9 @@ int32_t FindMemoryType(
 
 void null_callback(void*, uint8_t*, size_t) {}
 
-const char* kImageDumpPathEnv = "IMAGE_DUMP_PATH";
-
-void WritePngFile(std::unique_ptr<uint8_t[]> image_data, size_t size,
-                  std::string file_name, uint32_t width, uint32_t height,
-                  VkFormat image_format) {
-  std::ofstream output_file;
-  output_file.open(file_name, std::ios::binary | std::ios::out);
-  vk_tools::WritePng(&output_file, image_data.get(), size, width, height,
-                     image_format);
-  output_file.close();
-}
+const char* kReadbackDepthEnv = "VIRTUAL_SWAPCHAIN_READBACK_DEPTH";
+const char* kReadbackThreadsEnv = "VIRTUAL_SWAPCHAIN_READBACK_THREADS";
+const char* kDropFramesEnv = "VIRTUAL_SWAPCHAIN_DROP_FRAMES";
 
 }  // namespace
 
@@ -77,6 +66,7 @@ VirtualSwapchain::VirtualSwapchain(
       width_(_swapchain_info->imageExtent.width),
       height_(_swapchain_info->imageExtent.height),
       image_data_(num_images_),
+      presented_frames_(0),
       device_(device),
       should_close_(false),
       callback_(null_callback),
@@ -88,8 +78,85 @@ VirtualSwapchain::VirtualSwapchain(
       always_get_acquired_image_(always_get_acquired_image),
       base_swapchain_(nullptr) {
   VkPhysicalDeviceMemoryProperties properties = *memory_properties;
+
+  VkCommandPoolCreateInfo command_pool_info{
+      VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,       // sType
+      nullptr,                                          // pNext
+      VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,  // flags
+      queue_                                            // queueFamilyIndex
+  };
+  functions_->vkCreateCommandPool(device_, &command_pool_info, pAllocator,
+                                  &command_pool_);
+
+  // The size of the buffer that we need is surprisingly easy.
+  // Pixel-width * width * height. The GPU will copy into the
+  // buffer with the stride we provide.
+  // All we want to do here is create a buffer that we can copy
+  // the image into.
+  // TODO(awolosyn): Currently we know the format is VK_FORMAT_R8G8B8A8_UNORM
+  // Handle more formats later if we have other swapchain formats we care
+  // about.
+
+  // maximum non-coherent-command-size is 128 bytes
+  // This means we can write subsequent layers on 128-byte
+  // boundaries
+  size_t buffer_memory_size =
+      ((ImageByteSize() + 127) & ~127) * swapchain_info_.imageArrayLayers;
+
+  const VkBufferCreateInfo buffer_create_info{
+      VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,  // sType
+      nullptr,                               // pNext
+      0,                                     // flags
+      buffer_memory_size,                    // size
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT,      // usage
+      VK_SHARING_MODE_EXCLUSIVE,             // sharingMode
+      0,                                     // queueFamilyIndexCount
+      nullptr                                // pQueueFamilyIndices
+  };
+
+  // Create the readback slots. Their memory stays mapped until the swapchain
+  // is destroyed, so that reading a frame back does not map and unmap it.
+  uint32_t readback_depth = GetEnvUint(kReadbackDepthEnv, num_images_);
+  slots_.resize(readback_depth == 0 ? 1 : readback_depth);
+  for (auto& slot : slots_) {
+    functions_->vkCreateBuffer(device_, &buffer_create_info, pAllocator,
+                               &slot.buffer_);
+    VkMemoryRequirements reqs;
+    functions_->vkGetBufferMemoryRequirements(device_, slot.buffer_, &reqs);
+
+    // Reads of uncached memory are slow, prefer cached memory if there is
+    // some.
+    int32_t memory_type =
+        FindMemoryType(&properties, reqs.memoryTypeBits,
+                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                           VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    if (memory_type < 0) {
+      memory_type = FindMemoryType(&properties, reqs.memoryTypeBits,
+                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    }
+    slot.coherent_ = memory_type >= 0 &&
+                     (properties.memoryTypes[memory_type].propertyFlags &
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    VkMemoryAllocateInfo buffer_memory_info{
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,  // sType
+        nullptr,                                 // pNext
+        reqs.size,                               // allocationSize
+        static_cast<uint32_t>(memory_type)       // memoryTypeIndex
+    };
+
+    functions_->vkAllocateMemory(device_, &buffer_memory_info, pAllocator,
+                                 &slot.buffer_memory_);
+    functions_->vkBindBufferMemory(device_, slot.buffer_, slot.buffer_memory_,
+                                   0);
+    void* mapped_value = nullptr;
+    functions_->vkMapMemory(device_, slot.buffer_memory_, 0, VK_WHOLE_SIZE, 0,
+                            &mapped_value);
+    slot.mapped_ = static_cast<uint8_t*>(mapped_value);
+  }
+
   build_swapchain_image_data_ = [this, properties, pAllocator]() {
     SwapchainImageData image_data;
+    image_data.slot_ = kNoSlot;
 
     static const VkFenceCreateInfo fence_info{
         VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, 0};
@@ -111,54 +178,22 @@ VirtualSwapchain::VirtualSwapchain(
         swapchain_info_.pQueueFamilyIndices,    // queueFamilyIndices
         VK_IMAGE_LAYOUT_UNDEFINED,              // initialLayout
     };
-    // The size of the buffer that we need is surprisingly easy.
-    // Pixel-width * width * height. The GPU will copy into the
-    // buffer with the stride we provide.
-    // All we want to do here is create a buffer that we can copy
-    // the image into.
-    // TODO(awolosyn): Currently we know the format is VK_FORMAT_R8G8B8A8_UNORM
-    // Handle more formats later if we have other swapchain formats we care
-    // about.
-
-    // maximum non-coherent-command-size is 128 bytes
-    // This means we can write subsequent layers on 128-byte
-    // boundaries
-    size_t buffer_memory_size =
-        ((ImageByteSize() + 127) & ~127) * swapchain_info_.imageArrayLayers;
-
-    const VkBufferCreateInfo buffer_create_info{
-        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,  // sType
-        nullptr,                               // pNext
-        0,                                     // flags
-        buffer_memory_size,                    // size
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT,      // usage
-        VK_SHARING_MODE_EXCLUSIVE,             // sharingMode
-        0,                                     // queueFamilyIndexCount
-        nullptr                                // pQueueFamilyIndices
-    };
-
-    VkCommandPoolCreateInfo command_pool_info{
-        VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,       // sType
-        nullptr,                                          // pNext
-        VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,  // flags
-        queue_                                            // queueFamilyIndex
-    };
-
-    functions_->vkCreateCommandPool(device_, &command_pool_info, pAllocator,
-                                    &command_pool_);
 
     VkCommandBufferAllocateInfo command_buffer_info{
         VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,  // sType
         nullptr,                                         // pNext
         command_pool_,                                   // commandPool
         VK_COMMAND_BUFFER_LEVEL_PRIMARY,                 // level
-        1                                                // count
+        static_cast<uint32_t>(slots_.size())             // count
     };
 
-    // Create the command buffer
+    // Create a command buffer per readback slot
+    image_data.command_buffers_.resize(slots_.size());
     functions_->vkAllocateCommandBuffers(device_, &command_buffer_info,
-                                         &image_data.command_buffer_);
-    set_dispatch_from_parent(image_data.command_buffer_, device_);
+                                         image_data.command_buffers_.data());
+    for (auto command_buffer : image_data.command_buffers_) {
+      set_dispatch_from_parent(command_buffer, device_);
+    }
 
     // Create the fence
     {
@@ -167,33 +202,6 @@ VirtualSwapchain::VirtualSwapchain(
       functions_->vkResetFences(device_, 1, &image_data.fence_);
     }
 
-    // Create the buffer
-    {
-      functions_->vkCreateBuffer(device_, &buffer_create_info, pAllocator,
-                                 &image_data.buffer_);
-      // Create device-memory for the buffer
-      {
-        VkMemoryRequirements reqs;
-        functions_->vkGetBufferMemoryRequirements(device_, image_data.buffer_,
-                                                  &reqs);
-
-        uint32_t memory_type =
-            FindMemoryType(&properties, reqs.memoryTypeBits,
-                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-        VkMemoryAllocateInfo buffer_memory_info{
-            VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,  // sType
-            nullptr,                                 // pNext
-            reqs.size,                               // allocationSize
-            memory_type                              // memoryTypeIndex
-        };
-
-        functions_->vkAllocateMemory(device_, &buffer_memory_info, pAllocator,
-                                     &image_data.buffer_memory_);
-        functions_->vkBindBufferMemory(device_, image_data.buffer_,
-                                       image_data.buffer_memory_, 0);
-      }
-    }
-
     // Create the image
     {
       functions_->vkCreateImage(device_, &image_create_info, pAllocator,
@@ -220,18 +228,6 @@ VirtualSwapchain::VirtualSwapchain(
       }
     }
 
-    VkBufferMemoryBarrier dest_barrier{
-        VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,  // sType
-        nullptr,                                  // pNext
-        VK_ACCESS_TRANSFER_WRITE_BIT,             // srcAccessMask
-        VK_ACCESS_HOST_READ_BIT,                  // dstAccessMask
-        VK_QUEUE_FAMILY_IGNORED,                  // srcQueueFamilyIndex
-        VK_QUEUE_FAMILY_IGNORED,                  // dstQueueFamilyIndex
-        image_data.buffer_,                       // buffer
-        0,                                        // offset
-        VK_WHOLE_SIZE                             // size
-    };
-
     VkBufferImageCopy region{
         0,  // Start of the buffer
         0,  // bufferRowLength Tightly packed buffer
@@ -252,18 +248,41 @@ VirtualSwapchain::VirtualSwapchain(
         nullptr                                       // pInheritanceInfo
     };
 
-    functions_->vkBeginCommandBuffer(image_data.command_buffer_, &cbegin);
-    functions_->vkCmdCopyImageToBuffer(
-        image_data.command_buffer_, image_data.image_,
-        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image_data.buffer_, 1, &region);
-    functions_->vkCmdPipelineBarrier(
-        image_data.command_buffer_, VK_PIPELINE_STAGE_TRANSFER_BIT,
-        VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &dest_barrier, 0, 0);
-    functions_->vkEndCommandBuffer(image_data.command_buffer_);
+    for (size_t i = 0; i < slots_.size(); ++i) {
+      VkCommandBuffer command_buffer = image_data.command_buffers_[i];
+      VkBufferMemoryBarrier dest_barrier{
+          VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,  // sType
+          nullptr,                                  // pNext
+          VK_ACCESS_TRANSFER_WRITE_BIT,             // srcAccessMask
+          VK_ACCESS_HOST_READ_BIT,                  // dstAccessMask
+          VK_QUEUE_FAMILY_IGNORED,                  // srcQueueFamilyIndex
+          VK_QUEUE_FAMILY_IGNORED,                  // dstQueueFamilyIndex
+          slots_[i].buffer_,                        // buffer
+          0,                                        // offset
+          VK_WHOLE_SIZE                             // size
+      };
+
+      functions_->vkBeginCommandBuffer(command_buffer, &cbegin);
+      functions_->vkCmdCopyImageToBuffer(
+          command_buffer, image_data.image_,
+          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slots_[i].buffer_, 1, &region);
+      functions_->vkCmdPipelineBarrier(
+          command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+          VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &dest_barrier, 0, 0);
+      functions_->vkEndCommandBuffer(command_buffer);
+    }
 
     return image_data;
   };
 
+  frame_dumper_ = FrameDumper::FromEnvironment(
+      width_, height_, swapchain_info_.imageFormat);
+  readback_.reset(new ReadbackPipeline(
+      static_cast<uint32_t>(slots_.size()),
+      std::max(GetEnvUint(kReadbackThreadsEnv, 1), 1u),
+      GetEnvUint(kDropFramesEnv, 0) != 0,
+      [this](uint32_t slot) { ConsumeReadback(slot); }));
+
   // Populate the swapchain image data vector
   for (uint32_t i = 0; i < num_images_; i++) {
     image_data_[i] = build_swapchain_image_data_();
@@ -285,10 +304,6 @@ VirtualSwapchain::VirtualSwapchain(
                  },
                  this);
 #endif
-  const char* const image_dump_dir = std::getenv(kImageDumpPathEnv);
-  if (image_dump_dir != nullptr) {
-    image_dump_dir_ = std::string(image_dump_dir);
-  }
 }
 
 void VirtualSwapchain::Destroy(const VkAllocationCallbacks* pAllocator) {
@@ -299,15 +314,19 @@ void VirtualSwapchain::Destroy(const VkAllocationCallbacks* pAllocator) {
 #else
   pthread_join(thread_, nullptr);
 #endif
+  readback_->Stop();
+  frame_dumper_.reset();
 
   for (size_t i = 0; i < num_images_; ++i) {
     functions_->vkFreeMemory(device_, image_data_[i].image_memory_, pAllocator);
     functions_->vkDestroyImage(device_, image_data_[i].image_, pAllocator);
-    functions_->vkFreeMemory(device_, image_data_[i].buffer_memory_,
-                             pAllocator);
-    functions_->vkDestroyBuffer(device_, image_data_[i].buffer_, pAllocator);
     functions_->vkDestroyFence(device_, image_data_[i].fence_, pAllocator);
   }
+  for (auto& slot : slots_) {
+    functions_->vkUnmapMemory(device_, slot.buffer_memory_);
+    functions_->vkFreeMemory(device_, slot.buffer_memory_, pAllocator);
+    functions_->vkDestroyBuffer(device_, slot.buffer_, pAllocator);
+  }
 
   if (base_swapchain_) {
     base_swapchain_->Destroy(pAllocator);
@@ -316,21 +335,6 @@ void VirtualSwapchain::Destroy(const VkAllocationCallbacks* pAllocator) {
   functions_->vkDestroyCommandPool(device_, command_pool_, pAllocator);
 }
 
-void VirtualSwapchain::DumpImageToFile(uint8_t* image_data, size_t size) {
-  std::unique_ptr<uint8_t[]> image_data_owned(new uint8_t[size]());
-  memcpy(image_data_owned.get(), image_data, size);
-
-  auto now = std::chrono::system_clock::now().time_since_epoch().count();
-  auto image_path = image_dump_dir_ + "/image_" +
-                    std::to_string(dumped_frame_count_++) + "_ts_" +
-                    std::to_string(now) + ".png";
-
-  std::thread file_writer(WritePngFile, std::move(image_data_owned), size,
-                          image_path, width_, height_,
-                          swapchain_info_.imageFormat);
-  file_writer.detach();
-}
-
 void VirtualSwapchain::CopyThreadFunc() {
   while (true) {
     uint32_t pending_image = 0;
@@ -358,34 +362,51 @@ void VirtualSwapchain::CopyThreadFunc() {
     (void)ret;  // TODO: Check this?
     functions_->vkResetFences(device_, 1, &image_data_[pending_image].fence_);
 
-    void* mapped_value;
-    functions_->vkMapMemory(device_, image_data_[pending_image].buffer_memory_,
-                            0, VK_WHOLE_SIZE, 0, &mapped_value);
-    VkMappedMemoryRange range{
-        VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,      // sType
-        nullptr,                                    // pNext
-        image_data_[pending_image].buffer_memory_,  // memory
-        0,                                          // offset
-        VK_WHOLE_SIZE,                              // size
-    };
-    functions_->vkInvalidateMappedMemoryRanges(device_, 1, &range);
-
-    uint32_t length = ImageByteSize();
-    {
-      callback_(callback_user_data_, (uint8_t*)mapped_value, length);
-      if (image_dump_dir_ != "") {
-        DumpImageToFile((uint8_t*)mapped_value, length);
-      }
-    }
-
-    functions_->vkUnmapMemory(device_,
-                              image_data_[pending_image].buffer_memory_);
+    // The copy of the image has completed, so the image can be reused while
+    // the consumers read its copy back.
+    uint32_t slot = image_data_[pending_image].slot_;
     {
       std::unique_lock<threading::mutex> l(free_images_lock_);
       free_images_.push_back(pending_image);
     }
     free_images_condition_.notify_all();
+
+    if (slot == kNoSlot) {
+      continue;
+    }
+    if (!slots_[slot].coherent_) {
+      VkMappedMemoryRange range{
+          VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,  // sType
+          nullptr,                                // pNext
+          slots_[slot].buffer_memory_,            // memory
+          0,                                      // offset
+          VK_WHOLE_SIZE,                          // size
+      };
+      functions_->vkInvalidateMappedMemoryRanges(device_, 1, &range);
+    }
+    readback_->Publish(slot);
+  }
+}
+
+void VirtualSwapchain::ConsumeReadback(uint32_t slot) {
+  uint8_t* data = slots_[slot].mapped_;
+  uint32_t length = ImageByteSize();
+  callback_(callback_user_data_, data, length);
+  if (frame_dumper_) {
+    frame_dumper_->Dump(data, length, slots_[slot].frame_number_);
+  }
+}
+
+VkCommandBuffer VirtualSwapchain::PrepareReadback(size_t i) {
+  uint32_t frame_number = ++presented_frames_;
+  uint32_t slot = kNoSlot;
+  if (!readback_->AcquireSlot(&slot)) {
+    image_data_[i].slot_ = kNoSlot;
+    return VK_NULL_HANDLE;
   }
+  image_data_[i].slot_ = slot;
+  slots_[slot].frame_number_ = frame_number;
+  return image_data_[i].command_buffers_[slot];
 }
 
 bool VirtualSwapchain::GetImage(uint64_t timeout, uint32_t* image) {
@@ -24,8 +24,11 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <vector>
 #include "base_swapchain.h"
+#include "frame_dumper.h"
 #include "layer.h"
+#include "readback_pipeline.h"
 
 namespace swapchain {
 
@@ -78,10 +81,10 @@ class VirtualSwapchain {
 
   // Returns the VkFence associated with the i'th image.
   VkFence GetFence(size_t i) { return image_data_[i].fence_; }
-  // Returns the VkCommandBuffer with the i'th image.
-  VkCommandBuffer& GetCommandBuffer(size_t i) {
-    return image_data_[i].command_buffer_;
-  }
+  // Reserves a readback slot for the i'th image, and returns the
+  // VkCommandBuffer that copies the image into it. Returns VK_NULL_HANDLE if
+  // the frame is dropped, as all of the slots are in use.
+  VkCommandBuffer PrepareReadback(size_t i);
 
   // If we have create info, create a surface to render to.
   void CreateBaseSwapchain(VkInstance instance,
@@ -128,25 +131,41 @@ class VirtualSwapchain {
     always_get_acquired_image_ = always_get_acquired_image;
   }
 
+  // Returns the number of frames passed to the callback.
+  uint64_t DeliveredFrames() const { return readback_->DeliveredFrames(); }
+  // Returns the number of frames not read back, as the callback was behind.
+  uint64_t DroppedFrames() const { return readback_->DroppedFrames(); }
+
  private:
   const VkSwapchainCreateInfoKHR swapchain_info_;
   // This is the entry-point to our secondary thread.
-  // It is responsible for keeping track of copies, and calling the
-  // callback when a copy has completed.
+  // It is responsible for keeping track of copies, and publishing the
+  // readback slot of an image to the consumers when its copy has completed.
   void CopyThreadFunc();
+  // Calls the callback with the frame held in the given readback slot.
+  void ConsumeReadback(uint32_t slot);
   // Returns the size of the image in bytes.
   uint32_t ImageByteSize() const;
+  // Marks an image presented without a readback slot.
+  static const uint32_t kNoSlot = UINT32_MAX;
   // All of the data associated with a single swapchain VkImage.
   struct SwapchainImageData {
     VkImage image_;                // The image itself.
     VkDeviceMemory image_memory_;  // The device memory allocated to this image.
 
-    VkBuffer buffer_;  // The buffer to copy the image contents into.
-    VkDeviceMemory buffer_memory_;  // The memory for the buffer.
-
     VkFence fence_;  // The fence to signal when the copy is complete.
-    VkCommandBuffer
-        command_buffer_;  // The command_buffer that contains the copy commands.
+    // The command buffers copying the image into each readback slot.
+    std::vector<VkCommandBuffer> command_buffers_;
+    uint32_t slot_;  // The readback slot of the pending copy, or kNoSlot.
+  };
+  // A buffer that images are copied into, and read back from. Its memory is
+  // mapped for the lifetime of the swapchain.
+  struct ReadbackSlot {
+    VkBuffer buffer_;               // The buffer to copy an image into.
+    VkDeviceMemory buffer_memory_;  // The memory for the buffer.
+    uint8_t* mapped_;               // The mapping of buffer_memory_.
+    bool coherent_;  // Whether buffer_memory_ needs no invalidation.
+    uint32_t frame_number_;  // The number of the frame copied into the slot.
   };
 
   // In our constructor we rely on num_images_ being
@@ -162,6 +181,8 @@ class VirtualSwapchain {
                         // have been submitted but not processed yet.
   std::deque<uint32_t> free_images_;  // Indices into image_data_ for all images
                                       // that are not currently in use.
+  std::vector<ReadbackSlot> slots_;   // The ring of readback slots.
+  uint32_t presented_frames_;  // The number of frames presented.
   VkDevice device_;  // The device that this swapchain belongs to.
   VkCommandPool
       command_pool_;  // The command_pool that we are allocating buffers from.
@@ -219,14 +240,17 @@ class VirtualSwapchain {
   // The actual surface and swapchain if we're using one.
   std::unique_ptr<BaseSwapchain> base_swapchain_;
 
-  // The path to dump the swapchain image to file. This can be set via
-  // the environment variable "IMAGE_DUMP_PATH" before replay the trace.
-  std::string image_dump_dir_;
-  // The number of image dumped.
-  uint32_t dumped_frame_count_ = 1;
-  // Function to dump the image to dir |image_dump_dir_| if environment
-  // variable "IMAGE_DUMP_PATH" is set.
-  void DumpImageToFile(uint8_t* image_data, size_t size);
+  // Hands the readback slots to the threads calling the callback. The depth
+  // of the ring of slots, the number of consumer threads and whether frames
+  // are dropped when the consumers are behind can be set via the environment
+  // variables "VIRTUAL_SWAPCHAIN_READBACK_DEPTH" (the number of images by
+  // default), "VIRTUAL_SWAPCHAIN_READBACK_THREADS" (1 by default) and
+  // "VIRTUAL_SWAPCHAIN_DROP_FRAMES" (0 by default).
+  std::unique_ptr<ReadbackPipeline> readback_;
+
+  // Dumps the swapchain images to files, if the environment variable
+  // "IMAGE_DUMP_PATH" is set before replaying the trace.
+  std::unique_ptr<FrameDumper> frame_dumper_;
 };
 }  // namespace swapchain
 
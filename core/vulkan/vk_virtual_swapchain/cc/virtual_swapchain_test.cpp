@@ -0,0 +1,535 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "virtual_swapchain.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace swapchain {
+namespace test {
+
+const uint32_t kWidth = 4;
+const uint32_t kHeight = 4;
+const uint32_t kImageSize = kWidth * kHeight * 4;
+// Long enough to only expire if the swapchain never returns an image.
+const uint64_t kTimeout = 10000000000ull;
+
+// Non-dispatchable handles are pointers on 64-bit targets and integers on
+// 32-bit ones, so they are converted to and from the fake objects through
+// uintptr_t.
+template <typename T, typename O>
+T ToHandle(O* object) {
+  return (T)(reinterpret_cast<uintptr_t>(object));
+}
+template <typename O, typename T>
+O* FromHandle(T handle) {
+  return reinterpret_cast<O*>((uintptr_t)(handle));
+}
+
+// FakeDevice implements the device functions used by the VirtualSwapchain on
+// the host. Buffers and images are backed by host memory, and the command
+// buffers record the copy of an image into a buffer, which Submit executes.
+class FakeDevice {
+ public:
+  FakeDevice() : dispatch_(&dispatch_), live_objects_(0), invalidations_(0) {
+    sDevice = this;
+    memset(&functions_, 0, sizeof(functions_));
+    functions_.vkAllocateMemory = AllocateMemory;
+    functions_.vkFreeMemory = FreeMemory;
+    functions_.vkMapMemory = MapMemory;
+    functions_.vkUnmapMemory = UnmapMemory;
+    functions_.vkInvalidateMappedMemoryRanges = InvalidateMappedMemoryRanges;
+    functions_.vkCreateFence = CreateFence;
+    functions_.vkWaitForFences = WaitForFences;
+    functions_.vkDestroyFence = DestroyFence;
+    functions_.vkResetFences = ResetFences;
+    functions_.vkCreateImage = CreateImage;
+    functions_.vkGetImageMemoryRequirements = GetImageMemoryRequirements;
+    functions_.vkBindImageMemory = BindImageMemory;
+    functions_.vkDestroyImage = DestroyImage;
+    functions_.vkCreateBuffer = CreateBuffer;
+    functions_.vkGetBufferMemoryRequirements = GetBufferMemoryRequirements;
+    functions_.vkBindBufferMemory = BindBufferMemory;
+    functions_.vkDestroyBuffer = DestroyBuffer;
+    functions_.vkCreateCommandPool = CreateCommandPool;
+    functions_.vkDestroyCommandPool = DestroyCommandPool;
+    functions_.vkAllocateCommandBuffers = AllocateCommandBuffers;
+    functions_.vkBeginCommandBuffer = BeginCommandBuffer;
+    functions_.vkEndCommandBuffer = EndCommandBuffer;
+    functions_.vkCmdCopyImageToBuffer = CmdCopyImageToBuffer;
+    functions_.vkCmdPipelineBarrier = CmdPipelineBarrier;
+
+    // Buffers can use the first memory type, which is host visible and cached
+    // but not coherent, images use the second one.
+    memset(&memory_properties_, 0, sizeof(memory_properties_));
+    memory_properties_.memoryTypeCount = 2;
+    memory_properties_.memoryTypes[0].propertyFlags =
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    memory_properties_.memoryTypes[1].propertyFlags =
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    memory_properties_.memoryHeapCount = 1;
+  }
+
+  ~FakeDevice() {
+    EXPECT_EQ(0, live_objects_.load());
+    sDevice = nullptr;
+  }
+
+  VkDevice device() { return reinterpret_cast<VkDevice>(&dispatch_); }
+  const DeviceData* functions() const { return &functions_; }
+  const VkPhysicalDeviceMemoryProperties* memory_properties() const {
+    return &memory_properties_;
+  }
+  uint32_t invalidations() const { return invalidations_.load(); }
+
+  // Fills the memory of image with value.
+  void Render(VkImage image, uint8_t value) {
+    Memory* memory = FromHandle<Image>(image)->memory;
+    ASSERT_NE(nullptr, memory);
+    memset(memory->data.data(), value, memory->data.size());
+  }
+
+  // Executes command_buffer, if any, and signals fence.
+  void Submit(VkCommandBuffer command_buffer, VkFence fence) {
+    if (command_buffer != VK_NULL_HANDLE) {
+      auto cb = reinterpret_cast<CommandBuffer*>(command_buffer);
+      ASSERT_TRUE(cb->recorded);
+      ASSERT_NE(nullptr, cb->src);
+      ASSERT_NE(nullptr, cb->dst);
+      const std::vector<uint8_t>& src = cb->src->memory->data;
+      std::vector<uint8_t>& dst = cb->dst->memory->data;
+      ASSERT_LE(src.size(), dst.size());
+      memcpy(dst.data(), src.data(), src.size());
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      FromHandle<Fence>(fence)->signaled = true;
+    }
+    fence_signaled_.notify_all();
+  }
+
+ private:
+  struct Memory {
+    std::vector<uint8_t> data;
+    bool mapped;
+  };
+  struct Buffer {
+    VkDeviceSize size;
+    Memory* memory;
+  };
+  struct Image {
+    VkDeviceSize size;
+    Memory* memory;
+  };
+  struct Fence {
+    bool signaled;
+  };
+  // Command buffers are dispatchable, their first member is set to the
+  // dispatch table of the device.
+  struct CommandBuffer {
+    void* dispatch;
+    bool recorded;
+    Image* src;
+    Buffer* dst;
+  };
+  struct CommandPool {
+    std::vector<std::unique_ptr<CommandBuffer>> command_buffers;
+  };
+
+  static VKAPI_ATTR VkResult VKAPI_CALL
+  AllocateMemory(VkDevice, const VkMemoryAllocateInfo* pAllocateInfo,
+                 const VkAllocationCallbacks*, VkDeviceMemory* pMemory) {
+    EXPECT_LT(pAllocateInfo->memoryTypeIndex,
+              sDevice->memory_properties_.memoryTypeCount);
+    Memory* memory = new Memory();
+    memory->data.resize(pAllocateInfo->allocationSize);
+    memory->mapped = false;
+    sDevice->live_objects_++;
+    *pMemory = ToHandle<VkDeviceMemory>(memory);
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR void VKAPI_CALL FreeMemory(VkDevice, VkDeviceMemory memory,
+                                               const VkAllocationCallbacks*) {
+    Memory* m = FromHandle<Memory>(memory);
+    EXPECT_FALSE(m->mapped);
+    delete m;
+    sDevice->live_objects_--;
+  }
+
+  static VKAPI_ATTR VkResult VKAPI_CALL
+  MapMemory(VkDevice, VkDeviceMemory memory, VkDeviceSize offset, VkDeviceSize,
+            VkMemoryMapFlags, void** ppData) {
+    Memory* m = FromHandle<Memory>(memory);
+    EXPECT_FALSE(m->mapped);
+    m->mapped = true;
+    *ppData = m->data.data() + offset;
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR void VKAPI_CALL UnmapMemory(VkDevice,
+                                                VkDeviceMemory memory) {
+    Memory* m = FromHandle<Memory>(memory);
+    EXPECT_TRUE(m->mapped);
+    m->mapped = false;
+  }
+
+  static VKAPI_ATTR VkResult VKAPI_CALL InvalidateMappedMemoryRanges(
+      VkDevice, uint32_t memoryRangeCount, const VkMappedMemoryRange* pRanges) {
+    for (uint32_t i = 0; i < memoryRangeCount; i++) {
+      EXPECT_TRUE(FromHandle<Memory>(pRanges[i].memory)->mapped);
+    }
+    sDevice->invalidations_++;
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR VkResult VKAPI_CALL CreateFence(
+      VkDevice, const VkFenceCreateInfo*, const VkAllocationCallbacks*,
+      VkFence* pFence) {
+    sDevice->live_objects_++;
+    *pFence = ToHandle<VkFence>(new Fence{false});
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR VkResult VKAPI_CALL
+  WaitForFences(VkDevice, uint32_t fenceCount, const VkFence* pFences,
+                VkBool32, uint64_t) {
+    // The swapchain waits for a single fence, without a timeout.
+    EXPECT_EQ(1, fenceCount);
+    Fence* fence = FromHandle<Fence>(pFences[0]);
+    std::unique_lock<std::mutex> lock(sDevice->mutex_);
+    sDevice->fence_signaled_.wait(lock, [&] { return fence->signaled; });
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR void VKAPI_CALL DestroyFence(VkDevice, VkFence fence,
+                                                 const VkAllocationCallbacks*) {
+    delete FromHandle<Fence>(fence);
+    sDevice->live_objects_--;
+  }
+
+  static VKAPI_ATTR VkResult VKAPI_CALL ResetFences(VkDevice,
+                                                    uint32_t fenceCount,
+                                                    const VkFence* pFences) {
+    std::unique_lock<std::mutex> lock(sDevice->mutex_);
+    for (uint32_t i = 0; i < fenceCount; i++) {
+      FromHandle<Fence>(pFences[i])->signaled = false;
+    }
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR VkResult VKAPI_CALL
+  CreateImage(VkDevice, const VkImageCreateInfo* pCreateInfo,
+              const VkAllocationCallbacks*, VkImage* pImage) {
+    EXPECT_EQ(VK_FORMAT_R8G8B8A8_UNORM, pCreateInfo->format);
+    EXPECT_NE(0, pCreateInfo->usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+    const VkExtent3D& extent = pCreateInfo->extent;
+    sDevice->live_objects_++;
+    *pImage = ToHandle<VkImage>(
+        new Image{extent.width * extent.height * 4 * pCreateInfo->arrayLayers,
+                  nullptr});
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR void VKAPI_CALL GetImageMemoryRequirements(
+      VkDevice, VkImage image, VkMemoryRequirements* pMemoryRequirements) {
+    pMemoryRequirements->size = FromHandle<Image>(image)->size;
+    pMemoryRequirements->alignment = 1;
+    pMemoryRequirements->memoryTypeBits = 0x2;
+  }
+
+  static VKAPI_ATTR VkResult VKAPI_CALL BindImageMemory(VkDevice,
+                                                        VkImage image,
+                                                        VkDeviceMemory memory,
+                                                        VkDeviceSize) {
+    FromHandle<Image>(image)->memory = FromHandle<Memory>(memory);
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR void VKAPI_CALL DestroyImage(VkDevice, VkImage image,
+                                                 const VkAllocationCallbacks*) {
+    delete FromHandle<Image>(image);
+    sDevice->live_objects_--;
+  }
+
+  static VKAPI_ATTR VkResult VKAPI_CALL
+  CreateBuffer(VkDevice, const VkBufferCreateInfo* pCreateInfo,
+               const VkAllocationCallbacks*, VkBuffer* pBuffer) {
+    EXPECT_NE(0, pCreateInfo->usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    sDevice->live_objects_++;
+    *pBuffer = ToHandle<VkBuffer>(new Buffer{pCreateInfo->size, nullptr});
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR void VKAPI_CALL GetBufferMemoryRequirements(
+      VkDevice, VkBuffer buffer, VkMemoryRequirements* pMemoryRequirements) {
+    pMemoryRequirements->size = FromHandle<Buffer>(buffer)->size;
+    pMemoryRequirements->alignment = 1;
+    pMemoryRequirements->memoryTypeBits = 0x3;
+  }
+
+  static VKAPI_ATTR VkResult VKAPI_CALL BindBufferMemory(VkDevice,
+                                                         VkBuffer buffer,
+                                                         VkDeviceMemory memory,
+                                                         VkDeviceSize) {
+    FromHandle<Buffer>(buffer)->memory = FromHandle<Memory>(memory);
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR void VKAPI_CALL DestroyBuffer(
+      VkDevice, VkBuffer buffer, const VkAllocationCallbacks*) {
+    delete FromHandle<Buffer>(buffer);
+    sDevice->live_objects_--;
+  }
+
+  static VKAPI_ATTR VkResult VKAPI_CALL
+  CreateCommandPool(VkDevice, const VkCommandPoolCreateInfo*,
+                    const VkAllocationCallbacks*, VkCommandPool* pCommandPool) {
+    sDevice->live_objects_++;
+    *pCommandPool = ToHandle<VkCommandPool>(new CommandPool());
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR void VKAPI_CALL DestroyCommandPool(
+      VkDevice, VkCommandPool pool, const VkAllocationCallbacks*) {
+    delete FromHandle<CommandPool>(pool);
+    sDevice->live_objects_--;
+  }
+
+  static VKAPI_ATTR VkResult VKAPI_CALL AllocateCommandBuffers(
+      VkDevice, const VkCommandBufferAllocateInfo* pAllocateInfo,
+      VkCommandBuffer* pCommandBuffers) {
+    CommandPool* pool = FromHandle<CommandPool>(pAllocateInfo->commandPool);
+    for (uint32_t i = 0; i < pAllocateInfo->commandBufferCount; i++) {
+      pool->command_buffers.emplace_back(
+          new CommandBuffer{nullptr, false, nullptr, nullptr});
+      pCommandBuffers[i] =
+          reinterpret_cast<VkCommandBuffer>(pool->command_buffers.back().get());
+    }
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR VkResult VKAPI_CALL
+  BeginCommandBuffer(VkCommandBuffer command_buffer,
+                     const VkCommandBufferBeginInfo*) {
+    auto cb = reinterpret_cast<CommandBuffer*>(command_buffer);
+    // The dispatch table is set before the command buffer is used.
+    EXPECT_EQ(&sDevice->dispatch_, cb->dispatch);
+    cb->recorded = false;
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR VkResult VKAPI_CALL
+  EndCommandBuffer(VkCommandBuffer command_buffer) {
+    reinterpret_cast<CommandBuffer*>(command_buffer)->recorded = true;
+    return VK_SUCCESS;
+  }
+
+  static VKAPI_ATTR void VKAPI_CALL CmdCopyImageToBuffer(
+      VkCommandBuffer command_buffer, VkImage src, VkImageLayout, VkBuffer dst,
+      uint32_t regionCount, const VkBufferImageCopy* pRegions) {
+    EXPECT_EQ(1, regionCount);
+    EXPECT_EQ(0, pRegions[0].bufferOffset);
+    auto cb = reinterpret_cast<CommandBuffer*>(command_buffer);
+    cb->src = FromHandle<Image>(src);
+    cb->dst = FromHandle<Buffer>(dst);
+  }
+
+  static VKAPI_ATTR void VKAPI_CALL
+  CmdPipelineBarrier(VkCommandBuffer, VkPipelineStageFlags,
+                     VkPipelineStageFlags, VkDependencyFlags, uint32_t,
+                     const VkMemoryBarrier*, uint32_t,
+                     const VkBufferMemoryBarrier*, uint32_t,
+                     const VkImageMemoryBarrier*) {}
+
+  static FakeDevice* sDevice;
+
+  void* dispatch_;  // The dispatch table that device() points to.
+  DeviceData functions_;
+  VkPhysicalDeviceMemoryProperties memory_properties_;
+  std::atomic<int> live_objects_;  // The objects not destroyed yet.
+  std::atomic<uint32_t> invalidations_;
+
+  std::mutex mutex_;  // The lock for the state of the fences.
+  std::condition_variable fence_signaled_;
+};
+
+FakeDevice* FakeDevice::sDevice = nullptr;
+
+// ScopedEnv sets an environment variable for its lifetime.
+class ScopedEnv {
+ public:
+  ScopedEnv(const char* name, const char* value) : name_(name) {
+#ifdef _WIN32
+    _putenv_s(name, value);
+#else
+    setenv(name, value, 1);
+#endif
+  }
+  ~ScopedEnv() {
+#ifdef _WIN32
+    _putenv_s(name_, "");
+#else
+    unsetenv(name_);
+#endif
+  }
+
+ private:
+  const char* name_;
+};
+
+// Frames records the frames passed to the callback of the swapchain, and can
+// hold the callback until it is released.
+struct Frames {
+  static void Callback(void* user_data, uint8_t* data, size_t size) {
+    auto frames = static_cast<Frames*>(user_data);
+    std::unique_lock<std::mutex> lock(frames->mutex);
+    frames->values.push_back(data[0]);
+    frames->sizes.push_back(size);
+    frames->entered = true;
+    frames->condition.notify_all();
+    frames->condition.wait(lock, [&] { return !frames->held; });
+  }
+
+  // Waits for the callback to be called.
+  void WaitEntered() {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [&] { return entered; });
+  }
+
+  // Lets the callback return.
+  void Release() {
+    std::unique_lock<std::mutex> lock(mutex);
+    held = false;
+    condition.notify_all();
+  }
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool held = false;
+  bool entered = false;
+  std::vector<uint8_t> values;  // The first byte of each frame.
+  std::vector<size_t> sizes;
+};
+
+class VirtualSwapchainTest : public ::testing::Test {
+ protected:
+  VirtualSwapchainTest() {
+    memset(&properties_, 0, sizeof(properties_));
+    memset(&create_info_, 0, sizeof(create_info_));
+    create_info_.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    create_info_.minImageCount = 2;
+    create_info_.imageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    create_info_.imageExtent = VkExtent2D{kWidth, kHeight};
+    create_info_.imageArrayLayers = 1;
+    create_info_.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  }
+
+  void Create() {
+    swapchain_.reset(new VirtualSwapchain(
+        fake_.device(), 0, &properties_, fake_.memory_properties(),
+        fake_.functions(), &create_info_, nullptr));
+    swapchain_->SetCallback(Frames::Callback, &frames_);
+    images_ = swapchain_->GetImages(create_info_.minImageCount, false);
+  }
+
+  void Destroy() {
+    swapchain_->Destroy(nullptr);
+    swapchain_.reset();
+  }
+
+  // Acquires an image, renders value into it and presents it, as the layer
+  // does: the copy into the readback slot, if any, is submitted with the
+  // fence of the image.
+  void Present(uint8_t value) {
+    uint32_t i = 0;
+    ASSERT_TRUE(swapchain_->GetImage(kTimeout, &i));
+    ASSERT_LT(i, images_.size());
+    fake_.Render(images_[i], value);
+    VkCommandBuffer command_buffer = swapchain_->PrepareReadback(i);
+    fake_.Submit(command_buffer, swapchain_->GetFence(i));
+    swapchain_->NotifySubmitted(i);
+  }
+
+  FakeDevice fake_;
+  Frames frames_;
+  VkPhysicalDeviceProperties properties_;
+  VkSwapchainCreateInfoKHR create_info_;
+  std::unique_ptr<VirtualSwapchain> swapchain_;
+  std::vector<VkImage> images_;
+};
+
+TEST_F(VirtualSwapchainTest, DeliversFrames) {
+  const uint32_t kFrames = 20;
+  Create();
+  for (uint32_t frame = 1; frame <= kFrames; frame++) {
+    Present(static_cast<uint8_t>(frame));
+  }
+  Destroy();
+
+  ASSERT_EQ(kFrames, frames_.values.size());
+  for (uint32_t frame = 1; frame <= kFrames; frame++) {
+    EXPECT_EQ(frame, frames_.values[frame - 1]);
+    EXPECT_EQ(kImageSize, frames_.sizes[frame - 1]);
+  }
+  // The slots are not coherent, so each frame is invalidated before it is
+  // read.
+  EXPECT_EQ(kFrames, fake_.invalidations());
+}
+
+TEST_F(VirtualSwapchainTest, DropsFramesWithoutFreeSlot) {
+  ScopedEnv depth("VIRTUAL_SWAPCHAIN_READBACK_DEPTH", "1");
+  ScopedEnv drop("VIRTUAL_SWAPCHAIN_DROP_FRAMES", "1");
+  frames_.held = true;
+  Create();
+
+  // The single slot is held by the callback of the first frame, so the next
+  // frames are dropped. Their images are still reused, which would not
+  // return if the first image waited for the callback.
+  Present(1);
+  frames_.WaitEntered();
+  for (uint8_t frame = 2; frame <= 4; frame++) {
+    Present(frame);
+  }
+  EXPECT_EQ(3u, swapchain_->DroppedFrames());
+  EXPECT_EQ(0u, swapchain_->DeliveredFrames());
+
+  // The slot is free again once the callback has returned.
+  frames_.Release();
+  while (swapchain_->DeliveredFrames() < 1) {
+    std::this_thread::yield();
+  }
+  Present(5);
+  Destroy();
+
+  ASSERT_EQ(2u, frames_.values.size());
+  EXPECT_EQ(1, frames_.values[0]);
+  EXPECT_EQ(5, frames_.values[1]);
+  EXPECT_EQ(2u, fake_.invalidations());
+}
+
+}  // namespace test
+}  // namespace swapchain
@@ -43,15 +43,39 @@ namespace gapii {
 // Creates a CallObserver with a given spy and applies the memory space for
 // observation data from the spy instance.
 CallObserver::CallObserver(SpyBase* spy, CallObserver* parent, uint8_t api)
-    : mSpy(spy),
-      mParent(parent),
-      mSeenReferences{{nullptr, 0}},
+    : CallObserver() {
+  reset(spy, parent, api, core::Thread::current().id());
+}
+
+CallObserver::CallObserver()
+    : mSpy(nullptr),
+      mParent(nullptr),
       mCurrentCommandName(nullptr),
-      mObserveApplicationPool(spy->shouldObserveApplicationPool()),
+      mObserveApplicationPool(true),
       mError(0 /*GL_NO_ERROR*/),
-      mApi(api),
+      mApi(0),
       mShouldTrace(false),
-      mCurrentThread(core::Thread::current().id()) {
+      mCurrentThread(0) {
+  this->context_t::id = 0;
+  this->context_t::next_pool_id = nullptr;
+  this->context_t::globals = nullptr;
+  this->context_t::arena = nullptr;
+  mPendingObservations.setMergeThreshold(MEMORY_MERGE_THRESHOLD);
+}
+
+// Releases the observation data memory at the end.
+CallObserver::~CallObserver() {}
+
+void CallObserver::reset(SpyBase* spy, CallObserver* parent, uint8_t api,
+                         uint64_t thread) {
+  mSpy = spy;
+  mParent = parent;
+  mCurrentCommandName = nullptr;
+  mObserveApplicationPool = spy->shouldObserveApplicationPool();
+  mError = 0 /*GL_NO_ERROR*/;
+  mApi = api;
+  mCurrentThread = thread;
+
   // context_t initialization.
   this->context_t::id = 0;
   this->context_t::next_pool_id = &spy->next_pool_id();
@@ -59,17 +83,24 @@ CallObserver::CallObserver(SpyBase* spy, CallObserver* parent, uint8_t api)
   this->context_t::arena = reinterpret_cast<arena_t*>(spy->arena());
   mShouldTrace = mSpy->should_trace(mApi);
 
-  if (parent) {
-    mEncoderStack.push(mShouldTrace ? parent->encoder() : mSpy->nullEncoder());
+  if (!mShouldTrace) {
+    // Fast path: nothing is observed or encoded by this command.
+    mEncoderStack.push_back(mSpy->nullEncoder());
+  } else if (parent) {
+    mEncoderStack.push_back(parent->encoder());
   } else {
-    mEncoderStack.push(mSpy->getEncoder(mApi));
+    mEncoderStack.push_back(mSpy->getEncoder(mApi));
   }
-
-  mPendingObservations.setMergeThreshold(MEMORY_MERGE_THRESHOLD);
 }
 
-// Releases the observation data memory at the end.
-CallObserver::~CallObserver() {}
+void CallObserver::clear() {
+  // Drop the references to the encoders, so that an idle observer does not
+  // keep the encoder of a finished trace alive.
+  mEncoderStack.clear();
+  mOnSliceEncoded = nullptr;
+  mSeenReferences.clear();
+  mPendingObservations.clear();
+}
 
 core::Arena* CallObserver::arena() const { return mSpy->arena(); }
 
@@ -96,18 +127,49 @@ void CallObserver::observePending() {
     return;
   }
   for (auto p : mPendingObservations) {
-    uint8_t* data = reinterpret_cast<uint8_t*>(p.start());
-    uint64_t size = p.end() - p.start();
-    auto resIndex = mSpy->sendResource(mApi, data, size);
-    memory::Observation observation;
-    observation.set_base(p.start());
-    observation.set_size(size);
-    observation.set_res_index(resIndex);
-    encode_message(&observation);
+    observe(p.start(), p.end() - p.start());
   }
   mPendingObservations.clear();
 }
 
+void CallObserver::observe(uintptr_t base, uint64_t size) {
+  uint8_t* data = reinterpret_cast<uint8_t*>(base);
+  DeltaTracker* tracker = mSpy->delta_tracker();
+  std::vector<uint64_t> hashes;
+  if (tracker != nullptr && DeltaTracker::shouldTrack(size)) {
+    int64_t baseResIndex = 0;
+    std::vector<DeltaTracker::Span> changed;
+    if (tracker->diff(base, data, size, &baseResIndex, &changed, &hashes)) {
+      memory::DeltaObservation delta;
+      delta.set_base(base);
+      delta.set_size(size);
+      delta.set_base_res_index(baseResIndex);
+      if (!changed.empty()) {
+        std::string bytes;
+        for (const auto& span : changed) {
+          bytes.append(reinterpret_cast<char*>(data + span.offset), span.size);
+          delta.add_offsets(span.offset);
+          delta.add_sizes(span.size);
+        }
+        delta.set_res_index(
+            mSpy->sendResource(mApi, bytes.data(), bytes.size()));
+      }
+      encode_message(&delta);
+      return;
+    }
+  }
+
+  auto resIndex = mSpy->sendResource(mApi, data, size);
+  if (!hashes.empty()) {
+    tracker->rebase(base, size, resIndex, std::move(hashes));
+  }
+  memory::Observation observation;
+  observation.set_base(base);
+  observation.set_size(size);
+  observation.set_res_index(resIndex);
+  encode_message(&observation);
+}
+
 void CallObserver::observeTimestamp() {
   if (!mShouldTrace) {
     return;
@@ -123,7 +185,7 @@ void CallObserver::enter(const ::google::protobuf::Message* cmd) {
   if (!mShouldTrace) {
     return;
   }
-  mEncoderStack.push(encoder()->group(cmd));
+  mEncoderStack.push_back(encoder()->group(cmd));
 }
 
 void CallObserver::encode_message(const ::google::protobuf::Message* cmd) {
@@ -144,7 +206,7 @@ void CallObserver::resume() {
     // observations, but a concurrent command terminated the trace while this
     // command was passed on to the driver. Pop the encoder which was pushed at
     // creation.
-    mEncoderStack.pop();
+    mEncoderStack.pop_back();
   }
 }
 
@@ -152,7 +214,7 @@ void CallObserver::exit() {
   if (!mShouldTrace) {
     return;
   }
-  mEncoderStack.pop();
+  mEncoderStack.pop_back();
 }
 
 void CallObserver::encodeAndDelete(::google::protobuf::Message* cmd) {
@@ -183,4 +245,24 @@ gapil::String CallObserver::string(const gapil::Slice<char>& slice) {
 
 void CallObserver::endTraceIfRequested() { mSpy->endTraceIfRequested(); }
 
+CallObserverPool::CallObserverPool()
+    : mDepth(0), mThread(core::Thread::current().id()) {}
+
+CallObserver* CallObserverPool::acquire(SpyBase* spy, CallObserver* parent,
+                                        uint8_t api) {
+  if (mDepth == mObservers.size()) {
+    mObservers.emplace_back(new CallObserver());
+  }
+  CallObserver* observer = mObservers[mDepth++].get();
+  observer->reset(spy, parent, api, mThread);
+  return observer;
+}
+
+void CallObserverPool::release(CallObserver* observer) {
+  GAPID_ASSERT_MSG(mDepth > 0 && mObservers[mDepth - 1].get() == observer,
+                   "CallObservers released out of order");
+  observer->clear();
+  mDepth--;
+}
+
 }  // namespace gapii
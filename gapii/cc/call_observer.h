@@ -28,9 +28,10 @@
 #include "core/cc/vector.h"
 #include "core/memory/arena/cc/arena.h"
 
-#include <stack>
+#include <memory>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 namespace gapii {
 
@@ -40,7 +41,8 @@ class SpyBase;
 
 // CallObserver collects observation data in API function calls. It is supposed
 // to be created at the beginning of each intercepted API function call and
-// deleted at the end.
+// deleted at the end, or to be acquired from and released to a
+// CallObserverPool.
 class CallObserver : public context_t {
  public:
   template <class T>
@@ -76,8 +78,7 @@ class CallObserver : public context_t {
   // and true when the address is seen for the first time.
   // Nullptr address is always mapped to identifier 0.
   inline std::pair<uint64_t, bool> reference_id(const void* address) {
-    auto it = mSeenReferences.emplace(address, mSeenReferences.size());
-    return std::pair<uint64_t, bool>(it.first->second, it.second);
+    return mSeenReferences.insert(address);
   }
 
   // on_slice_encoded sets the callback to be invoked when slice_encoded is
@@ -187,6 +188,47 @@ class CallObserver : public context_t {
   void observeTimestamp();
 
  private:
+  friend class CallObserverPool;
+
+  // ReferenceIds maps object addresses to identifiers allocated in the order
+  // the addresses are first seen. Most commands only reference a handful of
+  // objects, so the first addresses are kept in an inline array that is
+  // searched linearly, and only the rest are kept in a hash map.
+  class ReferenceIds {
+   public:
+    ReferenceIds() : mCount(0) {}
+
+    // insert returns the identifier of address, and true if address was not
+    // seen before.
+    inline std::pair<uint64_t, bool> insert(const void* address);
+
+    // clear forgets all the addresses, keeping the allocated storage.
+    inline void clear() {
+      mCount = 0;
+      if (!mOverflow.empty()) {
+        mOverflow.clear();
+      }
+    }
+
+   private:
+    static const size_t kInlineCount = 4;
+
+    const void* mInline[kInlineCount];
+    size_t mCount;
+    std::unordered_map<const void*, uint64_t> mOverflow;
+  };
+
+  // Creates an observer that must be reset before use.
+  CallObserver();
+
+  // reset prepares this observer for a new command called on the thread with
+  // the given identifier.
+  void reset(SpyBase* spy, CallObserver* parent, uint8_t api, uint64_t thread);
+
+  // clear releases the encoders and callbacks held by this observer once the
+  // command has returned. The allocated storage is kept for the next command.
+  void clear();
+
   // shouldObserve returns true if the given slice is located in application
   // pool and we are supposed to observe application pool.
   template <class T>
@@ -194,6 +236,10 @@ class CallObserver : public context_t {
     return mObserveApplicationPool && slice.is_app_pool();
   }
 
+  // observe encodes the memory range [base, base + size) as an observation,
+  // sending its content if it has not been sent before.
+  void observe(uintptr_t base, uint64_t size);
+
   // Make a slice on a new Pool.
   template <typename T>
   inline gapil::Slice<T> make(uint64_t count);
@@ -208,10 +254,10 @@ class CallObserver : public context_t {
   CallObserver* mParent;
 
   // The encoder stack.
-  std::stack<PackEncoder::SPtr> mEncoderStack;
+  std::vector<PackEncoder::SPtr> mEncoderStack;
 
   // A map of object pointer to encoded reference identifier.
-  std::unordered_map<const void*, uint64_t> mSeenReferences;
+  ReferenceIds mSeenReferences;
 
   // A pointer to the static array that contains the current command name.
   const char* mCurrentCommandName;
@@ -238,6 +284,52 @@ class CallObserver : public context_t {
   OnSliceEncodedCallback mOnSliceEncoded;
 };
 
+// CallObserverPool keeps the CallObservers used by a single thread so that
+// they, and the storage of their containers, are reused from one command to
+// the next instead of being allocated for each command. Observers are acquired
+// and released in nested order, as commands are intercepted.
+class CallObserverPool {
+ public:
+  CallObserverPool();
+
+  // acquire returns an observer for a new command, observed by spy, that is
+  // called from the command observed by parent.
+  CallObserver* acquire(SpyBase* spy, CallObserver* parent, uint8_t api);
+
+  // release returns the observer last returned by acquire to the pool.
+  void release(CallObserver* observer);
+
+ private:
+  // The observers of the pool, the first mDepth of which are in use.
+  std::vector<std::unique_ptr<CallObserver> > mObservers;
+  size_t mDepth;
+  // The identifier of the thread using the pool.
+  uint64_t mThread;
+};
+
+inline std::pair<uint64_t, bool> CallObserver::ReferenceIds::insert(
+    const void* address) {
+  // Nullptr is always mapped to identifier 0.
+  if (address == nullptr) {
+    return std::pair<uint64_t, bool>(0, false);
+  }
+  size_t count = mCount < kInlineCount ? mCount : kInlineCount;
+  for (size_t i = 0; i < count; i++) {
+    if (mInline[i] == address) {
+      return std::pair<uint64_t, bool>(i + 1, false);
+    }
+  }
+  if (mCount < kInlineCount) {
+    mInline[mCount++] = address;
+    return std::pair<uint64_t, bool>(mCount, true);
+  }
+  auto it = mOverflow.emplace(address, mCount + 1);
+  if (it.second) {
+    mCount++;
+  }
+  return std::pair<uint64_t, bool>(it.first->second, it.second);
+}
+
 template <typename T>
 inline void CallObserver::read(const gapil::Slice<T>& slice) {
   if (shouldObserve(slice)) {
@@ -300,7 +392,9 @@ inline gapil::Slice<T> CallObserver::make(uint64_t count) {
   return gapil::Slice<T>::create(this, count);
 }
 
-inline PackEncoder::SPtr CallObserver::encoder() { return mEncoderStack.top(); }
+inline PackEncoder::SPtr CallObserver::encoder() {
+  return mEncoderStack.back();
+}
 
 template <typename T, typename /* = enable_if_encodable<T> */>
 inline void CallObserver::enter(const T& obj) {
@@ -311,7 +405,7 @@ inline void CallObserver::enter(const T& obj) {
   auto group = reinterpret_cast<PackEncoder*>(obj.encode(this, true));
   GAPID_ASSERT_MSG(group != nullptr,
                    "encode() for group did not return sub-encoder");
-  mEncoderStack.push(PackEncoder::SPtr(group));
+  mEncoderStack.push_back(PackEncoder::SPtr(group));
 }
 
 template <typename T, typename /* = enable_if_encodable<T> */>
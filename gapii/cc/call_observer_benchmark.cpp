@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Synthetic benchmark of the per-command overhead of CallObservers. Each
+// simulated command creates an observer, makes a few memory observations and
+// reference lookups as a typical command does, and then destroys the
+// observer. Observers allocated per command are compared against observers
+// reused from a CallObserverPool, with tracing enabled and disabled.
+
+#include "gapii/cc/call_observer.h"
+#include "gapii/cc/spy_base.h"
+
+#include "core/cc/timer.h"
+
+#include <stdio.h>
+
+namespace {
+
+const int kCommands = 1000000;
+const uint8_t kApi = 0;
+
+// simulateCommand performs the observer work of a single command.
+void simulateCommand(gapii::CallObserver* observer, int i) {
+  static const char* kName = "vkCmdDraw";
+  static uint64_t data[64];
+  observer->setCurrentCommandName(kName);
+  observer->read(&data[i % 16], 16);
+  observer->write(&data[32 + i % 16], 8);
+  observer->reference_id(&data[0]);
+  observer->reference_id(&data[i % 3]);
+}
+
+// runAllocated returns the average nanoseconds per command when a new
+// observer is allocated for each command.
+double runAllocated(gapii::SpyBase* spy) {
+  uint64_t start = core::GetNanoseconds();
+  for (int i = 0; i < kCommands; i++) {
+    auto observer = new gapii::CallObserver(spy, nullptr, kApi);
+    simulateCommand(observer, i);
+    delete observer;
+  }
+  return double(core::GetNanoseconds() - start) / kCommands;
+}
+
+// runPooled returns the average nanoseconds per command when the observers
+// are reused from a pool.
+double runPooled(gapii::SpyBase* spy) {
+  gapii::CallObserverPool pool;
+  uint64_t start = core::GetNanoseconds();
+  for (int i = 0; i < kCommands; i++) {
+    auto observer = pool.acquire(spy, nullptr, kApi);
+    simulateCommand(observer, i);
+    pool.release(observer);
+  }
+  return double(core::GetNanoseconds() - start) / kCommands;
+}
+
+}  // anonymous namespace
+
+int main() {
+  gapii::SpyBase spy;
+  printf("%-10s %14s %14s\n", "tracing", "allocated ns", "pooled ns");
+  for (bool tracing : {true, false}) {
+    spy.set_suspended(!tracing);
+    // Warm up the allocator.
+    runAllocated(&spy);
+    double allocated = runAllocated(&spy);
+    double pooled = runPooled(&spy);
+    printf("%-10s %14.1f %14.1f\n", tracing ? "enabled" : "disabled",
+           allocated, pooled);
+  }
+  return 0;
+}
@@ -52,6 +52,10 @@ class ConnectionHeader {
   static const uint32_t FLAG_STORE_TIMESTAMPS = 0x00000080;
   // Disables the coherent memory tracker (useful for debug)
   static const uint32_t FLAG_DISABLE_COHERENT_MEMORY_TRACKER = 0x00000100;
+  // Allows commands that only touch per-object state to run concurrently.
+  static const uint32_t FLAG_FINE_GRAINED_LOCKING = 0x00000200;
+  // Encodes repeated observations of large ranges as deltas.
+  static const uint32_t FLAG_DELTA_OBSERVATIONS = 0x00000400;
 
   // read reads the ConnectionHeader from the provided stream, returning true
   // on success or false on error.
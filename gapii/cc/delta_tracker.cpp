@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "delta_tracker.h"
+
+#include <city.h>
+
+#include <algorithm>
+
+namespace gapii {
+
+DeltaTracker::DeltaTracker() : mTrackedBytes(0) {}
+
+bool DeltaTracker::diff(uintptr_t base, const void* data, uint64_t size,
+                        int64_t* baseResIndex, std::vector<Span>* changed,
+                        std::vector<uint64_t>* hashes) {
+  auto bytes = reinterpret_cast<const char*>(data);
+  uint64_t count = (size + kBlockSize - 1) / kBlockSize;
+  hashes->resize(count);
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t offset = i * kBlockSize;
+    uint64_t len = std::min(kBlockSize, size - offset);
+    (*hashes)[i] = CityHash64(bytes + offset, static_cast<size_t>(len));
+  }
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  auto it = mEntries.find(base);
+  if (it == mEntries.end() || it->second.size != size) {
+    return false;
+  }
+  const Entry& entry = it->second;
+
+  changed->clear();
+  uint64_t changedBytes = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    if ((*hashes)[i] == entry.hashes[i]) {
+      continue;
+    }
+    uint64_t offset = i * kBlockSize;
+    uint64_t len = std::min(kBlockSize, size - offset);
+    if (!changed->empty() &&
+        changed->back().offset + changed->back().size == offset) {
+      changed->back().size += len;
+    } else {
+      changed->push_back(Span{offset, len});
+    }
+    changedBytes += len;
+  }
+  if (changedBytes * kMaxDeltaFraction > size) {
+    return false;
+  }
+  *baseResIndex = entry.resIndex;
+  return true;
+}
+
+void DeltaTracker::rebase(uintptr_t base, uint64_t size, int64_t resIndex,
+                          std::vector<uint64_t>&& hashes) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  auto it = mEntries.find(base);
+  if (it != mEntries.end()) {
+    mTrackedBytes -= it->second.size;
+    mEntries.erase(it);
+  }
+  if (mTrackedBytes + size > kMaxTrackedBytes) {
+    // Too much is being tracked. Start again rather than keeping an LRU; the
+    // ranges that are still updated will be picked up on their next full send.
+    mEntries.clear();
+    mTrackedBytes = 0;
+  }
+  Entry& entry = mEntries[base];
+  entry.size = size;
+  entry.resIndex = resIndex;
+  entry.hashes = std::move(hashes);
+  mTrackedBytes += size;
+}
+
+void DeltaTracker::clear() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  mEntries.clear();
+  mTrackedBytes = 0;
+}
+
+}  // namespace gapii
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GAPII_DELTA_TRACKER_H
+#define GAPII_DELTA_TRACKER_H
+
+#include <stdint.h>
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace gapii {
+
+// DeltaTracker keeps a fingerprint of large memory ranges that have been sent
+// in full, so that a later observation of the same range can be encoded as
+// the blocks that changed since, plus a reference to the full resource.
+//
+// A range is identified by its base address and size. The fingerprint is a
+// 64-bit hash per kBlockSize bytes. Deltas are always relative to the last
+// range content that was sent in full. Once a delta grows beyond
+// kMaxDeltaFraction of the range, the range is sent in full again and becomes
+// the new base.
+class DeltaTracker {
+ public:
+  // The granularity of change detection.
+  static const uint64_t kBlockSize = 1024;
+  // Ranges smaller than this are always sent in full.
+  static const uint64_t kMinTrackedSize = 64 * 1024;
+  // The maximum total size of the ranges that are tracked at any time.
+  static const uint64_t kMaxTrackedBytes = 1ull << 30;
+  // A delta is used only if it covers at most 1/kMaxDeltaFraction of the
+  // range.
+  static const uint64_t kMaxDeltaFraction = 4;
+
+  // Span is a byte range relative to the start of a tracked range.
+  struct Span {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  DeltaTracker();
+
+  // shouldTrack returns true if a range of size bytes is large enough to be
+  // tracked.
+  static bool shouldTrack(uint64_t size) { return size >= kMinTrackedSize; }
+
+  // diff compares the size bytes at data with the fingerprint of the range
+  // last sent in full for base. If the range can be sent as a delta, diff
+  // returns true, and sets baseResIndex to the index of the full resource and
+  // changed to the spans that differ from it.
+  // Otherwise diff returns false and hashes holds the fingerprint of data, to
+  // be passed to rebase() once the range has been sent in full.
+  bool diff(uintptr_t base, const void* data, uint64_t size,
+            int64_t* baseResIndex, std::vector<Span>* changed,
+            std::vector<uint64_t>* hashes);
+
+  // rebase records that the range at base of size bytes was sent in full as
+  // the resource resIndex, with the fingerprint hashes returned by diff().
+  void rebase(uintptr_t base, uint64_t size, int64_t resIndex,
+              std::vector<uint64_t>&& hashes);
+
+  // clear forgets all tracked ranges.
+  void clear();
+
+ private:
+  struct Entry {
+    uint64_t size;
+    int64_t resIndex;
+    std::vector<uint64_t> hashes;
+  };
+
+  std::mutex mMutex;
+  std::unordered_map<uintptr_t, Entry> mEntries;
+  uint64_t mTrackedBytes;
+};
+
+}  // namespace gapii
+
+#endif  // GAPII_DELTA_TRACKER_H
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Synthetic benchmark of delta observations. A 64 MB buffer is observed once
+// per frame after 1% of it has been updated, either as one contiguous block or
+// as many small scattered writes. The cost and size of sending the full buffer
+// every frame is compared against sending deltas.
+
+#include "gapii/cc/delta_tracker.h"
+
+#include "core/cc/id.h"
+#include "core/cc/timer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+const uint64_t kBufferSize = 64 * 1024 * 1024;
+const uint64_t kUpdateSize = kBufferSize / 100;
+const uint64_t kWriteSize = 256;
+const int kFrames = 60;
+
+// update modifies 1% of the buffer for the given frame.
+void update(std::vector<uint8_t>& buffer, int frame, bool scattered,
+            std::mt19937_64& rng) {
+  if (!scattered) {
+    uint64_t offset = (frame * kUpdateSize) % (kBufferSize - kUpdateSize);
+    memset(&buffer[offset], frame, kUpdateSize);
+    return;
+  }
+  std::uniform_int_distribution<uint64_t> dist(0, kBufferSize - kWriteSize);
+  for (uint64_t i = 0; i < kUpdateSize / kWriteSize; i++) {
+    memset(&buffer[dist(rng)], frame, kWriteSize);
+  }
+}
+
+void run(bool scattered) {
+  std::vector<uint8_t> buffer(kBufferSize);
+  std::mt19937_64 rng(1234);
+  uintptr_t base = reinterpret_cast<uintptr_t>(buffer.data());
+
+  // Full observations: the content is hashed to check whether it was already
+  // sent, and then copied into the resource.
+  uint64_t fullNs = 0;
+  uint64_t fullBytes = 0;
+  std::string resource;
+  for (int frame = 0; frame < kFrames; frame++) {
+    update(buffer, frame, scattered, rng);
+    uint64_t start = core::GetNanoseconds();
+    core::Id id = core::Id::Hash(buffer.data(), kBufferSize);
+    resource.assign(reinterpret_cast<char*>(buffer.data()), kBufferSize);
+    fullNs += core::GetNanoseconds() - start;
+    fullBytes += resource.size() + sizeof(id);
+  }
+
+  // Delta observations.
+  rng.seed(1234);
+  gapii::DeltaTracker tracker;
+  uint64_t deltaNs = 0;
+  uint64_t deltaBytes = 0;
+  int fullSends = 0;
+  int64_t nextResIndex = 1;
+  for (int frame = 0; frame < kFrames; frame++) {
+    update(buffer, frame, scattered, rng);
+    uint64_t start = core::GetNanoseconds();
+    int64_t baseResIndex = 0;
+    std::vector<gapii::DeltaTracker::Span> changed;
+    std::vector<uint64_t> hashes;
+    if (tracker.diff(base, buffer.data(), kBufferSize, &baseResIndex, &changed,
+                     &hashes)) {
+      resource.clear();
+      for (const auto& span : changed) {
+        resource.append(reinterpret_cast<char*>(&buffer[span.offset]),
+                        span.size);
+      }
+      core::Id id = core::Id::Hash(resource.data(), resource.size());
+      deltaBytes += resource.size() + sizeof(id) +
+                    changed.size() * sizeof(gapii::DeltaTracker::Span);
+    } else {
+      core::Id id = core::Id::Hash(buffer.data(), kBufferSize);
+      resource.assign(reinterpret_cast<char*>(buffer.data()), kBufferSize);
+      tracker.rebase(base, kBufferSize, nextResIndex++, std::move(hashes));
+      deltaBytes += resource.size() + sizeof(id);
+      fullSends++;
+    }
+    deltaNs += core::GetNanoseconds() - start;
+  }
+
+  printf("%-10s full: %8.2f ms/frame %10.2f MB/frame | ",
+         scattered ? "scattered" : "contiguous", fullNs / 1e6 / kFrames,
+         fullBytes / 1048576.0 / kFrames);
+  printf("delta: %8.2f ms/frame %10.2f MB/frame (%d full sends)\n",
+         deltaNs / 1e6 / kFrames, deltaBytes / 1048576.0 / kFrames, fullSends);
+}
+
+}  // anonymous namespace
+
+int main() {
+  run(false);
+  run(true);
+  return 0;
+}
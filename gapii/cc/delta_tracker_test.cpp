@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gapii/cc/delta_tracker.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace gapii {
+namespace test {
+
+const uintptr_t kBase = 0x10000;
+const uint64_t kSize = 64 * DeltaTracker::kBlockSize;
+const uint64_t kBlock = DeltaTracker::kBlockSize;
+
+class DeltaTrackerTest : public ::testing::Test {
+ protected:
+  DeltaTrackerTest() : data(kSize, 'a') {}
+
+  // Sends data in full as resource resIndex if it can't be sent as a delta,
+  // as CallObserver::observe does. Returns true if a delta was used.
+  bool observe(int64_t resIndex) {
+    changed.clear();
+    std::vector<uint64_t> hashes;
+    if (tracker.diff(kBase, data.data(), data.size(), &baseResIndex, &changed,
+                     &hashes)) {
+      return true;
+    }
+    EXPECT_EQ((data.size() + kBlock - 1) / kBlock, hashes.size());
+    tracker.rebase(kBase, data.size(), resIndex, std::move(hashes));
+    base = data;
+    return false;
+  }
+
+  // Applies the changed spans of the last delta to the content that was sent
+  // in full, as the replay side does.
+  std::string reconstruct() const {
+    std::string out = base;
+    for (const auto& span : changed) {
+      out.replace(span.offset, span.size, data, span.offset, span.size);
+    }
+    return out;
+  }
+
+  DeltaTracker tracker;
+  std::string data;
+  std::string base;
+  int64_t baseResIndex = 0;
+  std::vector<DeltaTracker::Span> changed;
+};
+
+TEST_F(DeltaTrackerTest, ShouldTrack) {
+  EXPECT_FALSE(DeltaTracker::shouldTrack(DeltaTracker::kMinTrackedSize - 1));
+  EXPECT_TRUE(DeltaTracker::shouldTrack(DeltaTracker::kMinTrackedSize));
+}
+
+TEST_F(DeltaTrackerTest, Unchanged) {
+  EXPECT_FALSE(observe(1));
+  EXPECT_TRUE(observe(2));
+  EXPECT_EQ(1, baseResIndex);
+  EXPECT_TRUE(changed.empty());
+  EXPECT_EQ(data, reconstruct());
+}
+
+TEST_F(DeltaTrackerTest, ChangedBlocks) {
+  EXPECT_FALSE(observe(1));
+
+  // Two adjacent blocks are merged into one span, and a change in the last
+  // byte gives a span of the last block.
+  data[3 * kBlock + 10] = 'b';
+  data[4 * kBlock] = 'b';
+  data[10 * kBlock + 1] = 'c';
+  data[kSize - 1] = 'd';
+  EXPECT_TRUE(observe(2));
+  EXPECT_EQ(1, baseResIndex);
+  ASSERT_EQ(3, changed.size());
+  EXPECT_EQ(3 * kBlock, changed[0].offset);
+  EXPECT_EQ(2 * kBlock, changed[0].size);
+  EXPECT_EQ(10 * kBlock, changed[1].offset);
+  EXPECT_EQ(kBlock, changed[1].size);
+  EXPECT_EQ(kSize - kBlock, changed[2].offset);
+  EXPECT_EQ(kBlock, changed[2].size);
+  EXPECT_EQ(data, reconstruct());
+
+  // Deltas stay relative to the content sent in full.
+  data[20 * kBlock] = 'e';
+  EXPECT_TRUE(observe(3));
+  EXPECT_EQ(1, baseResIndex);
+  EXPECT_EQ(4, changed.size());
+  EXPECT_EQ(data, reconstruct());
+}
+
+TEST_F(DeltaTrackerTest, PartialLastBlock) {
+  data.resize(kSize + 100, 'a');
+  EXPECT_FALSE(observe(1));
+  data.back() = 'b';
+  EXPECT_TRUE(observe(2));
+  ASSERT_EQ(1, changed.size());
+  EXPECT_EQ(kSize, changed[0].offset);
+  EXPECT_EQ(100, changed[0].size);
+  EXPECT_EQ(data, reconstruct());
+}
+
+TEST_F(DeltaTrackerTest, LargeChangeRebases) {
+  EXPECT_FALSE(observe(1));
+
+  // A quarter of the range can still be sent as a delta.
+  for (uint64_t i = 0; i < kSize / DeltaTracker::kMaxDeltaFraction; i++) {
+    data[i] = 'b';
+  }
+  EXPECT_TRUE(observe(2));
+  EXPECT_EQ(data, reconstruct());
+
+  // Any more is sent in full, and becomes the new base.
+  data[kSize - 1] = 'b';
+  EXPECT_FALSE(observe(3));
+  EXPECT_TRUE(observe(4));
+  EXPECT_EQ(3, baseResIndex);
+  EXPECT_TRUE(changed.empty());
+}
+
+TEST_F(DeltaTrackerTest, ResizedRange) {
+  EXPECT_FALSE(observe(1));
+  data.resize(kSize * 2, 'a');
+  EXPECT_FALSE(observe(2));
+  EXPECT_TRUE(observe(3));
+  EXPECT_EQ(2, baseResIndex);
+}
+
+TEST_F(DeltaTrackerTest, Clear) {
+  EXPECT_FALSE(observe(1));
+  tracker.clear();
+  EXPECT_FALSE(observe(2));
+  EXPECT_TRUE(observe(3));
+  EXPECT_EQ(2, baseResIndex);
+}
+
+}  // namespace test
+}  // namespace gapii
@@ -19,11 +19,15 @@
 
 #include "core/cc/stream_writer.h"
 
+#include "gapis/capture/capture.pb.h"
+
 #include <google/protobuf/descriptor.pb.h>
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/message.h>
 
+#include <algorithm>
 #include <mutex>
+#include <vector>
 
 using ::google::protobuf::Descriptor;
 using ::google::protobuf::DescriptorProto;
@@ -36,6 +40,12 @@ const uint64_t NO_ID = 0xffffffffffffffff;
 
 constexpr int TYPE_ID_CACHE_COUNT = 4;
 
+// Number of bytes written between two seek indices.
+constexpr uint64_t SEEK_INDEX_INTERVAL = 8 * 1024 * 1024;
+
+// The magic number of the seek footer, "SEKINDEX".
+constexpr uint64_t SEEK_FOOTER_MAGIC = 0x5845444e494b4553;
+
 const char header[] = "ProtoPack\r\n2.0\n";
 
 // PackEncoderImpl implements the PackEncoder interface.
@@ -52,6 +62,8 @@ class PackEncoderImpl : public gapii::PackEncoder {
   virtual PackEncoder* group(TypeID type, size_t size,
                              const void* data) override;
   virtual void flush() override;
+  virtual void frame() override;
+  virtual void finish() override;
 
  private:
   struct TypeIDCache {
@@ -67,6 +79,16 @@ class PackEncoderImpl : public gapii::PackEncoder {
     std::unordered_map<const void*, TypeID> type_ids;
     TypeIDCache type_id_caches[TYPE_ID_CACHE_COUNT];
     uint64_t mCurrentChunkId;
+
+    // The byte offset of the next chunk in the stream.
+    uint64_t offset;
+    // The ids of the group chunks that have not been terminated yet.
+    std::vector<uint64_t> open_groups;
+    // The seek index being built, and the offset of the previous one.
+    capture::SeekIndex index;
+    uint64_t index_offset;
+    uint64_t frame_count;
+    bool writing_index;
   };
 
   PackEncoderImpl(const std::shared_ptr<Shared>& shared,
@@ -83,6 +105,8 @@ class PackEncoderImpl : public gapii::PackEncoder {
   void writeZigzag(std::string& buffer, int64_t value);
   void writeVarint(std::string& buffer, uint64_t value);
   uint64_t flushChunk(std::string& buffer, bool isTypeDefChunk);
+  void setSeekPoint(capture::SeekPoint* point);
+  void writeSeekIndex();
 
   std::shared_ptr<Shared> mShared;
   uint64_t mParentChunkId;
@@ -90,7 +114,13 @@ class PackEncoderImpl : public gapii::PackEncoder {
 
 PackEncoderImpl::Shared::Shared(
     const std::shared_ptr<core::StringWriter>& writer)
-    : writer(writer), type_ids{{nullptr, 0}}, mCurrentChunkId(0) {}
+    : writer(writer),
+      type_ids{{nullptr, 0}},
+      mCurrentChunkId(0),
+      offset(sizeof(header)),
+      index_offset(0),
+      frame_count(0),
+      writing_index(false) {}
 
 PackEncoderImpl::PackEncoderImpl(
     const std::shared_ptr<core::StringWriter>& writer)
@@ -105,12 +135,45 @@ PackEncoderImpl::~PackEncoderImpl() {
     std::string buffer;
     std::lock_guard<std::recursive_mutex> lock(mShared->mutex);
     writeParentID(buffer);
+    auto& groups = mShared->open_groups;
+    // Groups are mostly terminated in the reverse order of their creation.
+    auto it = std::find(groups.rbegin(), groups.rend(), mParentChunkId);
+    if (it != groups.rend()) {
+      groups.erase(std::next(it).base());
+    }
     flushChunk(buffer, false);
   }
 }
 
 void PackEncoderImpl::flush() { mShared->writer->flush(); }
 
+void PackEncoderImpl::frame() {
+  std::lock_guard<std::recursive_mutex> lock(mShared->mutex);
+  if (mShared->index.frames_size() == 0) {
+    mShared->index.set_first_frame(mShared->frame_count);
+  }
+  mShared->frame_count++;
+  setSeekPoint(mShared->index.add_frames());
+}
+
+void PackEncoderImpl::finish() {
+  std::lock_guard<std::recursive_mutex> lock(mShared->mutex);
+  // The footer type is defined before the last index, so that the index
+  // lists all the type definitions.
+  auto type_id =
+      writeTypeIfNewBlocking(capture::SeekFooter::descriptor()).first;
+  writeSeekIndex();
+
+  capture::SeekFooter footer;
+  footer.set_last_index(mShared->index_offset);
+  footer.set_magic(SEEK_FOOTER_MAGIC);
+  std::string buffer;
+  writeZigzag(buffer, 0);
+  writeZigzag(buffer, type_id);
+  footer.AppendToString(&buffer);
+  flushChunk(buffer, false);
+}
+
 gapii::PackEncoder::TypeIDAndIsNew PackEncoderImpl::type(const char* name,
                                                          size_t size,
                                                          const void* data) {
@@ -145,6 +208,8 @@ gapii::PackEncoder::SPtr PackEncoderImpl::group(const Message* msg) {
   writeParentID(buffer);
   writeZigzag(buffer, -(int64_t)type_id);
   msg->AppendToString(&buffer);
+  // The group is open from its own chunk on.
+  mShared->open_groups.push_back(mShared->mCurrentChunkId);
   auto chunkID = flushChunk(buffer, false);
 
   return PackEncoder::SPtr(new PackEncoderImpl(mShared, chunkID));
@@ -157,6 +222,8 @@ gapii::PackEncoder* PackEncoderImpl::group(TypeID type_id, size_t size,
   writeParentID(buffer);
   writeZigzag(buffer, -(int64_t)type_id);
   buffer.append(reinterpret_cast<const char*>(data), size);
+  // The group is open from its own chunk on.
+  mShared->open_groups.push_back(mShared->mCurrentChunkId);
   auto chunkID = flushChunk(buffer, false);
 
   return new PackEncoderImpl(mShared, chunkID);
@@ -300,7 +367,47 @@ uint64_t PackEncoderImpl::flushChunk(std::string& buffer, bool isTypeDefChunk) {
   writeZigzag(sizeBuffer, isTypeDefChunk ? -size : size);
   mShared->writer->write({&sizeBuffer, &buffer});
   buffer.clear();
-  return mShared->mCurrentChunkId++;
+  if (isTypeDefChunk) {
+    mShared->index.add_type_offsets(mShared->offset);
+  }
+  mShared->offset += sizeBuffer.size() + size;
+  auto chunkID = mShared->mCurrentChunkId++;
+  if (mShared->offset - mShared->index_offset >= SEEK_INDEX_INTERVAL) {
+    writeSeekIndex();
+  }
+  return chunkID;
+}
+
+void PackEncoderImpl::setSeekPoint(capture::SeekPoint* point) {
+  point->set_offset(mShared->offset);
+  point->set_chunk(mShared->mCurrentChunkId);
+  point->set_type_count(mShared->type_ids.size() - 1);
+  for (auto id : mShared->open_groups) {
+    point->add_open_groups(id);
+  }
+}
+
+void PackEncoderImpl::writeSeekIndex() {
+  if (mShared->writing_index) {
+    return;
+  }
+  mShared->writing_index = true;
+  // The index types must be defined before the seek point of the index.
+  auto type_id =
+      writeTypeIfNewBlocking(capture::SeekIndex::descriptor()).first;
+
+  auto& index = mShared->index;
+  auto offset = mShared->offset;
+  index.set_previous(mShared->index_offset);
+  setSeekPoint(index.mutable_point());
+  std::string buffer;
+  writeZigzag(buffer, 0);
+  writeZigzag(buffer, type_id);
+  index.AppendToString(&buffer);
+  index.Clear();
+  mShared->index_offset = offset;
+  flushChunk(buffer, false);
+  mShared->writing_index = false;
 }
 
 // PackEncoderNoop is a no-op implementation of the PackEncoder interface.
@@ -320,6 +427,8 @@ class PackEncoderNoop : public gapii::PackEncoder {
     return new PackEncoderNoop();
   }
   virtual void flush() override {}
+  virtual void frame() override {}
+  virtual void finish() override {}
 };
 
 gapii::PackEncoder::SPtr PackEncoderNoop::instance =
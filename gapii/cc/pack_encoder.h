@@ -73,6 +73,14 @@ class PackEncoder {
   // flush flushes out all of the pending in the encoder
   virtual void flush() = 0;
 
+  // frame records that a new frame starts with the next encoded chunk, so
+  // that readers can seek to it.
+  virtual void frame() = 0;
+
+  // finish encodes the last seek index and the footer that marks a cleanly
+  // ended stream. Nothing should be encoded after calling finish.
+  virtual void finish() = 0;
+
   // create returns a PackEncoder::SPtr that writes to output.
   // If no_buffer is true, thn the output will be flushed after every write.
   static SPtr create(std::shared_ptr<core::StreamWriter> output,
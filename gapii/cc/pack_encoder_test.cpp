@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gapii/cc/pack_encoder.h"
+#include "gapii/cc/protocol.h"
+
+#include "core/cc/stream_writer.h"
+#include "gapis/capture/capture.pb.h"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <gtest/gtest.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using ::google::protobuf::io::CodedInputStream;
+
+namespace gapii {
+namespace test {
+
+const size_t kHeaderSize = 16;  // "ProtoPack\r\n2.0\n" and its terminator.
+const uint64_t kFooterMagic = 0x5845444e494b4553;
+
+// MemoryWriter holds the data of the protocol messages written to it in
+// memory.
+class MemoryWriter : public core::StreamWriter {
+ public:
+  uint64_t write(const void* data, uint64_t size) override {
+    // Each message is written at once.
+    EXPECT_GE(size, protocol::kHeaderSize);
+    EXPECT_EQ(0, static_cast<const uint8_t*>(data)[0]);  // kData
+    buffer.append(static_cast<const char*>(data) + protocol::kHeaderSize,
+                  size - protocol::kHeaderSize);
+    return size;
+  }
+
+  std::string buffer;
+};
+
+// Chunk is a decoded chunk of the stream.
+struct Chunk {
+  uint64_t offset;
+  bool type_definition;
+  std::string type;  // the type name of a definition or of an object.
+  std::string data;  // the message of an object.
+};
+
+int64_t readZigzag(CodedInputStream* in) {
+  uint64_t value = 0;
+  EXPECT_TRUE(in->ReadVarint64(&value));
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Decodes the chunks of the stream.
+std::vector<Chunk> decode(const std::string& stream) {
+  std::vector<Chunk> chunks;
+  std::vector<std::string> types;
+  auto data = reinterpret_cast<const uint8_t*>(stream.data());
+  uint64_t offset = kHeaderSize;
+  while (offset < stream.size()) {
+    CodedInputStream in(data + offset, stream.size() - offset);
+    int64_t size = readZigzag(&in);
+    Chunk chunk = {offset, size < 0, "", ""};
+    size = size < 0 ? -size : size;
+    const uint64_t start = offset + in.CurrentPosition();
+    CodedInputStream body(data + start, size);
+    if (chunk.type_definition) {
+      uint32_t length = 0;
+      EXPECT_TRUE(body.ReadVarint32(&length));
+      EXPECT_TRUE(body.ReadString(&chunk.type, length));
+      types.push_back(chunk.type);
+    } else {
+      readZigzag(&body);  // parent
+      if (body.CurrentPosition() < size) {
+        int64_t type = readZigzag(&body);
+        type = type < 0 ? -type : type;
+        if (type < 1 || type > static_cast<int64_t>(types.size())) {
+          ADD_FAILURE() << "Undefined type " << type;
+          break;
+        }
+        chunk.type = types[type - 1];
+        chunk.data = stream.substr(start + body.CurrentPosition(),
+                                   size - body.CurrentPosition());
+      }
+    }
+    chunks.push_back(chunk);
+    offset = start + size;
+  }
+  EXPECT_EQ(stream.size(), offset);
+  return chunks;
+}
+
+// Encodes a stream with enough data for several seek indices, frames inside
+// and outside of a group, and decodes it to check that the offsets, chunk
+// indices and type counts of the indices match the chunks.
+TEST(PackEncoderTest, SeekIndexRoundTrip) {
+  auto writer = std::make_shared<MemoryWriter>();
+  const int kFrames = 12;
+  {
+    auto encoder = PackEncoder::create(writer, false);
+    capture::Header header;
+    header.set_version(3);
+    encoder->object(&header);
+
+    capture::Resource resource;
+    resource.set_data(std::string(1 << 20, 'x'));
+    PackEncoder::SPtr group;
+    for (int frame = 0; frame < kFrames; frame++) {
+      if (frame == 4) {
+        group = encoder->group(&header);
+      } else if (frame == 8) {
+        group.reset();  // terminates the group
+      }
+      encoder->frame();
+      // The first chunk of each frame is the resource of the frame.
+      resource.set_index(frame);
+      (group ? group : encoder)->object(&resource);
+      if (frame == 2) {
+        // A type defined in the middle of the stream.
+        capture::TraceMessage message;
+        message.set_message("frame 2");
+        encoder->object(&message);
+      }
+    }
+    encoder->finish();
+  }
+
+  const std::string& stream = writer->buffer;
+  auto chunks = decode(stream);
+  ASSERT_GT(chunks.size(), 2);
+  std::map<uint64_t, size_t> chunk_at;  // chunk index by offset.
+  std::set<uint64_t> type_offsets;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    chunk_at[chunks[i].offset] = i;
+    if (chunks[i].type_definition) {
+      type_offsets.insert(chunks[i].offset);
+    }
+  }
+  auto typesBefore = [&](uint64_t offset) {
+    return std::distance(type_offsets.begin(),
+                         type_offsets.lower_bound(offset));
+  };
+  auto checkPoint = [&](const capture::SeekPoint& point) {
+    ASSERT_EQ(1, chunk_at.count(point.offset()));
+    EXPECT_EQ(chunk_at[point.offset()], point.chunk());
+    EXPECT_EQ(typesBefore(point.offset()), point.type_count());
+  };
+
+  // The footer is the last chunk, with a fixed size.
+  capture::SeekFooter footer;
+  ASSERT_EQ("capture.SeekFooter", chunks.back().type);
+  ASSERT_TRUE(footer.ParseFromString(chunks.back().data));
+  EXPECT_EQ(kFooterMagic, footer.magic());
+  EXPECT_EQ(18, chunks.back().data.size());
+  EXPECT_EQ(stream.substr(stream.size() - 18), chunks.back().data);
+
+  // Walk the index chain from the footer.
+  std::set<uint64_t> indexed_types;
+  std::map<uint64_t, capture::SeekPoint> frames;  // by frame number.
+  int num_indices = 0;
+  for (uint64_t offset = footer.last_index(); offset != 0;) {
+    ASSERT_EQ(1, chunk_at.count(offset));
+    const Chunk& chunk = chunks[chunk_at[offset]];
+    ASSERT_EQ("capture.SeekIndex", chunk.type);
+    capture::SeekIndex index;
+    ASSERT_TRUE(index.ParseFromString(chunk.data));
+    EXPECT_EQ(offset, index.point().offset());
+    checkPoint(index.point());
+    for (auto type_offset : index.type_offsets()) {
+      EXPECT_TRUE(indexed_types.insert(type_offset).second);
+    }
+    for (int i = 0; i < index.frames_size(); i++) {
+      checkPoint(index.frames(i));
+      frames[index.first_frame() + i] = index.frames(i);
+    }
+    EXPECT_LT(index.previous(), offset);
+    offset = index.previous();
+    num_indices++;
+  }
+  // A 12MB stream has an index every 8MB, and the final one.
+  EXPECT_EQ(2, num_indices);
+  EXPECT_EQ(type_offsets, indexed_types);
+
+  // Each frame starts at its resource, and lists the group it is in.
+  ASSERT_EQ(kFrames, frames.size());
+  uint64_t group_chunk = 0;
+  for (auto& it : frames) {
+    const Chunk& chunk = chunks[it.second.chunk()];
+    ASSERT_EQ("capture.Resource", chunk.type);
+    capture::Resource resource;
+    ASSERT_TRUE(resource.ParseFromString(chunk.data));
+    EXPECT_EQ(it.first, resource.index());
+    if (it.first >= 4 && it.first < 8) {
+      ASSERT_EQ(1, it.second.open_groups_size());
+      group_chunk = it.second.open_groups(0);
+      EXPECT_EQ("capture.Header", chunks[group_chunk].type);
+    } else {
+      EXPECT_EQ(0, it.second.open_groups_size());
+    }
+  }
+  EXPECT_NE(0, group_chunk);
+}
+
+}  // namespace test
+}  // namespace gapii
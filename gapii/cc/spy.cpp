@@ -97,6 +97,9 @@ const int32_t kSuspendIndefinitely = -1;
 
 thread_local gapii::CallObserver* gContext = nullptr;
 
+// The CallObservers reused by the commands intercepted on this thread.
+thread_local gapii::CallObserverPool gObservers;
+
 }  // anonymous namespace
 
 namespace gapii {
@@ -180,8 +183,31 @@ Spy::Spy()
   SpyBase::mDisableCoherentMemoryTracker =
       (header.mFlags &
        ConnectionHeader::FLAG_DISABLE_COHERENT_MEMORY_TRACKER) != 0;
+#if COHERENT_TRACKING_ENABLED
+  // The way coherent memory writes are detected can be overridden with
+  // GAPII_COHERENT_MEMORY_TRACKER set to "soft-dirty" or "userfaultfd".
+  if (const char* backend = getenv("GAPII_COHERENT_MEMORY_TRACKER")) {
+    std::string name = backend;
+    auto tracking_backend = track_memory::TrackingBackend::kSegfault;
+    if (name == "soft-dirty") {
+      tracking_backend = track_memory::TrackingBackend::kSoftDirty;
+    } else if (name == "userfaultfd") {
+      tracking_backend = track_memory::TrackingBackend::kUserfaultfd;
+    } else if (name != "segfault") {
+      GAPID_WARNING("Unknown coherent memory tracker: %s", backend);
+    }
+    if (!mMemoryTracker.SetBackend(tracking_backend)) {
+      GAPID_WARNING("Coherent memory tracker %s is not supported", backend);
+    }
+  }
+#endif  // COHERENT_TRACKING_ENABLED
   set_record_timestamps(
       0 != (header.mFlags & ConnectionHeader::FLAG_STORE_TIMESTAMPS));
+  set_delta_observations(
+      0 != (header.mFlags & ConnectionHeader::FLAG_DELTA_OBSERVATIONS));
+  if ((header.mFlags & ConnectionHeader::FLAG_FINE_GRAINED_LOCKING) != 0) {
+    set_lock_mode(SpyLock::Mode::kPerObject);
+  }
 
   mSuspendCaptureFrames = (header.mFlags & ConnectionHeader::FLAG_DEFER_START)
                               ? kSuspendIndefinitely
@@ -197,6 +223,10 @@ Spy::Spy()
              mDisablePrecompiledShaders ? "true" : "false");
   GAPID_INFO("Hide unknown extensions: %s",
              mHideUnknownExtensions ? "true" : "false");
+  GAPID_INFO("Fine grained locking: %s",
+             (header.mFlags & ConnectionHeader::FLAG_FINE_GRAINED_LOCKING) != 0
+                 ? "true"
+                 : "false");
 
   if (this_executable) {
     mEncoder = gapii::PackEncoder::create(
@@ -274,15 +304,27 @@ Spy::Spy()
 }
 
 Spy::~Spy() {
+  // The trace is only ended while holding the lock exclusively, which is not
+  // implied in per-object locking mode.
+  lock();
   mCaptureFrames = -1;
   endTraceIfRequested();
+  unlock();
 }
 
 void Spy::resolveImports() { GlesSpy::mImports.resolve(); }
 
 CallObserver* Spy::enter(const char* name, uint32_t api) {
   lock();
-  auto ctx = new CallObserver(this, gContext, api);
+  auto ctx = gObservers.acquire(this, gContext, api);
+  ctx->setCurrentCommandName(name);
+  gContext = ctx;
+  return ctx;
+}
+
+CallObserver* Spy::enter(const char* name, uint32_t api, uint64_t lock_key) {
+  lock(lock_key);
+  auto ctx = gObservers.acquire(this, gContext, api);
   ctx->setCurrentCommandName(name);
   gContext = ctx;
   return ctx;
@@ -291,7 +333,7 @@ CallObserver* Spy::enter(const char* name, uint32_t api) {
 void Spy::exit() {
   auto context = gContext;
   gContext = context->getParent();
-  delete context;
+  gObservers.release(context);
   unlock();
 }
 
@@ -490,8 +532,14 @@ void Spy::gvr_frame_submit(CallObserver* observer, gvr_frame** frame,
 }
 
 void Spy::endTraceIfRequested() {
+  if (!holds_exclusive_lock()) {
+    // Other commands may be running concurrently. The trace will be ended by
+    // the next command that holds the spy lock exclusively.
+    return;
+  }
   if (!is_suspended() && mCaptureFrames < 0) {
     GAPID_DEBUG("Ended capture");
+    mEncoder->finish();
     mEncoder->flush();
     // Error messages can be transferred any time during the trace, e.g.:
     // auto err = protocol::createError("end of the world");
@@ -502,6 +550,10 @@ void Spy::endTraceIfRequested() {
     std::this_thread::sleep_for(std::chrono::milliseconds(200));
     mConnection->close();
     set_suspended(true);
+    // The resources of the fingerprinted ranges belong to the ended trace.
+    if (auto tracker = delta_tracker()) {
+      tracker->clear();
+    }
   }
 }
 
@@ -594,6 +646,7 @@ void Spy::onPostFrameBoundary(bool isStartOfFrame) {
       }
     }
   } else {
+    mEncoder->frame();
     if (mCaptureFrames > 0) {
       if (--mCaptureFrames == 0) {
         mCaptureFrames = -1;
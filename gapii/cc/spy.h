@@ -40,6 +40,9 @@ class Spy : public GlesSpy, public GvrSpy, public VulkanSpy {
   void resolveImports();
 
   CallObserver* enter(const char* name, uint32_t api);
+  // enter begins a command that only accesses the state of the object
+  // identified by lock_key. See SpyLock for the locking semantics.
+  CallObserver* enter(const char* name, uint32_t api, uint64_t lock_key);
   void exit();
 
   EGLBoolean eglInitialize(CallObserver* observer, EGLDisplay dpy,
@@ -44,7 +44,8 @@ SpyBase::SpyBase()
       mObserveApplicationPool(true),
       mWatchedApis(0xFFFFFFFF),
       mIsRecordingState(false),
-      mRecordTimestamps(false) {
+      mRecordTimestamps(false),
+      mDeltaObservations(false) {
 }
 
 void SpyBase::init(CallObserver* observer) {
@@ -52,9 +53,11 @@ void SpyBase::init(CallObserver* observer) {
   mIsSuspended = false;
 }
 
-void SpyBase::lock() { mSpinLock.Lock(); }
+void SpyBase::lock() { mLock.lock(); }
 
-void SpyBase::unlock() { mSpinLock.Unlock(); }
+void SpyBase::lock(uint64_t key) { mLock.lock(key); }
+
+void SpyBase::unlock() { mLock.unlock(); }
 
 void SpyBase::abort() {
   GAPID_DEBUG("Command aborted");
@@ -19,12 +19,13 @@
 
 #include "abort_exception.h"
 #include "call_observer.h"
+#include "delta_tracker.h"
 #include "pack_encoder.h"
+#include "spy_lock.h"
 
 #include "core/cc/assert.h"
 #include "core/cc/id.h"
 #include "core/cc/interval_list.h"
-#include "core/cc/recursive_spinlock.h"
 #include "core/cc/vector.h"
 
 #include "core/memory/arena/cc/arena.h"
@@ -112,15 +113,38 @@ class SpyBase {
   void set_record_timestamps(bool record) { mRecordTimestamps = record; }
   bool should_record_timestamps() const { return mRecordTimestamps; }
 
+  void set_delta_observations(bool delta) { mDeltaObservations = delta; }
+
+  // Returns the tracker used to encode repeated observations of large ranges
+  // as deltas, or nullptr if delta observations are disabled.
+  DeltaTracker* delta_tracker() {
+    return mDeltaObservations ? &mDeltaTracker : nullptr;
+  }
+
   // Ends the current trace if requested by client.
   virtual void endTraceIfRequested() {}
 
+  // Sets the locking mode used for intercepted commands. Must be called
+  // before any command is intercepted.
+  void set_lock_mode(SpyLock::Mode mode) { mLock.setMode(mode); }
+
+  // Returns true if the calling thread holds the spy lock exclusively, i.e.
+  // no other intercepted command can be running concurrently.
+  bool holds_exclusive_lock() const { return mLock.isExclusive(); }
+
  protected:
   // lock begins the interception of a single command. It must be called
   // before invoking any command on the spy. Blocks if any other thread
-  // is has called lock and not yet called unlock.
+  // is has called lock and not yet called unlock. When nested inside a
+  // per-object command, the lock of the outer command is escalated to
+  // exclusive until the outer command returns.
   void lock();
 
+  // lock begins the interception of a single command that only accesses the
+  // state of the object identified by key. Depending on the lock mode,
+  // commands on different objects may run concurrently.
+  void lock(uint64_t key);
+
   // unlock must be called after invoking any command.
   // resets the buffers reused between commands.
   void unlock();
@@ -217,9 +241,9 @@ class SpyBase {
   std::unordered_map<core::Id, int64_t> mResources;
   std::mutex mResourcesMutex;
 
-  // The spinlock that should be locked for the duration of each of the
-  // intercepted commands.
-  core::RecursiveSpinLock mSpinLock;
+  // The lock that should be held for the duration of each of the intercepted
+  // commands.
+  SpyLock mLock;
 
   // True if we should observe the application pool.
   bool mObserveApplicationPool;
@@ -244,6 +268,13 @@ class SpyBase {
 
   // This is true if we should record timestamps and add them to the trace
   bool mRecordTimestamps;
+
+  // This is true if repeated observations of large ranges may be encoded as
+  // deltas.
+  bool mDeltaObservations;
+
+  // The fingerprints of the large ranges that were observed in full.
+  DeltaTracker mDeltaTracker;
 };
 
 template <class T>
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "spy_lock.h"
+
+#include "core/cc/assert.h"
+
+namespace {
+
+// Held is the per-thread record of the SpyLock acquisition.
+struct Held {
+  // The number of nested lock() / lock(key) calls.
+  uint32_t depth;
+  // True if the global lock is held exclusively.
+  bool exclusive;
+  // The stripe mutex held when the global lock was taken in shared mode,
+  // including when it was escalated since.
+  std::mutex* stripe;
+};
+
+thread_local Held tHeld = {0, false, nullptr};
+
+}  // anonymous namespace
+
+namespace gapii {
+
+SpyLock::SpyLock()
+    : mMode(Mode::kGlobal),
+      mSharedCount(0),
+      mExclusiveWaiting(0),
+      mEscalating(0),
+      mExclusive(false) {}
+
+void SpyLock::lock() {
+  if (mMode == Mode::kGlobal) {
+    mSpinLock.Lock();
+    return;
+  }
+  Held& held = tHeld;
+  if (held.depth > 0) {
+    if (!held.exclusive) {
+      // The locks of the outer per-object command are kept, as releasing them
+      // would let other commands run in the middle of it.
+      escalate();
+      held.exclusive = true;
+    }
+    held.depth++;
+    return;
+  }
+  lockExclusive();
+  held.depth = 1;
+  held.exclusive = true;
+  held.stripe = nullptr;
+}
+
+void SpyLock::lock(uint64_t key) {
+  if (mMode == Mode::kGlobal) {
+    mSpinLock.Lock();
+    return;
+  }
+  Held& held = tHeld;
+  if (held.depth > 0) {
+    held.depth++;
+    return;
+  }
+  // Fibonacci hashing spreads aligned handles and pointers across stripes.
+  uint64_t hash = (key ^ (key >> 29)) * 0x9E3779B97F4A7C15ull;
+  std::mutex* stripe = &mStripes[(hash >> 32) % kStripeCount].mutex;
+  // The stripe is locked first, so that no thread waits for a stripe while
+  // holding the shared lock, which would block a thread escalating while
+  // holding that stripe.
+  stripe->lock();
+  lockShared();
+  held.depth = 1;
+  held.exclusive = false;
+  held.stripe = stripe;
+}
+
+void SpyLock::unlock() {
+  if (mMode == Mode::kGlobal) {
+    mSpinLock.Unlock();
+    return;
+  }
+  Held& held = tHeld;
+  GAPID_ASSERT_MSG(held.depth > 0, "SpyLock::unlock() called without lock");
+  if (--held.depth > 0) {
+    return;
+  }
+  if (held.stripe == nullptr) {
+    unlockExclusive();
+  } else if (held.exclusive) {
+    unlockEscalated();
+    held.stripe->unlock();
+  } else {
+    unlockShared();
+    held.stripe->unlock();
+  }
+  held.exclusive = false;
+  held.stripe = nullptr;
+}
+
+bool SpyLock::isExclusive() const {
+  if (mMode == Mode::kGlobal) {
+    return true;
+  }
+  return tHeld.depth > 0 && tHeld.exclusive;
+}
+
+void SpyLock::lockExclusive() {
+  std::unique_lock<std::mutex> lock(mMutex);
+  mExclusiveWaiting++;
+  mCondition.wait(lock, [this] { return !mExclusive && mSharedCount == 0; });
+  mExclusiveWaiting--;
+  mExclusive = true;
+}
+
+void SpyLock::unlockExclusive() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mExclusive = false;
+  }
+  mCondition.notify_all();
+}
+
+void SpyLock::lockShared() {
+  std::unique_lock<std::mutex> lock(mMutex);
+  // Waiting exclusive lockers take priority so that global commands are not
+  // starved by a steady stream of per-object commands.
+  mCondition.wait(lock,
+                  [this] { return !mExclusive && mExclusiveWaiting == 0; });
+  mSharedCount++;
+}
+
+void SpyLock::unlockShared() {
+  bool notify;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    notify = --mSharedCount <= mEscalating && mExclusiveWaiting > 0;
+  }
+  if (notify) {
+    mCondition.notify_all();
+  }
+}
+
+void SpyLock::escalate() {
+  std::unique_lock<std::mutex> lock(mMutex);
+  mExclusiveWaiting++;
+  mEscalating++;
+  // The threads waiting to escalate hold the lock in shared mode, but are
+  // blocked here: they take the exclusive lock in turn.
+  mCondition.wait(lock,
+                  [this] { return !mExclusive && mSharedCount == mEscalating; });
+  mEscalating--;
+  mExclusiveWaiting--;
+  mExclusive = true;
+}
+
+void SpyLock::unlockEscalated() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mExclusive = false;
+    mSharedCount--;
+  }
+  mCondition.notify_all();
+}
+
+}  // namespace gapii
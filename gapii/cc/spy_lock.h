@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GAPII_SPY_LOCK_H
+#define GAPII_SPY_LOCK_H
+
+#include "core/cc/recursive_spinlock.h"
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace gapii {
+
+// SpyLock is the lock held by the spy for the duration of each intercepted
+// command.
+//
+// In kGlobal mode (the default) every command takes the same recursive
+// spin lock, so all commands in the process are serialized.
+//
+// In kPerObject mode, commands that only touch the state of a single API
+// object (for example command buffer recording) are locked with
+// lock(key). These take one of a fixed number of striped mutexes selected by
+// key plus the global lock in shared mode, so commands on different objects
+// can run concurrently. All other commands take the global lock exclusively.
+// A command that needs the global lock while nested inside a per-object
+// command escalates the shared lock of the outer command to exclusive, for
+// the rest of the outer command.
+// The order of commands in the trace is the order in which their command
+// groups are emitted by the encoder, which is serialized by the encoder.
+class SpyLock {
+ public:
+  enum class Mode { kGlobal, kPerObject };
+
+  SpyLock();
+
+  // setMode changes the locking mode. It must only be called while no thread
+  // holds the lock, typically before the first command is intercepted.
+  void setMode(Mode mode) { mMode = mode; }
+  Mode mode() const { return mMode; }
+
+  // lock acquires the lock exclusively for the calling thread. Calls to lock()
+  // and lock(key) may be nested on the same thread. When lock() is nested
+  // inside lock(key) in kPerObject mode, the lock is escalated to exclusive
+  // once the other per-object commands have completed, or are themselves
+  // waiting to escalate. The escalated lock is held until the outermost
+  // unlock().
+  void lock();
+
+  // lock acquires the lock for a command that only touches the object
+  // identified by key. In kGlobal mode this is equivalent to lock().
+  // If the calling thread already holds the lock, then the nested call is
+  // covered by the outer acquisition.
+  void lock(uint64_t key);
+
+  // unlock releases one level of the lock held by the calling thread.
+  void unlock();
+
+  // isExclusive returns true if the calling thread holds the lock
+  // exclusively, i.e. no other command can be running concurrently.
+  bool isExclusive() const;
+
+ private:
+  static const size_t kStripeCount = 64;
+
+  // Stripe is a mutex padded out to a cache-line to avoid false sharing
+  // between neighbouring stripes.
+  struct Stripe {
+    std::mutex mutex;
+    char padding[64 - (sizeof(std::mutex) % 64)];
+  };
+
+  void lockExclusive();
+  void unlockExclusive();
+  void lockShared();
+  void unlockShared();
+  // escalate turns the shared lock held by the calling thread into an
+  // exclusive one, and unlockEscalated releases it.
+  void escalate();
+  void unlockEscalated();
+
+  Mode mMode;
+
+  // The lock used in kGlobal mode.
+  core::RecursiveSpinLock mSpinLock;
+
+  // The reader-writer lock used in kPerObject mode.
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  uint32_t mSharedCount;
+  uint32_t mExclusiveWaiting;
+  // The number of threads waiting to escalate, which hold the lock in shared
+  // mode.
+  uint32_t mEscalating;
+  bool mExclusive;
+
+  Stripe mStripes[kStripeCount];
+};
+
+}  // namespace gapii
+
+#endif  // GAPII_SPY_LOCK_H
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Synthetic benchmark of the spy lock. Each thread simulates recording
+// commands into its own command buffer, doing the CPU-only work that the spy
+// does for a command: arena allocations for the command arguments and merging
+// of pending memory observations. A small fraction of the commands are global
+// (e.g. queue submits) and take the lock exclusively.
+
+#include "gapii/cc/spy_lock.h"
+
+#include "core/cc/interval_list.h"
+#include "core/cc/timer.h"
+#include "core/memory/arena/cc/arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kCommandsPerThread = 200000;
+
+// simulateCommand performs the CPU-only work done by the spy for a single
+// intercepted command.
+void simulateCommand(core::Arena* arena, uint64_t seed) {
+  core::IntervalList<uintptr_t> observations;
+  void* args[4];
+  for (int i = 0; i < 4; i++) {
+    args[i] = arena->allocate(32 + 16 * i, 8);
+  }
+  for (uintptr_t i = 0; i < 4; i++) {
+    uintptr_t start = (seed & 0xffff) + i * 512;
+    observations.merge(core::Interval<uintptr_t>{start, start + 64});
+  }
+  for (int i = 0; i < 4; i++) {
+    arena->free(args[i]);
+  }
+}
+
+// run runs threads threads, each recording commands into its own object.
+// Every global_every'th command is a global command (0 disables). Returns the
+// number of commands per second.
+double run(gapii::SpyLock::Mode mode, int threads, int global_every) {
+  gapii::SpyLock lock;
+  lock.setMode(mode);
+  core::Arena arena;
+
+  std::vector<std::thread> workers;
+  uint64_t start = core::GetNanoseconds();
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&lock, &arena, t, global_every] {
+      uint64_t key = 0x1000 + t * 0x40;  // a fake command buffer handle.
+      for (int i = 0; i < kCommandsPerThread; i++) {
+        bool global = global_every > 0 && (i % global_every) == 0;
+        if (global) {
+          lock.lock();
+        } else {
+          lock.lock(key);
+        }
+        simulateCommand(&arena, key * i);
+        lock.unlock();
+      }
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  uint64_t elapsed = core::GetNanoseconds() - start;
+  return double(threads) * kCommandsPerThread * 1e9 / double(elapsed);
+}
+
+const char* modeName(gapii::SpyLock::Mode mode) {
+  return mode == gapii::SpyLock::Mode::kGlobal ? "global" : "per-object";
+}
+
+}  // anonymous namespace
+
+int main(int argc, char** argv) {
+  int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+  printf("%-12s %8s %14s %14s\n", "mode", "threads", "cmds/s", "cmds/s(1%glb)");
+  for (auto mode :
+       {gapii::SpyLock::Mode::kGlobal, gapii::SpyLock::Mode::kPerObject}) {
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+      double local = run(mode, threads, 0);
+      double mixed = run(mode, threads, 100);
+      printf("%-12s %8d %14.0f %14.0f\n", modeName(mode), threads, local,
+             mixed);
+    }
+  }
+  return 0;
+}
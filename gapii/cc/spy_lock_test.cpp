@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gapii/cc/spy_lock.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace gapii {
+namespace test {
+
+TEST(SpyLockTest, GlobalNesting) {
+  SpyLock lock;
+  lock.lock();
+  EXPECT_TRUE(lock.isExclusive());
+  lock.lock(1);
+  lock.lock();
+  EXPECT_TRUE(lock.isExclusive());
+  lock.unlock();
+  lock.unlock();
+  lock.unlock();
+}
+
+TEST(SpyLockTest, PerObjectNesting) {
+  SpyLock lock;
+  lock.setMode(SpyLock::Mode::kPerObject);
+  EXPECT_FALSE(lock.isExclusive());
+
+  lock.lock();
+  EXPECT_TRUE(lock.isExclusive());
+  lock.lock(1);
+  EXPECT_TRUE(lock.isExclusive());
+  lock.unlock();
+  EXPECT_TRUE(lock.isExclusive());
+  lock.unlock();
+  EXPECT_FALSE(lock.isExclusive());
+
+  lock.lock(1);
+  EXPECT_FALSE(lock.isExclusive());
+  lock.lock(2);
+  EXPECT_FALSE(lock.isExclusive());
+  lock.unlock();
+  EXPECT_FALSE(lock.isExclusive());
+  // A nested global command escalates the lock until the outermost unlock.
+  lock.lock();
+  EXPECT_TRUE(lock.isExclusive());
+  lock.unlock();
+  EXPECT_TRUE(lock.isExclusive());
+  lock.unlock();
+  EXPECT_FALSE(lock.isExclusive());
+
+  // The lock is not held after an escalation.
+  lock.lock(3);
+  EXPECT_FALSE(lock.isExclusive());
+  lock.unlock();
+}
+
+// Commands on different objects run concurrently, but not with a global
+// command.
+TEST(SpyLockTest, SharedAndExclusive) {
+  SpyLock lock;
+  lock.setMode(SpyLock::Mode::kPerObject);
+
+  lock.lock(1);
+  std::thread other([&] {
+    lock.lock(2);
+    EXPECT_FALSE(lock.isExclusive());
+    lock.unlock();
+  });
+  // Would not return if the other command waited for this one.
+  other.join();
+
+  std::atomic<bool> acquired(false);
+  std::thread global([&] {
+    lock.lock();
+    EXPECT_TRUE(lock.isExclusive());
+    acquired = true;
+    lock.unlock();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(acquired);
+  lock.unlock();
+  global.join();
+  EXPECT_TRUE(acquired);
+}
+
+// Threads run per-object, global and escalated commands, and check that no
+// command runs concurrently with an exclusive one, nor with a command on the
+// same object. Run under TSan to check the synchronization.
+TEST(SpyLockTest, ConcurrentCommands) {
+  const int kThreads = 8;
+  const int kCommands = 2000;
+  const int kKeys = 4;
+  SpyLock lock;
+  lock.setMode(SpyLock::Mode::kPerObject);
+  std::atomic<int> exclusive(0);
+  std::atomic<int> shared(0);
+  std::atomic<int> keys[kKeys];
+  for (auto& key : keys) {
+    key = 0;
+  }
+
+  auto checkExclusive = [&] {
+    EXPECT_TRUE(lock.isExclusive());
+    EXPECT_EQ(0, exclusive.fetch_add(1));
+    std::this_thread::yield();
+    EXPECT_EQ(0, shared.load());
+    exclusive--;
+  };
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t] {
+      std::mt19937 rng(t);
+      for (int i = 0; i < kCommands; i++) {
+        const int key = rng() % kKeys;
+        switch (rng() % 4) {
+          case 0:
+            lock.lock();
+            checkExclusive();
+            lock.unlock();
+            break;
+          case 1:
+          case 2:
+            lock.lock(key);
+            EXPECT_EQ(0, keys[key].fetch_add(1));
+            shared++;
+            std::this_thread::yield();
+            EXPECT_EQ(0, exclusive.load());
+            shared--;
+            keys[key]--;
+            lock.unlock();
+            break;
+          case 3:
+            lock.lock(key);
+            EXPECT_EQ(0, keys[key].fetch_add(1));
+            shared++;
+            std::this_thread::yield();
+            EXPECT_EQ(0, exclusive.load());
+            shared--;
+            lock.lock();
+            checkExclusive();
+            lock.unlock();
+            checkExclusive();
+            keys[key]--;
+            lock.unlock();
+            break;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace test
+}  // namespace gapii
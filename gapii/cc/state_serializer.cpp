@@ -17,6 +17,8 @@
 #include "state_serializer.h"
 #include "core/cc/timer.h"
 
+#include <algorithm>
+
 namespace gapii {
 
 void StateSerializer::prepareForState(
@@ -30,10 +32,18 @@ void StateSerializer::prepareForState(
     if (p != nullptr && mSeenPools.count(p->id) == 0) {
       mSeenPools.insert(p->id);
 
-      memory::Observation observation;
-      observation.set_pool(p->id);
-      observation.set_base(0);
-      sendData(&observation, true, p->buffer, p->size);
+      // The data of a chunked pool is sent a chunk at a time, so that it is
+      // not copied.
+      const uint64_t step =
+          p->chunks != nullptr ? GAPIL_POOL_CHUNK_SIZE : p->size;
+      for (uint64_t offset = 0; offset < p->size; offset += step) {
+        auto size = std::min(step, p->size - offset);
+        memory::Observation observation;
+        observation.set_pool(p->id);
+        observation.set_base(offset);
+        sendData(&observation, true,
+                 gapil_pool_data(p, offset, size, GAPIL_READ), size);
+      }
     }
   });
 }
@@ -48,6 +58,8 @@ pool_t* StateSerializer::createPool(
   pool->size = pool_size;
   pool->ref_count = 1;
   pool->buffer = nullptr;
+  pool->chunks = nullptr;
+  pool->scratch = nullptr;
 
   mSeenPools.insert(pool->id);
 
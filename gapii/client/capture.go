@@ -53,6 +53,12 @@ const (
 	StoreTimestamps Flags = 0x00000080
 	// DisableCoherentMemoryTracker disables the coherent memory tracker from running.
 	DisableCoherentMemoryTracker Flags = 0x000000100
+	// FineGrainedLocking allows commands that only touch per-object state,
+	// such as command buffer recording, to be traced concurrently.
+	FineGrainedLocking Flags = 0x000000200
+	// DeltaObservations encodes repeated observations of large memory ranges
+	// as the blocks that changed since the range was last sent in full.
+	DeltaObservations Flags = 0x000000400
 
 	// GlesAPI is hard-coded bit mask for GLES API, it needs to be kept in sync
 	// with the api_index in the gles.api file.
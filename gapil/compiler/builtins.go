@@ -107,6 +107,7 @@ const (
 	PoolID       = "id"
 	PoolSize     = "size"
 	PoolBuffer   = "buffer"
+	PoolChunks   = "chunks"
 )
 
 // Field names for the map_t runtime type.
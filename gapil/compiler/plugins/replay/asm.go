@@ -105,14 +105,10 @@ const (
 	asmInstSwitchthread = asmInst(C.GAPIL_REPLAY_ASM_INST_SWITCHTHREAD)
 )
 
-func (r *replayer) asmWrite(s *compiler.S, v *codegen.Value) {
-	bufPtr := s.Ctx.Index(0, data, stream)
-	r.AppendBufferData(s, bufPtr, s.LocalInit("write", v))
-}
-
 func (r *replayer) asmWriteInst(s *compiler.S, ty asmInst, inst *codegen.Value) {
-	r.asmWrite(s, s.Scalar(ty))
-	r.asmWrite(s, inst)
+	dataPtr := s.Ctx.Index(0, data)
+	instPtr := s.LocalInit("inst", inst).Cast(r.T.VoidPtr)
+	s.Call(r.callbacks.emit, s.Ctx, dataPtr, s.Scalar(uint8(ty)), instPtr)
 }
 
 func (r *replayer) asmValue(s *compiler.S, val *codegen.Value, ty asmType) *codegen.Value {
@@ -33,6 +33,7 @@ type callbacks struct {
 	addConstant     *codegen.Function
 	addRemapping    *codegen.Function
 	lookupRemapping *codegen.Function
+	emit            *codegen.Function
 }
 
 func (r *replayer) parseCallbacks() {
@@ -48,4 +49,5 @@ func (r *replayer) parseCallbacks() {
 	r.callbacks.getRemapFunc = r.M.ParseFunctionSignature(C.GoString(C.gapil_replay_get_remap_func_sig))
 	r.callbacks.addRemapping = r.M.ParseFunctionSignature(C.GoString(C.gapil_replay_add_remapping_sig))
 	r.callbacks.lookupRemapping = r.M.ParseFunctionSignature(C.GoString(C.gapil_replay_lookup_remapping_sig))
+	r.callbacks.emit = r.M.ParseFunctionSignature(C.GoString(C.gapil_replay_emit_sig))
 }
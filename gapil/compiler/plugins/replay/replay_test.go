@@ -292,6 +292,119 @@ func TestReplay(t *testing.T) {
 				opcode.Extend{Value: 0x0},
 				opcode.Call{},
 			},
+		}, {
+			// The constant pointers are deferred until the constants are laid
+			// out, and the deferred push expands to a single PushI.
+			name: "Push Constant Pointer",
+			src:  "cmd void A(u32 a, u32[4] b, u32 c) {}",
+			data: D(
+				uint32(0x10),
+				uint32(1), uint32(2), uint32(3), uint32(4),
+				uint32(0x20),
+			),
+			expected: []opcode.Opcode{
+				opcode.Label{Value: baseCmdID},
+				opcode.PushI{DataType: protocol.Type_Uint32, Value: 0x10},
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 0},
+				opcode.PushI{DataType: protocol.Type_Uint32, Value: 0x20},
+				opcode.Call{},
+			},
+		}, {
+			// The observed pointers are deferred until the volatile memory is
+			// laid out. The pointers into the reserved memory are remapped to
+			// volatile pointers, the others to the unobserved pointer, which
+			// expands to a PushI and an Extend.
+			name: "Push Observed Pointer",
+			src: `cmd void A(u32* a, u32* b, u32* c, u32* d) { write(a[0:4]) }
+			      cmd void B(u32* a, u32* b, u32* c, u32* d) {}`,
+			data: D(
+				uint64(0x4030000), // Start of the reserved memory
+				uint64(0x4030008), // Within the reserved memory
+				uint64(0x4040000), // Not reserved
+				uint64(0x800),     // Below the observed addresses
+			),
+			expected: []opcode.Opcode{
+				opcode.Label{Value: baseCmdID},
+				opcode.PushI{DataType: protocol.Type_VolatilePointer, Value: 0},
+				opcode.PushI{DataType: protocol.Type_VolatilePointer, Value: 8},
+				opcode.PushI{DataType: protocol.Type_AbsolutePointer, Value: 0x2},
+				opcode.Extend{Value: 0x3adf00d},
+				opcode.PushI{DataType: protocol.Type_AbsolutePointer, Value: 0x800},
+				opcode.Call{FunctionID: 0},
+
+				opcode.Label{Value: baseCmdID + 1},
+				opcode.PushI{DataType: protocol.Type_VolatilePointer, Value: 0},
+				opcode.PushI{DataType: protocol.Type_VolatilePointer, Value: 8},
+				opcode.PushI{DataType: protocol.Type_AbsolutePointer, Value: 0x2},
+				opcode.Extend{Value: 0x3adf00d},
+				opcode.PushI{DataType: protocol.Type_AbsolutePointer, Value: 0x800},
+				opcode.Call{FunctionID: 1},
+			},
+		}, {
+			// b is a prefix of a, c and d are suffixes of a.
+			name: "Constants Share Prefixes And Suffixes",
+			src:  "cmd void A(u32[4] a, u32[2] b, u32[2] c, u32[3] d) {}",
+			data: D(
+				uint32(1), uint32(2), uint32(3), uint32(4),
+				uint32(1), uint32(2),
+				uint32(3), uint32(4),
+				uint32(2), uint32(3), uint32(4),
+			),
+			expected: []opcode.Opcode{
+				opcode.Label{Value: baseCmdID},
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 0},
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 0},
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 8},
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 4},
+				opcode.Call{},
+			},
+		}, {
+			// b is a suffix of a at an offset that suits the alignment of b.
+			name: "Constants Share Aligned Suffix",
+			src:  "cmd void A(u8[6] a, u16[1] b) {}",
+			data: D(
+				uint8(1), uint8(2), uint8(3), uint8(4), uint8(5), uint8(6),
+				uint16(0x0605),
+			),
+			expected: []opcode.Opcode{
+				opcode.Label{Value: baseCmdID},
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 0},
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 4},
+				opcode.Call{},
+			},
+		}, {
+			// b is a suffix of a, but at an offset that is not aligned for b,
+			// so b gets its own storage. b has more uses per byte, so it comes
+			// first, and a needs no padding after it.
+			name: "Constants Do Not Share Misaligned Suffix",
+			src:  "cmd void A(u8[5] a, u16[1] b) {}",
+			data: D(
+				uint8(1), uint8(2), uint8(3), uint8(4), uint8(5), P(1),
+				uint16(0x0504),
+			),
+			expected: []opcode.Opcode{
+				opcode.Label{Value: baseCmdID},
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 2},
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 0},
+				opcode.Call{},
+			},
+		}, {
+			// b and c are the same constant, so it has two uses for 4 bytes,
+			// and is laid out before a, which has one use for 16 bytes.
+			name: "Constants Ordered By Uses Per Byte",
+			src:  "cmd void A(u32[4] a, u32[1] b, u32[1] c) {}",
+			data: D(
+				uint32(1), uint32(2), uint32(3), uint32(4),
+				uint32(9),
+				uint32(9),
+			),
+			expected: []opcode.Opcode{
+				opcode.Label{Value: baseCmdID},
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 4},
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 0},
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 0},
+				opcode.Call{},
+			},
 		},
 	} {
 		t.Run(test.name, func(t *testing.T) {
@@ -300,10 +413,53 @@ func TestReplay(t *testing.T) {
 	}
 }
 
+// The constants past the first 1MB cannot be addressed by the 20 bits of a
+// LOAD_C or PUSH_I, and are pushed with an extra EXTEND.
+func TestReplayConstantsBeyondWindow(t *testing.T) {
+	ctx := log.Testing(t)
+
+	// Adds 257 different constants of 4KB, then a constant of 4 bytes twice,
+	// which has the most uses per byte and is laid out first.
+	const count = 0x100000/0x1000 + 1
+	cmds := []*testutils.Cmd{}
+	expected := []opcode.Opcode{}
+	for i := 0; i < count; i++ {
+		cmds = append(cmds, &testutils.Cmd{
+			N: "A",
+			D: bytes.Repeat(D(uint32(i)), 0x1000/4),
+		})
+		expected = append(expected, opcode.Label{Value: uint32(baseCmdID + i)})
+		if addr := uint32(4 + i*0x1000); addr < 0x100000 {
+			expected = append(expected,
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: addr})
+		} else {
+			expected = append(expected,
+				opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 0},
+				opcode.Extend{Value: addr})
+		}
+		expected = append(expected, opcode.Call{FunctionID: 0})
+	}
+	for i := count; i < count+2; i++ {
+		cmds = append(cmds, &testutils.Cmd{N: "B", D: D(uint32(0xffffffff))})
+		expected = append(expected,
+			opcode.Label{Value: uint32(baseCmdID + i)},
+			opcode.PushI{DataType: protocol.Type_ConstantPointer, Value: 0},
+			opcode.Call{FunctionID: 1})
+	}
+
+	test{
+		name:     "Constants Beyond Window",
+		src:      "cmd void A(u32[1024] a) {}\ncmd void B(u32[1] b) {}",
+		cmds:     cmds,
+		expected: expected,
+	}.run(ctx)
+}
+
 type test struct {
 	name     string
 	src      string
 	data     []byte
+	cmds     []*testutils.Cmd // The commands, if not each function called with data
 	dump     bool
 	expected []opcode.Opcode
 }
@@ -344,8 +500,14 @@ func (t test) run(ctx context.Context) (succeeded bool) {
 	env := exec.NewEnv(ctx, c)
 	defer env.Dispose()
 
-	for i, f := range a.Functions {
-		cmd := &testutils.Cmd{N: f.Name(), D: t.data}
+	cmds := t.cmds
+	if cmds == nil {
+		for _, f := range a.Functions {
+			cmds = append(cmds, &testutils.Cmd{N: f.Name(), D: t.data})
+		}
+	}
+
+	for i, cmd := range cmds {
 		err = env.Execute(ctx, cmd, api.CmdID(baseCmdID+i))
 		if !assert.For(ctx, "Execute").ThatError(err).Succeeded() {
 			return false
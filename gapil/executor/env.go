@@ -336,7 +336,7 @@ func (e *Env) resolvePoolData(pool *C.pool, ptr C.uint64_t, access C.gapil_data_
 		if len != nil {
 			*len = pool.size - ptr
 		}
-		return unsafe.Pointer(uintptr(pool.buffer) + uintptr(ptr))
+		return C.gapil_pool_data(pool, ptr, pool.size-ptr, access)
 	}
 
 	// Application pool
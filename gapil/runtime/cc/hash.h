@@ -90,16 +90,16 @@ struct hash<T*, void> {
 
 template <>
 struct hash<gapil::String, void> {
-  uint64_t operator()(const gapil::String& str) {
-    uint64_t h = 0;
-    const char* c_str = str.c_str();
-    for (size_t i = 0; i < str.length(); ++i) {
-      h += (h << 6) + (h << 16) + c_str[i];
-    }
-    return h;
-  }
+  uint64_t operator()(const gapil::String& str) { return str.hash(); }
 };
 
+// map_hash mixes the hash of a key for the C++ maps, so that both the low
+// bits and the top bits of the result depend on all the bits of the hash.
+inline uint64_t map_hash(uint64_t hash) {
+  hash *= 0x9E3779B97F4A7C15ull;
+  return hash ^ (hash >> 32);
+}
+
 }  // namespace gapil
 
 #endif  // __GAPIL_RUNTIME_HASH_H__
\ No newline at end of file
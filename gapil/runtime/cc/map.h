@@ -18,17 +18,57 @@
 #include "maker.h"
 #include "runtime.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace core {
 class Arena;
 }  // namespace core
 
 namespace gapil {
 
+// The number of control bytes of a map that are matched at once.
+const uint64_t kMapGroupSize = 16;
+
+// Values of the control bytes of a map. The control byte of a full slot has
+// its top bit set, and holds the 7 top bits of the hash of the key.
+const uint8_t kMapCtrlEmpty = 0x00;
+const uint8_t kMapCtrlDeleted = 0x01;
+const uint8_t kMapCtrlFull = 0x80;
+
+// MapGroup holds kMapGroupSize control bytes of a map, and returns bitmasks
+// of the bytes that match a value.
+class MapGroup {
+ public:
+  inline explicit MapGroup(const uint8_t* ctrl);
+
+  // Returns the bitmask of the bytes equal to c.
+  inline uint32_t match(uint8_t c) const;
+
+  // Returns the bitmask of the full slots.
+  inline uint32_t matchFull() const;
+
+ private:
+#if defined(__SSE2__)
+  __m128i ctrl;
+#else
+  const uint8_t* ctrl;
+#endif
+};
+
 // Map is an associative container that is compatible with the maps produced by
 // the gapil compiler. Maps hold references to their data, and several maps may
 // share the same underlying data.
 // Search, insertion, and removal of elements are O(1).
 // Like std::unordered_map, elements are stored in no particular order.
+//
+// The elements buffer holds the elements, followed by one control byte per
+// element and by the number of deleted elements. Lookups scan the control
+// bytes of a group of elements at once, probing the groups linearly, and only
+// compare the keys of the elements with a matching control byte. The used
+// field of the elements is kept up to date for the code generated by the gapil
+// compiler, which iterates over the elements of the maps it encodes.
 template <typename K, typename V, bool DENSE>
 class Map {
  private:
@@ -180,16 +220,92 @@ class Map {
 
     inline const element* els() const;
     inline element* els();
+
+    // Returns the control bytes of the elements.
+    inline const uint8_t* ctrl() const;
+    inline uint8_t* ctrl();
+
+    // Returns the number of deleted elements, whose slots cannot be used
+    // until they are reused by an insertion or the map is rehashed.
+    inline uint64_t& deleted();
+
+    // Returns the index of the element with the given key and hash, or
+    // capacity if there is none.
+    inline uint64_t find(const K& key, uint64_t hash) const
+        __attribute__((always_inline));
+
+    // Returns the index of the first slot that is not full in the probe
+    // sequence of hash.
+    inline uint64_t findSlot(uint64_t hash) const;
+
+    // Allocates an elements buffer for capacity elements.
+    void allocate(uint64_t capacity);
+
+    // Moves the elements into a new buffer of capacity elements, dropping
+    // the deleted elements.
+    void rehash(uint64_t capacity);
+
+    // Drops the deleted elements, keeping the current elements buffer.
+    void rehashInPlace();
+
+    // Marks the slot at index as full or empty.
+    inline void setFull(uint64_t index, uint8_t h2);
+    inline void setEmpty(uint64_t index, uint8_t ctrl);
   };
 
+  // The size of the elements buffer for capacity elements.
+  static inline uint64_t bufferSize(uint64_t capacity);
+
   struct SVOAllocation {
     Allocation alloc;
     element els[GAPIL_MIN_MAP_SIZE];
+    uint8_t ctrl[GAPIL_MIN_MAP_SIZE];
+    uint64_t deleted;
   };
 
   Allocation* ptr;
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// MapGroup //
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(__SSE2__)
+
+MapGroup::MapGroup(const uint8_t* c)
+    : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c))) {}
+
+uint32_t MapGroup::match(uint8_t c) const {
+  return static_cast<uint32_t>(_mm_movemask_epi8(
+      _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(c)))));
+}
+
+uint32_t MapGroup::matchFull() const {
+  return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+}
+
+#else  // defined(__SSE2__)
+
+MapGroup::MapGroup(const uint8_t* c) : ctrl(c) {}
+
+uint32_t MapGroup::match(uint8_t c) const {
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < kMapGroupSize; i++) {
+    mask |= static_cast<uint32_t>(ctrl[i] == c) << i;
+  }
+  return mask;
+}
+
+uint32_t MapGroup::matchFull() const {
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < kMapGroupSize; i++) {
+    mask |= static_cast<uint32_t>(ctrl[i] >> 7) << i;
+  }
+  return mask;
+}
+
+#endif  // defined(__SSE2__)
+
 ////////////////////////////////////////////////////////////////////////////////
 // Map<K, V, DENSE>::iterator //
 ////////////////////////////////////////////////////////////////////////////////
@@ -222,19 +338,28 @@ typename Map<K, V, DENSE>::element* Map<K, V, DENSE>::iterator::operator->() {
   return elem;
 }
 
-template <typename K, typename V, bool DENSE>
-const typename Map<K, V, DENSE>::iterator& Map<K, V, DENSE>::iterator::
-operator++() {
-  size_t offset = elem - reinterpret_cast<element*>(map->elements);
-  for (size_t i = offset; i < map->capacity; ++i) {
-    ++elem;
-    if (i == map->capacity - 1) {
-      break;
+// Returns the index of the first full slot at or after start in the control
+// bytes of a map, or capacity if there is none.
+inline uint64_t map_next_full(const uint8_t* ctrl, uint64_t start,
+                              uint64_t capacity) {
+  for (uint64_t group = start & ~(kMapGroupSize - 1); group < capacity;
+       group += kMapGroupSize) {
+    uint32_t mask = MapGroup(ctrl + group).matchFull();
+    if (group < start) {
+      mask &= ~0u << (start - group);
     }
-    if (elem->used == GAPIL_MAP_ELEMENT_FULL) {
-      break;
+    if (mask != 0) {
+      return group + __builtin_ctz(mask);
     }
   }
+  return capacity;
+}
+
+template <typename K, typename V, bool DENSE>
+const typename Map<K, V, DENSE>::iterator& Map<K, V, DENSE>::iterator::
+operator++() {
+  uint64_t offset = elem - map->els();
+  elem = map->els() + map_next_full(map->ctrl(), offset + 1, map->capacity);
   return *this;
 }
 
@@ -284,16 +409,8 @@ operator->() {
 template <typename K, typename V, bool DENSE>
 typename Map<K, V, DENSE>::const_iterator& Map<K, V, DENSE>::const_iterator::
 operator++() {
-  size_t offset = elem - reinterpret_cast<element*>(map->elements);
-  for (size_t i = offset; i < map->capacity; ++i) {
-    ++elem;
-    if (i == map->capacity - 1) {
-      break;
-    }
-    if (elem->used == GAPIL_MAP_ELEMENT_FULL) {
-      break;
-    }
-  }
+  uint64_t offset = elem - map->els();
+  elem = map->els() + map_next_full(map->ctrl(), offset + 1, map->capacity);
   return *this;
 }
 
@@ -337,26 +454,15 @@ bool Map<K, V, DENSE>::contains(const K& key) const {
 template <typename K, typename V, bool DENSE>
 const typename Map<K, V, DENSE>::const_iterator Map<K, V, DENSE>::begin()
     const {
-  auto it = const_iterator{ptr->els(), ptr};
-  for (size_t i = 0; i < ptr->capacity; ++i) {
-    if (it.elem->used == GAPIL_MAP_ELEMENT_FULL) {
-      break;
-    }
-    it.elem++;
-  }
-  return it;
+  const Allocation* alloc = ptr;
+  return const_iterator{
+      alloc->els() + map_next_full(alloc->ctrl(), 0, alloc->capacity), alloc};
 }
 
 template <typename K, typename V, bool DENSE>
 typename Map<K, V, DENSE>::iterator Map<K, V, DENSE>::begin() {
-  auto it = iterator{ptr->els(), ptr};
-  for (size_t i = 0; i < ptr->capacity; ++i) {
-    if (it.elem->used == GAPIL_MAP_ELEMENT_FULL) {
-      break;
-    }
-    it.elem++;
-  }
-  return it;
+  return iterator{ptr->els() + map_next_full(ptr->ctrl(), 0, ptr->capacity),
+                  ptr};
 }
 
 template <typename K, typename V, bool DENSE>
@@ -446,6 +552,26 @@ typename Map<K, V, DENSE>::element* Map<K, V, DENSE>::Allocation::els() {
   return reinterpret_cast<element*>(map_t::elements);
 }
 
+template <typename K, typename V, bool DENSE>
+const uint8_t* Map<K, V, DENSE>::Allocation::ctrl() const {
+  return reinterpret_cast<const uint8_t*>(els() + capacity);
+}
+
+template <typename K, typename V, bool DENSE>
+uint8_t* Map<K, V, DENSE>::Allocation::ctrl() {
+  return reinterpret_cast<uint8_t*>(els() + capacity);
+}
+
+template <typename K, typename V, bool DENSE>
+uint64_t& Map<K, V, DENSE>::Allocation::deleted() {
+  return *reinterpret_cast<uint64_t*>(ctrl() + capacity);
+}
+
+template <typename K, typename V, bool DENSE>
+uint64_t Map<K, V, DENSE>::bufferSize(uint64_t capacity) {
+  return (sizeof(element) + 1) * capacity + sizeof(uint64_t);
+}
+
 }  // namespace gapil
 
 #endif  // __GAPIL_RUNTIME_MAP_H__
\ No newline at end of file
@@ -0,0 +1,265 @@
+// Copyright (C) 2020 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Synthetic benchmark of gapil::Map. Inserts, lookups of present and absent
+// keys, erase and reinsert churn, and iteration are timed for small integer
+// keys and for pointer-like keys, and compared against a copy of the previous
+// map layout, which stored the state of each slot next to its element and
+// probed with a secondary hash.
+
+#include "map.inc"
+
+#include "core/cc/timer.h"
+#include "core/memory/arena/cc/arena.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace {
+
+const uint64_t kLegacyHashBits = 0xFFFFFFFFFFF;
+
+// LegacyMap is the previous open addressing layout of gapil::Map, kept here
+// as the baseline of the benchmark.
+template <typename K, typename V>
+class LegacyMap {
+ public:
+  LegacyMap() : mCount(0), mElements(GAPIL_MIN_MAP_SIZE) {}
+
+  V* index(K key, bool insert) {
+    uint64_t hash = gapil::hash<K>{}(key)&kLegacyHashBits;
+    uint64_t capacity = mElements.size();
+    for (uint64_t i = 0; i < capacity; ++i, hash = next(hash)) {
+      Element& el = mElements[hash & (capacity - 1)];
+      if (el.used == GAPIL_MAP_ELEMENT_EMPTY) {
+        break;
+      }
+      if (el.used == GAPIL_MAP_ELEMENT_FULL && el.key == key) {
+        return &el.value;
+      }
+    }
+    if (!insert) {
+      return nullptr;
+    }
+    if ((float)mCount / (float)capacity > GAPIL_MAP_MAX_CAPACITY) {
+      std::vector<Element> old(capacity * GAPIL_MAP_GROW_MULTIPLIER);
+      old.swap(mElements);
+      for (auto& el : old) {
+        if (el.used == GAPIL_MAP_ELEMENT_FULL) {
+          mElements[slot(el.key)] = el;
+        }
+      }
+    }
+    Element& el = mElements[slot(key)];
+    el.used = GAPIL_MAP_ELEMENT_FULL;
+    el.key = key;
+    el.value = V();
+    mCount++;
+    return &el.value;
+  }
+
+  void erase(K key) {
+    uint64_t hash = gapil::hash<K>{}(key)&kLegacyHashBits;
+    uint64_t capacity = mElements.size();
+    for (uint64_t i = 0; i < capacity; ++i, hash = next(hash)) {
+      Element& el = mElements[hash & (capacity - 1)];
+      if (el.used == GAPIL_MAP_ELEMENT_EMPTY) {
+        return;
+      }
+      if (el.used == GAPIL_MAP_ELEMENT_FULL && el.key == key) {
+        el.used = GAPIL_MAP_ELEMENT_USED;
+        mCount--;
+        return;
+      }
+    }
+  }
+
+  template <typename F>
+  void forEach(F f) {
+    for (auto& el : mElements) {
+      if (el.used == GAPIL_MAP_ELEMENT_FULL) {
+        f(el.key, el.value);
+      }
+    }
+  }
+
+ private:
+  struct Element {
+    uint64_t used;
+    K key;
+    V value;
+  };
+
+  static uint64_t next(uint64_t hash) {
+    return ((hash * 69069) + 1) & kLegacyHashBits;
+  }
+
+  uint64_t slot(K key) {
+    uint64_t hash = gapil::hash<K>{}(key)&kLegacyHashBits;
+    uint64_t capacity = mElements.size();
+    for (uint64_t i = 0; i < capacity; ++i, hash = next(hash)) {
+      if (mElements[hash & (capacity - 1)].used != GAPIL_MAP_ELEMENT_FULL) {
+        break;
+      }
+    }
+    return hash & (capacity - 1);
+  }
+
+  uint64_t mCount;
+  std::vector<Element> mElements;
+};
+
+// Adapters giving both maps the same interface.
+template <typename K>
+struct Legacy {
+  explicit Legacy(core::Arena*) {}
+  uint64_t* find(K k) { return map.index(k, false); }
+  void insert(K k, uint64_t v) { *map.index(k, true) = v; }
+  void erase(K k) { map.erase(k); }
+  uint64_t sum() {
+    uint64_t s = 0;
+    map.forEach([&s](K, uint64_t v) { s += v; });
+    return s;
+  }
+  LegacyMap<K, uint64_t> map;
+};
+
+template <typename K>
+struct Current {
+  explicit Current(core::Arena* arena) : map(arena) {}
+  uint64_t* find(K k) {
+    auto it = map.find(k);
+    return it == map.end() ? nullptr : &it->second;
+  }
+  void insert(K k, uint64_t v) { map[k] = v; }
+  void erase(K k) { map.erase(k); }
+  uint64_t sum() {
+    uint64_t s = 0;
+    for (auto& it : map) {
+      s += it.second;
+    }
+    return s;
+  }
+  gapil::Map<K, uint64_t, false> map;
+};
+
+struct Result {
+  double insert;
+  double hit;
+  double miss;
+  double churn;
+  double iterate;
+  uint64_t check;
+};
+
+double nsPer(uint64_t start, size_t n) {
+  return double(core::GetNanoseconds() - start) / n;
+}
+
+template <typename M, typename K>
+Result run(const std::vector<K>& keys, const std::vector<K>& absent) {
+  core::Arena arena;
+  Result r = {};
+  M m(&arena);
+
+  uint64_t start = core::GetNanoseconds();
+  for (size_t i = 0; i < keys.size(); i++) {
+    m.insert(keys[i], i);
+  }
+  r.insert = nsPer(start, keys.size());
+
+  start = core::GetNanoseconds();
+  for (int pass = 0; pass < 4; pass++) {
+    for (auto k : keys) {
+      r.check += *m.find(k);
+    }
+  }
+  r.hit = nsPer(start, keys.size() * 4);
+
+  start = core::GetNanoseconds();
+  for (auto k : absent) {
+    r.check += m.find(k) != nullptr;
+  }
+  r.miss = nsPer(start, absent.size());
+
+  // Erase and reinsert a quarter of the keys at a time, as is done with the
+  // short lived objects of a trace.
+  start = core::GetNanoseconds();
+  size_t quarter = keys.size() / 4;
+  for (int pass = 0; pass < 8; pass++) {
+    size_t from = (pass % 4) * quarter;
+    for (size_t i = from; i < from + quarter; i++) {
+      m.erase(keys[i]);
+    }
+    for (size_t i = from; i < from + quarter; i++) {
+      m.insert(keys[i], i);
+    }
+  }
+  r.churn = nsPer(start, quarter * 16);
+
+  start = core::GetNanoseconds();
+  for (int pass = 0; pass < 16; pass++) {
+    r.check += m.sum();
+  }
+  r.iterate = nsPer(start, keys.size() * 16);
+  return r;
+}
+
+template <typename K>
+void compare(const char* name, const std::vector<K>& keys,
+             const std::vector<K>& absent) {
+  Result legacy = run<Legacy<K>>(keys, absent);
+  Result current = run<Current<K>>(keys, absent);
+  if (legacy.check != current.check) {
+    printf("%s: results differ\n", name);
+  }
+  printf("%-8s %8zu %-7s %8.2f %8.2f %8.2f %8.2f %8.2f\n", name, keys.size(),
+         "legacy", legacy.insert, legacy.hit, legacy.miss, legacy.churn,
+         legacy.iterate);
+  printf("%-8s %8zu %-7s %8.2f %8.2f %8.2f %8.2f %8.2f\n", name, keys.size(),
+         "swiss", current.insert, current.hit, current.miss, current.churn,
+         current.iterate);
+}
+
+}  // anonymous namespace
+
+int main() {
+  printf("%-8s %8s %-7s %8s %8s %8s %8s %8s   (ns per op)\n", "keys", "count",
+         "layout", "insert", "hit", "miss", "churn", "iterate");
+  for (size_t n : {100, 10000, 1000000}) {
+    std::mt19937 rng(1234);
+    std::vector<uint32_t> ints(n);
+    std::vector<uint32_t> absentInts(n);
+    for (size_t i = 0; i < n; i++) {
+      ints[i] = uint32_t(i * 2);
+      absentInts[i] = uint32_t(i * 2 + 1);
+    }
+    std::shuffle(ints.begin(), ints.end(), rng);
+    compare("uint32", ints, absentInts);
+
+    // Handles and pointers are aligned, and allocated close to each other.
+    std::vector<uint64_t> ptrs(n);
+    std::vector<uint64_t> absentPtrs(n);
+    for (size_t i = 0; i < n; i++) {
+      ptrs[i] = 0x7f0000000000ull + i * 128;
+      absentPtrs[i] = 0x7f0000000000ull + i * 128 + 64;
+    }
+    std::shuffle(ptrs.begin(), ptrs.end(), rng);
+    compare("pointer", ptrs, absentPtrs);
+  }
+  return 0;
+}
@@ -139,6 +139,54 @@ TYPED_TEST(MapTest, range) {
   }
 }
 
+TYPED_TEST(MapTest, erase_reinsert) {
+  using key_type = typename TypeParam::key_type;
+  using value_type = typename TypeParam::value_type;
+
+  auto map = TypeParam(&this->TestFixture::arena);
+
+  // Continuously erasing and inserting distinct keys must not grow the map,
+  // nor lose any of the keys.
+  for (uint64_t i = 0; i < 1000; ++i) {
+    map[key_type(i)] = value_type(i);
+    if (i >= 16) {
+      map.erase(key_type(i - 16));
+    }
+    EXPECT_TRUE(map.contains(key_type(i)));
+  }
+  EXPECT_EQ(16, map.count());
+  EXPECT_EQ(GAPIL_MIN_MAP_SIZE, map.capacity());
+
+  for (uint64_t i = 0; i < 1000; ++i) {
+    EXPECT_EQ(i >= 1000 - 16, map.contains(key_type(i)));
+  }
+}
+
+TYPED_TEST(MapTest, range_after_erase) {
+  using key_type = typename TypeParam::key_type;
+  using value_type = typename TypeParam::value_type;
+
+  auto map = TypeParam(&this->TestFixture::arena);
+
+  for (uint64_t i = 0; i < 200; ++i) {
+    map[key_type(i)] = value_type(i);
+  }
+  for (uint64_t i = 0; i < 200; i += 2) {
+    map.erase(key_type(i));
+  }
+
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  for (auto& val : map) {
+    EXPECT_EQ(1, val.first % 2);
+    EXPECT_EQ(value_type(val.first), val.second);
+    sum += val.first;
+    ++count;
+  }
+  EXPECT_EQ(100, count);
+  EXPECT_EQ(100 * 100, sum);
+}
+
 class CppMapTest : public ::testing::Test {
   void TearDown() {
     EXPECT_EQ(0, arena.num_allocations());
@@ -24,6 +24,10 @@
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #define ENABLE_DEBUG 0
 #define ENABLE_DEBUG_INST 0
 
@@ -59,6 +63,16 @@ namespace {
 // Must match value used in cc/gapir/memory_manager.h
 const uint64_t unobservedPointer = 0xBADF00D;
 
+// The minimum number of bytes of instructions encoded by a worker thread.
+const uint64_t kMinBytesPerChunk = 256 * 1024;
+
+// The number of chunks of instructions per worker thread, so that the workers
+// that finish first take the remaining chunks.
+const uint64_t kChunksPerWorker = 4;
+
+// The minimum number of constants hashed by a worker thread.
+const size_t kMinConstantsPerWorker = 4096;
+
 // These functions are only used in debug
 #if ENABLE_DEBUG_INST
 const char* bool_str(bool b) { return b ? "true" : "false"; }
@@ -117,15 +131,169 @@ uint32_t set_bit(uint32_t bits, uint32_t idx, bool v) {
   return v ? bits | (1 << idx) : bits & ~(1 << idx);
 }
 
+#if ENABLE_DEBUG_INST
+// inst_size returns the size of the instruction that follows an instruction
+// type byte of the given type, or 0 if the type is unknown.
+uint64_t inst_size(uint8_t ty) {
+  switch (gapil_replay_asm_inst(ty)) {
+    case GAPIL_REPLAY_ASM_INST_CALL:
+      return sizeof(gapil_replay_asm_call);
+    case GAPIL_REPLAY_ASM_INST_PUSH:
+      return sizeof(gapil_replay_asm_push);
+    case GAPIL_REPLAY_ASM_INST_POP:
+      return sizeof(gapil_replay_asm_pop);
+    case GAPIL_REPLAY_ASM_INST_COPY:
+      return sizeof(gapil_replay_asm_copy);
+    case GAPIL_REPLAY_ASM_INST_CLONE:
+      return sizeof(gapil_replay_asm_clone);
+    case GAPIL_REPLAY_ASM_INST_LOAD:
+      return sizeof(gapil_replay_asm_load);
+    case GAPIL_REPLAY_ASM_INST_STORE:
+      return sizeof(gapil_replay_asm_store);
+    case GAPIL_REPLAY_ASM_INST_STRCPY:
+      return sizeof(gapil_replay_asm_strcpy);
+    case GAPIL_REPLAY_ASM_INST_RESOURCE:
+      return sizeof(gapil_replay_asm_resource);
+    case GAPIL_REPLAY_ASM_INST_POST:
+      return sizeof(gapil_replay_asm_post);
+    case GAPIL_REPLAY_ASM_INST_ADD:
+      return sizeof(gapil_replay_asm_add);
+    case GAPIL_REPLAY_ASM_INST_LABEL:
+      return sizeof(gapil_replay_asm_label);
+    case GAPIL_REPLAY_ASM_INST_SWITCHTHREAD:
+      return sizeof(gapil_replay_asm_switchthread);
+  }
+  return 0;
+}
+#endif  // #if ENABLE_DEBUG_INST
+
+// parallel_for calls f(worker) on num_workers threads, including the calling
+// thread, and waits for all the calls to return.
+template <typename F>
+void parallel_for(uint32_t num_workers, const F& f) {
+  std::vector<std::thread> threads;
+  threads.reserve(num_workers - 1);
+  for (uint32_t i = 1; i < num_workers; i++) {
+    threads.emplace_back([&f, i] { f(i); });
+  }
+  f(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// sort_by_key sorts the indices by less. key returns a 64-bit key for an
+// index, which orders the indices like less does when the keys differ, and is
+// compared first.
+template <typename Key, typename Less>
+void sort_by_key(std::vector<uint32_t>* indices, const Key& key,
+                 const Less& less) {
+  typedef std::pair<uint64_t, uint32_t> Keyed;
+  std::vector<Keyed> keyed;
+  keyed.reserve(indices->size());
+  for (auto i : *indices) {
+    keyed.emplace_back(key(i), i);
+  }
+  std::sort(keyed.begin(), keyed.end(), [&](const Keyed& a, const Keyed& b) {
+    return a.first != b.first ? a.first < b.first : less(a.second, b.second);
+  });
+  for (size_t i = 0; i < keyed.size(); i++) {
+    (*indices)[i] = keyed[i].second;
+  }
+}
+
 class Builder {
  public:
-  Builder(::arena* a, gapil_replay_data* d);
+  Builder(::arena* a, gapil_replay_data* d, uint32_t num_threads);
 
   void layout_volatile_memory();
+  void layout_constants();
   void generate_opcodes();
   void build_resources();
 
+  // remap returns the value with the observed pointers replaced by volatile
+  // pointers, and the constant indices replaced by constant addresses.
+  // remap is called concurrently by the workers encoding the instructions.
+  gapil_replay_asm_value remap(gapil_replay_asm_value v) const;
+
  private:
+  struct ReservedNamespace {
+    const MemoryRanges* ranges;
+    std::vector<DataEx::VolatileAddr> base_offsets;
+  };
+
+  // num_workers returns the number of threads used to process count items, of
+  // which each thread processes at least min_count.
+  uint32_t num_workers(size_t count, size_t min_count) const;
+
+#if !ENABLE_DEBUG_INST
+  // expand_opcodes expands, in place, the deferred instructions of the opcodes
+  // emitted by gapil_replay_emit.
+  void expand_opcodes();
+#else
+  // decode_instructions replaces the instructions recorded by
+  // gapil_replay_emit by their opcodes.
+  void decode_instructions();
+#endif  // #if !ENABLE_DEBUG_INST
+
+  // pack_constants lays out the constants, given the first constant with the
+  // same data as each constant, and sets their addresses.
+  void pack_constants(const std::vector<uint32_t>& firsts,
+                      StackAllocator<DataEx::ConstantAddr>* layout);
+
+  arena* arena_;
+  gapil_replay_data* data_;
+  uint32_t num_threads_;
+  std::unordered_map<DataEx::Namespace, ReservedNamespace> reserved_;
+  std::vector<DataEx::ConstantAddr> constant_addrs_;
+};
+
+// Encoder encodes instructions into opcodes.
+//
+// Without a builder, the memory and the constants are not laid out yet, so the
+// instructions using values that need to be remapped are encoded as deferred
+// instructions, which are expanded once the builder can remap the values. A
+// deferred instruction is a word with the kDeferred opcode, which is not a
+// valid opcode, followed by the value. It is never shorter than the opcodes it
+// expands to, so that it can be expanded in place.
+class Encoder {
+ public:
+  // The maximum number of words written for an instruction by encode().
+  static const uint32_t kMaxWordsPerInst = 5;
+
+  // The number of words of a deferred instruction.
+  static const uint32_t kDeferredWords = 4;
+
+  // The opcode of the deferred instructions.
+  static const uint32_t kDeferred = 0x3f;
+
+  Encoder(const Builder* builder, uint32_t* out);
+
+  // encode writes the opcodes of the instruction inst of type ty.
+  void encode(uint8_t ty, const void* inst);
+
+#if ENABLE_DEBUG_INST
+  // decode writes the opcodes of the instructions recorded in stream, which
+  // are preceded by their type. At most a word is written per 4 bytes of
+  // stream.
+  void decode(buffer* stream);
+#else
+  // expand writes the opcodes in [begin, end), with the deferred instructions
+  // expanded. The opcodes may be written over the opcodes being read.
+  void expand(const uint32_t* begin, const uint32_t* end);
+#endif  // #if ENABLE_DEBUG_INST
+
+  // out returns the end of the opcodes written so far.
+  inline uint32_t* out() const { return out_; }
+
+  // words returns the number of words of the opcode starting with word.
+  static inline uint32_t words(uint32_t word) {
+    return (word >> 26) == kDeferred ? kDeferredWords : 1;
+  }
+
+ private:
+  enum Deferred { DEFERRED_PUSH, DEFERRED_LOAD, DEFERRED_STORE };
+
   // Various bit-masks used by this class.
   // Many opcodes can fit values into the opcode itself.
   // These masks are used to determine which values fit.
@@ -136,22 +304,41 @@ class Builder {
   static const uint64_t mask46 = 0x3fffffffffff;
   static const uint64_t mask52 = 0xfffffffffffff;
 
-  gapil_replay_asm_value remap(gapil_replay_asm_value v);
+  inline gapil_replay_asm_value remap(gapil_replay_asm_value v) {
+    return builder_ != nullptr ? builder_->remap(v) : v;
+  }
+
+  // defer returns true if val must be remapped, but cannot be remapped yet.
+  inline bool defer(gapil_replay_asm_value val) {
+    const auto observed = GAPIL_REPLAY_ASM_TYPE_OBSERVED_POINTER_NAMESPACE_0;
+    return builder_ == nullptr &&
+           (val.data_type == GAPIL_REPLAY_ASM_TYPE_CONSTANT_POINTER ||
+            val.data_type >= observed);
+  }
+
+  // deferred writes a deferred instruction.
+  inline void deferred(Deferred kind, gapil_replay_asm_value val,
+                       uint32_t ty) {
+    *out_++ = (kDeferred << 26) | (uint32_t(kind) << 20) | ty;
+    *out_++ = uint32_t(val.data);
+    *out_++ = uint32_t(val.data >> 32);
+    *out_++ = uint32_t(val.data_type);
+  }
 
   void push(gapil_replay_asm_value val);
   void load(gapil_replay_asm_value val, gapil_replay_asm_type ty);
   void store(gapil_replay_asm_value dst);
 
   inline void pushi(uint32_t ty, uint32_t v) {
-    opcodes_.append(packCYZ(Opcode::PUSH_I, ty, v));
+    *out_++ = packCYZ(Opcode::PUSH_I, ty, v);
   }
 
   inline void extend(uint32_t v) { CX(Opcode::EXTEND, v); }
 
-  inline void C(Opcode c) { opcodes_.append(packC(c)); }
-  inline void CX(Opcode c, uint32_t x) { opcodes_.append(packCX(c, x)); }
+  inline void C(Opcode c) { *out_++ = packC(c); }
+  inline void CX(Opcode c, uint32_t x) { *out_++ = packCX(c, x); }
   inline void CYZ(Opcode c, uint32_t y, uint32_t z) {
-    opcodes_.append(packCYZ(c, y, z));
+    *out_++ = packCYZ(c, y, z);
   }
 
   // clang-format off
@@ -214,15 +401,16 @@ class Builder {
     return packC(c) | (y << 20) | z;
   }
 
-  arena* arena_;
-  gapil_replay_data* data_;
-  gapil::Buffer opcodes_;
-  std::unordered_map<DataEx::Namespace, std::vector<DataEx::VolatileAddr>>
-      reserved_base_offsets_;
+  const Builder* builder_;
+  uint32_t* out_;
 };
 
-Builder::Builder(arena* arena, gapil_replay_data* data)
-    : arena_(arena), data_(data), opcodes_(arena) {}
+Builder::Builder(arena* arena, gapil_replay_data* data, uint32_t num_threads)
+    : arena_(arena), data_(data), num_threads_(std::max(num_threads, 1u)) {}
+
+uint32_t Builder::num_workers(size_t count, size_t min_count) const {
+  return std::max<size_t>(1, std::min<size_t>(num_threads_, count / min_count));
+}
 
 void Builder::layout_volatile_memory() {
   DEBUG_PRINT("Builder::layout_volatile_memory()");
@@ -244,7 +432,8 @@ void Builder::layout_volatile_memory() {
 
   for (auto ns : namespaces) {
     const auto& reserved = ex->reserved[ns];
-    auto& offsets = reserved_base_offsets_[ns];
+    reserved_[ns].ranges = &reserved;
+    auto& offsets = reserved_[ns].base_offsets;
     offsets.reserve(reserved.count());
     for (auto block : reserved) {
       auto size = block.mEnd - block.mStart;
@@ -262,156 +451,334 @@ void Builder::layout_volatile_memory() {
   }
 }
 
-void Builder::generate_opcodes() {
-  DEBUG_PRINT("Builder::generate_opcodes()");
+void Builder::layout_constants() {
+  DEBUG_PRINT("Builder::layout_constants()");
 
-  gapil::Buffer::Reader reader(&data_->stream);
+  auto ex = reinterpret_cast<DataEx*>(data_->data_ex);
+  const auto& constants = ex->constants;
+  const auto count = constants.size();
 
-  while (true) {
-    uint8_t ty;
-    if (!reader.read(&ty)) {
-      break;
+  // Hash the constants.
+  std::vector<core::Id> ids(count);
+  auto hash_workers = num_workers(count, kMinConstantsPerWorker);
+  parallel_for(hash_workers, [&](uint32_t worker) {
+    auto end = count * (worker + 1) / hash_workers;
+    for (auto i = count * worker / hash_workers; i < end; i++) {
+      const auto& c = constants[i];
+      ids[i] = core::Id::Hash(&ex->constant_data[c.offset], c.size);
     }
+  });
 
-    switch (gapil_replay_asm_inst(ty)) {
-      case GAPIL_REPLAY_ASM_INST_CALL: {
-        gapil_replay_asm_call inst;
-        if (reader.read(&inst)) {
-          DEBUG_PRINT_INST(
-              "GAPIL_REPLAY_ASM_INST_CALL(push_return: %s, api_index: %" PRId8
-              ", function_id: %" PRId16 ")",
-              bool_str(inst.push_return), inst.api_index, inst.function_id);
-          auto packed = (uint32_t(inst.api_index & 0xf) << 16) |
-                        uint32_t(inst.function_id);
-          packed = set_bit(packed, 24, inst.push_return);
-          CX(Opcode::CALL, packed);
-        }
-        break;
+  // Find the first constant with the same data as each constant. Each worker
+  // deduplicates the constants of a shard of the hashes, in order. The shard
+  // is picked from the bytes of the hash that std::hash<core::Id> ignores.
+  std::vector<uint32_t> firsts(count);
+  auto shards = hash_workers;
+  parallel_for(shards, [&](uint32_t shard) {
+    std::unordered_map<core::Id, uint32_t> seen;
+    for (size_t i = 0; i < count; i++) {
+      if (ids[i].data[8] % shards == shard) {
+        firsts[i] = seen.emplace(ids[i], i).first->second;
       }
-      case GAPIL_REPLAY_ASM_INST_PUSH: {
-        gapil_replay_asm_push inst;
-        if (reader.read(&inst)) {
-          DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_PUSH(value: " ASM_VAL_FMT ")",
-                           ASM_VAL_ARGS(inst.value));
-          push(remap(inst.value));
-        }
-        break;
-      }
-      case GAPIL_REPLAY_ASM_INST_POP: {
-        gapil_replay_asm_pop inst;
-        if (reader.read(&inst)) {
-          DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_POP(count: %" PRIu32 ")",
-                           inst.count);
-          CX(Opcode::POP, inst.count);
-        }
-        break;
-      }
-      case GAPIL_REPLAY_ASM_INST_COPY: {
-        gapil_replay_asm_copy inst;
-        if (reader.read(&inst)) {
-          DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_COPY(count: %" PRIu32 ")",
-                           inst.count);
-          CX(Opcode::COPY, inst.count);
-        }
-        break;
-      }
-      case GAPIL_REPLAY_ASM_INST_CLONE: {
-        gapil_replay_asm_clone inst;
-        if (reader.read(&inst)) {
-          DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_CLONE(n: %" PRIu32 ")",
-                           inst.n);
-          CX(Opcode::CLONE, inst.n);
-        }
-        break;
-      }
-      case GAPIL_REPLAY_ASM_INST_LOAD: {
-        gapil_replay_asm_load inst;
-        if (reader.read(&inst)) {
-          DEBUG_PRINT_INST(
-              "GAPIL_REPLAY_ASM_INST_LOAD(type: %s, src: " ASM_VAL_FMT ")",
-              asm_type_str(inst.data_type), ASM_VAL_ARGS(inst.source));
-          load(remap(inst.source), inst.data_type);
-        }
-        break;
-      }
-      case GAPIL_REPLAY_ASM_INST_STORE: {
-        gapil_replay_asm_store inst;
-        if (reader.read(&inst)) {
-          DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_STORE(dst: " ASM_VAL_FMT ")",
-                           ASM_VAL_ARGS(inst.dst));
-          store(remap(inst.dst));
-        }
-        break;
-      }
-      case GAPIL_REPLAY_ASM_INST_STRCPY: {
-        gapil_replay_asm_strcpy inst;
-        if (reader.read(&inst)) {
-          DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_STRCPY(max_count: %" PRIu64
-                           ")",
-                           inst.max_count);
-          CX(Opcode::STRCPY, inst.max_count);
-        }
-        break;
-      }
-      case GAPIL_REPLAY_ASM_INST_RESOURCE: {
-        gapil_replay_asm_resource inst;
-        if (reader.read(&inst)) {
-          DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_RESOURCE(index: %" PRIu32
-                           ", dst: " ASM_VAL_FMT ")",
-                           inst.index, ASM_VAL_ARGS(inst.dest));
-          push(remap(inst.dest));
-          CX(Opcode::RESOURCE, inst.index);
-        }
-        break;
-      }
-      case GAPIL_REPLAY_ASM_INST_POST: {
-        gapil_replay_asm_post inst;
-        if (reader.read(&inst)) {
-          DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_POST(src: " ASM_VAL_FMT
-                           ", size: 0x%" PRIx64 ")",
-                           ASM_VAL_ARGS(inst.source), inst.size);
-          push(remap(inst.source));
-          C(Opcode::POST);
-        }
-        break;
+    }
+  });
+
+  // Pack the constants, and copy them to the constants buffer.
+  StackAllocator<DataEx::ConstantAddr> layout;
+  pack_constants(firsts, &layout);
+
+  auto& consts = data_->constants;
+  if (layout.size() > consts.capacity) {
+    auto arena = reinterpret_cast<core::Arena*>(consts.arena);
+    consts.capacity = layout.size();
+    consts.data = (uint8_t*)arena->reallocate(consts.data, consts.capacity,
+                                              consts.alignment);
+  }
+  // Clear the alignment padding to 0.
+  memset(consts.data, 0, layout.size());
+  consts.size = layout.size();
+  for (size_t i = 0; i < count; i++) {
+    if (firsts[i] == i) {
+      memcpy(consts.data + constant_addrs_[i],
+             &ex->constant_data[constants[i].offset], constants[i].size);
+    }
+  }
+
+  // The constants data is no longer needed.
+  std::vector<uint8_t>().swap(ex->constant_data);
+}
+
+void Builder::pack_constants(const std::vector<uint32_t>& firsts,
+                             StackAllocator<DataEx::ConstantAddr>* layout) {
+  auto ex = reinterpret_cast<DataEx*>(data_->data_ex);
+  const auto& constants = ex->constants;
+  const auto count = constants.size();
+  auto data = [&](uint32_t i) {
+    return &ex->constant_data[constants[i].offset];
+  };
+  auto size = [&](uint32_t i) { return constants[i].size; };
+
+  // The constants are packed into blocks. A constant is either the first
+  // constant of a block, or is found at an offset in the block of another
+  // constant. The alignment of a block is the largest alignment of its
+  // constants, and its uses are the number of times its constants were added.
+  struct Block {
+    uint32_t first;
+    uint64_t offset;
+    uint32_t alignment;
+    uint32_t uses;
+  };
+  std::vector<Block> blocks(count);
+  std::vector<uint32_t> uniques;
+  for (uint32_t i = 0; i < count; i++) {
+    auto& block = blocks[firsts[i]];
+    if (firsts[i] == i) {
+      block = Block{i, 0, constants[i].alignment, 0};
+      uniques.push_back(i);
+    }
+    block.alignment = std::max(block.alignment, constants[i].alignment);
+    block.uses++;
+  }
+
+  // Place the unique constant i at offset in the block of constant j.
+  auto share = [&](uint32_t i, uint32_t j, uint64_t offset) {
+    auto& block = blocks[blocks[j].first];
+    blocks[i].first = blocks[j].first;
+    blocks[i].offset = blocks[j].offset + offset;
+    block.alignment = std::max(block.alignment, blocks[i].alignment);
+    block.uses += blocks[i].uses;
+  };
+
+  // Share the constants that are prefixes of other constants. Once sorted,
+  // a constant that is a prefix of another is a prefix of the next constant.
+  // The constants are sorted by the first 8 bytes of their data before
+  // comparing all their data.
+  auto prefix_key = [&](uint32_t i) {
+    uint64_t key = 0;
+    for (uint32_t k = 0; k < 8; k++) {
+      key = (key << 8) | (k < size(i) ? data(i)[k] : 0);
+    }
+    return key;
+  };
+  auto less = [&](uint32_t a, uint32_t b) {
+    auto c = memcmp(data(a), data(b), std::min(size(a), size(b)));
+    return c != 0 ? c < 0 : size(a) < size(b);
+  };
+  sort_by_key(&uniques, prefix_key, less);
+  for (size_t k = uniques.size(); k > 1; k--) {
+    auto i = uniques[k - 2], j = uniques[k - 1];
+    if (size(i) <= size(j) && memcmp(data(i), data(j), size(i)) == 0) {
+      share(i, j, 0);
+    }
+  }
+
+  // Share the remaining constants that are suffixes of other constants, if
+  // the alignment of the constant allows it. The constants are sorted by
+  // their reversed data.
+  auto last = std::remove_if(uniques.begin(), uniques.end(),
+                             [&](uint32_t i) { return blocks[i].first != i; });
+  uniques.erase(last, uniques.end());
+  auto suffix_key = [&](uint32_t i) {
+    uint64_t key = 0;
+    for (uint32_t k = 1; k <= 8; k++) {
+      key = (key << 8) | (k <= size(i) ? data(i)[size(i) - k] : 0);
+    }
+    return key;
+  };
+  auto reverse_less = [&](uint32_t a, uint32_t b) {
+    auto n = std::min(size(a), size(b));
+    for (uint32_t k = 1; k <= n; k++) {
+      auto x = data(a)[size(a) - k], y = data(b)[size(b) - k];
+      if (x != y) {
+        return x < y;
       }
-      case GAPIL_REPLAY_ASM_INST_ADD: {
-        gapil_replay_asm_add inst;
-        if (reader.read(&inst)) {
-          DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_ADD(count: %" PRIu32 ")",
-                           inst.count);
-          CX(Opcode::RESOURCE, inst.count);
-        }
-        break;
+    }
+    return size(a) < size(b);
+  };
+  sort_by_key(&uniques, suffix_key, reverse_less);
+  for (size_t k = uniques.size(); k > 1; k--) {
+    auto i = uniques[k - 2], j = uniques[k - 1];
+    if (size(i) > size(j)) {
+      continue;
+    }
+    auto offset = size(j) - size(i);
+    if ((blocks[j].offset + offset) % blocks[i].alignment == 0 &&
+        memcmp(data(i), data(j) + offset, size(i)) == 0) {
+      share(i, j, offset);
+    }
+  }
+
+  // Lay out the blocks, with the most used bytes first, so that the most used
+  // constants can be loaded with LOAD_C, which addresses the first 1MB.
+  struct Root {
+    uint32_t index;
+    uint32_t size;
+    uint32_t alignment;
+    uint32_t uses;
+  };
+  std::vector<Root> roots;
+  for (auto i : uniques) {
+    if (blocks[i].first == i) {
+      roots.push_back(Root{i, std::max(size(i), 1u), blocks[i].alignment,
+                           blocks[i].uses});
+    }
+  }
+  std::sort(roots.begin(), roots.end(), [](const Root& a, const Root& b) {
+    uint64_t x = uint64_t(a.uses) * b.size;
+    uint64_t y = uint64_t(b.uses) * a.size;
+    return x != y ? x > y : a.index < b.index;
+  });
+  constant_addrs_.resize(count);
+  for (const auto& root : roots) {
+    constant_addrs_[root.index] =
+        layout->alloc(size(root.index), root.alignment);
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t offset = 0;
+    auto j = firsts[i];
+    while (blocks[j].first != j) {
+      offset += blocks[j].offset;
+      j = blocks[j].first;
+    }
+    if (j != i) {
+      constant_addrs_[i] = constant_addrs_[j] + offset;
+    }
+  }
+
+  // Report the bytes saved, compared to only sharing identical constants with
+  // the pointer alignment.
+  StackAllocator<DataEx::ConstantAddr> unpacked;
+  for (uint32_t i = 0; i < count; i++) {
+    if (firsts[i] == i) {
+      auto alignment = constants[i].alignment;
+      unpacked.alloc(size(i), std::max(alignment, data_->pointer_alignment));
+    }
+  }
+  GAPID_DEBUG("Replay constants: %" PRIu64 " bytes, %" PRIu64
+              " bytes saved by packing (%zu constants in %zu blocks)",
+              layout->size(), unpacked.size() - layout->size(), count,
+              roots.size());
+}
+
+void Builder::generate_opcodes() {
+  DEBUG_PRINT("Builder::generate_opcodes()");
+#if ENABLE_DEBUG_INST
+  decode_instructions();
+#else
+  expand_opcodes();
+#endif
+}
+
+#if !ENABLE_DEBUG_INST
+void Builder::expand_opcodes() {
+  auto& stream = data_->stream;
+  auto words = reinterpret_cast<uint32_t*>(stream.data);
+  auto count = stream.size / sizeof(uint32_t);
+
+  // Split the opcodes into chunks that are expanded by the workers, without
+  // splitting the deferred instructions.
+  auto workers = num_workers(stream.size, kMinBytesPerChunk);
+  auto num_chunks = workers == 1 ? 1 : workers * kChunksPerWorker;
+  std::vector<uint64_t> bounds{0};
+  if (num_chunks > 1) {
+    auto chunk_size = count / num_chunks;
+    uint64_t next = chunk_size;
+    for (uint64_t i = 0; i < count; i += Encoder::words(words[i])) {
+      if (i >= next) {
+        bounds.push_back(i);
+        next = i + chunk_size;
       }
-      case GAPIL_REPLAY_ASM_INST_LABEL: {
-        gapil_replay_asm_label inst;
-        if (reader.read(&inst)) {
-          DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_LABEL(count: %" PRIu32 ")",
-                           inst.value);
-          CX(Opcode::LABEL, inst.value);
-        }
-        break;
+    }
+  }
+  bounds.push_back(count);
+  num_chunks = bounds.size() - 1;
+
+  // Expand each chunk in place, then close the gaps left between the chunks
+  // by the deferred instructions that expanded to fewer words.
+  std::vector<uint64_t> sizes(num_chunks);
+  std::atomic<size_t> next_chunk(0);
+  parallel_for(workers, [&](uint32_t) {
+    for (auto i = next_chunk++; i < num_chunks; i = next_chunk++) {
+      Encoder encoder(this, words + bounds[i]);
+      encoder.expand(words + bounds[i], words + bounds[i + 1]);
+      sizes[i] = encoder.out() - (words + bounds[i]);
+    }
+  });
+
+  uint64_t size = 0;
+  for (size_t i = 0; i < num_chunks; i++) {
+    memmove(words + size, words + bounds[i], sizes[i] * sizeof(uint32_t));
+    size += sizes[i];
+  }
+  stream.size = size * sizeof(uint32_t);
+}
+
+#else
+void Builder::decode_instructions() {
+  auto& stream = data_->stream;
+
+  // Split the instructions into chunks that are encoded by the workers. As
+  // instructions have different sizes, the boundaries between instructions
+  // are found by scanning the stream in the same way as it is decoded.
+  auto workers = num_workers(stream.size, kMinBytesPerChunk);
+  auto num_chunks = workers == 1 ? 1 : workers * kChunksPerWorker;
+  std::vector<uint64_t> bounds{0};
+  if (num_chunks > 1) {
+    auto chunk_size = stream.size / num_chunks;
+    uint64_t offset = 0;
+    uint64_t next = chunk_size;
+    while (offset < stream.size) {
+      auto size = inst_size(stream.data[offset]);
+      if (size > 0 && offset + 1 + size <= stream.size) {
+        offset += 1 + size;
+      } else {
+        offset++;
       }
-      case GAPIL_REPLAY_ASM_INST_SWITCHTHREAD: {
-        gapil_replay_asm_switchthread inst;
-        if (reader.read(&inst)) {
-          DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_SWITCHTHREAD(index: %" PRIu32
-                           ")",
-                           inst.index);
-          CX(Opcode::SWITCH_THREAD, inst.index);
-        }
-        break;
+      if (offset >= next && offset < stream.size) {
+        bounds.push_back(offset);
+        next = offset + chunk_size;
       }
     }
   }
+  bounds.push_back(stream.size);
+  num_chunks = bounds.size() - 1;
+
+  // Encode the chunks, then concatenate their opcodes in order so that the
+  // opcodes do not depend on the number of workers.
+  std::vector<std::vector<uint32_t>> opcodes(num_chunks);
+  std::atomic<size_t> next_chunk(0);
+  parallel_for(workers, [&](uint32_t) {
+    for (auto i = next_chunk++; i < num_chunks; i = next_chunk++) {
+      buffer chunk = stream;
+      chunk.data += bounds[i];
+      chunk.size = bounds[i + 1] - bounds[i];
+      opcodes[i].resize((chunk.size + 3) / sizeof(uint32_t));
+      Encoder encoder(this, opcodes[i].data());
+      encoder.decode(&chunk);
+      opcodes[i].resize(encoder.out() - opcodes[i].data());
+    }
+  });
+
+  size_t size = 0;
+  for (const auto& chunk : opcodes) {
+    size += chunk.size() * sizeof(uint32_t);
+  }
+  gapil::Buffer out(arena_, std::max<size_t>(size, 16));
+  out.set_size(size);
+  auto buf = out.release_ownership();
+  size_t offset = 0;
+  for (const auto& chunk : opcodes) {
+    memcpy(buf.data + offset, chunk.data(), chunk.size() * sizeof(uint32_t));
+    offset += chunk.size() * sizeof(uint32_t);
+  }
 
   // Free the instructions as they are now no longer needed.
   gapil_free(arena_, data_->stream.data);
 
   // The stream is now a stream of opcodes.
-  data_->stream = opcodes_.release_ownership();
+  data_->stream = buf;
 }
+#endif  // #if !ENABLE_DEBUG_INST
 
 void Builder::build_resources() {
   auto ex = reinterpret_cast<DataEx*>(data_->data_ex);
@@ -428,30 +795,208 @@ void Builder::build_resources() {
   data_->resources = resources.release_ownership();
 }
 
-gapil_replay_asm_value Builder::remap(gapil_replay_asm_value v) {
-  auto ex = reinterpret_cast<DataEx*>(data_->data_ex);
-
+gapil_replay_asm_value Builder::remap(gapil_replay_asm_value v) const {
   if (v.data_type >= GAPIL_REPLAY_ASM_TYPE_OBSERVED_POINTER_NAMESPACE_0) {
     auto ns = DataEx::Namespace(
         v.data_type - GAPIL_REPLAY_ASM_TYPE_OBSERVED_POINTER_NAMESPACE_0);
-    const auto& reserved = ex->reserved[ns];
-    auto idx = reserved.index_of(v.data);
+    auto it = reserved_.find(ns);
+    auto idx = it != reserved_.end() ? it->second.ranges->index_of(v.data) : -1;
 
     if (idx < 0) {
       GAPID_WARNING("Pointer 0x%" PRIx64 "@%d not reserved", v.data, ns);
       return gapil_replay_asm_value{unobservedPointer,
                                     GAPIL_REPLAY_ASM_TYPE_ABSOLUTE_POINTER};
     } else {
-      const auto& offsets = reserved_base_offsets_[ns];
+      const auto& reserved = *it->second.ranges;
+      const auto& offsets = it->second.base_offsets;
       auto remapped = offsets[idx] + v.data - reserved[idx].mStart;
       return gapil_replay_asm_value{remapped,
                                     GAPIL_REPLAY_ASM_TYPE_VOLATILE_POINTER};
     }
   }
+  if (v.data_type == GAPIL_REPLAY_ASM_TYPE_CONSTANT_POINTER) {
+    if (v.data >= constant_addrs_.size()) {
+      GAPID_FATAL("Unknown constant %" PRIu64, v.data);
+    }
+    return gapil_replay_asm_value{constant_addrs_[v.data],
+                                  GAPIL_REPLAY_ASM_TYPE_CONSTANT_POINTER};
+  }
   return v;
 }
 
-void Builder::push(gapil_replay_asm_value val) {
+Encoder::Encoder(const Builder* builder, uint32_t* out)
+    : builder_(builder), out_(out) {}
+
+#if ENABLE_DEBUG_INST
+void Encoder::decode(buffer* stream) {
+  uint64_t offset = 0;
+  while (offset < stream->size) {
+    auto ty = stream->data[offset++];
+    auto size = inst_size(ty);
+    if (offset + size > stream->size) {
+      break;
+    }
+    if (size > 0) {
+      encode(ty, stream->data + offset);
+      offset += size;
+    }
+  }
+}
+
+#else
+void Encoder::expand(const uint32_t* begin, const uint32_t* end) {
+  for (auto in = begin; in < end;) {
+    auto word = *in;
+    if ((word >> 26) != kDeferred) {
+      *out_++ = word;
+      in++;
+      continue;
+    }
+    gapil_replay_asm_value val;
+    val.data = uint64_t(in[1]) | (uint64_t(in[2]) << 32);
+    val.data_type = gapil_replay_asm_type(in[3]);
+    in += kDeferredWords;
+    val = remap(val);
+    switch (Deferred((word >> 20) & 0x3f)) {
+      case DEFERRED_PUSH:
+        push(val);
+        break;
+      case DEFERRED_LOAD:
+        load(val, gapil_replay_asm_type(word & mask20));
+        break;
+      case DEFERRED_STORE:
+        store(val);
+        break;
+    }
+  }
+}
+#endif  // #if ENABLE_DEBUG_INST
+
+void Encoder::encode(uint8_t ty, const void* data) {
+  switch (gapil_replay_asm_inst(ty)) {
+    case GAPIL_REPLAY_ASM_INST_CALL: {
+      gapil_replay_asm_call inst;
+      memcpy(&inst, data, sizeof(inst));
+      DEBUG_PRINT_INST(
+          "GAPIL_REPLAY_ASM_INST_CALL(push_return: %s, api_index: %" PRId8
+          ", function_id: %" PRId16 ")",
+          bool_str(inst.push_return), inst.api_index, inst.function_id);
+      auto packed = (uint32_t(inst.api_index & 0xf) << 16) |
+                    uint32_t(inst.function_id);
+      packed = set_bit(packed, 24, inst.push_return);
+      CX(Opcode::CALL, packed);
+      break;
+    }
+    case GAPIL_REPLAY_ASM_INST_PUSH: {
+      gapil_replay_asm_push inst;
+      memcpy(&inst, data, sizeof(inst));
+      DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_PUSH(value: " ASM_VAL_FMT ")",
+                       ASM_VAL_ARGS(inst.value));
+      push(remap(inst.value));
+      break;
+    }
+    case GAPIL_REPLAY_ASM_INST_POP: {
+      gapil_replay_asm_pop inst;
+      memcpy(&inst, data, sizeof(inst));
+      DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_POP(count: %" PRIu32 ")",
+                       inst.count);
+      CX(Opcode::POP, inst.count);
+      break;
+    }
+    case GAPIL_REPLAY_ASM_INST_COPY: {
+      gapil_replay_asm_copy inst;
+      memcpy(&inst, data, sizeof(inst));
+      DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_COPY(count: %" PRIu32 ")",
+                       inst.count);
+      CX(Opcode::COPY, inst.count);
+      break;
+    }
+    case GAPIL_REPLAY_ASM_INST_CLONE: {
+      gapil_replay_asm_clone inst;
+      memcpy(&inst, data, sizeof(inst));
+      DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_CLONE(n: %" PRIu32 ")",
+                       inst.n);
+      CX(Opcode::CLONE, inst.n);
+      break;
+    }
+    case GAPIL_REPLAY_ASM_INST_LOAD: {
+      gapil_replay_asm_load inst;
+      memcpy(&inst, data, sizeof(inst));
+      DEBUG_PRINT_INST(
+          "GAPIL_REPLAY_ASM_INST_LOAD(type: %s, src: " ASM_VAL_FMT ")",
+          asm_type_str(inst.data_type), ASM_VAL_ARGS(inst.source));
+      load(remap(inst.source), inst.data_type);
+      break;
+    }
+    case GAPIL_REPLAY_ASM_INST_STORE: {
+      gapil_replay_asm_store inst;
+      memcpy(&inst, data, sizeof(inst));
+      DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_STORE(dst: " ASM_VAL_FMT ")",
+                       ASM_VAL_ARGS(inst.dst));
+      store(remap(inst.dst));
+      break;
+    }
+    case GAPIL_REPLAY_ASM_INST_STRCPY: {
+      gapil_replay_asm_strcpy inst;
+      memcpy(&inst, data, sizeof(inst));
+      DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_STRCPY(max_count: %" PRIu64
+                       ")",
+                       inst.max_count);
+      CX(Opcode::STRCPY, inst.max_count);
+      break;
+    }
+    case GAPIL_REPLAY_ASM_INST_RESOURCE: {
+      gapil_replay_asm_resource inst;
+      memcpy(&inst, data, sizeof(inst));
+      DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_RESOURCE(index: %" PRIu32
+                       ", dst: " ASM_VAL_FMT ")",
+                       inst.index, ASM_VAL_ARGS(inst.dest));
+      push(remap(inst.dest));
+      CX(Opcode::RESOURCE, inst.index);
+      break;
+    }
+    case GAPIL_REPLAY_ASM_INST_POST: {
+      gapil_replay_asm_post inst;
+      memcpy(&inst, data, sizeof(inst));
+      DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_POST(src: " ASM_VAL_FMT
+                       ", size: 0x%" PRIx64 ")",
+                       ASM_VAL_ARGS(inst.source), inst.size);
+      push(remap(inst.source));
+      C(Opcode::POST);
+      break;
+    }
+    case GAPIL_REPLAY_ASM_INST_ADD: {
+      gapil_replay_asm_add inst;
+      memcpy(&inst, data, sizeof(inst));
+      DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_ADD(count: %" PRIu32 ")",
+                       inst.count);
+      CX(Opcode::RESOURCE, inst.count);
+      break;
+    }
+    case GAPIL_REPLAY_ASM_INST_LABEL: {
+      gapil_replay_asm_label inst;
+      memcpy(&inst, data, sizeof(inst));
+      DEBUG_PRINT_INST("GAPIL_REPLAY_ASM_INST_LABEL(count: %" PRIu32 ")",
+                       inst.value);
+      CX(Opcode::LABEL, inst.value);
+      break;
+    }
+    case GAPIL_REPLAY_ASM_INST_SWITCHTHREAD: {
+      gapil_replay_asm_switchthread inst;
+      memcpy(&inst, data, sizeof(inst));
+      DEBUG_PRINT_INST(
+          "GAPIL_REPLAY_ASM_INST_SWITCHTHREAD(index: %" PRIu32 ")", inst.index);
+      CX(Opcode::SWITCH_THREAD, inst.index);
+      break;
+    }
+  }
+}
+
+void Encoder::push(gapil_replay_asm_value val) {
+  if (defer(val)) {
+    deferred(DEFERRED_PUSH, val, 0);
+    return;
+  }
   auto v = val.data;
   auto t = val.data_type;
   switch (t) {
@@ -534,7 +1079,11 @@ void Builder::push(gapil_replay_asm_value val) {
   }
 }
 
-void Builder::load(gapil_replay_asm_value val, gapil_replay_asm_type ty) {
+void Encoder::load(gapil_replay_asm_value val, gapil_replay_asm_type ty) {
+  if (defer(val)) {
+    deferred(DEFERRED_LOAD, val, ty);
+    return;
+  }
   if ((val.data & ~mask20) == 0) {
     switch (val.data_type) {
       case GAPIL_REPLAY_ASM_TYPE_CONSTANT_POINTER:
@@ -551,7 +1100,11 @@ void Builder::load(gapil_replay_asm_value val, gapil_replay_asm_type ty) {
   CX(Opcode::LOAD, ty);
 }
 
-void Builder::store(gapil_replay_asm_value dst) {
+void Encoder::store(gapil_replay_asm_value dst) {
+  if (defer(dst)) {
+    deferred(DEFERRED_STORE, dst, 0);
+    return;
+  }
   if ((dst.data & ~mask20) == 0 &&
       dst.data_type == GAPIL_REPLAY_ASM_TYPE_VOLATILE_POINTER) {
     CX(Opcode::STORE_V, dst.data);
@@ -563,9 +1116,51 @@ void Builder::store(gapil_replay_asm_value dst) {
 
 }  // anonymous namespace
 
+void gapil_replay_emit(context* ctx, gapil_replay_data* data, uint8_t ty,
+                       void* inst) {
+  auto& stream = data->stream;
+#if ENABLE_DEBUG_INST
+  // Record the instruction, so that it is printed when it is encoded.
+  gapil_append_buffer(&stream, &ty, sizeof(ty));
+  gapil_append_buffer(&stream, inst, inst_size(ty));
+#else
+  uint64_t max_size = static_cast<uint64_t>(stream.size) +
+                      Encoder::kMaxWordsPerInst * sizeof(uint32_t);
+  if (max_size > stream.capacity) {
+    // The size and capacity of a buffer are 32-bit. Grow up to that limit
+    // rather than letting the doubled capacity wrap around.
+    const uint64_t limit = UINT32_MAX;
+    if (max_size > limit) {
+      GAPID_FATAL("Replay instruction stream exceeds %" PRIu64 " bytes",
+                  limit);
+    }
+    uint64_t capacity = std::max<uint64_t>(
+        max_size, static_cast<uint64_t>(stream.capacity) * 2);
+    auto arena = reinterpret_cast<core::Arena*>(stream.arena);
+    stream.capacity = static_cast<uint32_t>(std::min(capacity, limit));
+    stream.alignment = std::max<uint32_t>(stream.alignment, sizeof(uint32_t));
+    stream.data = static_cast<uint8_t*>(
+        arena->reallocate(stream.data, stream.capacity, stream.alignment));
+  }
+  auto out = reinterpret_cast<uint32_t*>(stream.data + stream.size);
+  Encoder encoder(nullptr, out);
+  encoder.encode(ty, inst);
+  stream.size += (encoder.out() - out) * sizeof(uint32_t);
+#endif
+}
+
 void gapil_replay_build(context* ctx, gapil_replay_data* data) {
-  Builder builder(ctx->arena, data);
+  gapil_replay_build_with_threads(ctx, data, 0);
+}
+
+void gapil_replay_build_with_threads(context* ctx, gapil_replay_data* data,
+                                     uint32_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = std::thread::hardware_concurrency();
+  }
+  Builder builder(ctx->arena, data, num_threads);
   builder.layout_volatile_memory();
+  builder.layout_constants();
   builder.generate_opcodes();
   builder.build_resources();
 }
\ No newline at end of file
@@ -16,7 +16,7 @@
 #define __GAPIL_RUNTIME_REPLAY_DATAEX_H__
 
 #include "core/cc/id.h"
-#include "core/cc/interval_list.h"
+#include "core/cc/interval_btree.h"
 
 #include <unordered_map>
 #include <vector>
@@ -59,7 +59,11 @@ class MemoryRange : public core::Interval<uint64_t> {
   uint32_t mAlignment;
 };
 
-typedef core::CustomIntervalList<MemoryRange> MemoryRanges;
+// The reserved ranges of a large capture are many, and are not reserved in
+// address order, so they are held in a B-tree.
+typedef core::CustomIntervalList<MemoryRange,
+                                 core::BTreeIntervalStorage<MemoryRange> >
+    MemoryRanges;
 
 struct DataEx {
   typedef uint32_t Namespace;
@@ -73,11 +77,20 @@ struct DataEx {
     uint32_t size;
   };
 
+  // Constant is a constant added by gapil_replay_add_constant, which is laid
+  // out by gapil_replay_build.
+  struct Constant {
+    uint64_t offset;  // offset of the data in constant_data.
+    uint32_t size;
+    uint32_t alignment;
+  };
+
   StackAllocator<VolatileAddr> allocated;
   std::unordered_map<Namespace, MemoryRanges> reserved;
   std::unordered_map<core::Id, ResourceInfo> resources;
   std::unordered_map<RemapKey, VolatileAddr> remappings;
-  std::unordered_map<core::Id, uint32_t> constant_offsets;
+  std::vector<Constant> constants;
+  std::vector<uint8_t> constant_data;
 };
 
 }  // namespace replay
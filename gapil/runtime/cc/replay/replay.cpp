@@ -119,38 +119,16 @@ uint32_t gapil_replay_add_constant(context* ctx, gapil_replay_data* data,
               size);
   auto ex = reinterpret_cast<DataEx*>(data->data_ex);
 
-  // TODO: Remove. This is only here to match old implementation.
-  alignment = std::max(alignment, data->pointer_alignment);
-
-  // try to find an existing constant in the constants buffer.
-  auto id = core::Id::Hash(buf, size);
-  auto it = ex->constant_offsets.find(id);
-  if (it != ex->constant_offsets.end()) {
-    return it->second;
-  }
-
-  auto& consts = data->constants;
-
-  // grow the constants buffer to fit the data with the specified alignment.
-  auto offset = align<size_t>(consts.size, alignment);
-  auto new_size = offset + size;
-  if (new_size > consts.capacity) {
-    auto arena = reinterpret_cast<core::Arena*>(consts.arena);
-    consts.capacity = std::max<uint32_t>(new_size, consts.capacity * 2);
-    consts.data = (uint8_t*)arena->reallocate(consts.data, consts.capacity,
-                                              consts.alignment);
-  }
-  // clear the alignment padding to 0
-  memset(consts.data + consts.size, 0, offset - consts.size);
-  consts.size = new_size;
-
-  // append the data.
-  memcpy(consts.data + offset, buf, size);
-
-  // add the id to the constants_offsets map so that this data can be shared.
-  ex->constant_offsets[id] = offset;
-
-  return offset;
+  // The constants are hashed, deduplicated and laid out by the builder, which
+  // can do it in parallel.
+  DataEx::Constant constant;
+  constant.offset = ex->constant_data.size();
+  constant.size = size;
+  constant.alignment = std::max(alignment, 1u);
+  auto bytes = reinterpret_cast<const uint8_t*>(buf);
+  ex->constant_data.insert(ex->constant_data.end(), bytes, bytes + size);
+  ex->constants.push_back(constant);
+  return ex->constants.size() - 1;
 }
 
 gapil_replay_remap_func* gapil_replay_get_remap_func(char* api, char* type) {
@@ -27,7 +27,8 @@ typedef struct gapil_replay_resource_info {
 } gapil_replay_resource_info_t;
 
 typedef struct gapil_replay_data_t {
-  // instructions currently being built, or opcodes post build.
+  // opcodes of the instructions currently being built, some of which are
+  // not remapped yet, or opcodes post build.
   buffer stream;
 
   // buffer of gapil_replay_resource_info representing all the resources used by
@@ -52,9 +53,16 @@ typedef struct gapil_replay_data_t {
 // Runtime API implemented in replay.cpp                                      //
 ////////////////////////////////////////////////////////////////////////////////
 
-// TODO
+// gapil_replay_build lays out the memory and the constants of the replay, and
+// encodes its instructions into opcodes, using a thread per hardware thread.
 void gapil_replay_build(context* ctx, gapil_replay_data* data);
 
+// gapil_replay_build_with_threads is gapil_replay_build using up to
+// num_threads threads, or a thread per hardware thread if num_threads is 0.
+// The built replay does not depend on the number of threads.
+void gapil_replay_build_with_threads(context* ctx, gapil_replay_data* data,
+                                     uint32_t num_threads);
+
 // gapil_replay_remap_func is a function that can be used to return a remapping
 // key for the given remapped value at ptr.
 typedef uint64_t gapil_replay_remap_func(context* ctx, void* ptr);
@@ -102,7 +110,8 @@ DECL_GAPIL_REPLAY_FUNC(uint32_t, gapil_replay_add_resource, context* ctx,
                        gapil_replay_data* data, slice* slice);
 
 // gapil_replay_add_constant adds data to the constants buffer, returning the
-// address of the constant in the constant address space.
+// index of the constant. The index is replaced by the address of the constant
+// in the constant address space by gapil_replay_build.
 // Constants are deduplicated.
 DECL_GAPIL_REPLAY_FUNC(uint32_t, gapil_replay_add_constant, context* ctx,
                        gapil_replay_data* data, void* buf, uint32_t size,
@@ -118,6 +127,13 @@ DECL_GAPIL_REPLAY_FUNC(gapil_replay_remap_func*, gapil_replay_get_remap_func,
 DECL_GAPIL_REPLAY_FUNC(void, gapil_replay_add_remapping, context* ctx,
                        gapil_replay_data* data, uint64_t addr, uint64_t key);
 
+// gapil_replay_emit is called to emit the instruction inst of type ty, one of
+// gapil_replay_asm_inst, to the replay stream. The instruction is encoded
+// into opcodes as it is emitted, apart from the values that are remapped by
+// gapil_replay_build.
+DECL_GAPIL_REPLAY_FUNC(void, gapil_replay_emit, context* ctx,
+                       gapil_replay_data* data, uint8_t ty, void* inst);
+
 // gapil_replay_lookup_remapping is called to lookup a remapped value address
 // that was previously registered with gapil_replay_add_remapping. Returns the
 // volatile address if the key is found, otherwise ~0.
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Synthetic benchmark of gapil_replay_build. The instructions of a frame of
+// draw calls are emitted, as the compiled commands do: each draw reserves
+// memory, adds constants, some of which overlap, and pushes, loads and
+// stores values and observed pointers before the call. The replay is then
+// built with different numbers of threads, and the built replays are checked
+// to be identical to the replay built with a single thread.
+
+#include "asm.h"
+#include "dataex.h"
+#include "replay.h"
+
+#include "core/cc/timer.h"
+#include "core/memory/arena/cc/arena.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+namespace {
+
+const uint64_t kBaseAddress = 0x100000000;
+
+struct Replay {
+  std::vector<uint8_t> opcodes;
+  std::vector<uint8_t> constants;
+  double record;    // ms to record the instructions.
+  double build;     // ms to build.
+  uint64_t stream;  // bytes of the stream before the build.
+};
+
+template <typename T>
+void append(context* ctx, gapil_replay_data* data, gapil_replay_asm_inst ty,
+            T inst) {
+  gapil_replay_emit(ctx, data, ty, &inst);
+}
+
+gapil_replay_asm_value value(uint64_t data, gapil_replay_asm_type ty) {
+  return gapil_replay_asm_value{data, ty};
+}
+
+// record records the instructions of draws draw calls.
+void record(context* ctx, gapil_replay_data* data, int draws) {
+  std::mt19937_64 rng(1234);
+  const auto observed = GAPIL_REPLAY_ASM_TYPE_OBSERVED_POINTER_NAMESPACE_0;
+  for (int draw = 0; draw < draws; draw++) {
+    // The descriptors and buffers used by the draw.
+    uint64_t addrs[4];
+    for (auto& addr : addrs) {
+      addr = kBaseAddress + (rng() % (draws * 16)) * 256;
+      slice sli = {nullptr, addr, addr, 64 + rng() % 192, 1};
+      gapil_replay_reserve_memory(ctx, data, &sli, 0, 8);
+    }
+
+    // A few constant arrays, half of which are shared between draws, either
+    // whole or in part.
+    uint32_t constants[4];
+    for (auto& c : constants) {
+      uint64_t words[16];
+      auto seed = rng() % 2 == 0 ? rng() % 64 : rng();
+      for (size_t i = 0; i < 16; i++) {
+        words[i] = seed * 16 + i;
+      }
+      auto first = rng() % 4;
+      auto count = 1 + rng() % (16 - first);
+      c = gapil_replay_add_constant(ctx, data, words + first, count * 8, 8);
+    }
+
+    for (int i = 0; i < 16; i++) {
+      gapil_replay_asm_push push;
+      auto v = rng();
+      switch (i % 4) {
+        case 0:
+          push.value = value(v & 0xffff, GAPIL_REPLAY_ASM_TYPE_UINT32);
+          break;
+        case 1:
+          push.value = value(v, GAPIL_REPLAY_ASM_TYPE_INT64);
+          break;
+        case 2:
+          push.value = value(addrs[v % 4] + v % 64, observed);
+          break;
+        case 3:
+          push.value = value(constants[v % 4],
+                             GAPIL_REPLAY_ASM_TYPE_CONSTANT_POINTER);
+          break;
+      }
+      append(ctx, data, GAPIL_REPLAY_ASM_INST_PUSH, push);
+    }
+
+    gapil_replay_asm_load load;
+    load.data_type = GAPIL_REPLAY_ASM_TYPE_UINT32;
+    load.source = value(constants[0], GAPIL_REPLAY_ASM_TYPE_CONSTANT_POINTER);
+    append(ctx, data, GAPIL_REPLAY_ASM_INST_LOAD, load);
+
+    gapil_replay_asm_store store;
+    store.dst = value(addrs[0], observed);
+    append(ctx, data, GAPIL_REPLAY_ASM_INST_STORE, store);
+
+    gapil_replay_asm_call call;
+    call.push_return = false;
+    call.api_index = 1;
+    call.function_id = draw % 300;
+    append(ctx, data, GAPIL_REPLAY_ASM_INST_CALL, call);
+  }
+}
+
+Replay build(int draws, uint32_t threads) {
+  core::Arena arena;
+  context ctx = {};
+  ctx.arena = reinterpret_cast<::arena*>(&arena);
+  gapil_replay_data data = {};
+  gapil_replay_init_data(&ctx, &data);
+  gapil_create_buffer(ctx.arena, 1024, 16, &data.stream);
+  data.pointer_alignment = 8;
+
+  Replay out;
+  uint64_t start = core::GetNanoseconds();
+  record(&ctx, &data, draws);
+  out.record = double(core::GetNanoseconds() - start) / 1e6;
+  out.stream = data.stream.size;
+
+  start = core::GetNanoseconds();
+  gapil_replay_build_with_threads(&ctx, &data, threads);
+  out.build = double(core::GetNanoseconds() - start) / 1e6;
+  out.opcodes.assign(data.stream.data, data.stream.data + data.stream.size);
+  out.constants.assign(data.constants.data,
+                       data.constants.data + data.constants.size);
+
+  gapil_destroy_buffer(&data.stream);
+  gapil_replay_term_data(&ctx, &data);
+  return out;
+}
+
+}  // anonymous namespace
+
+int main() {
+  printf("%8s %8s %12s %12s %10s %12s %10s %10s\n", "draws", "threads",
+         "opcodes", "constants", "stream KB", "record ms", "build ms",
+         "identical");
+  for (int draws : {1000, 10000, 100000}) {
+    Replay serial = build(draws, 1);
+    printf("%8d %8d %12zu %12zu %10.1f %12.2f %10.2f %10s\n", draws, 1,
+           serial.opcodes.size() / 4, serial.constants.size(),
+           serial.stream / 1024.0, serial.record, serial.build, "-");
+    for (uint32_t threads : {2, 4, 8}) {
+      Replay r = build(draws, threads);
+      bool identical =
+          r.opcodes == serial.opcodes && r.constants == serial.constants;
+      printf("%8d %8u %12zu %12zu %10.1f %12.2f %10.2f %10s\n", draws,
+             threads, r.opcodes.size() / 4, r.constants.size(),
+             r.stream / 1024.0, r.record, r.build, identical ? "yes" : "NO");
+    }
+  }
+  return 0;
+}
@@ -31,6 +31,10 @@
 #include <inttypes.h>
 
 #include <cstring>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
 
 #if 0
 #define DEBUG_PRINT(...) GAPID_DEBUG(__VA_ARGS__)
@@ -48,6 +52,206 @@ namespace {
 
 gapil_runtime_callbacks runtime_callbacks = {0};
 
+const uint64_t kChunkSize = GAPIL_POOL_CHUNK_SIZE;
+
+// Chunk is a reference-counted chunk of the data of a chunked pool. The data
+// is allocated separately, so that it fills an arena block.
+struct Chunk {
+  uint32_t ref_count;  // number of pool chunk slots referencing the chunk.
+  Arena* arena;        // arena that owns the chunk.
+  uint8_t* data;       // kChunkSize bytes.
+};
+
+inline Chunk** chunks_of(pool* p) { return static_cast<Chunk**>(p->chunks); }
+
+inline uint64_t num_chunks(pool* p) {
+  return (p->size + kChunkSize - 1) / kChunkSize;
+}
+
+Chunk* new_chunk(Arena* arena) {
+  auto chunk = arena->create<Chunk>();
+  chunk->ref_count = 1;
+  chunk->arena = arena;
+  chunk->data = static_cast<uint8_t*>(arena->allocate(kChunkSize, 16));
+  return chunk;
+}
+
+void reference_chunk(Chunk* chunk) {
+  if (chunk != nullptr) {
+    __atomic_fetch_add(&chunk->ref_count, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void release_chunk(Chunk* chunk) {
+  if (chunk != nullptr &&
+      __atomic_sub_fetch(&chunk->ref_count, 1, __ATOMIC_ACQ_REL) == 0) {
+    chunk->arena->free(chunk->data);
+    chunk->arena->destroy(chunk);
+  }
+}
+
+// The data of the chunks that were never written.
+alignas(16) const uint8_t kZeroChunk[kChunkSize] = {};
+
+// Scratch is the header of a scratch buffer, which holds a copy of a range of
+// a chunked pool that spans several chunks. The scratch buffers of a pool are
+// listed from pool->scratch, and the data follows the header.
+struct Scratch {
+  Scratch* next;
+  uint64_t offset;
+  uint64_t size;
+};
+
+const uint64_t kScratchHeaderSize = 32;
+static_assert(sizeof(Scratch) <= kScratchHeaderSize,
+              "Scratch does not fit its header");
+
+// Frees the scratch buffers of the pool. The list is detached atomically, as
+// other threads may push to it, but the pool must not be read concurrently:
+// the data read from the scratch buffers would be freed.
+void free_scratch(pool* p) {
+  auto scratch = static_cast<Scratch*>(
+      __atomic_exchange_n(reinterpret_cast<Scratch**>(&p->scratch), nullptr,
+                          __ATOMIC_ACQUIRE));
+  Arena* arena = reinterpret_cast<Arena*>(p->arena);
+  while (scratch != nullptr) {
+    auto next = scratch->next;
+    arena->free(scratch);
+    scratch = next;
+  }
+}
+
+// Returns a scratch buffer holding a copy of the size bytes of the chunked
+// pool starting at offset. The scratch buffer of the same range is reused, so
+// that begin() and end() of a slice point into the same buffer. Several threads
+// may gather data of the same pool at once: the buffers are pushed to the list
+// atomically, and are not modified once pushed.
+uint8_t* gather(pool* p, uint64_t offset, uint64_t size) {
+  auto head = static_cast<Scratch*>(
+      __atomic_load_n(reinterpret_cast<Scratch**>(&p->scratch),
+                      __ATOMIC_ACQUIRE));
+  for (auto s = head; s != nullptr; s = s->next) {
+    if (s->offset == offset && s->size == size) {
+      return reinterpret_cast<uint8_t*>(s) + kScratchHeaderSize;
+    }
+  }
+
+  DEBUG_PRINT("gather(pool: %p, offset: 0x%" PRIx64 ", size: 0x%" PRIx64 ")",
+              p, offset, size);
+  Arena* arena = reinterpret_cast<Arena*>(p->arena);
+  auto scratch = static_cast<Scratch*>(
+      arena->allocate(kScratchHeaderSize + size, 16));
+  scratch->offset = offset;
+  scratch->size = size;
+  auto data = reinterpret_cast<uint8_t*>(scratch) + kScratchHeaderSize;
+  auto chunks = chunks_of(p);
+  for (uint64_t done = 0; done < size;) {
+    auto at = offset + done;
+    auto n = std::min(size - done, kChunkSize - at % kChunkSize);
+    auto chunk = chunks[at / kChunkSize];
+    if (chunk != nullptr) {
+      memcpy(data + done, chunk->data + at % kChunkSize, n);
+    } else {
+      memset(data + done, 0, n);
+    }
+    done += n;
+  }
+
+  do {
+    scratch->next = head;
+  } while (!__atomic_compare_exchange_n(
+      reinterpret_cast<Scratch**>(&p->scratch), &head, scratch, true,
+      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  return data;
+}
+
+// Replaces the chunks of the pool by a single buffer.
+void flatten_pool(pool* p) {
+  DEBUG_PRINT("flatten_pool(pool: %p)", p);
+  Arena* arena = reinterpret_cast<Arena*>(p->arena);
+  auto buffer = static_cast<uint8_t*>(arena->allocate(p->size, 16));
+  auto chunks = chunks_of(p);
+  for (uint64_t i = 0, n = num_chunks(p); i < n; i++) {
+    auto offset = i * kChunkSize;
+    auto size = std::min(kChunkSize, p->size - offset);
+    if (chunks[i] != nullptr) {
+      memcpy(buffer + offset, chunks[i]->data, size);
+      release_chunk(chunks[i]);
+    } else {
+      memset(buffer + offset, 0, size);
+    }
+  }
+  arena->free(chunks);
+  p->chunks = nullptr;
+  p->buffer = buffer;
+}
+
+// Returns a pointer to the size bytes of the slice's data.
+void* slice_data(context* ctx, slice* sli, uint64_t size,
+                 gapil_data_access access) {
+  if (sli->pool != nullptr) {
+    return gapil_pool_data(sli->pool, sli->base, size, access);
+  }
+  uint64_t bufSize = 0;
+  auto ptr = gapil_resolve_pool_data(ctx, nullptr, sli->base, access, &bufSize);
+  GAPID_ASSERT_MSG(size <= bufSize,
+                   "slice " SLICE_FMT " overflows underlying buffer",
+                   SLICE_ARGS(sli));
+  return ptr;
+}
+
+// The reference count of the interned strings. Compiled code counts the
+// references to the strings without synchronization, so the count is kept
+// far from zero.
+const uint32_t kInternedRefCount = 0x40000000;
+
+const int kInternShards = 16;
+
+// InternedString is the allocation of an interned string: the hash of the
+// data precedes the string, which is followed by its data.
+struct InternedString {
+  uint64_t hash;
+  string_t str;
+};
+
+// InternTable holds the interned strings. They are split in shards by hash, so
+// that the threads interning different strings seldom contend.
+struct InternTable {
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_multimap<uint64_t, string_t*> strings;  // by hash.
+  };
+
+  Arena* arena;
+  Shard shards[kInternShards];
+};
+
+// Returns the intern table, which is never destroyed, as the interned strings
+// may be referenced until the process exits. Its arena is constructed in
+// gapil_intern_arena_storage.
+InternTable* intern_table() {
+  static InternTable* table = [] {
+    auto table = new InternTable();
+    table->arena = new (gapil_intern_arena_storage) Arena();
+    return table;
+  }();
+  return table;
+}
+
+inline bool is_interned(string* str) {
+  return str->arena == reinterpret_cast<arena*>(gapil_intern_arena_storage);
+}
+
+// Returns the hash of the string data. This must match gapil/compiler/map.go.
+uint64_t hash_data(const void* data, uint64_t length) {
+  auto p = static_cast<const char*>(data);
+  uint64_t hash = 0;
+  for (uint64_t i = 0; i < length; i++) {
+    hash += (hash << 6) + (hash << 16) + p[i];
+  }
+  return hash;
+}
+
 }  // anonymous namespace
 
 extern "C" {
@@ -75,15 +279,16 @@ void gapil_logf(uint8_t severity, uint8_t* file, uint32_t line, uint8_t* fmt,
 void gapil_any_reference(gapil_any* a) {
   if (a != nullptr) {
     GAPID_ASSERT_MSG(a->ref_count > 0, "Attempting to reference released any");
-    a->ref_count++;
+    __atomic_add_fetch(&a->ref_count, 1, __ATOMIC_RELAXED);
   }
 }
 
 void gapil_any_release(gapil_any* a) {
   if (a != nullptr) {
     GAPID_ASSERT_MSG(a->ref_count > 0, "Attempting to reference released any");
-    a->ref_count--;
-    if (a->ref_count == 0) {
+    // The reference counts of anys, msgs and strings are updated atomically
+    // as they may be shared between commands that are traced concurrently.
+    if (__atomic_sub_fetch(&a->ref_count, 1, __ATOMIC_ACQ_REL) == 0) {
       if (a->rtti->release != nullptr) {
         a->rtti->release(a->value);
       }
@@ -95,15 +300,14 @@ void gapil_any_release(gapil_any* a) {
 void gapil_msg_reference(gapil_msg* m) {
   if (m != nullptr) {
     GAPID_ASSERT_MSG(m->ref_count > 0, "Attempting to reference released msg");
-    m->ref_count++;
+    __atomic_add_fetch(&m->ref_count, 1, __ATOMIC_RELAXED);
   }
 }
 
 void gapil_msg_release(gapil_msg* m) {
   if (m != nullptr) {
     GAPID_ASSERT_MSG(m->ref_count > 0, "Attempting to reference released msg");
-    m->ref_count--;
-    if (m->ref_count == 0) {
+    if (__atomic_sub_fetch(&m->ref_count, 1, __ATOMIC_ACQ_REL) == 0) {
       auto args = m->args;
       while (args->name != nullptr) {
         gapil_any_release(args->value);
@@ -177,18 +381,31 @@ void gapil_append_buffer(buffer* buf, const void* data, uint64_t size) {
 pool* gapil_make_pool(context* ctx, uint64_t size) {
   Arena* arena = reinterpret_cast<Arena*>(ctx->arena);
 
-  void* buffer = arena->allocate(size, 16);
-  memset(buffer, 0, size);
-
   auto pool = arena->create<pool_t>();
   pool->arena = ctx->arena;
-  pool->id = (*ctx->next_pool_id)++;
+  pool->id = __atomic_fetch_add(ctx->next_pool_id, 1, __ATOMIC_RELAXED);
   pool->size = size;
   pool->ref_count = 1;
-  pool->buffer = buffer;
+  pool->scratch = nullptr;
+
+  if (size > kChunkSize) {
+    // The chunks are allocated when they are first accessed. Until then, they
+    // are zero.
+    auto count = num_chunks(pool);
+    auto chunks = arena->allocate(count * sizeof(Chunk*), alignof(Chunk*));
+    memset(chunks, 0, count * sizeof(Chunk*));
+    pool->buffer = nullptr;
+    pool->chunks = chunks;
+  } else {
+    void* buffer = arena->allocate(size, 16);
+    memset(buffer, 0, size);
+    pool->buffer = buffer;
+    pool->chunks = nullptr;
+  }
 
-  DEBUG_PRINT("gapil_make_pool(size: 0x%" PRIx64 ") -> [pool: %p, buffer: %p]",
-              size, pool, buffer);
+  DEBUG_PRINT("gapil_make_pool(size: 0x%" PRIx64
+              ") -> [pool: %p, buffer: %p, chunks: %p]",
+              size, pool, pool->buffer, pool->chunks);
   return pool;
 }
 
@@ -201,19 +418,107 @@ void gapil_free_pool(pool* pool) {
   }
 
   Arena* arena = reinterpret_cast<Arena*>(pool->arena);
-  arena->free(pool->buffer);
+  free_scratch(pool);
+  if (pool->chunks != nullptr) {
+    auto chunks = chunks_of(pool);
+    for (uint64_t i = 0, n = num_chunks(pool); i < n; i++) {
+      release_chunk(chunks[i]);
+    }
+    arena->free(chunks);
+  } else {
+    arena->free(pool->buffer);
+  }
   arena->destroy(pool);
 }
 
-void* gapil_slice_data(context* ctx, slice* sli, gapil_data_access access) {
-  uint64_t bufSize = 0;
-  auto ptr =
-      gapil_resolve_pool_data(ctx, sli->pool, sli->base, access, &bufSize);
-  GAPID_ASSERT_MSG(sli->size <= bufSize,
-                   "gapil_slice_data(" SLICE_FMT
-                   ", %d) overflows underlying buffer",
-                   SLICE_ARGS(sli), access);
+void* gapil_pool_data(pool* pool, uint64_t offset, uint64_t size,
+                      gapil_data_access access) {
+  if (pool->chunks == nullptr) {
+    return static_cast<uint8_t*>(pool->buffer) + offset;
+  }
+
+  GAPID_ASSERT_MSG(offset + size <= pool->size,
+                   "gapil_pool_data(offset: 0x%" PRIx64 ", size: 0x%" PRIx64
+                   ") overflows pool of size 0x%" PRIx64,
+                   offset, size, pool->size);
+  if (size == 0) {
+    return nullptr;
+  }
+  bool write = (access & GAPIL_WRITE) != 0;
+  if (write) {
+    free_scratch(pool);
+  }
+  auto index = offset / kChunkSize;
+  if ((offset + size - 1) / kChunkSize != index) {
+    if (!write) {
+      return gather(pool, offset, size);
+    }
+    flatten_pool(pool);
+    return static_cast<uint8_t*>(pool->buffer) + offset;
+  }
+
+  auto& chunk = chunks_of(pool)[index];
+  if (chunk == nullptr) {
+    if (!write) {
+      return const_cast<uint8_t*>(kZeroChunk) + offset % kChunkSize;
+    }
+    chunk = new_chunk(reinterpret_cast<Arena*>(pool->arena));
+    memset(chunk->data, 0, kChunkSize);
+  } else if (write &&
+             __atomic_load_n(&chunk->ref_count, __ATOMIC_ACQUIRE) > 1) {
+    // The chunk is shared with another pool. Copy it before writing to it.
+    auto copy = new_chunk(reinterpret_cast<Arena*>(pool->arena));
+    memcpy(copy->data, chunk->data, kChunkSize);
+    release_chunk(chunk);
+    chunk = copy;
+  }
+  return chunk->data + offset % kChunkSize;
+}
+
+void gapil_copy_pool_data(pool* dst, uint64_t dst_offset, pool* src,
+                          uint64_t src_offset, uint64_t size) {
+  DEBUG_PRINT("gapil_copy_pool_data(dst: %p, dst_offset: 0x%" PRIx64
+              ", src: %p, src_offset: 0x%" PRIx64 ", size: 0x%" PRIx64 ")",
+              dst, dst_offset, src, src_offset, size);
+
+  if (size > 0) {
+    free_scratch(dst);
+  }
+  while (size > 0) {
+    auto n = size;
+    if (src->chunks != nullptr) {
+      n = std::min(n, kChunkSize - src_offset % kChunkSize);
+    }
+    if (dst->chunks != nullptr) {
+      n = std::min(n, kChunkSize - dst_offset % kChunkSize);
+    }
+
+    // Share the chunk of src if it replaces all the data of the chunk of dst.
+    bool whole = n == kChunkSize || dst_offset + n == dst->size;
+    if (src->chunks != nullptr && dst->chunks != nullptr &&
+        src_offset % kChunkSize == 0 && dst_offset % kChunkSize == 0 &&
+        whole) {
+      auto from = chunks_of(src)[src_offset / kChunkSize];
+      auto& to = chunks_of(dst)[dst_offset / kChunkSize];
+      if (from != to) {
+        reference_chunk(from);
+        release_chunk(to);
+        to = from;
+      }
+    } else {
+      auto from = gapil_pool_data(src, src_offset, n, GAPIL_READ);
+      auto to = gapil_pool_data(dst, dst_offset, n, GAPIL_WRITE);
+      memmove(to, from, n);
+    }
 
+    dst_offset += n;
+    src_offset += n;
+    size -= n;
+  }
+}
+
+void* gapil_slice_data(context* ctx, slice* sli, gapil_data_access access) {
+  auto ptr = slice_data(ctx, sli, sli->size, access);
   DEBUG_PRINT("gapil_slice_data(" SLICE_FMT ", %d) -> %p", SLICE_ARGS(sli),
               access, ptr);
   return ptr;
@@ -229,16 +534,13 @@ void gapil_copy_slice(context* ctx, slice* dst, slice* src) {
 
   uint64_t size = std::min(dst->size, src->size);
 
-  uint64_t dstBufLen = 0;
-  auto dstPtr = gapil_resolve_pool_data(ctx, dst->pool, dst->base, GAPIL_WRITE,
-                                        &dstBufLen);
-  GAPID_ASSERT_MSG(size <= dstBufLen, "gapil_copy_slice overflows dst buffer");
-
-  uint64_t srcBufLen = 0;
-  auto srcPtr = gapil_resolve_pool_data(ctx, src->pool, src->base, GAPIL_READ,
-                                        &srcBufLen);
-  GAPID_ASSERT_MSG(size <= srcBufLen, "gapil_copy_slice overflows src buffer");
+  if (dst->pool != nullptr && src->pool != nullptr) {
+    gapil_copy_pool_data(dst->pool, dst->base, src->pool, src->base, size);
+    return;
+  }
 
+  auto dstPtr = slice_data(ctx, dst, size, GAPIL_WRITE);
+  auto srcPtr = slice_data(ctx, src, size, GAPIL_READ);
   memcpy(dstPtr, srcPtr, size);
 }
 
@@ -270,6 +572,14 @@ void gapil_cstring_to_slice(context* ctx, uintptr_t ptr, slice* out) {
 }
 
 string* gapil_make_string(arena* a, uint64_t length, void* data) {
+  if (a == reinterpret_cast<arena*>(gapil_intern_arena_storage)) {
+    if (data == nullptr) {
+      std::vector<uint8_t> zeros(length);
+      return gapil_intern_string(length, zeros.data());
+    }
+    return gapil_intern_string(length, data);
+  }
+
   Arena* arena = reinterpret_cast<Arena*>(a);
 
   auto str = reinterpret_cast<string_t*>(
@@ -297,10 +607,60 @@ void gapil_free_string(string* str) {
               ", str: '%s' (%p))",
               str, str->ref_count, str->length, str->data, str->data);
 
+  if (is_interned(str)) {
+    return;
+  }
+
   Arena* arena = reinterpret_cast<Arena*>(str->arena);
   arena->free(str);
 }
 
+alignas(Arena) uint8_t gapil_intern_arena_storage[sizeof(Arena)];
+
+arena* gapil_intern_arena(void) {
+  return reinterpret_cast<arena*>(intern_table()->arena);
+}
+
+string* gapil_intern_string(uint64_t length, void* data) {
+  auto table = intern_table();
+  auto hash = hash_data(data, length);
+  auto& shard = table->shards[(hash ^ (hash >> 16)) % kInternShards];
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto range = shard.strings.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    auto str = it->second;
+    if (str->length == length && memcmp(str->data, data, length) == 0) {
+      return str;
+    }
+  }
+
+  auto interned = static_cast<InternedString*>(table->arena->allocate(
+      sizeof(InternedString) + length + 1, alignof(InternedString)));
+  interned->hash = hash;
+  auto str = &interned->str;
+  str->arena = gapil_intern_arena();
+  str->ref_count = kInternedRefCount;
+  str->length = length;
+  memcpy(str->data, data, length);
+  str->data[length] = 0;
+  shard.strings.emplace(hash, str);
+
+  DEBUG_PRINT("gapil_intern_string(length: %" PRIu64 ", data: '%s') -> %p",
+              length, str->data, str);
+  return str;
+}
+
+uint64_t gapil_string_hash(string* str) {
+  if (is_interned(str)) {
+    auto offset = offsetof(InternedString, str);
+    auto interned = reinterpret_cast<InternedString*>(
+        reinterpret_cast<uint8_t*>(str) - offset);
+    return interned->hash;
+  }
+  return hash_data(str->data, str->length);
+}
+
 string* gapil_slice_to_string(context* ctx, slice* sli) {
   DEBUG_PRINT("gapil_slice_to_string(" SLICE_FMT ")", SLICE_ARGS(sli));
   auto ptr = gapil_slice_data(ctx, sli, GAPIL_READ);
@@ -316,7 +676,8 @@ void gapil_string_to_slice(context* ctx, string* str, slice* out) {
 
   auto pool = gapil_make_pool(ctx, str->length);
 
-  memcpy(pool->buffer, str->data, str->length);
+  memcpy(gapil_pool_data(pool, 0, str->length, GAPIL_WRITE), str->data,
+         str->length);
 
   out->pool = pool;
   out->base = 0;
@@ -329,11 +690,11 @@ string* gapil_string_concat(string* a, string* b) {
   DEBUG_PRINT("gapil_string_concat(a: '%s', b: '%s')", a->data, b->data);
 
   if (a->length == 0) {
-    b->ref_count++;
+    __atomic_add_fetch(&b->ref_count, 1, __ATOMIC_RELAXED);
     return b;
   }
   if (b->length == 0) {
-    a->ref_count++;
+    __atomic_add_fetch(&a->ref_count, 1, __ATOMIC_RELAXED);
     return a;
   }
 
@@ -342,6 +703,13 @@ string* gapil_string_concat(string* a, string* b) {
   GAPID_ASSERT_MSG(b->arena != nullptr,
                    "string concat using string with no arena");
 
+  if (is_interned(a)) {
+    std::vector<uint8_t> data(a->length + b->length);
+    memcpy(data.data(), a->data, a->length);
+    memcpy(data.data() + a->length, b->data, b->length);
+    return gapil_intern_string(data.size(), data.data());
+  }
+
   auto str = gapil_make_string(a->arena, a->length + b->length, nullptr);
   memcpy(str->data, a->data, a->length);
   memcpy(str->data + a->length, b->data, b->length);
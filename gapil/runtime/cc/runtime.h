@@ -55,13 +55,26 @@ typedef struct context_t {
   // additional data used by compiler plugins goes here.
 } context;
 
+// The size in bytes of the chunks of a chunked pool.
+#define GAPIL_POOL_CHUNK_SIZE 65536
+
 // pool describes the underlying buffer that may be used by one or more slices.
+//
+// The data of the pools larger than a chunk is held in reference-counted
+// chunks of GAPIL_POOL_CHUNK_SIZE bytes, which are shared by the pools the
+// data is copied to until either pool writes to them. Chunks are not
+// contiguous, so the data of a chunked pool must be accessed with
+// gapil_pool_data. A chunked pool is flattened into a single buffer when a
+// range spanning several chunks is written, and the ranges spanning several
+// chunks that are only read are copied to scratch buffers.
 typedef struct pool_t {
   uint32_t ref_count;  // number of owners of this pool.
   uint32_t id;         // unique identifier of this pool.
   uint64_t size;       // total size of the pool in bytes.
   arena* arena;  // arena that owns the allocation of this pool and its buffer.
-  void* buffer;  // nullptr for application pool
+  void* buffer;  // nullptr for application pool, or for chunked pools.
+  void* chunks;  // the array of chunks of a chunked pool, or nullptr.
+  void* scratch;  // the copies of the ranges read across chunks, or nullptr.
 } pool;
 
 // slice is the data of a gapil slice type (elty foo[]).
@@ -303,6 +316,26 @@ DECL_GAPIL_CB(pool*, gapil_make_pool, context*, uint64_t size);
 // gapil_string_to_slice.
 DECL_GAPIL_CB(void, gapil_free_pool, pool*);
 
+// returns a pointer to the size bytes of the pool's data starting at offset.
+// If the pool is chunked and access includes GAPIL_WRITE, the chunk holding the
+// data is copied first if it is shared, and the pool is flattened if the data
+// spans several chunks. Otherwise, the data is only read: the chunks that were
+// never written are read from a shared chunk of zeros, and the data spanning
+// several chunks is copied to a scratch buffer, which stays valid until the
+// pool is next written to or freed.
+// Several threads may read the same pool at once. As writes may flatten the
+// pool or free its scratch buffers, a pool shared between threads, such as by
+// commands on different objects under per-object locking, must not be written
+// while another thread accesses it, as for the application data.
+DECL_GAPIL_CB(void*, gapil_pool_data, pool*, uint64_t offset, uint64_t size,
+              gapil_data_access);
+
+// copies size bytes of the pool src starting at src_offset to the pool dst
+// starting at dst_offset. The chunks that are entirely copied are shared
+// between the pools instead of being copied.
+DECL_GAPIL_CB(void, gapil_copy_pool_data, pool* dst, uint64_t dst_offset,
+              pool* src, uint64_t src_offset, uint64_t size);
+
 // returns a pointer to the underlying buffer data for the given slice,
 // using gapil_data_resolver if it has been set.
 DECL_GAPIL_CB(void*, gapil_slice_data, context*, slice*, gapil_data_access);
@@ -316,15 +349,39 @@ DECL_GAPIL_CB(void, gapil_string_to_slice, context*, string* string,
 
 // allocates a new string with the given data and length.
 // length excludes a null-pointer.
+// If arena is the arena returned by gapil_intern_arena, the string is
+// interned.
 DECL_GAPIL_CB(string*, gapil_make_string, arena*, uint64_t length, void* data);
 
+// returns the arena that owns the interned strings.
+//
+// Interned strings are unique for their data, in the whole process, so that
+// they can be compared by pointer, and cache the hash of their data. They are
+// never freed, and their reference count is kept high enough to never reach
+// zero, so they can be shared across threads.
+DECL_GAPIL_CB(arena*, gapil_intern_arena, void);
+
+// the storage of the arena returned by gapil_intern_arena. Its address is
+// constant, so that a string can be tested for being interned by comparing its
+// arena with it, without a call.
+extern uint8_t gapil_intern_arena_storage[];
+
+// returns the interned string with the given data and length, interning a
+// copy of the data if there is none yet. This may be called from multiple
+// threads at once.
+DECL_GAPIL_CB(string*, gapil_intern_string, uint64_t length, void* data);
+
+// returns the hash of the data of the string, as used by the maps keyed by
+// strings. The hash of interned strings is cached.
+DECL_GAPIL_CB(uint64_t, gapil_string_hash, string*);
+
 // outputs a slice spanning the bytes of the null-terminated string starting at
 // ptr. The slice includes the null-terminator byte.
 DECL_GAPIL_CB(void, gapil_cstring_to_slice, context*, uintptr_t ptr,
               slice* out);
 
 // frees a string allocated with gapil_make_string, gapil_string_concat or
-// gapil_slice_to_string.
+// gapil_slice_to_string. Interned strings are not freed.
 DECL_GAPIL_CB(void, gapil_free_string, string*);
 
 // allocates a new string filled with the data of slice.
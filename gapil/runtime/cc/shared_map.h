@@ -0,0 +1,401 @@
+// Copyright (C) 2020 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __GAPIL_RUNTIME_SHARED_MAP_H__
+#define __GAPIL_RUNTIME_SHARED_MAP_H__
+
+#include "maker.h"
+#include "runtime.h"
+
+namespace core {
+class Arena;
+}  // namespace core
+
+namespace gapil {
+
+// SharedMap is an associative container with the interface of Map, whose
+// clones share their elements until they are modified.
+//
+// The elements are held in a hash array mapped trie: each node of the trie
+// holds the elements and the child nodes for 5 bits of the hash of the keys,
+// and nodes are reference counted. clone() is O(1), as the clone shares the
+// root node. A modification copies the nodes on the path to the modified
+// element that are shared with another map, so taking a snapshot of a large
+// map only costs the nodes that are modified afterwards.
+//
+// Like Map, SharedMaps hold references to their data, and copies of a
+// SharedMap share the same underlying data. The data and the nodes are
+// allocated from the arena of the map.
+template <typename K, typename V>
+class SharedMap {
+ private:
+  struct Allocation;
+  struct Node;
+
+ public:
+  struct element {
+    K first;
+    V second;
+  };
+
+  using key_type = K;
+  using value_type = V;
+
+  class const_iterator {
+   public:
+    inline bool operator==(const const_iterator& other) const;
+
+    inline bool operator!=(const const_iterator& other) const;
+
+    inline const element& operator*() const;
+
+    inline const element* operator->() const;
+
+    inline const_iterator& operator++();
+
+    inline const_iterator operator++(int);
+
+   private:
+    friend class SharedMap<K, V>;
+
+    // The maximum depth of the trie: 13 levels consume the 64 bits of the
+    // hash, and the last level holds the elements with colliding hashes.
+    static const int kMaxDepth = 14;
+
+    struct Frame {
+      const Node* node;
+      uint32_t index;  // index of the current element of the node.
+      uint32_t child;  // index of the next child node to visit.
+    };
+
+    inline const_iterator();
+    inline explicit const_iterator(const Node* root);
+
+    // Moves to the next element, starting from the current frame.
+    inline void settle();
+
+    Frame stack[kMaxDepth];
+    int depth;
+  };
+
+  // Constructs a new empty map.
+  SharedMap(core::Arena*);
+
+  // Constructs a map which shares the data with other.
+  SharedMap(const SharedMap<K, V>& other);
+
+  SharedMap(SharedMap<K, V>&&);
+  ~SharedMap();
+
+  // Returns a copy of this map with the same elements, in O(1). The elements
+  // are shared with this map until either map is modified.
+  SharedMap<K, V> clone() const;
+
+  // Makes this map refer to the RHS map.
+  SharedMap<K, V>& operator=(const SharedMap<K, V>&);
+
+  // Returns the arena this map belongs to.
+  inline core::Arena* arena() const;
+
+  // Returns the number of elements currently held in the map.
+  inline uint64_t count() const;
+
+  // Returns true if the map has no elements.
+  inline bool empty() const;
+
+  // Returns true if the map contains the given key.
+  inline bool contains(const K&) const;
+
+  // Returns a constant iterator to the beginning.
+  inline const_iterator begin() const;
+
+  // Returns a constant iterator to the end.
+  inline const_iterator end() const;
+
+  // Removes the element with the given key from the map.
+  void erase(const K& k);
+
+  // Removes all the elements of the map.
+  void clear();
+
+  // Returns a reference to the element with the given key, creating and
+  // adding an element if one did not exist. The nodes on the path to the
+  // element are copied if they are shared with another map. The reference is
+  // invalidated by the next modification of the map.
+  template <typename T>
+  inline V& operator[](const T& key);
+
+  // Returns an iterator to an element with the given key.
+  // If no such element is found, the end iterator is returned.
+  const_iterator find(const K& k) const;
+
+  // finds a key in the map and returns the value. If no value is present
+  // Returns the zero for that type.
+  inline V findOrZero(const K& key) const;
+
+  // instance_ptr returns an opaque pointer to the underlying map data.
+  // This can be used for map equality.
+  inline const void* instance_ptr() const;
+
+ private:
+  // Node is the header of a trie node. It is followed by the elements of the
+  // node, and by the pointers to its child nodes.
+  struct Node {
+    uint32_t ref_count;  // number of parents and maps referencing the node.
+    uint32_t datamap;    // bitmask of the hash fragments of the elements.
+    uint32_t nodemap;    // bitmask of the hash fragments of the children.
+    uint32_t size;       // number of elements.
+
+    inline element* elements();
+    inline const element* elements() const;
+    inline Node** children();
+    inline Node* const* children() const;
+    inline uint32_t numChildren() const;
+
+    static inline size_t elementsOffset();
+    static inline size_t childrenOffset(uint32_t size);
+  };
+
+  struct Allocation {
+    uint32_t ref_count;  // number of owners of this map.
+    arena_t* arena;      // arena that owns this map allocation and its nodes.
+    uint64_t count;      // number of elements in the map.
+    Node* root;          // root node of the trie, or nullptr if empty.
+
+    void reference();
+    void release();
+
+    // Returns a pointer to the value of the key, inserting it if needed.
+    V* index(const K& key);
+    // Returns the element with the given key, or nullptr if there is none.
+    const element* find(const K& key) const;
+    // Removes the element with the given key, if any.
+    void remove(const K& key);
+
+    // The following methods return the node that replaces the node passed
+    // to them in its parent. The nodes passed to them must not be shared.
+
+    // Inserts the key at the given path of node, copying the shared nodes
+    // on the path. out is set to the value of the key.
+    Node* insert(Node* node, uint64_t hash, uint32_t shift, const K& key,
+                 V** out);
+    // Removes the key, which must be in the map, from the given path of node.
+    Node* erase(Node* node, uint64_t hash, uint32_t shift, const K& key);
+    // Returns a copy of node, that is not shared, if node is shared.
+    Node* unique(Node* node);
+    // Returns node with a new element for key at index idx.
+    Node* insertElement(Node* node, uint32_t bit, uint32_t idx, const K& key);
+    // Returns node without the element at index idx.
+    Node* removeElement(Node* node, uint32_t bit, uint32_t idx);
+    // Returns node with the element at index idx replaced by a child node
+    // holding both the element and a new element for key.
+    Node* pushDown(Node* node, uint32_t bit, uint32_t idx, uint64_t hash,
+                   uint32_t shift, const K& key, V** out);
+    // Returns node with the child node at index idx, which holds a single
+    // element, replaced by that element.
+    Node* inlineChild(Node* node, uint32_t bit, uint32_t idx);
+
+    // Returns a new node holding the element el, with hash elHash, and a new
+    // element for key.
+    Node* newPair(element* el, uint64_t elHash, uint64_t hash, uint32_t shift,
+                  const K& key, V** out);
+    Node* newNode(uint32_t datamap, uint32_t nodemap, uint32_t size);
+    void freeNode(Node* node);
+    void releaseNode(Node* node);
+    void newElement(element* el, const K& key);
+  };
+
+  Allocation* ptr;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// SharedMap<K, V>::const_iterator //
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename K, typename V>
+SharedMap<K, V>::const_iterator::const_iterator() : depth(0) {}
+
+template <typename K, typename V>
+SharedMap<K, V>::const_iterator::const_iterator(const Node* root) : depth(0) {
+  if (root != nullptr) {
+    stack[0] = Frame{root, 0, 0};
+    depth = 1;
+    settle();
+  }
+}
+
+template <typename K, typename V>
+void SharedMap<K, V>::const_iterator::settle() {
+  while (depth > 0) {
+    Frame& f = stack[depth - 1];
+    if (f.index < f.node->size) {
+      return;
+    }
+    if (f.child < f.node->numChildren()) {
+      stack[depth] = Frame{f.node->children()[f.child++], 0, 0};
+      depth++;
+    } else {
+      depth--;
+    }
+  }
+}
+
+template <typename K, typename V>
+bool SharedMap<K, V>::const_iterator::operator==(
+    const const_iterator& other) const {
+  if (depth != other.depth) {
+    return false;
+  }
+  return depth == 0 || (stack[depth - 1].node == other.stack[depth - 1].node &&
+                        stack[depth - 1].index == other.stack[depth - 1].index);
+}
+
+template <typename K, typename V>
+bool SharedMap<K, V>::const_iterator::operator!=(
+    const const_iterator& other) const {
+  return !(*this == other);
+}
+
+template <typename K, typename V>
+const typename SharedMap<K, V>::element&
+    SharedMap<K, V>::const_iterator::operator*() const {
+  const Frame& f = stack[depth - 1];
+  return f.node->elements()[f.index];
+}
+
+template <typename K, typename V>
+const typename SharedMap<K, V>::element*
+    SharedMap<K, V>::const_iterator::operator->() const {
+  return &**this;
+}
+
+template <typename K, typename V>
+typename SharedMap<K, V>::const_iterator&
+SharedMap<K, V>::const_iterator::operator++() {
+  stack[depth - 1].index++;
+  settle();
+  return *this;
+}
+
+template <typename K, typename V>
+typename SharedMap<K, V>::const_iterator
+SharedMap<K, V>::const_iterator::operator++(int) {
+  const_iterator ret = *this;
+  ++(*this);
+  return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SharedMap<K, V>::Node //
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename K, typename V>
+size_t SharedMap<K, V>::Node::elementsOffset() {
+  return (sizeof(Node) + alignof(element) - 1) & ~(alignof(element) - 1);
+}
+
+template <typename K, typename V>
+size_t SharedMap<K, V>::Node::childrenOffset(uint32_t size) {
+  size_t end = elementsOffset() + sizeof(element) * size;
+  return (end + alignof(Node*) - 1) & ~(alignof(Node*) - 1);
+}
+
+template <typename K, typename V>
+typename SharedMap<K, V>::element* SharedMap<K, V>::Node::elements() {
+  return reinterpret_cast<element*>(reinterpret_cast<uint8_t*>(this) +
+                                    elementsOffset());
+}
+
+template <typename K, typename V>
+const typename SharedMap<K, V>::element* SharedMap<K, V>::Node::elements()
+    const {
+  return reinterpret_cast<const element*>(
+      reinterpret_cast<const uint8_t*>(this) + elementsOffset());
+}
+
+template <typename K, typename V>
+typename SharedMap<K, V>::Node** SharedMap<K, V>::Node::children() {
+  return reinterpret_cast<Node**>(reinterpret_cast<uint8_t*>(this) +
+                                  childrenOffset(size));
+}
+
+template <typename K, typename V>
+typename SharedMap<K, V>::Node* const* SharedMap<K, V>::Node::children()
+    const {
+  return reinterpret_cast<Node* const*>(
+      reinterpret_cast<const uint8_t*>(this) + childrenOffset(size));
+}
+
+template <typename K, typename V>
+uint32_t SharedMap<K, V>::Node::numChildren() const {
+  return __builtin_popcount(nodemap);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SharedMap<K, V> //
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename K, typename V>
+core::Arena* SharedMap<K, V>::arena() const {
+  return reinterpret_cast<core::Arena*>(ptr->arena);
+}
+
+template <typename K, typename V>
+uint64_t SharedMap<K, V>::count() const {
+  return ptr->count;
+}
+
+template <typename K, typename V>
+bool SharedMap<K, V>::empty() const {
+  return ptr->count == 0;
+}
+
+template <typename K, typename V>
+bool SharedMap<K, V>::contains(const K& key) const {
+  return ptr->find(key) != nullptr;
+}
+
+template <typename K, typename V>
+typename SharedMap<K, V>::const_iterator SharedMap<K, V>::begin() const {
+  return const_iterator(ptr->root);
+}
+
+template <typename K, typename V>
+typename SharedMap<K, V>::const_iterator SharedMap<K, V>::end() const {
+  return const_iterator();
+}
+
+template <typename K, typename V>
+template <typename T>
+V& SharedMap<K, V>::operator[](const T& key) {
+  return *ptr->index(key);
+}
+
+template <typename K, typename V>
+V SharedMap<K, V>::findOrZero(const K& key) const {
+  const element* el = ptr->find(key);
+  if (el == nullptr) {
+    return make<V>(arena());
+  }
+  return el->second;
+}
+
+template <typename K, typename V>
+const void* SharedMap<K, V>::instance_ptr() const {
+  return ptr;
+}
+
+}  // namespace gapil
+
+#endif  // __GAPIL_RUNTIME_SHARED_MAP_H__
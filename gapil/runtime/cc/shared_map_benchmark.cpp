@@ -0,0 +1,103 @@
+// Copyright (C) 2020 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Synthetic benchmark of state snapshots. A map of about the size of the
+// object maps of a Vulkan state is snapshotted every frame, after a small
+// fraction of its elements have been modified. gapil::Map, which copies all
+// the elements on clone(), is compared against gapil::SharedMap, which shares
+// them. Lookups and inserts are also timed, as the trie is deeper than the
+// hash table.
+
+#include "map.inc"
+#include "shared_map.inc"
+
+#include "core/cc/timer.h"
+#include "core/memory/arena/cc/arena.h"
+
+#include <stdio.h>
+
+#include <random>
+#include <vector>
+
+namespace {
+
+const int kFrames = 10;
+
+double msSince(uint64_t start) {
+  return double(core::GetNanoseconds() - start) / 1e6;
+}
+
+template <typename M>
+void run(const char* name, size_t size, size_t updates) {
+  core::Arena arena;
+  std::mt19937_64 rng(1234);
+  std::vector<uint64_t> keys(size);
+  for (auto& k : keys) {
+    k = rng();
+  }
+
+  M map(&arena);
+  uint64_t start = core::GetNanoseconds();
+  for (size_t i = 0; i < size; i++) {
+    map[keys[i]] = i;
+  }
+  double insertMs = msSince(start);
+
+  uint64_t check = 0;
+  start = core::GetNanoseconds();
+  for (auto k : keys) {
+    check += map.findOrZero(k);
+  }
+  double lookupMs = msSince(start);
+
+  // Each frame modifies some elements, and snapshots the map. The snapshots
+  // are all kept alive, as a checkpointing replay would.
+  std::vector<M> snapshots;
+  double updateMs = 0;
+  double snapshotMs = 0;
+  for (int frame = 0; frame < kFrames; frame++) {
+    start = core::GetNanoseconds();
+    for (size_t i = 0; i < updates; i++) {
+      map[keys[rng() % size]] = frame;
+    }
+    updateMs += msSince(start);
+    start = core::GetNanoseconds();
+    snapshots.push_back(map.clone());
+    snapshotMs += msSince(start);
+  }
+  for (auto& s : snapshots) {
+    check += s.count();
+  }
+  size_t bytes = arena.num_bytes_allocated();
+  snapshots.clear();
+
+  printf("%-10s %8zu %8zu %10.2f %10.2f %10.3f %12.3f %10.1f   (%llu)\n",
+         name, size, updates, insertMs, lookupMs, updateMs / kFrames,
+         snapshotMs / kFrames, bytes / 1048576.0,
+         static_cast<unsigned long long>(check % 10));
+}
+
+}  // anonymous namespace
+
+int main() {
+  printf("%-10s %8s %8s %10s %10s %10s %12s %10s\n", "map", "size", "updates",
+         "insert ms", "lookup ms", "update ms", "snapshot ms", "MB");
+  for (size_t size : {10000, 1000000}) {
+    for (size_t updates : {size / 1000, size / 100}) {
+      run<gapil::Map<uint64_t, uint64_t, false>>("Map", size, updates);
+      run<gapil::SharedMap<uint64_t, uint64_t>>("SharedMap", size, updates);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,180 @@
+// Copyright (C) 2020 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "shared_map.inc"
+
+#include "string.h"
+
+#include "core/memory/arena/cc/arena.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+
+namespace {
+
+// colliding_key is a key type whose hashes all collide.
+struct colliding_key {
+  uint32_t v;
+  bool operator==(const colliding_key& other) const { return v == other.v; }
+};
+
+}  // anonymous namespace
+
+namespace gapil {
+
+template <>
+struct hash<colliding_key, void> {
+  uint64_t operator()(const colliding_key&) { return 42; }
+};
+
+}  // namespace gapil
+
+class SharedMapTest : public ::testing::Test {
+  void TearDown() {
+    EXPECT_EQ(0, arena.num_allocations());
+    EXPECT_EQ(0, arena.num_bytes_allocated());
+  }
+
+ public:
+  core::Arena arena;
+};
+
+TEST_F(SharedMapTest, basic_insert) {
+  auto map = gapil::SharedMap<uint32_t, uint32_t>(&arena);
+  EXPECT_TRUE(map.empty());
+
+  map[32] = 42;
+  EXPECT_EQ(1, map.count());
+
+  EXPECT_EQ(42, map.findOrZero(32));
+  EXPECT_EQ(0, map.findOrZero(42));
+  EXPECT_TRUE(map.contains(32));
+  EXPECT_FALSE(map.contains(42));
+
+  EXPECT_EQ(42, map[32]);
+  EXPECT_EQ(0, map[42]);
+  EXPECT_EQ(2, map.count());
+}
+
+TEST_F(SharedMapTest, matches_std_map) {
+  auto map = gapil::SharedMap<uint64_t, uint64_t>(&arena);
+  std::map<uint64_t, uint64_t> expected;
+  std::mt19937_64 rng(1234);
+
+  for (int i = 0; i < 20000; ++i) {
+    uint64_t key = rng() % 5000;
+    if (rng() % 3 == 0) {
+      map.erase(key);
+      expected.erase(key);
+    } else {
+      map[key] = i;
+      expected[key] = i;
+    }
+  }
+
+  EXPECT_EQ(expected.size(), map.count());
+  uint64_t count = 0;
+  for (auto& it : map) {
+    EXPECT_EQ(expected[it.first], it.second);
+    ++count;
+  }
+  EXPECT_EQ(expected.size(), count);
+  for (auto& it : expected) {
+    auto found = map.find(it.first);
+    ASSERT_TRUE(found != map.end());
+    EXPECT_EQ(it.second, found->second);
+  }
+}
+
+TEST_F(SharedMapTest, clone_is_independent) {
+  auto map = gapil::SharedMap<uint32_t, uint32_t>(&arena);
+  for (uint32_t i = 0; i < 1000; ++i) {
+    map[i] = i;
+  }
+
+  auto snapshot = map.clone();
+  EXPECT_NE(map.instance_ptr(), snapshot.instance_ptr());
+  EXPECT_EQ(1000, snapshot.count());
+
+  for (uint32_t i = 0; i < 1000; i += 2) {
+    map[i] = i + 1;
+  }
+  map.erase(1);
+  map[5000] = 5000;
+  snapshot[7] = 0;
+
+  EXPECT_EQ(1000, map.count());
+  EXPECT_EQ(1000, snapshot.count());
+  for (uint32_t i = 0; i < 1000; ++i) {
+    uint32_t expected = (i % 2 == 0) ? i + 1 : i;
+    if (i == 1) {
+      EXPECT_FALSE(map.contains(i));
+    } else if (i == 7) {
+      EXPECT_EQ(7, map.findOrZero(i));
+    } else {
+      EXPECT_EQ(expected, map.findOrZero(i));
+    }
+    EXPECT_EQ(i == 7 ? 0 : i, snapshot.findOrZero(i));
+  }
+  EXPECT_FALSE(snapshot.contains(5000));
+}
+
+TEST_F(SharedMapTest, copy_shares_data) {
+  auto map = gapil::SharedMap<uint32_t, uint32_t>(&arena);
+  auto copy = map;
+  map[1] = 2;
+  EXPECT_EQ(map.instance_ptr(), copy.instance_ptr());
+  EXPECT_EQ(2, copy.findOrZero(1));
+}
+
+TEST_F(SharedMapTest, colliding_hashes) {
+  auto map = gapil::SharedMap<colliding_key, uint32_t>(&arena);
+  for (uint32_t i = 0; i < 10; ++i) {
+    map[colliding_key{i}] = i;
+  }
+  auto snapshot = map.clone();
+  EXPECT_EQ(10, map.count());
+  for (uint32_t i = 0; i < 10; i += 2) {
+    map.erase(colliding_key{i});
+  }
+  EXPECT_EQ(5, map.count());
+  for (uint32_t i = 0; i < 10; ++i) {
+    EXPECT_EQ(i % 2 == 1, map.contains(colliding_key{i}));
+    EXPECT_EQ(i, snapshot.findOrZero(colliding_key{i}));
+  }
+  uint32_t sum = 0;
+  for (auto& it : map) {
+    sum += it.second;
+  }
+  EXPECT_EQ(1 + 3 + 5 + 7 + 9, sum);
+}
+
+TEST_F(SharedMapTest, string_as_value) {
+  auto map = gapil::SharedMap<uint32_t, gapil::String>(&arena);
+
+  map[1] = gapil::String(&arena, "one");
+  map[2] = gapil::String(&arena, "two");
+  auto snapshot = map.clone();
+  map[2] = gapil::String(&arena, "deux");
+  map.clear();
+  map[3] = gapil::String(&arena, "three");
+
+  EXPECT_EQ(1, map.count());
+  EXPECT_STREQ(map[3].c_str(), "three");
+  EXPECT_EQ(2, snapshot.count());
+  EXPECT_STREQ(snapshot[1].c_str(), "one");
+  EXPECT_STREQ(snapshot[2].c_str(), "two");
+}
@@ -18,6 +18,7 @@
 #include "runtime.h"
 
 #include <functional>
+#include <type_traits>
 
 namespace core {
 class Arena;
@@ -88,7 +89,8 @@ class Slice {
   inline T& operator[](uint64_t index) const;
 
   // Copies count elements starting at start into the dst Slice starting at
-  // dstStart.
+  // dstStart. The large chunks of the pool are shared with dst, rather than
+  // copied, until either slice writes to them.
   inline void copy(const Slice<T>& dst, uint64_t start, uint64_t count,
                    uint64_t dstStart) const;
 
@@ -98,11 +100,18 @@ class Slice {
   template <typename U>
   inline Slice<U> as() const;
 
-  // Support for range-based for looping
+  // Support for range-based for looping.
+  // The elements are only read through the returned pointers, so begin() does
+  // not copy the shared chunks of the pool. The elements must be written with
+  // operator[].
   inline T* begin() const;
   inline T* end() const;
 
  private:
+  // Returns a pointer to the first element of the slice, for the given access
+  // to all the elements.
+  inline T* ptr(gapil_data_access access) const;
+
   void init(pool_t* pool, uint64_t root, uint64_t base, uint64_t size,
             uint64_t count, bool add_ref = true);
 
@@ -0,0 +1,95 @@
+// Copyright (C) 2020 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Synthetic benchmark of the clones of large slices, as the observer makes of
+// the buffers and images read by commands. Each frame modifies a few bytes of
+// a large slice, and clones it. The clones of a chunked pool share its chunks,
+// and are compared against the clones of a flattened pool, whose data is
+// copied.
+
+#include "slice.inc"
+
+#include "core/cc/timer.h"
+#include "core/memory/arena/cc/arena.h"
+
+#include <stdio.h>
+
+#include <random>
+#include <vector>
+
+namespace {
+
+const int kFrames = 10;
+
+double msSince(uint64_t start) {
+  return double(core::GetNanoseconds() - start) / 1e6;
+}
+
+void run(uint64_t size, size_t updates, bool flatten) {
+  core::Arena arena;
+  context_t ctx;
+  ctx.arena = reinterpret_cast<arena_t*>(&arena);
+  ctx.next_pool_id = arena.create<uint32_t>(1);
+  std::mt19937_64 rng(1234);
+
+  auto sli = gapil::Slice<uint8_t>::create(&ctx, size);
+  for (uint64_t i = 0; i < size; i += 4096) {
+    sli[i] = i;
+  }
+  if (flatten) {
+    sli.begin();
+  }
+
+  // The clones are all kept alive, as the observations of the commands are.
+  std::vector<gapil::Slice<uint8_t>> clones;
+  double updateMs = 0;
+  double cloneMs = 0;
+  for (int frame = 0; frame < kFrames; frame++) {
+    uint64_t start = core::GetNanoseconds();
+    for (size_t i = 0; i < updates; i++) {
+      sli[rng() % size] = frame;
+    }
+    updateMs += msSince(start);
+    start = core::GetNanoseconds();
+    auto clone = gapil::Slice<uint8_t>::create(&ctx, size);
+    sli.copy(clone, 0, size, 0);
+    clones.push_back(clone);
+    cloneMs += msSince(start);
+  }
+
+  uint64_t check = 0;
+  for (auto& c : clones) {
+    check += c[rng() % size];
+  }
+  printf("%10.1f %-9s %8zu %10.3f %10.3f %12.1f %6d\n", size / 1048576.0,
+         flatten ? "flat" : "chunked", updates, updateMs / kFrames,
+         cloneMs / kFrames, arena.num_bytes_allocated() / 1048576.0,
+         int(check % 10));
+}
+
+}  // anonymous namespace
+
+int main() {
+  printf("%10s %-9s %8s %10s %10s %12s %6s\n", "size MB", "pool", "updates",
+         "update ms", "clone ms", "arena MB", "check");
+  for (uint64_t size : {1u << 20, 8u << 20, 32u << 20}) {
+    for (size_t updates : {1, 100}) {
+      for (bool flatten : {true, false}) {
+        run(size, updates, flatten);
+      }
+    }
+  }
+  return 0;
+}
@@ -18,6 +18,9 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+#include <vector>
+
 TEST(SliceTest, empty) {
   gapil::Slice<uint8_t> sli;
 
@@ -65,3 +68,189 @@ TEST(SliceTest, new_pool) {
 
   EXPECT_EQ(arena.num_allocations(), initial_allocs);  // nothing leaked
 }
+
+namespace {
+
+const uint64_t kChunk = GAPIL_POOL_CHUNK_SIZE;
+
+class ChunkedSliceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ctx.arena = reinterpret_cast<arena_t*>(&arena);
+    ctx.next_pool_id = arena.create<uint32_t>(1);
+    initial_allocs = arena.num_allocations();
+  }
+
+  void TearDown() override {
+    EXPECT_EQ(arena.num_allocations(), initial_allocs);  // nothing leaked
+  }
+
+  core::Arena arena;
+  context_t ctx;
+  size_t initial_allocs;
+};
+
+// Returns the byte at offset i of the slice's pool, without writing to it.
+uint8_t read(const gapil::Slice<uint8_t>& sli, uint64_t i) {
+  auto pool = const_cast<pool_t*>(sli.pool());
+  return *static_cast<uint8_t*>(gapil_pool_data(pool, i, 1, GAPIL_READ));
+}
+
+}  // anonymous namespace
+
+TEST_F(ChunkedSliceTest, copy_shares_chunks) {
+  auto a = gapil::Slice<uint8_t>::create(&ctx, 4 * kChunk);
+  auto b = gapil::Slice<uint8_t>::create(&ctx, 4 * kChunk);
+  for (uint64_t i = 0; i < 4; i++) {
+    a[i * kChunk] = i + 1;
+  }
+
+  auto allocs = arena.num_allocations();
+  a.copy(b, 0, 4 * kChunk, 0);
+  EXPECT_EQ(arena.num_allocations(), allocs);  // the chunks are shared
+  for (uint64_t i = 0; i < 4; i++) {
+    EXPECT_EQ(read(b, i * kChunk), i + 1);
+  }
+  EXPECT_EQ(arena.num_allocations(), allocs);  // reading does not copy
+
+  // Writing to a shared chunk copies it.
+  b[0] = 42;
+  EXPECT_GT(arena.num_allocations(), allocs);
+  allocs = arena.num_allocations();
+  EXPECT_EQ(a[0], 1);
+  EXPECT_EQ(b[0], 42);
+
+  a[kChunk + 1] = 43;
+  EXPECT_GT(arena.num_allocations(), allocs);
+  EXPECT_EQ(a[kChunk + 1], 43);
+  EXPECT_EQ(b[kChunk + 1], 0);
+  EXPECT_EQ(b[kChunk], 2);
+}
+
+TEST_F(ChunkedSliceTest, unaligned_copy) {
+  auto a = gapil::Slice<uint8_t>::create(&ctx, 3 * kChunk + 100);
+  auto b = gapil::Slice<uint8_t>::create(&ctx, 3 * kChunk + 100);
+  for (uint64_t i = 0; i < a.count(); i += 97) {
+    a[i] = i % 251 + 1;
+  }
+
+  // Copy a range that starts and ends within chunks, and is not aligned to
+  // the chunks of the destination.
+  const uint64_t start = 10, count = 2 * kChunk + 50, dstStart = 30;
+  a.copy(b, start, count, dstStart);
+  for (uint64_t i = 0; i < b.count(); i++) {
+    uint8_t expected = 0;
+    if (i >= dstStart && i < dstStart + count) {
+      auto j = i - dstStart + start;
+      expected = j % 97 == 0 ? j % 251 + 1 : 0;
+    }
+    ASSERT_EQ(b[i], expected) << "at " << i;
+  }
+
+  // Sharing the last, partial chunk.
+  auto allocs = arena.num_allocations();
+  a.copy(b, 3 * kChunk, 100, 3 * kChunk);
+  EXPECT_LT(arena.num_allocations(), allocs);  // b's chunk was released
+  EXPECT_EQ(b[3 * kChunk + 97], a[3 * kChunk + 97]);
+}
+
+TEST_F(ChunkedSliceTest, copy_to_unchunked) {
+  auto a = gapil::Slice<uint32_t>::create(&ctx, kChunk);
+  auto b = gapil::Slice<uint32_t>::create(&ctx, 100);
+  a[kChunk / 4 - 1] = 5;
+  a[kChunk / 4] = 6;
+  a.copy(b, kChunk / 4 - 1, 2, 0);
+  EXPECT_EQ(b[0], 5);
+  EXPECT_EQ(b[1], 6);
+  b.copy(a, 0, 2, 3);
+  EXPECT_EQ(a[3], 5);
+  EXPECT_EQ(a[4], 6);
+}
+
+TEST_F(ChunkedSliceTest, read_across_chunks) {
+  auto a = gapil::Slice<uint32_t>::create(&ctx, kChunk);
+  auto b = gapil::Slice<uint32_t>::create(&ctx, kChunk);
+  for (uint64_t i = 0; i < a.count(); i += 1000) {
+    a[i] = i;
+  }
+  a.copy(b, 0, a.count(), 0);
+
+  // Reading across the chunks copies the data to a scratch buffer, and
+  // leaves the pool chunked.
+  uint64_t sum = 0;
+  for (auto v : a) {
+    sum += v;
+  }
+  EXPECT_EQ(a.contains(16000), true);
+  EXPECT_EQ(a.contains(16001), false);
+  EXPECT_NE(a.pool()->chunks, nullptr);
+  EXPECT_NE(a.pool()->scratch, nullptr);
+
+  // Writing frees the scratch buffers, and only copies the chunk written to.
+  a[1000] = 7;
+  EXPECT_EQ(a.pool()->scratch, nullptr);
+  EXPECT_NE(a.pool()->chunks, nullptr);
+  EXPECT_EQ(b[1000], 1000);
+
+  uint64_t expected = 0;
+  for (uint64_t i = 0; i < b.count(); i++) {
+    expected += b[i];
+  }
+  EXPECT_EQ(sum, expected);
+}
+
+// Threads read the same ranges across the chunks of a shared pool at once.
+// Run under TSan to check the synchronization of the scratch buffers.
+TEST_F(ChunkedSliceTest, concurrent_reads_across_chunks) {
+  auto a = gapil::Slice<uint32_t>::create(&ctx, 4 * kChunk / 4);
+  for (uint64_t i = 0; i < a.count(); i++) {
+    a[i] = i;
+  }
+  const int kThreads = 4;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t] {
+      for (uint64_t i = 0; i < 64; i++) {
+        uint64_t start = (i * 997 + t) % (3 * kChunk / 4);
+        auto sub = a(start, start + kChunk / 4 + 1);
+        uint64_t expected = start;
+        for (auto v : sub) {
+          ASSERT_EQ(v, expected++);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_NE(a.pool()->chunks, nullptr);
+  a[0] = 1;
+  EXPECT_EQ(a.pool()->scratch, nullptr);
+}
+
+TEST_F(ChunkedSliceTest, read_unwritten_chunks) {
+  auto a = gapil::Slice<uint8_t>::create(&ctx, 4 * kChunk);
+  auto allocs = arena.num_allocations();
+  EXPECT_EQ(read(a, 0), 0);
+  EXPECT_EQ(read(a, 3 * kChunk + 5), 0);
+  EXPECT_EQ(arena.num_allocations(), allocs);  // the chunks are not allocated
+
+  for (auto v : a(kChunk - 10, 3 * kChunk)) {
+    ASSERT_EQ(v, 0);
+  }
+  a[2 * kChunk] = 3;
+  EXPECT_EQ(read(a, 2 * kChunk), 3);
+  EXPECT_EQ(read(a, 2 * kChunk + 1), 0);
+}
+
+TEST_F(ChunkedSliceTest, write_across_chunks) {
+  auto a = gapil::Slice<uint32_t>::create(&ctx, kChunk);
+  a[kChunk / 4 - 1] = 5;
+  auto pool = const_cast<pool_t*>(a.pool());
+  auto data = static_cast<uint32_t*>(
+      gapil_pool_data(pool, kChunk - 4, 8, GAPIL_WRITE));
+  EXPECT_EQ(a.pool()->chunks, nullptr);  // the pool is flattened
+  EXPECT_EQ(data[0], 5);
+  data[1] = 6;
+  EXPECT_EQ(a[kChunk / 4], 6);
+}
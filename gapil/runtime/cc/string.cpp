@@ -62,6 +62,12 @@ String::String(core::Arena* arena, const char* s, size_t len) {
 
 String::String(string_t* p) : ptr(p) {}
 
+String String::intern(const char* s) { return intern(s, strlen(s)); }
+
+String String::intern(const char* s, size_t len) {
+  return String(gapil_intern_string(len, const_cast<char*>(s)));
+}
+
 String::~String() {
   if (ptr != nullptr) {  // note: nullptr is only valid in the case of a move
     release();
@@ -86,11 +92,17 @@ String& String::operator+=(const String& other) {
 }
 
 bool String::operator==(const String& other) const {
+  if (ptr == other.ptr) {
+    return true;
+  }
+  if (is_interned() && other.is_interned()) {
+    return false;
+  }
   return gapil_string_compare(ptr, other.ptr) == 0;
 }
 
 bool String::operator!=(const String& other) const {
-  return gapil_string_compare(ptr, other.ptr) != 0;
+  return !(*this == other);
 }
 
 bool String::operator<(const String& other) const {
@@ -113,6 +125,13 @@ size_t String::length() const { return ptr->length; }
 
 const char* String::c_str() const { return reinterpret_cast<char*>(ptr->data); }
 
+String String::interned() const {
+  if (is_interned()) {
+    return *this;
+  }
+  return String(gapil_intern_string(ptr->length, ptr->data));
+}
+
 void String::clear() {
   release();
   ptr = &EMPTY;
@@ -120,19 +139,27 @@ void String::clear() {
 }
 
 void String::release() {
+  if (is_interned()) {
+    ptr = nullptr;
+    return;
+  }
   GAPID_ASSERT_MSG(ptr->ref_count > 0,
                    "attempting to release freed string (%s)", ptr->data);
-  ptr->ref_count--;
-  if (ptr->ref_count == 0) {
+  // The reference count is updated atomically as strings may be shared
+  // between commands that are traced concurrently.
+  if (__atomic_sub_fetch(&ptr->ref_count, 1, __ATOMIC_ACQ_REL) == 0) {
     gapil_free_string(ptr);
   }
   ptr = nullptr;
 }
 
 void String::reference() {
+  if (is_interned()) {
+    return;
+  }
   GAPID_ASSERT_MSG(ptr->ref_count > 0,
                    "attempting to reference freed string (%s)", ptr->data);
-  ptr->ref_count++;
+  __atomic_add_fetch(&ptr->ref_count, 1, __ATOMIC_RELAXED);
 }
 
 }  // namespace gapil
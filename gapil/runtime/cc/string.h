@@ -28,6 +28,11 @@ namespace gapil {
 // String is a string container that is compatible with the strings produced by
 // the gapil compiler. Strings hold references to their data, and several
 // strings may share the same underlying data.
+//
+// Strings may be interned, in which case their data is shared with all the
+// interned strings with the same data, and is never freed. Interned strings
+// are compared by pointer and cache their hash, which makes them cheap keys
+// for the names that are looked up often.
 class String {
  public:
   // Constructs a zero length string.
@@ -45,6 +50,10 @@ class String {
   String(String&&);
   ~String();
 
+  // Returns the interned string with the given data.
+  static String intern(const char*);
+  static String intern(const char* start, size_t len);
+
   // Makes this string refer to the RHS string.
   String& operator=(const String&);
 
@@ -68,6 +77,15 @@ class String {
   // Sets this string to a zero length string.
   void clear();
 
+  // Returns true if this string is interned.
+  inline bool is_interned() const;
+
+  // Returns the interned string with the same data as this string.
+  String interned() const;
+
+  // Returns the hash of the data of the string used by gapil::hash.
+  inline uint64_t hash() const;
+
   // Returns the arena that owns this string's underlying data.
   inline core::Arena* arena() const;
 
@@ -86,6 +104,12 @@ inline core::Arena* String::arena() const {
   return reinterpret_cast<core::Arena*>(ptr->arena);
 }
 
+inline bool String::is_interned() const {
+  return ptr->arena == reinterpret_cast<::arena*>(gapil_intern_arena_storage);
+}
+
+inline uint64_t String::hash() const { return gapil_string_hash(ptr); }
+
 }  // namespace gapil
 
 namespace std {
@@ -0,0 +1,107 @@
+// Copyright (C) 2020 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Synthetic benchmark of string-keyed map lookups, as the API state makes with
+// extension, entry-point and debug label names. The names are looked up with
+// strings that were made separately from the keys of the map, which compare
+// and hash their data, and with interned strings, which compare by pointer
+// and cache their hash.
+
+#include "map.inc"
+
+#include "core/cc/timer.h"
+#include "core/memory/arena/cc/arena.h"
+
+#include <stdio.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int kLookups = 1000000;
+
+double nsPer(uint64_t start, size_t n) {
+  return double(core::GetNanoseconds() - start) / n;
+}
+
+// Returns count names of about length bytes, which share a common prefix, as
+// the names of the API do.
+std::vector<std::string> names(size_t count, size_t length) {
+  std::mt19937 rng(1234);
+  std::vector<std::string> out;
+  for (size_t i = 0; i < count; i++) {
+    std::string name = "VK_EXT_";
+    while (name.size() < length) {
+      name += 'a' + rng() % 26;
+    }
+    out.push_back(name + std::to_string(i));
+  }
+  return out;
+}
+
+void run(size_t count, size_t length) {
+  core::Arena arena;
+  auto strings = names(count, length);
+
+  // The map keys and the lookup keys are made separately, as they are when
+  // the lookup keys come from the commands.
+  std::vector<gapil::String> plain;
+  std::vector<gapil::String> interned;
+  gapil::Map<gapil::String, uint64_t, false> plainMap(&arena);
+  gapil::Map<gapil::String, uint64_t, false> internedMap(&arena);
+  for (size_t i = 0; i < count; i++) {
+    plainMap[gapil::String(&arena, strings[i].c_str())] = i;
+    internedMap[gapil::String::intern(strings[i].c_str())] = i;
+    plain.push_back(gapil::String(&arena, strings[i].c_str()));
+    interned.push_back(gapil::String::intern(strings[i].c_str()));
+  }
+
+  std::mt19937 rng(5678);
+  std::vector<uint32_t> order(kLookups);
+  for (auto& i : order) {
+    i = rng() % count;
+  }
+
+  uint64_t check = 0;
+  uint64_t start = core::GetNanoseconds();
+  for (auto i : order) {
+    check += plainMap.findOrZero(plain[i]);
+  }
+  double plainNs = nsPer(start, kLookups);
+
+  start = core::GetNanoseconds();
+  for (auto i : order) {
+    check -= internedMap.findOrZero(interned[i]);
+  }
+  double internedNs = nsPer(start, kLookups);
+
+  printf("%8zu %8zu %12.1f %12.1f %8s\n", count, length, plainNs, internedNs,
+         check == 0 ? "ok" : "BAD");
+}
+
+}  // anonymous namespace
+
+int main() {
+  printf("%8s %8s %12s %12s %8s   (ns per lookup)\n", "names", "length",
+         "plain", "interned", "check");
+  for (size_t count : {16, 256, 4096}) {
+    for (size_t length : {16, 48}) {
+      run(count, length);
+    }
+  }
+  return 0;
+}
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "hash.h"
 #include "string.h"
 
 #include "core/memory/arena/cc/arena.h"
@@ -187,3 +188,43 @@ TEST(StringTest, clear) {
   EXPECT_EQ(arena.num_allocations(), 0);
   EXPECT_STREQ(str.c_str(), "");
 }
+
+TEST(StringTest, interned) {
+  core::Arena arena;
+  auto initial_allocs = arena.num_allocations();
+  {
+    auto a = gapil::String::intern("VK_KHR_swapchain");
+    auto b = gapil::String::intern("VK_KHR_swapchain", 16);
+    gapil::String c(&arena, "VK_KHR_swapchain");
+    auto d = gapil::String::intern("VK_KHR_surface");
+
+    EXPECT_TRUE(a.is_interned());
+    EXPECT_FALSE(c.is_interned());
+    EXPECT_STREQ(a.c_str(), "VK_KHR_swapchain");
+    EXPECT_EQ(a.length(), 16);
+
+    // Interned strings with the same data share it.
+    EXPECT_EQ(a.c_str(), b.c_str());
+    EXPECT_EQ(a.c_str(), c.interned().c_str());
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(a, c);
+    EXPECT_NE(a, d);
+    EXPECT_LT(d, a);
+
+    // The hashes of interned strings are the hashes of their data.
+    gapil::hash<gapil::String> hash;
+    EXPECT_EQ(hash(a), hash(c));
+    EXPECT_NE(hash(a), hash(d));
+
+    // Strings made with the intern arena are interned.
+    gapil::String e(reinterpret_cast<core::Arena*>(gapil_intern_arena()),
+                    "VK_KHR_surface");
+    EXPECT_EQ(e.c_str(), d.c_str());
+
+    auto f = d;
+    f += gapil::String(&arena, "_x");
+    EXPECT_TRUE(f.is_interned());
+    EXPECT_EQ(f.c_str(), gapil::String::intern("VK_KHR_surface_x").c_str());
+  }
+  EXPECT_EQ(arena.num_allocations(), initial_allocs);  // nothing leaked
+}
@@ -23,6 +23,7 @@ import (
 	"github.com/google/gapid/core/data/protoconv"
 	"github.com/google/gapid/core/memory/arena"
 	"github.com/google/gapid/gapis/api"
+	"github.com/google/gapid/gapis/memory/memory_pb"
 )
 
 type cmdGroup struct {
@@ -204,6 +205,9 @@ func (d *decoder) decode(ctx context.Context, in proto.Message) (interface{}, er
 		d.builder.addMessage(ctx, obj)
 		return in, nil
 
+	case *memory_pb.DeltaObservation:
+		return d.builder.resolveDelta(ctx, obj, d.RemapIndex)
+
 	case api.Cmd:
 		return &cmdGroup{cmd: obj}, nil
 
@@ -0,0 +1,111 @@
+// Copyright (C) 2020 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package capture
+
+import (
+	"bytes"
+	"testing"
+
+	"github.com/google/gapid/core/assert"
+	"github.com/google/gapid/core/data/id"
+	"github.com/google/gapid/core/data/pack"
+	"github.com/google/gapid/core/log"
+	"github.com/google/gapid/core/memory/arena"
+	"github.com/google/gapid/core/os/device"
+	"github.com/google/gapid/gapis/api"
+	"github.com/google/gapid/gapis/api/test"
+	"github.com/google/gapid/gapis/database"
+)
+
+const seekFooterMagic = 0x5845444e494b4553
+
+// TestImportSkipsSeekIndex checks that the seek indices and footer written by
+// the spy are ignored by the import, which does not use them.
+func TestImportSkipsSeekIndex(t *testing.T) {
+	ctx := log.Testing(t)
+	ctx = database.Put(ctx, database.NewInMemory(ctx))
+	header := &Header{ABI: device.WindowsX86_64}
+	cmds := []api.Cmd{test.Cmds.A, test.Cmds.B}
+	c, err := NewGraphicsCapture(ctx, arena.New(), "test", header, nil, cmds)
+	if !assert.For(ctx, "NewGraphicsCapture").ThatError(err).Succeeded() {
+		return
+	}
+
+	buf := &bytes.Buffer{}
+	w, err := pack.NewWriter(buf)
+	if !assert.For(ctx, "pack.NewWriter").ThatError(err).Succeeded() {
+		return
+	}
+	e := newEncoder(c, w)
+	ctx = id.PutRemapper(ctx, e)
+
+	// Interleave the commands with seek indices, as the spy does, and end the
+	// stream with the footer. The offsets are not read, so any value will do.
+	err = w.Object(ctx, c.Header)
+	if !assert.For(ctx, "Header").ThatError(err).Succeeded() {
+		return
+	}
+	index := &SeekIndex{}
+	for i, cmd := range cmds {
+		index = &SeekIndex{
+			Previous:    index.GetPoint().GetOffset(),
+			TypeOffsets: []uint64{16},
+			FirstFrame:  uint64(i),
+			Frames:      []*SeekPoint{{Offset: 32, Chunk: 1, TypeCount: 1}},
+			Point: &SeekPoint{
+				Offset:     uint64(buf.Len()),
+				Chunk:      uint64(2 * i),
+				TypeCount:  2,
+				OpenGroups: []uint64{1},
+			},
+		}
+		err = w.Object(ctx, index)
+		if !assert.For(ctx, "SeekIndex").ThatError(err).Succeeded() {
+			return
+		}
+		cmdID, err := e.startCmd(ctx, cmd)
+		if !assert.For(ctx, "startCmd").ThatError(err).Succeeded() {
+			return
+		}
+		err = e.extras(ctx, cmd, cmdID)
+		if !assert.For(ctx, "extras").ThatError(err).Succeeded() {
+			return
+		}
+		err = e.endCmd(ctx, cmd)
+		if !assert.For(ctx, "endCmd").ThatError(err).Succeeded() {
+			return
+		}
+	}
+	footer := &SeekFooter{
+		LastIndex: index.Point.Offset,
+		Magic:     seekFooterMagic,
+	}
+	err = w.Object(ctx, footer)
+	if !assert.For(ctx, "SeekFooter").ThatError(err).Succeeded() {
+		return
+	}
+
+	ip, err := Import(ctx, "key", "imported", &Blob{Data: buf.Bytes()})
+	if !assert.For(ctx, "Import").ThatError(err).Succeeded() {
+		return
+	}
+	ic, err := Resolve(Put(ctx, ip))
+	if !assert.For(ctx, "Resolve").ThatError(err).Succeeded() {
+		return
+	}
+	got := ic.(*GraphicsCapture)
+	assert.For(ctx, "Commands").That(got.Commands).CustomDeepEquals(cmds, test.Cmds.IgnoreArena)
+	assert.For(ctx, "Messages").That(len(got.Messages)).Equals(0)
+}
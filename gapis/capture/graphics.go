@@ -31,6 +31,7 @@ import (
 	"github.com/google/gapid/gapis/api"
 	"github.com/google/gapid/gapis/database"
 	"github.com/google/gapid/gapis/memory"
+	"github.com/google/gapid/gapis/memory/memory_pb"
 	"github.com/google/gapid/gapis/messages"
 	"github.com/google/gapid/gapis/replay/value"
 	"github.com/google/gapid/gapis/service"
@@ -341,6 +342,60 @@ func (b *builder) addObservation(ctx context.Context, o *api.CmdObservation) {
 	interval.Merge(&b.observed, o.Range.Span(), true)
 }
 
+// resolveDelta reconstructs the full content of the delta observation o by
+// applying its changed spans to the base resource, and returns the equivalent
+// full observation.
+func (b *builder) resolveDelta(ctx context.Context, o *memory_pb.DeltaObservation,
+	remap func(context.Context, int64) (id.ID, error)) (api.CmdObservation, error) {
+
+	if len(o.Offsets) != len(o.Sizes) {
+		return api.CmdObservation{}, fmt.Errorf("Delta observation has %v offsets but %v sizes",
+			len(o.Offsets), len(o.Sizes))
+	}
+	baseID, err := remap(ctx, o.BaseResIndex)
+	if err != nil {
+		return api.CmdObservation{}, err
+	}
+	base, err := database.Resolve(ctx, baseID)
+	if err != nil {
+		return api.CmdObservation{}, err
+	}
+	data := make([]byte, o.Size)
+	copy(data, base.([]byte))
+
+	if len(o.Offsets) > 0 {
+		changedID, err := remap(ctx, o.ResIndex)
+		if err != nil {
+			return api.CmdObservation{}, err
+		}
+		changed, err := database.Resolve(ctx, changedID)
+		if err != nil {
+			return api.CmdObservation{}, err
+		}
+		src := changed.([]byte)
+		for i, offset := range o.Offsets {
+			size := o.Sizes[i]
+			if offset+size > o.Size || size > uint64(len(src)) {
+				return api.CmdObservation{}, fmt.Errorf("Delta observation span [%v, %v) out of bounds",
+					offset, offset+size)
+			}
+			copy(data[offset:offset+size], src[:size])
+			src = src[size:]
+		}
+	}
+
+	dID, err := database.Store(ctx, data)
+	if err != nil {
+		return api.CmdObservation{}, err
+	}
+	obs := api.CmdObservation{
+		Pool:  memory.PoolID(o.Pool),
+		Range: memory.Range{Base: o.Base, Size: o.Size},
+		ID:    dID,
+	}
+	return obs, nil
+}
+
 func (b *builder) addRes(ctx context.Context, expectedIndex int64, data []byte) error {
 	dID, err := database.Store(ctx, data)
 	if err != nil {
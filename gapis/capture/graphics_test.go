@@ -0,0 +1,111 @@
+// Copyright (C) 2020 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package capture
+
+import (
+	"bytes"
+	"strings"
+	"testing"
+
+	"github.com/google/gapid/core/assert"
+	"github.com/google/gapid/core/log"
+	"github.com/google/gapid/core/memory/arena"
+	"github.com/google/gapid/gapis/api"
+	"github.com/google/gapid/gapis/database"
+	"github.com/google/gapid/gapis/memory"
+	"github.com/google/gapid/gapis/memory/memory_pb"
+)
+
+func TestResolveDelta(t *testing.T) {
+	ctx := log.Testing(t)
+	ctx = database.Put(ctx, database.NewInMemory(ctx))
+
+	base := bytes.Repeat([]byte{'a'}, 64)
+	d := newDecoder(arena.New())
+	if !assert.For(ctx, "addRes").ThatError(d.builder.addRes(ctx, 1, base)).Succeeded() {
+		return
+	}
+	// The bytes of the changed spans, concatenated.
+	changed := []byte("bbbbcccccccd")
+	if !assert.For(ctx, "addRes").ThatError(d.builder.addRes(ctx, 2, changed)).Succeeded() {
+		return
+	}
+
+	for _, test := range []struct {
+		name     string
+		delta    *memory_pb.DeltaObservation
+		expected []byte
+	}{
+		{
+			"unchanged",
+			&memory_pb.DeltaObservation{Base: 0x1000, Size: 64, BaseResIndex: 1, Pool: 1},
+			base,
+		}, {
+			"changed spans",
+			&memory_pb.DeltaObservation{
+				Base:         0x1000,
+				Size:         64,
+				BaseResIndex: 1,
+				ResIndex:     2,
+				Offsets:      []uint64{0, 16, 63},
+				Sizes:        []uint64{4, 7, 1},
+			},
+			[]byte("bbbb" + strings.Repeat("a", 12) + "ccccccc" + strings.Repeat("a", 40) + "d"),
+		},
+	} {
+		ctx := log.Enter(ctx, test.name)
+		obj, err := d.decode(ctx, test.delta)
+		if !assert.For(ctx, "decode").ThatError(err).Succeeded() {
+			continue
+		}
+		obs, ok := obj.(api.CmdObservation)
+		if !assert.For(ctx, "is observation").That(ok).Equals(true) {
+			continue
+		}
+		assert.For(ctx, "pool").That(obs.Pool).Equals(memory.PoolID(test.delta.Pool))
+		assert.For(ctx, "range").That(obs.Range).Equals(memory.Range{Base: 0x1000, Size: 64})
+		data, err := database.Resolve(ctx, obs.ID)
+		if !assert.For(ctx, "resolve").ThatError(err).Succeeded() {
+			continue
+		}
+		assert.For(ctx, "data").ThatSlice(data).Equals(test.expected)
+	}
+
+	for _, test := range []struct {
+		name  string
+		delta *memory_pb.DeltaObservation
+	}{
+		{
+			"mismatched spans",
+			&memory_pb.DeltaObservation{Size: 64, BaseResIndex: 1, ResIndex: 2,
+				Offsets: []uint64{0}, Sizes: []uint64{4, 8}},
+		}, {
+			"unknown base",
+			&memory_pb.DeltaObservation{Size: 64, BaseResIndex: 3},
+		}, {
+			"span past the range",
+			&memory_pb.DeltaObservation{Size: 64, BaseResIndex: 1, ResIndex: 2,
+				Offsets: []uint64{62}, Sizes: []uint64{4}},
+		}, {
+			"span past the changed bytes",
+			&memory_pb.DeltaObservation{Size: 64, BaseResIndex: 1, ResIndex: 2,
+				Offsets: []uint64{0, 16}, Sizes: []uint64{8, 8}},
+		},
+	} {
+		ctx := log.Enter(ctx, test.name)
+		_, err := d.decode(ctx, test.delta)
+		assert.For(ctx, "decode").ThatError(err).Failed()
+	}
+}
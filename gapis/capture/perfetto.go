@@ -19,7 +19,6 @@ import (
 	"bytes"
 	"context"
 	"io"
-	"io/ioutil"
 
 	"github.com/google/gapid/core/app/analytics"
 	"github.com/google/gapid/gapis/perfetto"
@@ -68,12 +67,7 @@ func deserializePerfettoTrace(ctx context.Context, r *Record, in io.Reader) (Cap
 	stopTiming := analytics.SendTiming("perfetto", "deserialize")
 	defer stopTiming(analytics.Size(len(r.Data)))
 
-	data, err := ioutil.ReadAll(in)
-	if err != nil {
-		return nil, err
-	}
-
-	p, err := perfetto.NewProcessor(ctx, data)
+	p, err := perfetto.NewProcessorFromReader(ctx, in)
 	if err != nil {
 		return nil, err
 	}
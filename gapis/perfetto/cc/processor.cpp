@@ -15,6 +15,7 @@
  */
 
 #include <google/protobuf/text_format.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "gapis/perfetto/service/perfetto.pb.h"
@@ -31,17 +32,53 @@ processor new_processor() {
 }
 
 bool parse_data(processor processor, const void* data, size_t size) {
-  ptp::TraceProcessor* p = static_cast<ptp::TraceProcessor*>(processor);
-  std::unique_ptr<uint8_t[]> buf(new uint8_t[size]);
-  memcpy(buf.get(), data, size);
-  // TODO: return the error message.
-  if (!p->Parse(std::move(buf), size).ok()) {
+  uint8_t* chunk = new_chunk(size);
+  memcpy(chunk, data, size);
+  if (!parse_chunk(processor, chunk, size)) {
     return false;
   }
-  p->NotifyEndOfFile();
+  notify_end_of_file(processor);
   return true;
 }
 
+bool parse_file(processor processor, const char* path, size_t chunk_size) {
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = true;
+  while (ok) {
+    uint8_t* chunk = new_chunk(chunk_size);
+    size_t size = fread(chunk, 1, chunk_size, file);
+    if (size == 0) {
+      delete_chunk(chunk);
+      ok = !ferror(file);
+      break;
+    }
+    ok = parse_chunk(processor, chunk, size);
+  }
+  fclose(file);
+  if (ok) {
+    notify_end_of_file(processor);
+  }
+  return ok;
+}
+
+uint8_t* new_chunk(size_t size) { return new uint8_t[size]; }
+
+void delete_chunk(uint8_t* chunk) { delete[] chunk; }
+
+bool parse_chunk(processor processor, uint8_t* chunk, size_t size) {
+  ptp::TraceProcessor* p = static_cast<ptp::TraceProcessor*>(processor);
+  std::unique_ptr<uint8_t[]> buf(chunk);
+  // TODO: return the error message.
+  return p->Parse(std::move(buf), size).ok();
+}
+
+void notify_end_of_file(processor processor) {
+  static_cast<ptp::TraceProcessor*>(processor)->NotifyEndOfFile();
+}
+
 result execute_query(processor processor, const char* query) {
   ptp::TraceProcessor* p = static_cast<ptp::TraceProcessor*>(processor);
   p::QueryResult raw;
@@ -144,4 +181,6 @@ result execute_query(processor processor, const char* query) {
   return res;
 }
 
-void delete_processor(processor processor) { free(processor); }
+void delete_processor(processor processor) {
+  delete static_cast<ptp::TraceProcessor*>(processor);
+}
@@ -33,7 +33,24 @@ typedef struct {
 } result;
 
 processor new_processor();
+// Parses the whole trace in data, which is copied.
 bool parse_data(processor processor, const void* data, size_t size);
+// Parses the whole trace file at path, reading it in chunks of chunk_size
+// bytes directly into the buffers handed to the processor.
+bool parse_file(processor processor, const char* path, size_t chunk_size);
+
+// Allocates a chunk of size bytes, to be filled with trace data and passed to
+// parse_chunk, or released with delete_chunk.
+uint8_t* new_chunk(size_t size);
+void delete_chunk(uint8_t* chunk);
+// Parses the next size bytes of the trace in chunk, taking ownership of the
+// chunk. Chunks need not end on packet boundaries. Queries may be executed
+// between chunks, and see the events parsed and sorted so far.
+bool parse_chunk(processor processor, uint8_t* chunk, size_t size);
+// Flushes the events still waiting to be sorted, once all of the chunks of
+// the trace have been parsed.
+void notify_end_of_file(processor processor);
+
 result execute_query(processor processor, const char* query);
 void delete_processor(processor processor);
 
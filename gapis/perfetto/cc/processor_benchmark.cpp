@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark of the load time and peak RSS of a large synthetic trace, loaded
+// in memory and parsed with parse_data, parsed from the file with parse_file,
+// and streamed with parse_chunk while querying the partially loaded trace.
+// Each method runs in its own process, so that the peak RSS is its own.
+//
+// Usage: processor_benchmark [size in MB] [chunk size in MB]
+
+#include "processor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace {
+
+// The field numbers of the trace packets.
+const uint32_t kTracePacket = 1;
+const uint32_t kPacketProcessTree = 2;
+const uint32_t kPacketTimestamp = 8;
+const uint32_t kPacketSequenceId = 10;
+const uint32_t kProcessTreeProcess = 1;
+const uint32_t kProcessPid = 1;
+const uint32_t kProcessPpid = 2;
+const uint32_t kProcessCmdline = 3;
+
+void writeVarint(std::string* out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+void writeVarintField(std::string* out, uint32_t field, uint64_t value) {
+  writeVarint(out, field << 3);
+  writeVarint(out, value);
+}
+
+void writeBytesField(std::string* out, uint32_t field,
+                     const std::string& value) {
+  writeVarint(out, field << 3 | 2);
+  writeVarint(out, value.size());
+  out->append(value);
+}
+
+// Returns a trace packet of a process tree with a single process.
+std::string processPacket(uint64_t timestamp, uint32_t pid) {
+  std::string process;
+  writeVarintField(&process, kProcessPid, pid);
+  writeVarintField(&process, kProcessPpid, 1);
+  writeBytesField(&process, kProcessCmdline,
+                  "/system/bin/process_" + std::to_string(pid));
+  std::string tree;
+  writeBytesField(&tree, kProcessTreeProcess, process);
+  std::string packet;
+  writeVarintField(&packet, kPacketTimestamp, timestamp);
+  writeVarintField(&packet, kPacketSequenceId, 1);
+  writeBytesField(&packet, kPacketProcessTree, tree);
+  std::string out;
+  writeBytesField(&out, kTracePacket, packet);
+  return out;
+}
+
+// Writes a trace of at least size bytes to path, without holding it in
+// memory, and returns the number of packets.
+uint64_t writeTrace(const char* path, size_t size) {
+  FILE* file = fopen(path, "wb");
+  if (file == nullptr) {
+    return 0;
+  }
+  uint64_t packets = 0;
+  std::string buffer;
+  for (size_t written = 0; written < size;) {
+    buffer.clear();
+    while (buffer.size() < (1 << 20)) {
+      buffer += processPacket(packets * 1000, packets % 32768 + 2);
+      packets++;
+    }
+    fwrite(buffer.data(), 1, buffer.size(), file);
+    written += buffer.size();
+  }
+  fclose(file);
+  return packets;
+}
+
+// Returns the result of the query, as a serialized QueryResult.
+std::string query(processor p, const char* sql) {
+  result res = execute_query(p, sql);
+  std::string out(reinterpret_cast<char*>(res.data), res.size);
+  delete[] res.data;
+  return out;
+}
+
+double msSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+long peakRssMB() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024;
+}
+
+bool loadData(processor p, const char* path, size_t) {
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  std::vector<uint8_t> data(ftell(file));
+  fseek(file, 0, SEEK_SET);
+  size_t size = fread(data.data(), 1, data.size(), file);
+  fclose(file);
+  return size == data.size() && parse_data(p, data.data(), data.size());
+}
+
+bool loadFile(processor p, const char* path, size_t chunk_size) {
+  return parse_file(p, path, chunk_size);
+}
+
+// Streams the file with parse_chunk, querying the partially loaded trace
+// after each chunk.
+bool loadChunks(processor p, const char* path, size_t chunk_size) {
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = true;
+  while (ok) {
+    uint8_t* chunk = new_chunk(chunk_size);
+    size_t size = fread(chunk, 1, chunk_size, file);
+    if (size == 0) {
+      delete_chunk(chunk);
+      break;
+    }
+    ok = parse_chunk(p, chunk, size);
+    query(p, "select count(*) from process");
+  }
+  fclose(file);
+  notify_end_of_file(p);
+  return ok;
+}
+
+typedef bool (*load_func)(processor, const char*, size_t);
+
+// Loads the trace in a child process, and prints its load time and peak RSS.
+void run(const char* name, load_func load, const char* path,
+         size_t chunk_size) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid != 0) {
+    waitpid(pid, nullptr, 0);
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  processor p = new_processor();
+  bool ok = load(p, path, chunk_size);
+  double ms = msSince(start);
+  std::string count = query(p, "select count(*) from process");
+  delete_processor(p);
+  printf("%-11s %10.1f ms %8ld MB peak RSS%s (%zu byte result)\n", name, ms,
+         peakRssMB(), ok ? "" : ", failed", count.size());
+  fflush(stdout);
+  _exit(ok ? 0 : 1);
+}
+
+}  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+  const size_t size = (argc > 1 ? atoll(argv[1]) : 512) << 20;
+  const size_t chunk_size = (argc > 2 ? atoll(argv[2]) : 16) << 20;
+
+  char path[] = "/tmp/processor_benchmark_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    fprintf(stderr, "error: cannot create the trace file\n");
+    return 1;
+  }
+  close(fd);
+  uint64_t packets = writeTrace(path, size);
+  printf("%zu MB trace, %llu packets, %zu MB chunks\n", size >> 20,
+         static_cast<unsigned long long>(packets), chunk_size >> 20);
+
+  run("parse_data", loadData, path, chunk_size);
+  run("parse_file", loadFile, path, chunk_size);
+  run("parse_chunk", loadChunks, path, chunk_size);
+  unlink(path);
+  return 0;
+}
@@ -15,10 +15,12 @@
 package perfetto
 
 // #include <stdlib.h> // free
+// #include <string.h> // memcpy
 // #include "cc/processor.h"
 import "C"
 import (
 	"context"
+	"io"
 	"sync"
 	"unsafe"
 
@@ -27,20 +29,113 @@ import (
 	"github.com/google/gapid/gapis/perfetto/service"
 )
 
+// chunkSize is the size of the chunks in which traces are streamed to the
+// trace processor.
+const chunkSize = 16 << 20
+
+// firstChunkSize is the size of the first chunk read from a reader of
+// unknown length. The following chunks double in size up to chunkSize, so
+// that small traces do not allocate a full chunk.
+const firstChunkSize = 1 << 20
+
 type Processor struct {
-	handle C.processor
-	mutex  sync.Mutex
+	handle   C.processor
+	mutex    sync.Mutex
+	finished bool
 }
 
 func NewProcessor(ctx context.Context, data []byte) (*Processor, error) {
-	p := C.new_processor()
+	p := newIncrementalProcessor()
 	log.D(ctx, "[perfetto] Parsing %d bytes", len(data))
-	if !C.parse_data(p, unsafe.Pointer(&data[0]), C.size_t(len(data))) {
+	if err := p.parse(ctx, data); err != nil {
+		p.Close()
+		return nil, err
+	}
+	p.finish()
+	return p, nil
+}
+
+// NewProcessorFromReader returns a processor of the trace read from r, which
+// is read in chunks directly into the buffers of the trace processor.
+func NewProcessorFromReader(ctx context.Context, r io.Reader) (*Processor, error) {
+	p := newIncrementalProcessor()
+	size, next := 0, firstChunkSize
+	if l, ok := r.(interface{ Len() int }); ok {
+		// Read the whole trace in a single chunk if it fits, plus a byte to
+		// detect the end of the reader without another chunk.
+		next = l.Len() + 1
+	}
+	for {
+		if next > chunkSize {
+			next = chunkSize
+		}
+		chunk := C.new_chunk(C.size_t(next))
+		buf := (*[chunkSize]byte)(unsafe.Pointer(chunk))[:next:next]
+		n, err := io.ReadFull(r, buf)
+		if n == 0 {
+			C.delete_chunk(chunk)
+		} else if perr := p.parseChunk(ctx, chunk, n); perr != nil {
+			p.Close()
+			return nil, perr
+		}
+		size += n
+		if err == io.EOF || err == io.ErrUnexpectedEOF {
+			break
+		} else if err != nil {
+			p.Close()
+			return nil, log.Err(ctx, err, "reading trace failed")
+		}
+		if next *= 2; next < firstChunkSize {
+			next = firstChunkSize
+		}
+	}
+	log.D(ctx, "[perfetto] Parsed %d bytes", size)
+	p.finish()
+	return p, nil
+}
+
+// newIncrementalProcessor returns a processor to which the trace is streamed
+// with parse. It can be queried before finish is called, on the part of the
+// trace parsed so far.
+func newIncrementalProcessor() *Processor {
+	return &Processor{handle: C.new_processor()}
+}
+
+// parse copies and parses the next chunk of the trace, which need not end on
+// a packet boundary.
+func (p *Processor) parse(ctx context.Context, data []byte) error {
+	if len(data) == 0 {
+		return nil
+	}
+	chunk := C.new_chunk(C.size_t(len(data)))
+	C.memcpy(unsafe.Pointer(chunk), unsafe.Pointer(&data[0]), C.size_t(len(data)))
+	return p.parseChunk(ctx, chunk, len(data))
+}
+
+// parseChunk parses the first size bytes of chunk, taking ownership of it.
+func (p *Processor) parseChunk(ctx context.Context, chunk *C.uint8_t, size int) error {
+	p.mutex.Lock()
+	defer p.mutex.Unlock()
+	if p.finished {
+		C.delete_chunk(chunk)
+		return log.Errf(ctx, nil, "parsing trace after its end")
+	}
+	if !C.parse_chunk(p.handle, chunk, C.size_t(size)) {
 		log.W(ctx, "[perfetto] Parsing failed")
-		C.delete_processor(p)
-		return nil, log.Errf(ctx, nil, "parsing trace failed")
+		return log.Errf(ctx, nil, "parsing trace failed")
+	}
+	return nil
+}
+
+// finish signals the end of the trace, making all of its events visible to
+// queries.
+func (p *Processor) finish() {
+	p.mutex.Lock()
+	defer p.mutex.Unlock()
+	if !p.finished {
+		C.notify_end_of_file(p.handle)
+		p.finished = true
 	}
-	return &Processor{handle: p}, nil
 }
 
 func (p *Processor) Query(q string) (*service.QueryResult, error) {
@@ -0,0 +1,149 @@
+// Copyright (C) 2020 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package perfetto
+
+import (
+	"bytes"
+	"context"
+	"io"
+	"testing"
+
+	"github.com/golang/protobuf/proto"
+	"github.com/google/gapid/core/assert"
+	"github.com/google/gapid/core/log"
+)
+
+// Field numbers of the trace protos.
+const (
+	tracePacket            = 1 // Trace.packet
+	tracePacketProcessTree = 2 // TracePacket.process_tree
+	tracePacketTimestamp   = 8 // TracePacket.timestamp
+	processTreeProcesses   = 1 // ProcessTree.processes
+	processPid             = 1 // ProcessTree.Process.pid
+	processPpid            = 2 // ProcessTree.Process.ppid
+	processCmdline         = 3 // ProcessTree.Process.cmdline
+)
+
+type process struct {
+	pid  int
+	name string
+}
+
+func field(b *proto.Buffer, number, wireType int) {
+	b.EncodeVarint(uint64(number<<3 | wireType))
+}
+
+// processPacket returns the encoded trace packet of a process tree with a
+// single process, at the timestamp ts.
+func processPacket(ts uint64, p process) []byte {
+	proc := proto.NewBuffer(nil)
+	field(proc, processPid, proto.WireVarint)
+	proc.EncodeVarint(uint64(p.pid))
+	field(proc, processPpid, proto.WireVarint)
+	proc.EncodeVarint(1)
+	field(proc, processCmdline, proto.WireBytes)
+	proc.EncodeStringBytes(p.name)
+
+	tree := proto.NewBuffer(nil)
+	field(tree, processTreeProcesses, proto.WireBytes)
+	tree.EncodeRawBytes(proc.Bytes())
+
+	packet := proto.NewBuffer(nil)
+	field(packet, tracePacketTimestamp, proto.WireVarint)
+	packet.EncodeVarint(ts)
+	field(packet, tracePacketProcessTree, proto.WireBytes)
+	packet.EncodeRawBytes(tree.Bytes())
+
+	trace := proto.NewBuffer(nil)
+	field(trace, tracePacket, proto.WireBytes)
+	trace.EncodeRawBytes(packet.Bytes())
+	return trace.Bytes()
+}
+
+// queryProcesses returns the pids of the processes of the test in p.
+func queryProcesses(ctx context.Context, p *Processor) []int64 {
+	res, err := p.Query("select pid from process where pid >= 100 order by pid")
+	if !assert.For(ctx, "Query").ThatError(err).Succeeded() {
+		return nil
+	}
+	assert.For(ctx, "Query error").ThatString(res.GetError()).Equals("")
+	if len(res.GetColumns()) == 0 {
+		return []int64{}
+	}
+	return append([]int64{}, res.GetColumns()[0].GetLongValues()...)
+}
+
+func TestIncrementalProcessor(t *testing.T) {
+	ctx := log.Testing(t)
+
+	procs := []process{{100, "first"}, {101, "second"}, {102, "third"}}
+	packets := [][]byte{}
+	for i, p := range procs {
+		// Far enough apart for the earlier packets to be sorted before the end.
+		packets = append(packets, processPacket(uint64(i+1)*1000000000000, p))
+	}
+	trace := bytes.Join(packets, nil)
+	// Split the trace in the middle of the second packet.
+	split := len(packets[0]) + len(packets[1])/2
+
+	p := newIncrementalProcessor()
+	defer p.Close()
+
+	if !assert.For(ctx, "parse first").ThatError(p.parse(ctx, trace[:split])).Succeeded() {
+		return
+	}
+	before := queryProcesses(ctx, p)
+	if !assert.For(ctx, "parse second").ThatError(p.parse(ctx, trace[split:])).Succeeded() {
+		return
+	}
+	// Queries before the end only see the events sorted so far.
+	partial := queryProcesses(ctx, p)
+	assert.For(ctx, "sorted so far").That(len(before) <= len(partial)).Equals(true)
+	assert.For(ctx, "before finish").That(len(partial) <= len(procs)).Equals(true)
+
+	p.finish()
+	assert.For(ctx, "after finish").ThatSlice(queryProcesses(ctx, p)).Equals([]int64{100, 101, 102})
+
+	// The trace can't be parsed past its end.
+	assert.For(ctx, "parse after finish").ThatError(p.parse(ctx, packets[0])).Failed()
+	assert.For(ctx, "still queryable").ThatSlice(queryProcesses(ctx, p)).Equals([]int64{100, 101, 102})
+}
+
+func TestNewProcessorFromReader(t *testing.T) {
+	ctx := log.Testing(t)
+
+	trace := bytes.Join([][]byte{
+		processPacket(1000, process{100, "first"}),
+		processPacket(2000, process{101, "second"}),
+	}, nil)
+	for _, r := range []struct {
+		name   string
+		reader io.Reader
+	}{
+		// A reader with a known length is read in a single chunk.
+		{"sized", bytes.NewReader(trace)},
+		// Other readers are read in growing chunks.
+		{"unsized", io.MultiReader(bytes.NewReader(trace))},
+	} {
+		ctx := log.Enter(ctx, r.name)
+		p, err := NewProcessorFromReader(ctx, r.reader)
+		if !assert.For(ctx, "NewProcessorFromReader").ThatError(err).Succeeded() {
+			continue
+		}
+		assert.For(ctx, "processes").ThatSlice(queryProcesses(ctx, p)).Equals([]int64{100, 101})
+		assert.For(ctx, "parse after end").ThatError(p.parse(ctx, trace)).Failed()
+		p.Close()
+	}
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark of the conversion of the .vert and .frag shaders of a directory,
+// such as tests/shaders, one by one with convertGlsl and with
+// convertGlslBatch. Each shader is repeated with a different comment, as a
+// capture has many distinct programs, and the cache is disabled.
+//
+// Usage: convert_benchmark <directory> [copies] [threads]
+
+#include "libmanager.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+bool endsWith(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+double msSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+}  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <directory> [copies] [threads]\n", argv[0]);
+    return 1;
+  }
+  const std::string dir = argv[1];
+  const int copies = argc > 2 ? atoi(argv[2]) : 20;
+  const uint32_t threads = argc > 3 ? atoi(argv[3]) : 0;
+
+  std::vector<std::string> sources;
+  std::vector<shader_type> types;
+  DIR* d = opendir(dir.c_str());
+  if (!d) {
+    fprintf(stderr, "error: cannot open directory '%s'\n", dir.c_str());
+    return 1;
+  }
+  while (dirent* entry = readdir(d)) {
+    std::string name = entry->d_name;
+    bool vert = endsWith(name, ".vert");
+    if (!vert && !endsWith(name, ".frag")) {
+      continue;
+    }
+    std::ifstream file(dir + "/" + name);
+    std::stringstream source;
+    source << file.rdbuf();
+    for (int i = 0; i < copies; i++) {
+      sources.push_back(source.str() + "\n// " + std::to_string(i) + "\n");
+      types.push_back(vert ? VERTEX : FRAGMENT);
+    }
+  }
+  closedir(d);
+
+  std::vector<convert_request_t> requests(sources.size());
+  for (size_t i = 0; i < sources.size(); i++) {
+    convert_request_t& request = requests[i];
+    request.source = sources[i].c_str();
+    request.length = sources[i].size();
+    request.options = convert_options_t{};
+    request.options.shader_type = types[i];
+    request.options.preamble = "";
+    request.options.prefix_names = true;
+    request.options.add_outputs_for_inputs = true;
+    request.options.check_after_changes = true;
+    request.options.relaxed = true;
+    request.options.target_glsl_version = 330;
+  }
+  setConvertCacheCapacity(0);
+
+  size_t failed = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (const convert_request_t& request : requests) {
+    code_with_debug_info_t* result =
+        convertGlsl(request.source, request.length, &request.options);
+    failed += result->ok ? 0 : 1;
+    deleteGlslCodeWithDebug(result);
+  }
+  double serial = msSince(start);
+
+  std::vector<code_with_debug_info_t*> results(requests.size());
+  start = std::chrono::steady_clock::now();
+  convertGlslBatch(requests.data(), requests.size(), threads, results.data());
+  double batch = msSince(start);
+  for (code_with_debug_info_t* result : results) {
+    deleteGlslCodeWithDebug(result);
+  }
+
+  printf("%zu shaders (%zu failed)\n", requests.size(), failed);
+  printf("convertGlsl:      %8.1f ms, %6.3f ms/shader\n", serial,
+         serial / requests.size());
+  printf("convertGlslBatch: %8.1f ms, %6.3f ms/shader, %.2fx\n", batch,
+         batch / requests.size(), serial / batch);
+  return 0;
+}
@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "convert_cache.h"
+
+#include "core/cc/id.h"
+#include "core/cc/version.h"
+
+#include <cstring>
+
+namespace {
+
+// The length written for a null string.
+const uint32_t kNullString = ~0u;
+
+void writeBytes(std::string* out, const void* data, size_t size) {
+  out->append(static_cast<const char*>(data), size);
+}
+
+void writeU32(std::string* out, uint32_t value) {
+  writeBytes(out, &value, sizeof(value));
+}
+
+void writeString(std::string* out, const char* str) {
+  if (!str) {
+    writeU32(out, kNullString);
+    return;
+  }
+  uint32_t length = strlen(str);
+  writeU32(out, length);
+  writeBytes(out, str, length);
+}
+
+// Reads the values written by the write functions, failing once the data is
+// exhausted.
+class Reader {
+ public:
+  Reader(const std::string& data)
+      : data(data.data()), remaining(data.size()) {}
+
+  bool readBytes(void* out, size_t size) {
+    if (size > remaining) {
+      return false;
+    }
+    memcpy(out, data, size);
+    data += size;
+    remaining -= size;
+    return true;
+  }
+
+  bool readU32(uint32_t* value) { return readBytes(value, sizeof(*value)); }
+
+  bool readString(char** str) {
+    uint32_t length;
+    if (!readU32(&length)) {
+      return false;
+    }
+    if (length == kNullString) {
+      *str = nullptr;
+      return true;
+    }
+    if (length > remaining) {
+      return false;
+    }
+    *str = new char[length + 1];
+    readBytes(*str, length);
+    (*str)[length] = '\0';
+    return true;
+  }
+
+  bool done() const { return remaining == 0; }
+
+ private:
+  const char* data;
+  size_t remaining;
+};
+
+}  // anonymous namespace
+
+namespace convertcache {
+
+std::string serialize(const code_with_debug_info_t& result) {
+  std::string out;
+  uint8_t ok = result.ok ? 1 : 0;
+  writeBytes(&out, &ok, 1);
+  writeString(&out, result.message);
+  writeString(&out, result.source_code);
+  writeString(&out, result.disassembly_string);
+  if (!result.info) {
+    writeU32(&out, kNullString);
+    return out;
+  }
+  writeU32(&out, result.info->insts_num);
+  for (uint32_t i = 0; i < result.info->insts_num; i++) {
+    const instruction_t& inst = result.info->insts[i];
+    writeU32(&out, inst.id);
+    writeU32(&out, inst.opcode);
+    writeU32(&out, inst.words_num);
+    writeBytes(&out, inst.words, inst.words_num * sizeof(uint32_t));
+    writeString(&out, inst.name);
+  }
+  return out;
+}
+
+code_with_debug_info_t* deserialize(const std::string& data) {
+  Reader reader(data);
+  code_with_debug_info_t* result = new code_with_debug_info_t{};
+  uint8_t ok = 0;
+  uint32_t insts_num = 0;
+  bool valid = reader.readBytes(&ok, 1) &&
+               reader.readString(&result->message) &&
+               reader.readString(&result->source_code) &&
+               reader.readString(&result->disassembly_string) &&
+               reader.readU32(&insts_num);
+  result->ok = ok != 0;
+  if (valid && insts_num != kNullString) {
+    // Each instruction takes at least 16 bytes.
+    valid = insts_num <= data.size() / 16;
+    if (valid) {
+      result->info = new debug_instructions_t{new instruction_t[insts_num](),
+                                              insts_num};
+    }
+    for (uint32_t i = 0; valid && i < insts_num; i++) {
+      instruction_t& inst = result->info->insts[i];
+      valid = reader.readU32(&inst.id) && reader.readU32(&inst.opcode) &&
+              reader.readU32(&inst.words_num) &&
+              inst.words_num <= data.size() / sizeof(uint32_t);
+      if (valid) {
+        inst.words = new uint32_t[inst.words_num];
+        valid = reader.readBytes(inst.words,
+                                 inst.words_num * sizeof(uint32_t)) &&
+                reader.readString(&inst.name);
+      }
+    }
+  }
+  if (!valid || !reader.done()) {
+    deleteGlslCodeWithDebug(result);
+    return nullptr;
+  }
+  return result;
+}
+
+ConvertCache::ConvertCache(size_t capacity)
+    : capacity(capacity), size(0), hits(0), archive_hits(0), misses(0) {}
+
+std::string ConvertCache::key(const char* source, size_t length,
+                              const convert_options_t* options) {
+  // The results depend on the versions of glslang and SPIRV-Cross, so the
+  // archived results of other builds are not used.
+  std::string data;
+  writeString(&data, AGI_VERSION_AND_BUILD);
+  writeU32(&data, length);
+  writeBytes(&data, source, length);
+  writeString(&data, options->preamble);
+  writeU32(&data, options->shader_type);
+  writeU32(&data, options->prefix_names);
+  writeString(&data, options->names_prefix);
+  writeU32(&data, options->add_outputs_for_inputs);
+  writeString(&data, options->output_prefix);
+  writeU32(&data, options->make_debuggable);
+  writeU32(&data, options->check_after_changes);
+  writeU32(&data, options->disassemble);
+  writeU32(&data, options->relaxed);
+  writeU32(&data, options->strip_optimizations);
+  writeU32(&data, options->target_glsl_version);
+  return core::Id::Hash(data.data(), data.size()).string();
+}
+
+code_with_debug_info_t* ConvertCache::find(const std::string& key) {
+  // The result is copied under the lock, and deserialized outside of it.
+  std::string data;
+  bool in_memory = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it != index.end()) {
+      entries.splice(entries.begin(), entries, it->second);
+      data = it->second->second;
+      in_memory = true;
+    } else if (archive) {
+      uint32_t data_size = archive->size(key);
+      data.resize(data_size);
+      if (data_size > 0 && !archive->read(key, &data.front(), data_size)) {
+        data.clear();
+      }
+    }
+  }
+  code_with_debug_info_t* result = data.empty() ? nullptr : deserialize(data);
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!result) {
+    misses++;
+  } else if (in_memory) {
+    hits++;
+  } else {
+    archive_hits++;
+    insertInMemory(key, std::move(data));
+  }
+  return result;
+}
+
+void ConvertCache::insert(const std::string& key,
+                          const code_with_debug_info_t& result) {
+  std::string data = serialize(result);
+  std::lock_guard<std::mutex> lock(mutex);
+  if (archive) {
+    archive->write(key, data.data(), data.size());
+  }
+  insertInMemory(key, std::move(data));
+}
+
+void ConvertCache::insertInMemory(const std::string& key, std::string&& data) {
+  auto it = index.find(key);
+  if (it != index.end()) {
+    size -= it->second->first.size() + it->second->second.size();
+    entries.erase(it->second);
+    index.erase(it);
+  }
+  size_t entry_size = key.size() + data.size();
+  if (entry_size > capacity) {
+    return;
+  }
+  entries.emplace_front(key, std::move(data));
+  index[key] = entries.begin();
+  size += entry_size;
+  evict();
+}
+
+void ConvertCache::evict() {
+  while (size > capacity) {
+    auto& last = entries.back();
+    size -= last.first.size() + last.second.size();
+    index.erase(last.first);
+    entries.pop_back();
+  }
+}
+
+void ConvertCache::setCapacity(size_t new_capacity) {
+  std::lock_guard<std::mutex> lock(mutex);
+  capacity = new_capacity;
+  evict();
+}
+
+void ConvertCache::setArchive(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  archive.reset();
+  if (!path.empty()) {
+    archive.reset(new core::Archive(path));
+  }
+}
+
+void ConvertCache::getStats(convert_cache_stats_t* stats) {
+  std::lock_guard<std::mutex> lock(mutex);
+  stats->hits = hits;
+  stats->archive_hits = archive_hits;
+  stats->misses = misses;
+  stats->entries = entries.size();
+  stats->size = size;
+}
+
+}  // namespace convertcache
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONVERT_CACHE_H_
+#define CONVERT_CACHE_H_
+
+#include "core/cc/archive.h"
+
+#include "libmanager.h"
+
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace convertcache {
+
+/**
+ * Holds the results of convertGlsl, keyed by a hash of the source code, the
+ * preamble and the options, in memory and optionally in an archive on disk.
+ * The memory tier is bounded in size, and evicts the least recently used
+ * results first. All of the methods are thread-safe.
+ **/
+class ConvertCache {
+ public:
+  explicit ConvertCache(size_t capacity);
+
+  // Returns the key of the conversion of the source with the options.
+  static std::string key(const char* source, size_t length,
+                         const convert_options_t* options);
+
+  // Returns a copy of the result stored for key, to be released with
+  // deleteGlslCodeWithDebug, or nullptr if there is none. The archive is
+  // only read when the result is not in memory.
+  code_with_debug_info_t* find(const std::string& key);
+
+  // Stores a copy of the result for key, in memory and in the archive.
+  void insert(const std::string& key, const code_with_debug_info_t& result);
+
+  // Sets the size in bytes of the results held in memory, evicting results
+  // if needed. A capacity of 0 disables the memory tier.
+  void setCapacity(size_t capacity);
+
+  // Opens or creates the archive at path as the persistent tier, or closes
+  // the persistent tier if path is empty.
+  void setArchive(const std::string& path);
+
+  void getStats(convert_cache_stats_t* stats);
+
+ private:
+  typedef std::list<std::pair<std::string, std::string>> entry_list;
+
+  // Adds the serialized result to the memory tier, and evicts the least
+  // recently used results over capacity. Must be called with mutex held.
+  void insertInMemory(const std::string& key, std::string&& data);
+  // Evicts the least recently used results over capacity. Must be called
+  // with mutex held.
+  void evict();
+
+  std::mutex mutex;
+  size_t capacity;
+  size_t size;  // The size of the keys and results held in memory.
+  // The keys and serialized results, most recently used first.
+  entry_list entries;
+  std::unordered_map<std::string, entry_list::iterator> index;
+  std::unique_ptr<core::Archive> archive;
+
+  uint64_t hits;
+  uint64_t archive_hits;
+  uint64_t misses;
+};
+
+// Serializes the result of convertGlsl to a string.
+std::string serialize(const code_with_debug_info_t& result);
+
+// Returns the result serialized in data, to be released with
+// deleteGlslCodeWithDebug, or nullptr if data is not valid.
+code_with_debug_info_t* deserialize(const std::string& data);
+
+}  // namespace convertcache
+
+#endif  // CONVERT_CACHE_H_
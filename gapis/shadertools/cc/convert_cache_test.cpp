@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2020 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "convert_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+
+namespace convertcache {
+namespace test {
+
+char* newString(const char* str) {
+  char* out = new char[strlen(str) + 1];
+  strcpy(out, str);
+  return out;
+}
+
+// Returns a result with source_code and two debug instructions.
+code_with_debug_info_t* newResult(const char* source_code) {
+  code_with_debug_info_t* result = new code_with_debug_info_t{};
+  result->ok = true;
+  result->source_code = newString(source_code);
+  result->info = new debug_instructions_t{new instruction_t[2](), 2};
+  result->info->insts[0].id = 1;
+  result->info->insts[0].opcode = 5;
+  result->info->insts[0].words = new uint32_t[2]{7, 8};
+  result->info->insts[0].words_num = 2;
+  result->info->insts[0].name = newString("main");
+  result->info->insts[1].id = 2;
+  result->info->insts[1].opcode = 6;
+  return result;
+}
+
+void expectEqual(const code_with_debug_info_t& expected,
+                 const code_with_debug_info_t& got) {
+  EXPECT_EQ(expected.ok, got.ok);
+  EXPECT_EQ(expected.message == nullptr, got.message == nullptr);
+  ASSERT_NE(nullptr, got.source_code);
+  EXPECT_STREQ(expected.source_code, got.source_code);
+  EXPECT_EQ(nullptr, got.disassembly_string);
+  ASSERT_NE(nullptr, got.info);
+  ASSERT_EQ(expected.info->insts_num, got.info->insts_num);
+  for (uint32_t i = 0; i < got.info->insts_num; i++) {
+    const instruction_t& e = expected.info->insts[i];
+    const instruction_t& g = got.info->insts[i];
+    EXPECT_EQ(e.id, g.id);
+    EXPECT_EQ(e.opcode, g.opcode);
+    ASSERT_EQ(e.words_num, g.words_num);
+    for (uint32_t j = 0; j < g.words_num; j++) {
+      EXPECT_EQ(e.words[j], g.words[j]);
+    }
+    EXPECT_EQ(e.name == nullptr, g.name == nullptr);
+    if (e.name && g.name) {
+      EXPECT_STREQ(e.name, g.name);
+    }
+  }
+}
+
+convert_options_t options() {
+  convert_options_t options = {};
+  options.shader_type = FRAGMENT;
+  options.preamble = "";
+  options.target_glsl_version = 330;
+  return options;
+}
+
+TEST(ConvertCacheTest, Serialize) {
+  code_with_debug_info_t* result = newResult("void main() {}");
+  std::string data = serialize(*result);
+  code_with_debug_info_t* got = deserialize(data);
+  ASSERT_NE(nullptr, got);
+  expectEqual(*result, *got);
+  deleteGlslCodeWithDebug(got);
+
+  // Truncated data is rejected.
+  for (size_t size = 0; size < data.size(); size++) {
+    EXPECT_EQ(nullptr, deserialize(data.substr(0, size)));
+  }
+  deleteGlslCodeWithDebug(result);
+}
+
+TEST(ConvertCacheTest, KeyDependsOnInputs) {
+  const char* source = "void main() {}";
+  convert_options_t base = options();
+  const std::string key = ConvertCache::key(source, strlen(source), &base);
+  EXPECT_EQ(key, ConvertCache::key(source, strlen(source), &base));
+  EXPECT_NE(key, ConvertCache::key(source, strlen(source) - 1, &base));
+
+  convert_options_t other = base;
+  other.preamble = "#define X";
+  EXPECT_NE(key, ConvertCache::key(source, strlen(source), &other));
+  other = base;
+  other.make_debuggable = true;
+  EXPECT_NE(key, ConvertCache::key(source, strlen(source), &other));
+  other = base;
+  other.names_prefix = "";
+  EXPECT_NE(key, ConvertCache::key(source, strlen(source), &other));
+  other = base;
+  other.target_glsl_version = 450;
+  EXPECT_NE(key, ConvertCache::key(source, strlen(source), &other));
+}
+
+TEST(ConvertCacheTest, EvictsLeastRecentlyUsed) {
+  code_with_debug_info_t* result = newResult("void main() {}");
+  const size_t entry_size = 1 + serialize(*result).size();
+  ConvertCache cache(entry_size * 2);
+
+  cache.insert("a", *result);
+  cache.insert("b", *result);
+  code_with_debug_info_t* got = cache.find("a");
+  ASSERT_NE(nullptr, got);
+  expectEqual(*result, *got);
+  deleteGlslCodeWithDebug(got);
+  cache.insert("c", *result);  // Evicts b.
+
+  EXPECT_EQ(nullptr, cache.find("b"));
+  got = cache.find("a");
+  EXPECT_NE(nullptr, got);
+  deleteGlslCodeWithDebug(got);
+  got = cache.find("c");
+  EXPECT_NE(nullptr, got);
+  deleteGlslCodeWithDebug(got);
+
+  convert_cache_stats_t stats;
+  cache.getStats(&stats);
+  EXPECT_EQ(3u, stats.hits);
+  EXPECT_EQ(0u, stats.archive_hits);
+  EXPECT_EQ(1u, stats.misses);
+  EXPECT_EQ(2u, stats.entries);
+  EXPECT_EQ(entry_size * 2, stats.size);
+
+  cache.setCapacity(0);
+  EXPECT_EQ(nullptr, cache.find("a"));
+  deleteGlslCodeWithDebug(result);
+}
+
+TEST(ConvertCacheTest, Archive) {
+  const char* tmp = getenv("TEST_TMPDIR");
+  std::string dir = std::string(tmp ? tmp : "/tmp") + "/convert_cache_XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(&dir[0]));
+  const std::string path = dir + "/cache";
+  code_with_debug_info_t* result = newResult("void main() {}");
+  {
+    ConvertCache cache(1 << 20);
+    cache.setArchive(path);
+    cache.insert("a", *result);
+  }
+
+  // A new cache, as in a new process, finds the result in the archive.
+  ConvertCache cache(1 << 20);
+  cache.setArchive(path);
+  code_with_debug_info_t* got = cache.find("a");
+  ASSERT_NE(nullptr, got);
+  expectEqual(*result, *got);
+  deleteGlslCodeWithDebug(got);
+  got = cache.find("a");
+  EXPECT_NE(nullptr, got);
+  deleteGlslCodeWithDebug(got);
+
+  convert_cache_stats_t stats;
+  cache.getStats(&stats);
+  EXPECT_EQ(1u, stats.hits);
+  EXPECT_EQ(1u, stats.archive_hits);
+  EXPECT_EQ(0u, stats.misses);
+
+  cache.setArchive("");
+  remove((path + ".index").c_str());
+  remove((path + ".data").c_str());
+  rmdir(dir.c_str());
+  deleteGlslCodeWithDebug(result);
+}
+
+}  // namespace test
+}  // namespace convertcache
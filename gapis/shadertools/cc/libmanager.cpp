@@ -18,14 +18,19 @@
 #include "third_party/glslang/SPIRV/disassemble.h"
 #include "third_party/glslang/glslang/Public/ShaderLang.h"
 
+#include "convert_cache.h"
 #include "libmanager.h"
 #include "spirv2glsl.h"
 #include "spv_manager.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 const TBuiltInResource DefaultTBuiltInResource = {
@@ -125,6 +130,23 @@ const TBuiltInResource DefaultTBuiltInResource = {
         /* .generalConstantMatrixVectorIndexing = */ 1,
     }};
 
+// The default size of the results of convertGlsl held in memory.
+const size_t kDefaultConvertCacheCapacity = 64 * 1024 * 1024;
+
+convertcache::ConvertCache& convertCache() {
+  static convertcache::ConvertCache* cache =
+      new convertcache::ConvertCache(kDefaultConvertCacheCapacity);
+  return *cache;
+}
+
+// Initializes glslang for the process. The compiler initialization is fairly
+// expensive, so it is done once and kept indefinitely. Once it is done,
+// shaders can be compiled on several threads at once.
+void initializeGlslang() {
+  static std::once_flag once;
+  std::call_once(once, [] { glslang::InitializeProcess(); });
+}
+
 void set_error_msg(code_with_debug_info_t* x, std::string msg) {
   x->ok = false;
   x->message = new char[msg.length() + 1];
@@ -209,7 +231,7 @@ std::vector<unsigned int> parseGlslang(const char* code, const char* preamble,
     }
   }
 
-  glslang::InitializeProcess();
+  initializeGlslang();
   glslang::TShader shader(lang);
   shader.setPreamble(preamble);
   shader.setStrings(&code, 1);
@@ -248,9 +270,6 @@ std::vector<unsigned int> parseGlslang(const char* code, const char* preamble,
     glslang::GlslangToSpv(*program.getIntermediate(lang), spirv);
   }
 
-  // The compiler initialization is fairly expensive, so keep it initialized
-  // indefinitely. glslang::FinalizeProcess();
-
   // Hack the SPIR-V to add a version to the header
   if (spirv.size() >= 2) {
     spirv[1] = glslang::EShTargetSpv_1_0;
@@ -266,8 +285,8 @@ std::vector<unsigned int> parseGlslang(const char* code, const char* preamble,
  * 3. Decompiles changed spirv to source code using spirv-cross,
  * 4. Check, if changed source code correctly compiles.
  **/
-code_with_debug_info_t* convertGlsl(const char* input, size_t length,
-                                    const convert_options_t* options) {
+code_with_debug_info_t* convertGlslUncached(const char* input,
+                                            const convert_options_t* options) {
   code_with_debug_info_t* result = new code_with_debug_info_t{};
   std::string err_msg;
 
@@ -354,12 +373,67 @@ code_with_debug_info_t* convertGlsl(const char* input, size_t length,
   return result;
 }
 
+code_with_debug_info_t* convertGlsl(const char* input, size_t length,
+                                    const convert_options_t* options) {
+  const std::string key =
+      convertcache::ConvertCache::key(input, length, options);
+  if (code_with_debug_info_t* result = convertCache().find(key)) {
+    return result;
+  }
+  code_with_debug_info_t* result = convertGlslUncached(input, options);
+  convertCache().insert(key, *result);
+  return result;
+}
+
+void convertGlslBatch(const convert_request_t* requests, size_t count,
+                      uint32_t threads, code_with_debug_info_t** results) {
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  threads = std::min<size_t>(threads, count);
+  initializeGlslang();
+
+  std::atomic<size_t> next(0);
+  auto convert = [&]() {
+    for (size_t i = next++; i < count; i = next++) {
+      const convert_request_t& request = requests[i];
+      try {
+        results[i] =
+            convertGlsl(request.source, request.length, &request.options);
+      } catch (...) {
+        results[i] = new code_with_debug_info_t{};
+        set_error_msg(results[i], "Unknown exception thrown\n");
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (uint32_t i = 1; i < threads; i++) {
+    workers.emplace_back(convert);
+  }
+  convert();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void setConvertCacheCapacity(size_t capacity) {
+  convertCache().setCapacity(capacity);
+}
+
+void setConvertCacheArchive(const char* path) {
+  convertCache().setArchive(path ? path : "");
+}
+
+void getConvertCacheStats(convert_cache_stats_t* stats) {
+  convertCache().getStats(stats);
+}
+
 /**
  * Releses memory allocated by SpvManager.
  * May needs update after changes.
  **/
 void deleteGlslCodeWithDebug(code_with_debug_info_t* debug) {
-  delete debug->message;
+  delete[] debug->message;
   delete[] debug->source_code;
   delete[] debug->disassembly_string;
 
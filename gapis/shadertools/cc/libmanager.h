@@ -79,6 +79,12 @@ typedef struct convert_options_t {
   int target_glsl_version;
 } convert_options_t;
 
+typedef struct convert_request_t {
+  const char* source;
+  size_t length;
+  convert_options_t options;
+} convert_request_t;
+
 typedef struct compile_options_t {
   shader_type shader_type;
   client_type client_type;
@@ -96,9 +102,40 @@ typedef struct glsl_compile_result_t {
   spirv_binary_t binary;
 } glsl_compile_result_t;
 
+typedef struct convert_cache_stats_t {
+  uint64_t hits;         /* Results found in memory. */
+  uint64_t archive_hits; /* Results found in the archive. */
+  uint64_t misses;       /* Results converted. */
+  uint64_t entries;      /* Results held in memory. */
+  uint64_t size;         /* Bytes held in memory. */
+} convert_cache_stats_t;
+
 code_with_debug_info_t* convertGlsl(const char*, size_t,
                                     const convert_options_t*);
 
+/**
+ * Converts the count shaders of requests as convertGlsl does, on a pool of
+ * up to threads threads, or one per core if threads is 0. The result of
+ * each request is stored in results, to be released with
+ * deleteGlslCodeWithDebug, and reports the errors of that shader only.
+ **/
+void convertGlslBatch(const convert_request_t* requests, size_t count,
+                      uint32_t threads, code_with_debug_info_t** results);
+
+/**
+ * The results of convertGlsl are cached, in memory and optionally in an
+ * archive on disk, keyed by a hash of the source code and the options.
+ **/
+void setConvertCacheCapacity(size_t);
+
+/**
+ * Opens the archive at the given path as the persistent tier of the cache,
+ * or closes it if the path is empty.
+ **/
+void setConvertCacheArchive(const char*);
+
+void getConvertCacheStats(convert_cache_stats_t*);
+
 void deleteGlslCodeWithDebug(code_with_debug_info_t*);
 
 const char* getDisassembleText(uint32_t*, size_t);
@@ -13,6 +13,9 @@
 // limitations under the License.
 
 // Package shadertools wraps around external C code for manipulating shaders.
+// The functions of the package may be called from several goroutines at once:
+// glslang is initialized once for the process, and the C code holds no other
+// unsynchronized state.
 package shadertools
 
 //#include "cc/libmanager.h"
@@ -25,15 +28,12 @@ import (
 	"fmt"
 	"sort"
 	"strings"
-	"sync"
 	"unsafe"
 
 	"github.com/google/gapid/core/fault"
 	"github.com/google/gapid/core/text"
 )
 
-var mutex sync.Mutex
-
 // Instruction represents a SPIR-V instruction.
 type Instruction struct {
 	ID     uint32   // Result identifer.
@@ -155,8 +155,32 @@ func ConvertGlsl(source string, o *ConvertOptions) (CodeWithDebugInfo, error) {
 		}
 	}()
 
-	mutex.Lock()
-	defer mutex.Unlock()
+	cstr := func(s string) *C.char {
+		out := C.CString(s)
+		toFree = append(toFree, unsafe.Pointer(out))
+		return out
+	}
+
+	opts := convertOptions(o, cstr)
+	result := C.convertGlsl(cstr(source), C.size_t(len(source)), &opts)
+	defer C.deleteGlslCodeWithDebug(result)
+
+	return convertResult(result, source, o)
+}
+
+// ConvertGlslBatch converts each of the sources with the options of the same
+// index, as ConvertGlsl does, returning the result and error of each. The
+// shaders are converted in parallel.
+func ConvertGlslBatch(sources []string, o []*ConvertOptions) ([]CodeWithDebugInfo, []error) {
+	if len(sources) != len(o) {
+		panic("ConvertGlslBatch: mismatched sources and options")
+	}
+	toFree := []unsafe.Pointer{}
+	defer func() {
+		for _, ptr := range toFree {
+			C.free(ptr)
+		}
+	}()
 
 	cstr := func(s string) *C.char {
 		out := C.CString(s)
@@ -164,7 +188,33 @@ func ConvertGlsl(source string, o *ConvertOptions) (CodeWithDebugInfo, error) {
 		return out
 	}
 
-	opts := C.struct_convert_options_t{
+	// The requests only hold C strings, so they can be passed to C.
+	requests := make([]C.convert_request_t, len(sources))
+	for i, source := range sources {
+		requests[i] = C.convert_request_t{
+			source:  cstr(source),
+			length:  C.size_t(len(source)),
+			options: convertOptions(o[i], cstr),
+		}
+	}
+	results := make([]*C.code_with_debug_info_t, len(sources))
+	if len(sources) > 0 {
+		C.convertGlslBatch(&requests[0], C.size_t(len(requests)), 0, &results[0])
+	}
+
+	rets := make([]CodeWithDebugInfo, len(sources))
+	errs := make([]error, len(sources))
+	for i, result := range results {
+		rets[i], errs[i] = convertResult(result, sources[i], o[i])
+		C.deleteGlslCodeWithDebug(result)
+	}
+	return rets, errs
+}
+
+// convertOptions returns the C options of o, allocating the strings with
+// cstr.
+func convertOptions(o *ConvertOptions, cstr func(string) *C.char) C.struct_convert_options_t {
+	return C.struct_convert_options_t{
 		shader_type:            C.shader_type(o.ShaderType),
 		preamble:               cstr(o.Preamble),
 		prefix_names:           C.bool(o.PrefixNames),
@@ -178,9 +228,10 @@ func ConvertGlsl(source string, o *ConvertOptions) (CodeWithDebugInfo, error) {
 		strip_optimizations:    C.bool(o.StripOptimizations),
 		target_glsl_version:    C.int(o.TargetGLSLVersion),
 	}
-	result := C.convertGlsl(cstr(source), C.size_t(len(source)), &opts)
-	defer C.deleteGlslCodeWithDebug(result)
+}
 
+// convertResult returns the result of the conversion of source with o.
+func convertResult(result *C.code_with_debug_info_t, source string, o *ConvertOptions) (CodeWithDebugInfo, error) {
 	ret := CodeWithDebugInfo{
 		SourceCode:        C.GoString(result.source_code),
 		DisassemblyString: C.GoString(result.disassembly_string),
@@ -219,6 +270,44 @@ func ConvertGlsl(source string, o *ConvertOptions) (CodeWithDebugInfo, error) {
 	return ret, nil
 }
 
+// ConvertCacheStats holds the counters of the cache of ConvertGlsl results.
+type ConvertCacheStats struct {
+	Hits        uint64 // Results found in memory.
+	ArchiveHits uint64 // Results found in the archive.
+	Misses      uint64 // Results converted.
+	Entries     uint64 // Results held in memory.
+	Size        uint64 // Bytes held in memory.
+}
+
+// GetConvertCacheStats returns the counters of the cache of ConvertGlsl
+// results.
+func GetConvertCacheStats() ConvertCacheStats {
+	stats := C.convert_cache_stats_t{}
+	C.getConvertCacheStats(&stats)
+	return ConvertCacheStats{
+		Hits:        uint64(stats.hits),
+		ArchiveHits: uint64(stats.archive_hits),
+		Misses:      uint64(stats.misses),
+		Entries:     uint64(stats.entries),
+		Size:        uint64(stats.size),
+	}
+}
+
+// SetConvertCacheCapacity sets the size in bytes of the ConvertGlsl results
+// held in memory. A capacity of 0 disables the memory tier of the cache.
+func SetConvertCacheCapacity(capacity int) {
+	C.setConvertCacheCapacity(C.size_t(capacity))
+}
+
+// SetConvertCacheArchive opens or creates the archive at path as the
+// persistent tier of the cache of ConvertGlsl results, so that they are kept
+// across runs. An empty path closes the archive.
+func SetConvertCacheArchive(path string) {
+	cstr := C.CString(path)
+	defer C.free(unsafe.Pointer(cstr))
+	C.setConvertCacheArchive(cstr)
+}
+
 // DisassembleSpirvBinary disassembles the given SPIR-V binary words by calling
 // SPIRV-Tools and returns the disassembly. Returns an empty string if
 // diassembling fails.
@@ -278,9 +367,6 @@ func CompileGlsl(source string, o CompileOptions) ([]uint32, error) {
 			C.free(ptr)
 		}
 	}()
-	mutex.Lock()
-	defer mutex.Unlock()
-
 	cstr := func(s string) *C.char {
 		out := C.CString(s)
 		toFree = append(toFree, unsafe.Pointer(out))
@@ -15,6 +15,7 @@
 package shadertools_test
 
 import (
+	"fmt"
 	"testing"
 
 	"github.com/google/gapid/core/assert"
@@ -89,6 +90,62 @@ void main()
 	}
 }
 
+func TestConvertGlslCache(t *testing.T) {
+	ctx := log.Testing(t)
+	opts := shadertools.ConvertOptions{
+		ShaderType:        shadertools.TypeFragment,
+		CheckAfterChanges: true,
+		MakeDebuggable:    true,
+	}
+	src := `#version 310 es
+out highp vec4 cache_test_color;
+void main() { cache_test_color = vec4(0.5); }`
+
+	before := shadertools.GetConvertCacheStats()
+	first, err := shadertools.ConvertGlsl(src, &opts)
+	assert.For(ctx, "err").ThatError(err).Succeeded()
+	second, err := shadertools.ConvertGlsl(src, &opts)
+	assert.For(ctx, "err").ThatError(err).Succeeded()
+	after := shadertools.GetConvertCacheStats()
+
+	assert.For(ctx, "misses").That(after.Misses - before.Misses).Equals(uint64(1))
+	assert.For(ctx, "hits").That(after.Hits - before.Hits).Equals(uint64(1))
+	assert.For(ctx, "src").ThatString(second.SourceCode).Equals(first.SourceCode)
+	assert.For(ctx, "info").ThatSlice(second.Info).DeepEquals(first.Info)
+}
+
+func TestConvertGlslBatch(t *testing.T) {
+	ctx := log.Testing(t)
+	opts := &shadertools.ConvertOptions{
+		ShaderType:        shadertools.TypeFragment,
+		CheckAfterChanges: true,
+	}
+	valid := `#version 310 es
+out highp vec4 color;
+void main() { color = vec4(%v); }`
+	sources := []string{}
+	options := []*shadertools.ConvertOptions{}
+	for i := 0; i < 16; i++ {
+		sources = append(sources, fmt.Sprintf(valid, i))
+		options = append(options, opts)
+	}
+	sources[5] = "#version 310 es\nvoid main() { undeclared = 1; }"
+
+	results, errs := shadertools.ConvertGlslBatch(sources, options)
+	assert.For(ctx, "results").ThatSlice(results).IsLength(len(sources))
+	assert.For(ctx, "errs").ThatSlice(errs).IsLength(len(sources))
+	for i := range sources {
+		if i == 5 {
+			assert.For(ctx, "errs[5]").ThatError(errs[i]).Failed()
+			continue
+		}
+		if assert.For(ctx, "errs[%d]", i).ThatError(errs[i]).Succeeded() {
+			expected, _ := shadertools.ConvertGlsl(sources[i], opts)
+			assert.For(ctx, "results[%d]", i).ThatString(results[i].SourceCode).Equals(expected.SourceCode)
+		}
+	}
+}
+
 func TestCompileGlsl(t *testing.T) {
 	for _, test := range []struct {
 		desc     string
@@ -120,16 +120,11 @@ func (t *androidTracer) GetDevice() bind.Device {
 
 func (t *androidTracer) ProcessProfilingData(ctx context.Context, buffer *bytes.Buffer, handleMappings *map[uint64][]service.VulkanHandleMappingItem) (*service.ProfilingData, error) {
 	// Load Perfetto trace and create trace processor.
-	rawData := make([]byte, buffer.Len())
-	_, err := buffer.Read(rawData)
-	if err != nil {
-		return nil, log.Err(ctx, err, "Failed to read trace buffer")
-	}
-	processor, err := perfetto.NewProcessor(ctx, rawData)
-	defer processor.Close()
+	processor, err := perfetto.NewProcessorFromReader(ctx, buffer)
 	if err != nil {
 		return nil, log.Errf(ctx, err, "Failed to create trace processor")
 	}
+	defer processor.Close()
 	conf := t.b.Instance().GetConfiguration()
 	gpu := conf.GetHardware().GetGPU()
 	desc := conf.GetPerfettoCapability().GetGpuProfiling().GetGpuCounterDescriptor()
@@ -213,9 +208,7 @@ func (t *androidTracer) Validate(ctx context.Context) error {
 	var processor *perfetto.Processor
 	status.Do(ctx, "Trace loading", func(ctx context.Context) {
 		// Load Perfetto trace and create trace processor.
-		rawData := make([]byte, written)
-		_, err = buf.Read(rawData)
-		processor, err = perfetto.NewProcessor(ctx, rawData)
+		processor, err = perfetto.NewProcessorFromReader(ctx, &buf)
 	})
 	if err != nil {
 		return err
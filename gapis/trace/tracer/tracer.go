@@ -135,6 +135,12 @@ func GapiiOptions(o *service.TraceOptions) gapii.Options {
 	if o.DisableCoherentMemoryTracker {
 		flags |= gapii.DisableCoherentMemoryTracker
 	}
+	if o.FineGrainedLocking {
+		flags |= gapii.FineGrainedLocking
+	}
+	if o.DeltaObservations {
+		flags |= gapii.DeltaObservations
+	}
 
 	return gapii.Options{
 		o.ObserveFrameFrequency,